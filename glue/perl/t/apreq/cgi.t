@@ -30,7 +30,7 @@ if (-d $perlpod) {
 }      
 
 my @names = sort keys %types;
-my @methods = sort qw/slurp fh tempname link io/;
+my @methods = sort qw/slurp fh tempname link persist io/;
 
 my $cgi = File::Spec->catfile(Apache::Test::vars('serverroot'),
                               qw(cgi-bin test_cgi.pl));
@@ -305,6 +305,21 @@ elsif ($method) {
         close $fh;
         unlink $link_file if -f $link_file;
     }
+    elsif ($method eq 'persist') {
+        my $persist_file = File::Spec->catfile($temp_dir, "persistfile");
+        unlink $persist_file if -f $persist_file;
+        $param->upload_persist($persist_file)
+            or die "Can't persist to $persist_file: $!";
+        (((stat $persist_file)[2] & 07777) == 0600)
+            or die "$persist_file isn't owner-only";
+        !$param->upload_persist($persist_file) && $!{EEXIST}
+            or die "Persisting over $persist_file didn't fail with EEXIST";
+        open $fh, "<", $persist_file or die "Can't open $persist_file: $!";
+        binmode $fh;
+        read $fh, $data, $param->upload_size;
+        close $fh;
+        unlink $persist_file if -f $persist_file;
+    }
     elsif ($method eq 'io') {
         read $param->upload_io, $data, $param->upload_size;
     }
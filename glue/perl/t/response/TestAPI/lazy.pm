@@ -0,0 +1,41 @@
+package TestAPI::lazy;
+
+use strict;
+use warnings FATAL => 'all';
+
+use Apache::Test;
+use Apache::TestUtil;
+
+use APR::Request::Param;
+use APR::Request::Apache2;
+use APR::Request::Error qw/BADSEQ/;
+
+sub handler {
+    my $r = shift;
+    plan $r, tests => 7;
+    $r->args("ok=a%20b;bad=%zz;cut=%4");
+
+    my $req = APR::Request::Apache2->handle($r);
+    my $args = $req->args;
+
+    ok t_cmp $args->{ok}, "a b", "decoded on first read";
+
+    $! = 0;
+    ok !defined $args->{bad};
+    ok t_cmp $! + 0, BADSEQ + 0, '$! holds the decoding error';
+    ok !defined $args->{cut};
+
+    ok !defined $req->args("bad");
+
+    $args->param_class("APR::Request::Param");
+    my $param = $args->{bad};
+    ok $param->isa("APR::Request::Param");
+    ok !defined $param->value;
+
+    return 0;
+}
+
+
+1;
+__END__
+APREQ2_LazyDecode On
@@ -154,7 +154,14 @@ upload_link(param, path)
     if (param->upload == NULL)
         Perl_croak(aTHX_ "$param->upload_link($file): param has no upload brigade");
     f = apreq_brigade_spoolfile(param->upload);
-    if (f == NULL) {
+    fname = NULL;
+    if (f != NULL) {
+        s = apr_file_name_get(&fname, f);
+        if (s != APR_SUCCESS)
+            Perl_croak(aTHX_ "$param->upload_link($file): can't get spoolfile name");
+    }
+    if (fname == NULL) {
+        /* no spoolfile, or a nameless one from the temp file pool */
         apr_off_t len;
         s = apr_file_open(&f, path, APR_CREATE | APR_EXCL | APR_WRITE |
                           APR_READ | APR_BINARY,
@@ -167,9 +174,6 @@ upload_link(param, path)
         }
     }
     else {
-        s = apr_file_name_get(&fname, f);
-        if (s != APR_SUCCESS)
-            Perl_croak(aTHX_ "$param->upload_link($file): can't get spoolfile name");
         if (PerlLIO_link(fname, path) >= 0)
             XSRETURN_YES;
         else {
@@ -183,6 +187,25 @@ upload_link(param, path)
   OUTPUT:
     RETVAL
 
+SV *
+upload_persist(param, path)
+    APR::Request::Param param
+    const char *path
+  PREINIT:
+    apr_status_t s;
+
+  CODE:
+    if (param->upload == NULL)
+        Perl_croak(aTHX_ "$param->upload_persist($file): param has no upload brigade");
+    s = apreq_brigade_persist(param->upload->p, path, param->upload);
+    if (s == APR_SUCCESS)
+        XSRETURN_YES;
+    SETERRNO(APR_TO_OS_ERROR(s), 0);
+    RETVAL = &PL_sv_undef;
+
+  OUTPUT:
+    RETVAL
+
 apr_size_t
 upload_slurp(param, buffer)
     APR::Request::Param param
@@ -300,6 +323,11 @@ upload_tempname(param, req=apreq_xs_sv2handle(aTHX_ ST(0)))
         Perl_croak(aTHX_ 
                    "$param->upload_link($file): can't get spool file name"
                    );
+    if (RETVAL == NULL)
+        Perl_croak(aTHX_
+                   "$param->upload_tempname($req): spool file is unlinked "
+                   "(APREQ2_TempFilePool)"
+                   );
 
   OUTPUT:
     RETVAL
@@ -133,8 +133,19 @@ APR_INLINE
 static SV *apreq_xs_param2sv(pTHX_ apreq_param_t *p,
                               const char *class, SV *parent)
 {
+    apr_status_t s = apreq_param_value_decode(p);
+
     if (class == NULL) {
-        SV *rv = newSVpvn(p->v.data, p->v.dlen);
+        SV *rv;
+
+        /* A malformed lazy value is undef, as the C getters return
+         * NULL for it, and $! holds the decoding error. */
+        if (s != APR_SUCCESS) {
+            SETERRNO(s, 0);
+            return newSV(0);
+        }
+
+        rv = newSVpvn(p->v.data, p->v.dlen);
         if (apreq_param_is_tainted(p))
             SvTAINTED_on(rv);
         else if (apreq_param_charset_get(p) == APREQ_CHARSET_UTF8)
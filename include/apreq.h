@@ -110,6 +110,13 @@
  */
 #define APREQ_DEFAULT_NELTS              8
 
+/**
+ * Number of spool writes an asynchronous spool writer keeps in flight
+ * before the parser waits for one to finish.
+ * @see apreq_spool_writer_make
+ */
+#define APREQ_DEFAULT_SPOOL_DEPTH        16
+
 
 
 /**
@@ -161,6 +168,19 @@
  */
 #define APREQ_TAINTED_MASK          1
 
+/**
+ * Encoded Bit
+ * @see APREQ_FLAGS_OFF @see APREQ_FLAGS_ON
+ * @see APREQ_FLAGS_GET @see APREQ_FLAGS_SET
+ */
+#define APREQ_ENCODED_BIT           9
+/**
+ * Encoded Mask
+ * @see APREQ_FLAGS_OFF @see APREQ_FLAGS_ON
+ * @see APREQ_FLAGS_GET @see APREQ_FLAGS_SET
+ */
+#define APREQ_ENCODED_MASK          1
+
 /**
  * Cookier Version Bit
  * @see APREQ_FLAGS_OFF @see APREQ_FLAGS_ON
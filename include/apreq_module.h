@@ -95,6 +95,13 @@ typedef struct apreq_module_t {
     /** set the directory used by the parser for temporary files */
     apr_status_t (*temp_dir_set)(apreq_handle_t *, const char *);
 
+    /** restrict body parsing to the named fields */
+    apr_status_t (*parse_only_set)(apreq_handle_t *,
+                                   const apr_array_header_t *);
+    /** get several body parameters by name in one pass */
+    apr_status_t (*body_getv)(apreq_handle_t *, const char *const *, int,
+                              apreq_param_t **);
+
 } apreq_module_t;
 
 
@@ -210,6 +217,27 @@ apreq_param_t *apreq_body_get(apreq_handle_t *req, const char *name)
     return req->module->body_get(req, name);
 }
 
+/**
+ * Fetch the first body param for each of several names.  The
+ * body is read at most once for the whole set, and reading stops
+ * as soon as every name has been seen.
+ *
+ * @param req    The request handle
+ * @param names  Array of n case-insensitive param names.
+ * @param n      Number of entries in names and params.
+ * @param params Array of n slots; on return params[i] holds the
+ *               first param named names[i], or NULL if none match.
+ *
+ * @return       The body status at the time of return, as for
+ *               apreq_body().
+ */
+static APR_INLINE
+apr_status_t apreq_body_getv(apreq_handle_t *req, const char *const *names,
+                             int n, apreq_param_t **params)
+{
+    return req->module->body_getv(req, names, n, params);
+}
+
 /**
  * Fetch the active body parser.
  *
@@ -351,6 +379,26 @@ apr_status_t apreq_temp_dir_get(apreq_handle_t *req, const char **path)
     return req->module->temp_dir_get(req, path);
 }
 
+/**
+ * Restrict body parsing to the given field names.  Other fields
+ * and uploads are skipped by the parser: no params are made for
+ * them, hooks never see them and their data is never spooled.
+ *
+ * @param req   The handle.
+ * @param names Array of (const char *) field names, compared
+ *              case-insensitively; NULL parses every field.
+ *              The array must live as long as the handle's pool.
+ *
+ * @return APR_SUCCESS, or APREQ_ERROR_NOTEMPTY from every module if
+ *         the body has already been read from.
+ */
+static APR_INLINE
+apr_status_t apreq_parse_only_set(apreq_handle_t *req,
+                                  const apr_array_header_t *names)
+{
+    return req->module->parse_only_set(req, names);
+}
+
 
 
 /**
@@ -371,6 +419,7 @@ apr_status_t apreq_temp_dir_get(apreq_handle_t *req, const char **path)
   pre##_brigade_limit_get, pre##_brigade_limit_set,     \
   pre##_read_limit_get,    pre##_read_limit_set,        \
   pre##_temp_dir_get,      pre##_temp_dir_set,          \
+  pre##_parse_only_set,    pre##_body_getv,             \
   }
 
 
@@ -400,6 +449,10 @@ APREQ_DECLARE(apreq_handle_t*) apreq_handle_cgi(apr_pool_t *pool);
  * @param in           brigade containing the request body
  *
  * @return new handle; can only be NULL if the pool allocation failed.
+ *
+ * @remarks For a compressed body, give the parser a decompression stage
+ *          with apreq_parser_inflate() first; read_limit still counts
+ *          the bytes taken from in.
  */
 APREQ_DECLARE(apreq_handle_t*) apreq_handle_custom(apr_pool_t *pool,
                                                    const char *query_string,
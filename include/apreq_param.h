@@ -60,6 +60,15 @@ void apreq_param_tainted_off(apreq_param_t *p) {
     APREQ_FLAGS_OFF(p->flags, APREQ_TAINTED);
 }
 
+/**
+ * @return 1 if the value is still url-encoded, 0 otherwise.
+ * @see apreq_param_value_decode()
+ */
+static APR_INLINE
+unsigned apreq_param_is_encoded(const apreq_param_t *p) {
+    return APREQ_FLAGS_GET(p->flags, APREQ_ENCODED);
+}
+
 /** Sets the character encoding for this parameter. */
 static APR_INLINE
 apreq_charset_t apreq_param_charset_set(apreq_param_t *p, apreq_charset_t c) {
@@ -118,6 +127,36 @@ APREQ_DECLARE(apr_status_t) apreq_param_decode(apreq_param_t **param,
                                                apr_size_t nlen,
                                                apr_size_t vlen);
 
+/**
+ * Url-decodes the value of a param parsed in lazy mode, in place.
+ * The param's charset is updated to account for the decoded value.
+ * This is a no-op for params whose value is already decoded.
+ *
+ * @param param Param to decode.
+ *
+ * @return APR_SUCCESS on success.
+ * @return ::APREQ_ERROR_BADSEQ, ::APREQ_ERROR_BADCHAR or APR_INCOMPLETE
+ *         on malformed input, in which case the raw value is left intact
+ *         and the param remains encoded.
+ */
+APREQ_DECLARE(apr_status_t) apreq_param_value_decode(apreq_param_t *param);
+
+/**
+ * Upgrades a table value to its param like apreq_value_to_param(),
+ * url-decoding the value first if it was parsed in lazy mode.
+ *
+ * @return NULL if the value cannot be decoded.
+ */
+static APR_INLINE
+apreq_param_t *apreq_value_to_decoded_param(const char *val)
+{
+    apreq_param_t *p = apreq_value_to_param(val);
+
+    if (apreq_param_is_encoded(p) && apreq_param_value_decode(p) != APR_SUCCESS)
+        return NULL;
+    return p;
+}
+
 /**
  * Url-encodes the param into a name-value pair.
  * @param pool Pool which allocates the returned string.
@@ -142,6 +181,23 @@ APREQ_DECLARE(apr_status_t) apreq_parse_query_string(apr_pool_t *pool,
                                                      apr_table_t *t,
                                                      const char *qs);
 
+/**
+ * Lazy variant of apreq_parse_query_string().  Only the names are
+ * url-decoded up front; each value is copied verbatim and flagged
+ * as encoded until it is first read through apreq_param_value_decode(),
+ * apreq_value_to_decoded_param() or the handle accessors.
+ * @param pool    pool used to allocate the param data.
+ * @param t       table to which the params are added.
+ * @param qs      Query string to parse.
+ * @return        APR_SUCCESS if successful, error otherwise.
+ * @remark        Values fetched straight from the table with apr_table_get()
+ *                are still url-encoded.  Malformed values are only
+ *                reported when they are decoded.
+ */
+APREQ_DECLARE(apr_status_t) apreq_parse_query_string_lazy(apr_pool_t *pool,
+                                                          apr_table_t *t,
+                                                          const char *qs);
+
 
 /**
  * Returns an array of parameters (apreq_param_t *) matching the given key.
@@ -153,6 +209,8 @@ APREQ_DECLARE(apr_status_t) apreq_parse_query_string(apr_pool_t *pool,
  *    key==NULL fetches all parameters.
  * @return an array of apreq_param_t* (pointers)
  * @remark Also parses the request if necessary.
+ * @remark Lazily parsed values are decoded first; those that turn out
+ *    to be malformed are left out.
  */
 APREQ_DECLARE(apr_array_header_t *) apreq_params_as_array(apr_pool_t *p,
                                                           const apr_table_t *t,
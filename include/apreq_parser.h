@@ -20,6 +20,7 @@
 /* These structs are defined below */
 
 #include "apreq_param.h"
+#include "apreq_util.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -43,6 +44,12 @@ typedef struct apreq_hook_t apreq_hook_t;
  */
 typedef struct apreq_parser_t apreq_parser_t;
 
+/**
+ * A sink takes the data of file uploads off the parser's hands, in
+ * place of their being spooled into param->upload.  See apreq_sink_t.
+ */
+typedef struct apreq_sink_t apreq_sink_t;
+
 /** Parser arguments. */
 #define APREQ_PARSER_ARGS  apreq_parser_t *parser,     \
                            apr_table_t *t,             \
@@ -53,6 +60,11 @@ typedef struct apreq_parser_t apreq_parser_t;
                            apreq_param_t *param,       \
                            apr_bucket_brigade *bb
 
+/** Sink arguments */
+#define APREQ_SINK_ARGS    apreq_sink_t *sink,         \
+                           apreq_param_t *param,       \
+                           apr_bucket_brigade *bb
+
 /**
  * The callback function implementing a request body parser.
  */
@@ -63,6 +75,11 @@ typedef apr_status_t (*apreq_parser_function_t)(APREQ_PARSER_ARGS);
  */
 typedef apr_status_t (*apreq_hook_function_t)(APREQ_HOOK_ARGS);
 
+/**
+ * The callback function of a sink. See apreq_sink_t.
+ */
+typedef apr_status_t (*apreq_sink_function_t)(APREQ_SINK_ARGS);
+
 /**
  * Declares a API parser.
  */
@@ -75,6 +92,12 @@ typedef apr_status_t (*apreq_hook_function_t)(APREQ_HOOK_ARGS);
 #define APREQ_DECLARE_HOOK(f)   APREQ_DECLARE_NONSTD(apr_status_t) \
                                 (f) (APREQ_HOOK_ARGS)
 
+/**
+ * Declares an API sink.
+ */
+#define APREQ_DECLARE_SINK(f)   APREQ_DECLARE_NONSTD(apr_status_t) \
+                                (f) (APREQ_SINK_ARGS)
+
 /**
  * A hook is called by the parser whenever data arrives in a file
  * upload parameter of the request body. You may associate any number
@@ -87,6 +110,29 @@ struct apreq_hook_t {
     void *ctx; /**< a user defined pointer passed to the hook function */
 };
 
+/**
+ * A sink is handed each chunk of a multipart upload's data, after the
+ * parser's hooks have seen it, and consumes what it takes by deleting
+ * those buckets from bb.  An EOS bucket ends each upload.  The NDJSON
+ * parser hands its records to a sink the same way, one per upload.  A sink that
+ * can't take everything at once returns APR_EAGAIN: the parser keeps
+ * the rest and, until the sink has taken it, offers it again on each
+ * run in place of parsing further, returning APR_EAGAIN itself so its
+ * caller can stop reading the body for a while.  Any status other than
+ * APR_SUCCESS or APR_EAGAIN aborts the parse.
+ * @remark mod_apreq2 stops prefetching the body while its parser
+ * returns APR_EAGAIN, and holds back at most the brigade limit of the
+ * body read by downstream filters in the meantime: past that, a
+ * non-blocking read gets APR_EAGAIN and a blocking one ends the parse
+ * with APREQ_ERROR_OVERLIMIT.  The CGI and Apache 1 handles take it for a
+ * failed parse, so sinks used there should block instead.
+ */
+struct apreq_sink_t {
+    apreq_sink_function_t sink; /**< the sink function */
+    apr_pool_t           *pool; /**< pool which allocated this sink */
+    void *ctx; /**< a user defined pointer passed to the sink function */
+};
+
 /**
  * A request body parser instance.
  */
@@ -101,12 +147,36 @@ struct apreq_parser_t {
     apr_bucket_alloc_t     *bucket_alloc;
     /** the maximum in-memory bytes a brigade may use */
     apr_size_t              brigade_limit;
-    /** the directory for generating temporary files */
+    /** the directory, or PATH-style list of directories, for generating
+     *  temporary files; see apreq_file_mktemp() */
     const char             *temp_dir;
     /** linked list of hooks */
     apreq_hook_t           *hook;
     /** internal context pointer used by the parser function */
     void                   *ctx;
+    /** names (const char *) of the only fields to parse, NULL for all */
+    const apr_array_header_t *parse_only;
+    /** writer for queueing upload spool writes, NULL to write in place */
+    apreq_spool_writer_t   *spool_writer;
+    /** upper bound on the body bytes still to be read, 0 if unknown:
+     *  set from the Content-Length and lowered through
+     *  apreq_parser_hint_read(); a new upload spool file is
+     *  preallocated to it, within limits */
+    apr_off_t               size_hint;
+    /** takes multipart upload data in place of param->upload, which is
+     *  left empty, and NDJSON records in place of the table; NULL to
+     *  spool and add them as usual */
+    apreq_sink_t           *sink;
+    /** nonzero to have apreq_parse_multipart decode base64 and
+     *  quoted-printable parts as they arrive, so params, hooks and
+     *  spool files get the decoded data; such parts' info tables then
+     *  say "Content-Transfer-Encoding: binary".  mod_apreq2 sets it
+     *  from APREQ2_DecodeTransferEncoding; with the CGI handle, set it
+     *  on a parser handed to apreq_parser_set() */
+    int                     decode_transfer_encoding;
+    /** the decompression stage set up by apreq_parser_inflate(), NULL
+     *  if the body isn't compressed */
+    struct apreq_inflate_t *inflate;
 };
 
 
@@ -127,6 +197,17 @@ apr_status_t apreq_parser_run(struct apreq_parser_t *psr, apr_table_t *t,
     return psr->parser(psr, t, bb);
 }
 
+/**
+ * Lowers the parser's size_hint by the len bytes just read from the
+ * body, so it keeps bounding what is still to arrive.  Handles call
+ * this as they read.
+ */
+static APR_INLINE
+void apreq_parser_hint_read(struct apreq_parser_t *psr, apr_off_t len)
+{
+    psr->size_hint = (psr->size_hint > len) ? psr->size_hint - len : 0;
+}
+
 /**
  * Run the hook with the current parameter and the incoming
  * bucket brigade.  The hook may modify the brigade if necessary.
@@ -142,6 +223,20 @@ apr_status_t apreq_hook_run(struct apreq_hook_t *h, apreq_param_t *param,
 }
 
 
+/**
+ * Run the sink with the current upload parameter and a chunk of its
+ * data.  See apreq_sink_t.
+ * @return APR_SUCCESS once the sink has taken all of bb, APR_EAGAIN
+ * if it has left some for later, or an error.
+ */
+static APR_INLINE
+apr_status_t apreq_sink_run(struct apreq_sink_t *s, apreq_param_t *param,
+                            apr_bucket_brigade *bb)
+{
+    return s->sink(s, param, bb);
+}
+
+
 /**
  * RFC 822 Header parser. It will reject all data
  * after the first CRLF CRLF sequence (an empty line).
@@ -154,6 +249,13 @@ APREQ_DECLARE_PARSER(apreq_parse_headers);
  */
 APREQ_DECLARE_PARSER(apreq_parse_urlencoded);
 
+/**
+ * Lazy variant of apreq_parse_urlencoded(): names are decoded as usual,
+ * but values are stored url-encoded until first read.
+ * @see apreq_parse_query_string_lazy(), apreq_param_value_decode()
+ */
+APREQ_DECLARE_PARSER(apreq_parse_urlencoded_lazy);
+
 /**
  * RFC 2388 multipart/form-data (and XForms 1.0 multipart/related)
  * parser. It will reject any buckets representing preamble and
@@ -162,6 +264,38 @@ APREQ_DECLARE_PARSER(apreq_parse_urlencoded);
  */
 APREQ_DECLARE_PARSER(apreq_parse_multipart);
 
+/**
+ * RFC 8259 application/json parser.  The body must be an object; each
+ * scalar in it becomes a param named by its path, with object keys
+ * joined by "." and array indices appended as "[n]", so
+ * {"a":{"b":[1,"x"]}} yields a.b[0]=1 and a.b[1]=x.  Strings are
+ * unescaped to utf8; true, false, null and numbers keep their JSON
+ * spelling.  Empty objects and arrays yield nothing.  A string too
+ * long for the brigade limit is spooled into param->upload like a
+ * file upload, leaving the param's value empty.  Names are matched
+ * against parse_only in their flattened form.
+ */
+APREQ_DECLARE_PARSER(apreq_parse_json);
+
+/** Name of the params apreq_parse_ndjson() makes of its records. */
+#define APREQ_NDJSON_RECORD "record"
+
+/**
+ * application/x-ndjson (newline delimited JSON) parser.  The body is
+ * split on newlines as it arrives, and each non-empty line, without
+ * its LF or CRLF, becomes a param named APREQ_NDJSON_RECORD whose
+ * value is the line as sent; the records are not parsed as JSON.  A record
+ * longer than the brigade limit fails with APREQ_ERROR_OVERLIMIT.
+ *
+ * @remarks With a sink on the parser, each record is instead streamed
+ * to the sink as a separate upload, chunk by chunk, whatever its
+ * length, and kept out of the table.  As with multipart uploads, the
+ * hooks see each chunk before the sink does, and an EOS bucket after
+ * the last.  This keeps bulk uploads of millions of records out of
+ * memory.
+ */
+APREQ_DECLARE_PARSER(apreq_parse_ndjson);
+
 /**
  * Generic parser.  No table entries will be added to
  * the req->body table by this parser.  The parser creates
@@ -181,6 +315,74 @@ APREQ_DECLARE_PARSER(apreq_parse_generic);
  */
 APREQ_DECLARE_HOOK(apreq_hook_apr_xml_parser);
 
+/**
+ * Context struct for the apreq_hook_xml_sax hook.  Any of the
+ * callbacks may be NULL.  A callback returning anything other than
+ * APR_SUCCESS aborts the parse with that status.
+ */
+typedef struct apreq_hook_xml_sax_ctx_t {
+    /** An element starts.  attrs holds its attributes as name, value
+     *  pairs, followed by NULL. */
+    apr_status_t (*start)(void *baton, const char *name,
+                          const char *const *attrs);
+    /** An element ends. */
+    apr_status_t (*end)(void *baton, const char *name);
+    /** Character data, with references decoded, in chunks as it
+     *  arrives; adjacent chunks belong to the same text. */
+    apr_status_t (*text)(void *baton, const char *data, apr_size_t len);
+    void *baton;    /**< passed to the callbacks */
+    void *state;    /**< the hook's own; must be NULL initially */
+} apreq_hook_xml_sax_ctx_t;
+
+/**
+ * Streaming alternative to apreq_hook_apr_xml_parser.  Instead of
+ * building a document, it reports elements and text to the callbacks
+ * in the hook's apreq_hook_xml_sax_ctx_t as each brigade arrives, in
+ * memory that doesn't grow with the body.  Each upload is parsed as a
+ * document of its own, which must be whole when its EOS arrives.
+ *
+ * @remarks This is not a validating parser.  Comments, processing
+ * instructions and the DOCTYPE are skipped; no DTD is read, so only
+ * the predefined and numeric character references are understood.
+ * Namespace prefixes are left in names.  A tag longer than 8K, more
+ * than 32 attributes on an element, or nesting deeper than 256
+ * elements fails with APREQ_ERROR_OVERLIMIT.
+ */
+APREQ_DECLARE_HOOK(apreq_hook_xml_sax);
+
+/** param->info key of the hex SHA-256 digest of an upload */
+#define APREQ_DIGEST_SHA256  "APREQ-SHA256"
+
+/** param->info key of the CRC32C of an upload, as 8 hex digits */
+#define APREQ_DIGEST_CRC32C  "APREQ-CRC32C"
+
+/** param->info key of the XXH64 of an upload, as 16 hex digits */
+#define APREQ_DIGEST_XXH64   "APREQ-XXH64"
+
+/**
+ * Digests each file upload as its data passes through the parser,
+ * sparing a second read of the spooled file.  Once the upload has
+ * ended, the lowercase hex SHA-256 digest of its contents is set in
+ * param->info under APREQ_DIGEST_SHA256, replacing any part header
+ * of that name.  The hook's ctx must be NULL when the hook is made.
+ */
+APREQ_DECLARE_HOOK(apreq_hook_digest_sha256);
+
+/**
+ * Like apreq_hook_digest_sha256, but sets the upload's CRC32C under
+ * APREQ_DIGEST_CRC32C.  The CPU's CRC32C instruction is used where
+ * available (SSE4.2 on x86-64, the CRC extension on AArch64).
+ */
+APREQ_DECLARE_HOOK(apreq_hook_digest_crc32c);
+
+/**
+ * Like apreq_hook_digest_sha256, but sets the upload's XXH64 (seed 0,
+ * as printed by xxhsum) under APREQ_DIGEST_XXH64.  It is portable
+ * code needing no CPU support, and outpaces table-driven CRC32C; like
+ * CRC32C it catches corruption, not tampering.
+ */
+APREQ_DECLARE_HOOK(apreq_hook_digest_xxh64);
+
 /**
  * Construct a parser.
  *
@@ -203,6 +405,67 @@ APREQ_DECLARE(apreq_parser_t *) apreq_parser_make(apr_pool_t *pool,
                                                   apreq_hook_t *hook,
                                                   void *ctx);
 
+/**
+ * Check a field name against the parser's parse_only list.  The
+ * urlencoded and multipart parsers skip fields it rejects without
+ * creating params for them, running hooks or spooling their data.
+ *
+ * @param parser The parser.
+ * @param name   Field name; need not be NUL-terminated.
+ * @param nlen   Length of name.
+ * @return 1 if the field should be parsed, 0 if it should be skipped.
+ * @remark Names are compared case-insensitively, as in table lookups.
+ */
+APREQ_DECLARE(int) apreq_parser_wants(const apreq_parser_t *parser,
+                                      const char *name, apr_size_t nlen);
+
+/**
+ * Appends bb to an upload brigade, as parsers do with upload data:
+ * through apreq_brigade_concat_async() with the parser's spool
+ * writer, temp_dir and brigade_limit.  A spool file it starts is
+ * preallocated to the parser's size_hint, capped per part; nothing is
+ * reserved when the hint is too small to be worth it.
+ *
+ * @param parser The parser.
+ * @param pool   Pool for the spool file.
+ * @param upload The upload brigade.
+ * @param bb     Data to append.
+ * @param done   Nonzero if this is the last of the upload.  The queued
+ *               writes are then waited for, and the spool file is
+ *               trimmed to the data.
+ * @return APR_SUCCESS, or an error from apreq_brigade_concat_async(),
+ *         apreq_spool_writer_wait() or apreq_brigade_spool_trim().
+ */
+APREQ_DECLARE(apr_status_t) apreq_parser_spool(apreq_parser_t *parser,
+                                               apr_pool_t *pool,
+                                               apr_bucket_brigade *upload,
+                                               apr_bucket_brigade *bb,
+                                               int done);
+
+/**
+ * Puts a decompression stage in front of the parser's function, for a
+ * body sent with a Content-Encoding.  The body is inflated as it
+ * arrives, a block at a time, and the parser function only ever sees
+ * the inflated data; the caller keeps running the parser as before.
+ *
+ * @param parser   The parser, after apreq_parser_make().
+ * @param encoding The Content-Encoding request header: "gzip",
+ *                 "x-gzip" or "deflate".  NULL, "" and "identity"
+ *                 leave the parser as it is.
+ * @param limit    Maximum size of the inflated body.  Parsing fails
+ *                 with APREQ_ERROR_OVERLIMIT once it is passed, which
+ *                 guards against small bodies that inflate enormously.
+ * @return APR_SUCCESS, APR_ENOTIMPL for any other encoding (or for all
+ *         of them without zlib), or APREQ_ERROR_MISMATCH if the parser
+ *         already has a decompression stage.
+ * @remark The parser's size_hint is cleared, since the Content-Length
+ *         says nothing about the inflated size.  A truncated or
+ *         corrupt stream fails with APREQ_ERROR_BADDATA.
+ */
+APREQ_DECLARE(apr_status_t) apreq_parser_inflate(apreq_parser_t *parser,
+                                                 const char *encoding,
+                                                 apr_uint64_t limit);
+
 /**
  * Construct a hook.
  *
@@ -218,6 +481,18 @@ APREQ_DECLARE(apreq_hook_t *) apreq_hook_make(apr_pool_t *pool,
                                               void *ctx);
 
 
+/**
+ * Construct a sink.
+ *
+ * @param pool used to allocate the sink.
+ * @param sink The sink function.
+ * @param ctx Sink's internal scratch pad.
+ * @return New sink.
+ */
+APREQ_DECLARE(apreq_sink_t *) apreq_sink_make(apr_pool_t *pool,
+                                              apreq_sink_function_t sink,
+                                              void *ctx);
+
 /**
  * Add a new hook to the end of the parser's hook list.
  *
@@ -266,6 +541,45 @@ APREQ_DECLARE_HOOK(apreq_hook_disable_uploads);
  */
 APREQ_DECLARE_HOOK(apreq_hook_discard_brigade);
 
+/**
+ * Writes upload data to the apr_file_t * in the sink's ctx, such as
+ * a pipe or one end of a socket pair.  On a non-blocking file, data
+ * the file won't take yet makes the sink return APR_EAGAIN.  The file
+ * is left open at the end of each upload.
+ */
+APREQ_DECLARE_SINK(apreq_sink_file);
+
+/**
+ * Sends upload data on the apr_socket_t * in the sink's ctx, with
+ * APR_EAGAIN while a non-blocking socket's send buffer is full.
+ */
+APREQ_DECLARE_SINK(apreq_sink_socket);
+
+/**
+ * The callback of apreq_sink_callback.  It should take up to *len bytes
+ * of data, set *len to the number taken, and return APR_SUCCESS, or
+ * APR_EAGAIN if it took fewer than it was offered.  It is called with
+ * data == NULL and *len == 0 at the end of each upload.
+ */
+typedef apr_status_t (*apreq_sink_callback_t)(void *baton,
+                                              apreq_param_t *param,
+                                              const char *data,
+                                              apr_size_t *len);
+
+/**
+ * Context struct for the apreq_sink_callback sink.
+ */
+typedef struct apreq_sink_callback_ctx_t {
+    apreq_sink_callback_t  callback;
+    void                  *baton;
+} apreq_sink_callback_ctx_t;
+
+/**
+ * Hands upload data to a plain callback, one buffer at a time.  The
+ * sink's ctx should be an apreq_sink_callback_ctx_t *.
+ */
+APREQ_DECLARE_SINK(apreq_sink_callback);
+
 /**
  * Context struct for the apreq_hook_find_param hook.
  */
@@ -292,6 +606,32 @@ typedef struct apreq_hook_find_param_ctx_t {
  */
 APREQ_DECLARE_HOOK(apreq_hook_find_param);
 
+/**
+ * Context struct for the apreq_hook_find_params hook.
+ */
+typedef struct apreq_hook_find_params_ctx_t {
+    const char *const *names;
+    apreq_param_t    **params;
+    int                nelts;
+    int                missing;
+} apreq_hook_find_params_ctx_t;
+
+
+/**
+ * Locates several parameters in a single pass over the body.
+ * The hook's ctx should be an apreq_hook_find_params_ctx_t *
+ * whose names and params arrays both hold nelts entries; each
+ * NULL slot in params is filled with the first param whose name
+ * matches the corresponding entry in names, and missing counts
+ * down the slots still NULL.  Unlike apreq_hook_find_param,
+ * this hook never removes itself from the chain.
+ *
+ * @remarks When used, this should always be the first hook
+ * invoked, so push it onto the front of parser->hook manually
+ * and unlink it again once missing reaches zero.
+ */
+APREQ_DECLARE_HOOK(apreq_hook_find_params);
+
 
 #ifdef __cplusplus
 }
@@ -71,6 +71,51 @@ APREQ_DECLARE(apr_ssize_t) apreq_index(const char* hay, apr_size_t hlen,
                                        const char* ndl, apr_size_t nlen,
                                        const apreq_match_t type);
 
+/**
+ * Precompiled search string for apreq_index_match().  The index function
+ * is selected once, at precompile time, from the fastest implementation
+ * (AVX2, SSE2 or portable C) supported by the running CPU.
+ */
+typedef struct apreq_index_pattern_t apreq_index_pattern_t;
+
+/** @brief Precompiled search string */
+struct apreq_index_pattern_t {
+    /** Scanner chosen by apreq_index_precompile() */
+    apr_ssize_t (*index)(const apreq_index_pattern_t *pattern,
+                         const char *hay, apr_size_t hlen,
+                         const apreq_match_t type);
+    /** Search string */
+    const char *ndl;
+    /** Length of search string */
+    apr_size_t nlen;
+};
+
+/**
+ * Precompiles a search string for use with apreq_index_match().
+ *
+ * @param p    Pool to allocate the pattern from.
+ * @param ndl  Search string; must remain valid for the pattern's lifetime.
+ * @param nlen Length of search string.
+ *
+ * @return Precompiled pattern.
+ */
+APREQ_DECLARE(const apreq_index_pattern_t *)
+    apreq_index_precompile(apr_pool_t *p, const char *ndl, apr_size_t nlen);
+
+/**
+ * Same as apreq_index(), using a pattern from apreq_index_precompile().
+ * Full and trailing partial matches are found in a single pass.
+ *
+ * @param pattern Precompiled search string.
+ * @param hay     Location of bytes to scan.
+ * @param hlen    Number of bytes available for scanning.
+ * @param type    Match type.
+ *
+ * @return Offset of match string, or -1 if no match is found.
+ */
+#define apreq_index_match(pattern, hay, hlen, type) \
+    (*((pattern)->index))((pattern), (hay), (hlen), (type))
+
 /**
  * Places a quoted copy of src into dest.  Embedded quotes are escaped with a
  * backslash ('\').
@@ -189,6 +234,57 @@ APREQ_DECLARE(apr_status_t) apreq_decode(char *dest, apr_size_t *dlen,
 APREQ_DECLARE(apr_status_t) apreq_decodev(char *dest, apr_size_t *dlen,
                                           struct iovec *v, int nelts);
 
+/**
+ * Checks a url-encoded string without decoding it.
+ *
+ * @param src  Url-encoded string.
+ * @param slen Length of src.
+ *
+ * @return The status apreq_decode() would return for src.
+ */
+
+APREQ_DECLARE(apr_status_t) apreq_decode_check(const char *src,
+                                               apr_size_t slen);
+
+/**
+ * Url-decodes a string and divines the charset of the result in the
+ * same pass.  Equivalent to apreq_decode() followed by
+ * apreq_charset_divine() on the decoded string, without reading it twice.
+ *
+ * @param dest    Location of url-decoded result string, as for apreq_decode().
+ * @param dlen    Resultant length of dest.
+ * @param charset Charset of the decoded string; only meaningful when
+ *                APR_SUCCESS is returned.
+ * @param src     Original string.
+ * @param slen    Length of original string.
+ *
+ * @return As for apreq_decode().
+ */
+
+APREQ_DECLARE(apr_status_t) apreq_decode_charset(char *dest, apr_size_t *dlen,
+                                                 apreq_charset_t *charset,
+                                                 const char *src,
+                                                 apr_size_t slen);
+
+/**
+ * Url-decodes an iovec array and divines the charset of the result in
+ * the same pass.  Equivalent to apreq_decodev() followed by
+ * apreq_charset_divine() on the decoded string.
+ *
+ * @param dest    Location of url-decoded result string, as for apreq_decodev().
+ * @param dlen    Resultant length of dest.
+ * @param charset Charset of the decoded string; only meaningful when
+ *                APR_SUCCESS is returned.
+ * @param v       Array of iovecs that represent the source string
+ * @param nelts   Number of iovecs in the array.
+ *
+ * @return As for apreq_decodev().
+ */
+
+APREQ_DECLARE(apr_status_t) apreq_decodev_charset(char *dest, apr_size_t *dlen,
+                                                  apreq_charset_t *charset,
+                                                  struct iovec *v, int nelts);
+
 /**
  * Returns an url-encoded copy of a string.
  *
@@ -277,6 +373,32 @@ APREQ_DECLARE(apr_int64_t) apreq_atoi64t(const char *s);
 APREQ_DECLARE(apr_status_t) apreq_brigade_fwrite(apr_file_t *f,
                                                  apr_off_t *wlen,
                                                  apr_bucket_brigade *bb);
+
+/**
+ * Saves the contents of a brigade, typically a spooled upload, as a
+ * new file without copying it through user space where possible.
+ * When the spool file holds all of bb, it is hard linked to path,
+ * including an O_TMPFILE from apreq_tempfile_pool_get(), and the temp
+ * name of one from apreq_file_mktemp() is removed.  Failing that, as
+ * across devices, the spool file is cloned (FICLONE) or copied with
+ * copy_file_range().  Otherwise bb is written out as by
+ * apreq_brigade_fwrite().
+ *
+ * @param pool    Pool for temporary allocations.
+ * @param path    Name of the new file; it must not exist yet.
+ * @param bb      Bucket brigade.
+ *
+ * @return APR_SUCCESS.
+ * @return APR_EEXIST if path already exists.
+ * @return Error status code from creating or writing the new file.
+ *
+ * @remarks bb stays readable afterwards.  The new file is readable and
+ *          writable by its owner only, whether it was linked or written.
+ */
+APREQ_DECLARE(apr_status_t) apreq_brigade_persist(apr_pool_t *pool,
+                                                  const char *path,
+                                                  apr_bucket_brigade *bb);
+
 /**
  * Makes a temporary file.
  *
@@ -287,6 +409,12 @@ APREQ_DECLARE(apr_status_t) apreq_brigade_fwrite(apr_file_t *f,
  * @param path  The base directory which will contain the temp file.
  *              If param == NULL, the directory will be selected via
  *              tempnam().  See the tempnam manpage for details.
+ *              This may also be a list of directories, separated as
+ *              in PATH (see apr_filepath_list_split()), to stripe temp
+ *              files across devices: each call takes the next one in
+ *              turn, skipping any that fail.  A path naming an
+ *              existing directory is never taken for a list, even if
+ *              it holds the separator.
  *
  * @return APR_SUCCESS.
  * @return Error status code from unsuccessful apr_filepath_merge(),
@@ -297,6 +425,117 @@ APREQ_DECLARE(apr_status_t) apreq_file_mktemp(apr_file_t **fp,
                                               apr_pool_t *pool,
                                               const char *path);
 
+/**
+ * Enables the process-wide temp file pool used by
+ * apreq_tempfile_pool_get().  Calling it again replaces the
+ * previous pool, closing its idle files.  No file is made here: the
+ * pool fills lazily, as files leased by apreq_tempfile_pool_get()
+ * are released, so the first max uploads still create theirs.
+ *
+ * @param pool  Lifetime of the pool; a child process pool, say.
+ *              The idle files are closed when it is cleared.
+ * @param max   High-water mark: at most this many released files
+ *              are kept open for reuse.  0 disables the pool.
+ *
+ * @return APR_SUCCESS.
+ * @return APR_ENOTIMPL on platforms that can't unlink open files.
+ * @return Error status code from apr_thread_mutex_create().
+ */
+APREQ_DECLARE(apr_status_t) apreq_tempfile_pool_init(apr_pool_t *pool,
+                                                     int max);
+
+/**
+ * Like apreq_file_mktemp(), but hands out an already-unlinked file
+ * from the temp file pool, creating one (with O_TMPFILE where
+ * available) if none is idle.  When pool is cleared, the file is
+ * truncated and returned to the temp file pool rather than closed.
+ * Falls back to apreq_file_mktemp() if the temp file pool is
+ * disabled or a file can't be made.
+ *
+ * @param fp    Points to the temporary apr_file_t on success.
+ * @param pool  Pool to lease the temp file to.
+ * @param path  The base directory, or list of directories as for
+ *              apreq_file_mktemp(), to contain the temp file.
+ *              If path == NULL, apr_temp_dir_get() picks one.
+ *
+ * @return APR_SUCCESS.
+ * @return Error status code from apreq_file_mktemp().
+ *
+ * @remarks Pooled files have no name: apr_file_name_get() yields NULL.
+ */
+APREQ_DECLARE(apr_status_t) apreq_tempfile_pool_get(apr_file_t **fp,
+                                                    apr_pool_t *pool,
+                                                    const char *path);
+
+/**
+ * Configures the memory spool tier of apreq_brigade_concat(): a
+ * brigade that outgrows its heap limit is spooled into an anonymous
+ * memfd, rather than a temp file, for as long as it stays within
+ * limit bytes and the process-wide budget allows.  Its spool bucket
+ * is then read straight from a shared mapping.  These settings apply
+ * to the whole process.
+ *
+ * @param limit   Largest memory spool; 0 disables the tier.
+ * @param budget  Total bytes all memory spools in this process
+ *                may hold at once.
+ *
+ * @return APR_SUCCESS.
+ * @return APR_ENOTIMPL where memfd_create() is unavailable.
+ */
+APREQ_DECLARE(apr_status_t) apreq_spool_memory_set(apr_size_t limit,
+                                                   apr_uint64_t budget);
+
+/**
+ * Configures the direct spool mode of apreq_brigade_concat(): once a
+ * spool file holds threshold bytes, further appends to it are staged
+ * in an aligned buffer kept with the file and written with O_DIRECT
+ * each time it fills, so that very large uploads don't push
+ * everything else out of the page cache.  What is left staged goes to
+ * the file when an EOS is appended, when the spool is trimmed or
+ * persisted, or when its bucket is first read, split or copied.  Where
+ * O_DIRECT is unavailable, or the file system refuses it, the written
+ * ranges are dropped from the cache with posix_fadvise() instead, as
+ * they are for spool files written by apreq_brigade_concat_async().
+ * This setting applies to the whole process.
+ *
+ * @param threshold  Spool file size past which the mode kicks in;
+ *                   0 disables it.
+ *
+ * @return APR_SUCCESS.
+ * @return APR_ENOTIMPL where neither O_DIRECT nor posix_fadvise()
+ *         is available.
+ */
+APREQ_DECLARE(apr_status_t) apreq_spool_direct_set(apr_off_t threshold);
+
+/**
+ * Preallocates the spool file at the end of bb (see
+ * apreq_brigade_spoolfile()) to size bytes, so that a large upload
+ * is laid out in few extents rather than grown a write at a time.
+ * Uses fallocate() with FALLOC_FL_KEEP_SIZE where available, or else
+ * posix_fallocate(), which extends the file until it is trimmed.
+ *
+ * @param bb    Brigade; a final EOS bucket is looked past.
+ * @param size  Expected size of the whole spool file.
+ *
+ * @return APR_SUCCESS, also if bb has no spool file or a memory one.
+ * @return APR_ENOTIMPL where neither call is available.
+ * @return Error status code from a failed preallocation.
+ */
+APREQ_DECLARE(apr_status_t) apreq_brigade_spool_reserve(apr_bucket_brigade *bb,
+                                                        apr_off_t size);
+
+/**
+ * Truncates the spool file at the end of bb to the data it holds,
+ * releasing what apreq_brigade_spool_reserve() set aside beyond it.
+ * Queued writes (apreq_spool_writer_wait()) must be complete.
+ *
+ * @param bb    Brigade; a final EOS bucket is looked past.
+ *
+ * @return APR_SUCCESS, also if bb has no spool file or a memory one.
+ * @return Error status code from apr_file_trunc().
+ */
+APREQ_DECLARE(apr_status_t) apreq_brigade_spool_trim(apr_bucket_brigade *bb);
+
 /**
  * Set aside all buckets in the brigade.
  *
@@ -407,7 +646,8 @@ APREQ_DECLARE(apr_status_t) apreq_header_attribute(const char *hdr,
  * Concatenates the brigades, spooling large brigades into
  * a tempfile (APREQ_SPOOL) bucket.
  *
- * @param pool           Pool for creating a tempfile bucket.
+ * @param pool           Pool for creating a tempfile bucket; the
+ *                       tempfile comes from apreq_tempfile_pool_get().
  * @param temp_dir       Directory for tempfile creation.
  * @param brigade_limit  If out's length would exceed this value,
  *                       the appended buckets get written to a tempfile.
@@ -416,7 +656,16 @@ APREQ_DECLARE(apr_status_t) apreq_header_attribute(const char *hdr,
  *
  * @return APR_SUCCESS.
  * @return Error status code resulting from either apr_brigade_length(),
- *         apreq_file_mktemp(), apreq_brigade_fwrite(), or apr_file_seek().
+ *         apreq_file_mktemp(), apr_bucket_read(), or a failed write.
+ *
+ * @remarks Spool writes are positional (pwritev() where available),
+ *          so reading the spool bucket between calls is harmless.
+ * @remarks The spool starts out in memory where apreq_spool_memory_set()
+ *          allows, and moves to a tempfile once it outgrows that.
+ *          in == out always leaves a tempfile spool.
+ * @remarks Appends to a tempfile past the apreq_spool_direct_set()
+ *          threshold bypass the page cache, and may be staged in
+ *          memory until the spool is read, trimmed or ended by EOS.
  *
  * @todo Flesh out these error codes, making them as explicit as possible.
  */
@@ -436,6 +685,106 @@ APREQ_DECLARE(apr_status_t) apreq_brigade_concat(apr_pool_t *pool,
  */
 APREQ_DECLARE(apr_file_t *)apreq_brigade_spoolfile(apr_bucket_brigade *bb);
 
+/**
+ * Asynchronous writer for upload spool files; see
+ * apreq_brigade_concat_async().
+ */
+typedef struct apreq_spool_writer_t apreq_spool_writer_t;
+
+/**
+ * Creates an asynchronous spool writer.  Writes are queued to an
+ * io_uring ring where the platform provides one, else to a writer
+ * thread, else they are done synchronously; nothing is set up until
+ * the first write is queued.
+ *
+ * @param pool  Pool the writer lives in.  It must outlive every pool
+ *              passed to apreq_brigade_concat_async() with it.
+ * @param depth Writes kept in flight before callers block, or 0
+ *              for ::APREQ_DEFAULT_SPOOL_DEPTH.
+ *
+ * @return the new writer.
+ */
+APREQ_DECLARE(apreq_spool_writer_t *)
+    apreq_spool_writer_make(apr_pool_t *pool, int depth);
+
+/**
+ * Waits for every write queued on the writer to complete.
+ *
+ * @param w The writer, or NULL.
+ *
+ * @return APR_SUCCESS, or the status of the first write that failed.
+ */
+APREQ_DECLARE(apr_status_t) apreq_spool_writer_wait(apreq_spool_writer_t *w);
+
+/**
+ * Like apreq_brigade_concat(), but once out ends in a spool bucket
+ * the appended data is queued on the writer instead of being written
+ * before returning.  The spool bucket's length covers queued data
+ * immediately, so out must not be read until apreq_spool_writer_wait()
+ * has returned.  The buckets in "in" are kept by the writer until
+ * their write completes.
+ *
+ * @param w              Asynchronous writer; NULL makes this
+ *                       apreq_brigade_concat().
+ * @param pool           Pool for creating a tempfile bucket.
+ * @param temp_dir       Directory for tempfile creation.
+ * @param brigade_limit  If out's length would exceed this value,
+ *                       the appended buckets get written to a tempfile.
+ * @param out            Resulting brigade.
+ * @param in             Brigade to append.
+ *
+ * @return APR_SUCCESS.
+ * @return Error status code from apreq_brigade_concat(),
+ *         apr_bucket_read(), or an earlier queued write that failed.
+ */
+APREQ_DECLARE(apr_status_t)
+    apreq_brigade_concat_async(apreq_spool_writer_t *w,
+                               apr_pool_t *pool,
+                               const char *temp_dir,
+                               apr_size_t brigade_limit,
+                               apr_bucket_brigade *out,
+                               apr_bucket_brigade *in);
+
+/**
+ * Tables with fewer entries than this are searched with apr_table_get()
+ * rather than indexed.
+ */
+#ifndef APREQ_TABLE_INDEX_MIN
+#define APREQ_TABLE_INDEX_MIN 32
+#endif
+
+/**
+ * Hashed lookup index over an apr table, as used by the handles for
+ * their jar, args and body tables.  The hash is seeded per process.
+ */
+typedef struct apreq_table_index_t apreq_table_index_t;
+
+/**
+ * Creates an empty index.  Nothing is hashed until the first lookup
+ * into a table with at least ::APREQ_TABLE_INDEX_MIN entries.
+ *
+ * @param p Pool the index allocates from.
+ * @return The index.
+ */
+APREQ_DECLARE(apreq_table_index_t *) apreq_table_index_make(apr_pool_t *p);
+
+/**
+ * Drop-in replacement for apr_table_get(): returns the value of the
+ * first entry in t whose key matches (case-insensitively).
+ *
+ * @param idx Index to use.
+ * @param t   Table to search; switching tables rebuilds the index.
+ * @param key Key to look up.
+ * @return The value, or NULL if t has no such key (or t is NULL).
+ *
+ * @remarks Entries appended to t are indexed on the next lookup.  The
+ *          index assumes t only ever grows by appending; a table that
+ *          shrinks is reindexed, but other edits are not detected.
+ */
+APREQ_DECLARE(const char *) apreq_table_index_get(apreq_table_index_t *idx,
+                                                  const apr_table_t *t,
+                                                  const char *key);
+
 #ifdef __cplusplus
  }
 #endif
@@ -55,6 +55,7 @@ struct cgi_handle {
     struct apreq_handle_t       handle;
 
     apr_table_t                 *jar, *args, *body;
+    apreq_table_index_t         *jar_index, *args_index, *body_index;
     apr_status_t                 jar_status,
                                  args_status,
                                  body_status;
@@ -64,6 +65,7 @@ struct cgi_handle {
     apreq_hook_t                *find_param;
 
     const char                  *temp_dir;
+    const apr_array_header_t    *parse_only;
     apr_size_t                   brigade_limit;
     apr_uint64_t                 read_limit;
     apr_uint64_t                 bytes_read;
@@ -350,6 +352,7 @@ static void init_body(apreq_handle_t *handle)
     apr_pool_t *pool = handle->pool;
     apr_file_t *file;
     apr_bucket *eos, *pipe;
+    apr_off_t size_hint = 0;
 
     if (cl_header != NULL) {
         char *dummy;
@@ -369,6 +372,7 @@ static void init_body(apreq_handle_t *handle)
                           cl_header, req->read_limit);
             return;
         }
+        size_hint = content_length;
     }
 
     if (req->parser == NULL) {
@@ -386,6 +390,7 @@ static void init_body(apreq_handle_t *handle)
                                                 req->temp_dir,
                                                 req->hook_queue,
                                                 NULL);
+                req->parser->parse_only = req->parse_only;
             }
             else {
                 req->body_status = APREQ_ERROR_NOPARSER;
@@ -404,8 +409,23 @@ static void init_body(apreq_handle_t *handle)
             req->parser->temp_dir = req->temp_dir;
         if (req->hook_queue != NULL)
             apreq_parser_add_hook(req->parser, req->hook_queue);
+        if (req->parse_only != NULL)
+            req->parser->parse_only = req->parse_only;
     }
 
+    req->parser->size_hint = size_hint;
+
+    if (req->parser->inflate == NULL) {
+        const char *ce_header = cgi_header_in(handle, "Content-Encoding");
+        apr_status_t s = apreq_parser_inflate(req->parser, ce_header,
+                                              req->read_limit);
+        if (s != APR_SUCCESS) {
+            req->body_status = s;
+            cgi_log_error(CGILOG_MARK, CGILOG_ERR, req->body_status, handle,
+                          "Unsupported Content-Encoding (%s)", ce_header);
+            return;
+        }
+    }
     req->hook_queue = NULL;
     req->in         = apr_brigade_create(pool, ba);
     req->tmpbb      = apr_brigade_create(pool, ba);
@@ -441,6 +461,7 @@ static apr_status_t cgi_read(apreq_handle_t *handle,
 
         apreq_brigade_move(req->tmpbb, req->in, e);
         req->bytes_read += bytes;
+        apreq_parser_hint_read(req->parser, bytes);
 
         if (req->bytes_read > req->read_limit) {
             req->body_status = APREQ_ERROR_OVERLIMIT;
@@ -467,6 +488,7 @@ static apr_status_t cgi_read(apreq_handle_t *handle,
             break;
         }
         req->bytes_read += len;
+        apreq_parser_hint_read(req->parser, len);
 
         if (req->bytes_read > req->read_limit) {
             req->body_status = APREQ_ERROR_OVERLIMIT;
@@ -597,7 +619,7 @@ static apreq_cookie_t *cgi_jar_get(apreq_handle_t *handle,
     else
         t = req->jar;
 
-    val = apr_table_get(t, name);
+    val = apreq_table_index_get(req->jar_index, t, name);
     if (val == NULL) {
         if (!req->interactive_mode) {
             return NULL;
@@ -629,7 +651,7 @@ static apreq_param_t *cgi_args_get(apreq_handle_t *handle,
     else
         t = req->args;
 
-    val = apr_table_get(t, name);
+    val = apreq_table_index_get(req->args_index, t, name);
     if (val == NULL) {
         if (!req->interactive_mode) {
             return NULL;
@@ -646,7 +668,7 @@ static apreq_param_t *cgi_args_get(apreq_handle_t *handle,
     }
 
 
-    return apreq_value_to_param(val);
+    return apreq_value_to_decoded_param(val);
 }
 
 
@@ -708,7 +730,7 @@ static apreq_param_t *cgi_body_get(apreq_handle_t *handle,
     apreq_hook_find_param_ctx_t *hook_ctx;
 
     if (req->interactive_mode) {
-        val = apr_table_get(req->body, name);
+        val = apreq_table_index_get(req->body_index, req->body, name);
         if (val == NULL) {
             return NULL;
         } else {
@@ -720,7 +742,7 @@ static apreq_param_t *cgi_body_get(apreq_handle_t *handle,
             apreq_param_tainted_on(p);
             apreq_value_table_add(&p->v, req->body);
             val = p->v.data;
-            return apreq_value_to_param(val);
+            return apreq_value_to_decoded_param(val);
         }
     }
 
@@ -729,9 +751,9 @@ static apreq_param_t *cgi_body_get(apreq_handle_t *handle,
 
     case APR_SUCCESS:
 
-        val = apr_table_get(req->body, name);
+        val = apreq_table_index_get(req->body_index, req->body, name);
         if (val != NULL)
-            return apreq_value_to_param(val);
+            return apreq_value_to_decoded_param(val);
         return NULL;
 
 
@@ -745,9 +767,9 @@ static apreq_param_t *cgi_body_get(apreq_handle_t *handle,
 
     case APR_INCOMPLETE:
 
-        val = apr_table_get(req->body, name);
+        val = apreq_table_index_get(req->body_index, req->body, name);
         if (val != NULL)
-            return apreq_value_to_param(val);
+            return apreq_value_to_decoded_param(val);
 
         /* Not seen yet, so we need to scan for
            param while prefetching the body */
@@ -768,11 +790,12 @@ static apreq_param_t *cgi_body_get(apreq_handle_t *handle,
 
         do {
             cgi_read(handle, APREQ_DEFAULT_READ_BLOCK_SIZE);
-            if (hook_ctx->param != NULL)
-                return hook_ctx->param;
-        } while (req->body_status == APR_INCOMPLETE);
+        } while (hook_ctx->param == NULL
+                 && req->body_status == APR_INCOMPLETE);
 
         req->parser->hook = h->next;
+        if (hook_ctx->param != NULL)
+            return apreq_value_to_decoded_param(hook_ctx->param->v.data);
         return NULL;
 
 
@@ -781,9 +804,9 @@ static apreq_param_t *cgi_body_get(apreq_handle_t *handle,
         if (req->body == NULL)
             return NULL;
 
-        val = apr_table_get(req->body, name);
+        val = apreq_table_index_get(req->body_index, req->body, name);
         if (val != NULL)
-            return apreq_value_to_param(val);
+            return apreq_value_to_decoded_param(val);
         return NULL;
     }
 
@@ -791,6 +814,62 @@ static apreq_param_t *cgi_body_get(apreq_handle_t *handle,
     return NULL;
 }
 
+static apr_status_t cgi_body_getv(apreq_handle_t *handle,
+                                  const char *const *names, int n,
+                                  apreq_param_t **params)
+{
+    struct cgi_handle *req = (struct cgi_handle *)handle;
+    apreq_hook_t *h;
+    apreq_hook_find_params_ctx_t *hook_ctx;
+    const char *val;
+    int i, missing = 0;
+
+    if (req->interactive_mode) {
+        for (i = 0; i < n; ++i)
+            params[i] = cgi_body_get(handle, names[i]);
+        return req->body_status;
+    }
+
+    if (req->body_status == APR_EINIT) {
+        init_body(handle);
+        if (req->body_status == APR_INCOMPLETE)
+            cgi_read(handle, APREQ_DEFAULT_READ_BLOCK_SIZE);
+    }
+
+    for (i = 0; i < n; ++i) {
+        val = (req->body == NULL) ? NULL
+            : apreq_table_index_get(req->body_index, req->body, names[i]);
+        params[i] = (val != NULL) ? apreq_value_to_param(val) : NULL;
+        missing += (val == NULL);
+    }
+
+    if (missing > 0 && req->body_status == APR_INCOMPLETE) {
+        /* Scan for every name still missing with a single
+           hook while prefetching the rest of the body */
+        hook_ctx = apr_palloc(handle->pool, sizeof *hook_ctx);
+        hook_ctx->names = names;
+        hook_ctx->params = params;
+        hook_ctx->nelts = n;
+        hook_ctx->missing = missing;
+
+        h = apreq_hook_make(handle->pool, apreq_hook_find_params,
+                            req->parser->hook, hook_ctx);
+        req->parser->hook = h;
+
+        do {
+            cgi_read(handle, APREQ_DEFAULT_READ_BLOCK_SIZE);
+        } while (hook_ctx->missing > 0 && req->body_status == APR_INCOMPLETE);
+
+        req->parser->hook = h->next;
+    }
+
+    for (i = 0; i < n; ++i)
+        if (params[i] != NULL)
+            params[i] = apreq_value_to_decoded_param(params[i]->v.data);
+
+    return req->body_status;
+}
+
 static apr_status_t cgi_parser_get(apreq_handle_t *handle,
                                    const apreq_parser_t **parser)
 {
@@ -818,6 +897,9 @@ static apr_status_t cgi_parser_set(apreq_handle_t *handle,
         if (req->brigade_limit < parser->brigade_limit) {
             parser->brigade_limit = req->brigade_limit;
         }
+        if (req->parse_only != NULL) {
+            parser->parse_only = req->parse_only;
+        }
 
         req->hook_queue = NULL;
         req->parser = parser;
@@ -928,6 +1010,20 @@ static apr_status_t cgi_temp_dir_get(apreq_handle_t *handle,
     return APR_SUCCESS;
 }
 
+static apr_status_t cgi_parse_only_set(apreq_handle_t *handle,
+                                       const apr_array_header_t *names)
+{
+    struct cgi_handle *req = (struct cgi_handle *)handle;
+
+    if (req->bytes_read != 0)
+        return APREQ_ERROR_NOTEMPTY;
+
+    req->parse_only = names;
+    if (req->parser != NULL)
+        req->parser->parse_only = names;
+    return APR_SUCCESS;
+}
+
 
 
 #ifdef APR_POOL_DEBUG
@@ -964,7 +1060,7 @@ static int is_interactive_mode(apr_pool_t *pool) {
     return 0;
 }
 
-static APREQ_MODULE(cgi, 20090110);
+static APREQ_MODULE(cgi, 20261017);
 
 APREQ_DECLARE(apreq_handle_t *)apreq_handle_cgi(apr_pool_t *pool)
 {
@@ -992,6 +1088,10 @@ APREQ_DECLARE(apreq_handle_t *)apreq_handle_cgi(apr_pool_t *pool)
     req->body = apr_table_make(pool, APREQ_DEFAULT_NELTS);
     req->jar  = apr_table_make(pool, APREQ_DEFAULT_NELTS);
 
+    req->args_index = apreq_table_index_make(pool);
+    req->body_index = apreq_table_index_make(pool);
+    req->jar_index  = apreq_table_index_make(pool);
+
     req->args_status =
         req->jar_status =
             req->body_status = APR_EINIT;
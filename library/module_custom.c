@@ -26,6 +26,7 @@ struct custom_handle {
     struct apreq_handle_t        handle;
 
     apr_table_t                 *jar, *args, *body;
+    apreq_table_index_t         *jar_index, *args_index, *body_index;
     apr_status_t                 jar_status,
                                  args_status,
                                  body_status;
@@ -127,7 +128,7 @@ static apreq_cookie_t *custom_jar_get(apreq_handle_t *handle, const char *name)
     if (req->jar == NULL || name == NULL)
         return NULL;
 
-    val = apr_table_get(req->jar, name);
+    val = apreq_table_index_get(req->jar_index, req->jar, name);
 
     if (val == NULL)
         return NULL;
@@ -143,12 +144,12 @@ static apreq_param_t *custom_args_get(apreq_handle_t *handle, const char *name)
     if (req->args == NULL || name == NULL)
         return NULL;
 
-    val = apr_table_get(req->args, name);
+    val = apreq_table_index_get(req->args_index, req->args, name);
 
     if (val == NULL)
         return NULL;
 
-    return apreq_value_to_param(val);
+    return apreq_value_to_decoded_param(val);
 }
 
 static apreq_param_t *custom_body_get(apreq_handle_t *handle, const char *name)
@@ -160,7 +161,8 @@ static apreq_param_t *custom_body_get(apreq_handle_t *handle, const char *name)
         return NULL;
 
     while (1) {
-        *(const char **)&val = apr_table_get(req->body, name);
+        *(const char **)&val = apreq_table_index_get(req->body_index,
+                                                     req->body, name);
         if (val != NULL)
             break;
 
@@ -170,7 +172,39 @@ static apreq_param_t *custom_body_get(apreq_handle_t *handle, const char *name)
             return NULL;
     }
 
-    return apreq_value_to_param(val);
+    return apreq_value_to_decoded_param(val);
+}
+
+static apr_status_t custom_body_getv(apreq_handle_t *handle,
+                                     const char *const *names, int n,
+                                     apreq_param_t **params)
+{
+    struct custom_handle *req = (struct custom_handle*)handle;
+    const char *val;
+    int i, missing;
+
+    for (i = 0; i < n; ++i)
+        params[i] = NULL;
+
+    while (1) {
+        missing = 0;
+        for (i = 0; i < n; ++i) {
+            if (params[i] != NULL)
+                continue;
+            val = apreq_table_index_get(req->body_index, req->body, names[i]);
+            if (val != NULL)
+                params[i] = apreq_value_to_decoded_param(val);
+            else
+                ++missing;
+        }
+
+        if (missing == 0 || req->body_status != APR_INCOMPLETE)
+            break;
+
+        custom_parse_brigade(handle, READ_BYTES);
+    }
+
+    return req->body_status;
 }
 
 
@@ -249,8 +283,20 @@ static apr_status_t custom_temp_dir_set(apreq_handle_t *handle,
     return APR_ENOTIMPL;
 }
 
+static apr_status_t custom_parse_only_set(apreq_handle_t *handle,
+                                          const apr_array_header_t *names)
+{
+    struct custom_handle *req = (struct custom_handle*)handle;
+
+    if (req->bytes_read != 0)
+        return APREQ_ERROR_NOTEMPTY;
+
+    req->parser->parse_only = names;
+    return APR_SUCCESS;
+}
+
 
-static APREQ_MODULE(custom, 20070428);
+static APREQ_MODULE(custom, 20261017);
 
 APREQ_DECLARE(apreq_handle_t *)apreq_handle_custom(apr_pool_t *pool,
                                                    const char *query_string,
@@ -271,6 +317,9 @@ APREQ_DECLARE(apreq_handle_t *)apreq_handle_custom(apr_pool_t *pool,
     req->tmpbb = apr_brigade_create(pool, in->bucket_alloc);
     req->body = apr_table_make(pool, APREQ_DEFAULT_NELTS);
     req->body_status = APR_INCOMPLETE;
+    req->jar_index = apreq_table_index_make(pool);
+    req->args_index = apreq_table_index_make(pool);
+    req->body_index = apreq_table_index_make(pool);
     APR_BRIGADE_CONCAT(req->in, in);
 
     if (cookie != NULL) {
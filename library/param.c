@@ -60,16 +60,35 @@ APREQ_DECLARE(apreq_param_t *) apreq_param_make(apr_pool_t *p,
     return param;
 }
 
-APREQ_DECLARE(apr_status_t) apreq_param_decode(apreq_param_t **param,
-                                               apr_pool_t *pool,
-                                               const char *word,
-                                               apr_size_t nlen,
-                                               apr_size_t vlen)
+/* Folds the charset of a param's name into that of its value. */
+static apreq_charset_t charset_merge(apreq_charset_t charset,
+                                     apreq_charset_t name_charset)
+{
+    switch (name_charset) {
+    case APREQ_CHARSET_UTF8:
+        if (charset == APREQ_CHARSET_ASCII)
+            charset = APREQ_CHARSET_UTF8;
+    case APREQ_CHARSET_ASCII:
+        break;
+
+    case APREQ_CHARSET_LATIN1:
+        if (charset != APREQ_CHARSET_CP1252)
+            charset = APREQ_CHARSET_LATIN1;
+        break;
+    case APREQ_CHARSET_CP1252:
+        charset = APREQ_CHARSET_CP1252;
+    }
+    return charset;
+}
+
+static apr_status_t param_decode(apreq_param_t **param, apr_pool_t *pool,
+                                 const char *word, apr_size_t nlen,
+                                 apr_size_t vlen, int lazy)
 {
     apr_status_t status;
     apreq_value_t *v;
     apreq_param_t *p;
-    apreq_charset_t charset;
+    apreq_charset_t charset, name_charset;
 
     if (nlen == 0) {
         *param = NULL;
@@ -82,13 +101,21 @@ APREQ_DECLARE(apr_status_t) apreq_param_decode(apreq_param_t **param,
     p->flags = 0;
     *(const apreq_value_t **)&v = &p->v;
 
-    if (vlen > 0) {
-        status = apreq_decode(v->data, &v->dlen, word + nlen + 1, vlen);
+    if (vlen > 0 && lazy) {
+        /* leave the value alone until someone asks for it */
+        memcpy(v->data, word + nlen + 1, vlen);
+        v->data[vlen] = 0;
+        v->dlen = vlen;
+        charset = APREQ_CHARSET_ASCII;
+        APREQ_FLAGS_ON(p->flags, APREQ_ENCODED);
+    }
+    else if (vlen > 0) {
+        status = apreq_decode_charset(v->data, &v->dlen, &charset,
+                                      word + nlen + 1, vlen);
         if (status != APR_SUCCESS) {
             *param = NULL;
             return status;
         }
-        charset = apreq_charset_divine(v->data, v->dlen);
     }
     else {
         v->data[0] = 0;
@@ -97,29 +124,55 @@ APREQ_DECLARE(apr_status_t) apreq_param_decode(apreq_param_t **param,
     }
     v->name = v->data + vlen + 1;
 
-    status = apreq_decode(v->name, &v->nlen, word, nlen);
+    status = apreq_decode_charset(v->name, &v->nlen, &name_charset,
+                                  word, nlen);
     if (status != APR_SUCCESS) {
         *param = NULL;
         return status;
     }
 
-    switch (apreq_charset_divine(v->name, v->nlen)) {
-    case APREQ_CHARSET_UTF8:
-        if (charset == APREQ_CHARSET_ASCII)
-            charset = APREQ_CHARSET_UTF8;
-    case APREQ_CHARSET_ASCII:
-        break;
+    apreq_param_charset_set(p, charset_merge(charset, name_charset));
+    *param = p;
 
-    case APREQ_CHARSET_LATIN1:
-        if (charset != APREQ_CHARSET_CP1252)
-            charset = APREQ_CHARSET_LATIN1;
-        break;
-    case APREQ_CHARSET_CP1252:
-        charset = APREQ_CHARSET_CP1252;
-    }
+    return APR_SUCCESS;
+}
 
-    apreq_param_charset_set(p, charset);
-    *param = p;
+APREQ_DECLARE(apr_status_t) apreq_param_decode(apreq_param_t **param,
+                                               apr_pool_t *pool,
+                                               const char *word,
+                                               apr_size_t nlen,
+                                               apr_size_t vlen)
+{
+    return param_decode(param, pool, word, nlen, vlen, 0);
+}
+
+APREQ_DECLARE(apr_status_t) apreq_param_value_decode(apreq_param_t *param)
+{
+    apreq_value_t *v;
+    apreq_charset_t charset;
+    apr_status_t status;
+    apr_size_t dlen;
+
+    if (!apreq_param_is_encoded(param))
+        return APR_SUCCESS;
+
+    *(const apreq_value_t **)&v = &param->v;
+
+    /* decoding in place can't be undone, so a malformed value is
+     * caught first and left as it was */
+    status = apreq_decode_check(v->data, v->dlen);
+    if (status != APR_SUCCESS)
+        return status;
+
+    status = apreq_decode_charset(v->data, &dlen, &charset,
+                                  v->data, v->dlen);
+    if (status != APR_SUCCESS)
+        return status;
+
+    v->dlen = dlen;
+    apreq_param_charset_set(param, charset_merge(charset,
+                                    apreq_param_charset_get(param)));
+    APREQ_FLAGS_OFF(param->flags, APREQ_ENCODED);
 
     return APR_SUCCESS;
 }
@@ -133,19 +186,24 @@ APREQ_DECLARE(char *) apreq_param_encode(apr_pool_t *pool,
     data = apr_palloc(pool, 3 * (param->v.nlen + param->v.dlen) + 2);
     dlen = apreq_encode(data, param->v.name, param->v.nlen);
     data[dlen++] = '=';
+    if (apreq_param_is_encoded(param)) {
+        memcpy(data + dlen, param->v.data, param->v.dlen + 1);
+        return data;
+    }
     dlen += apreq_encode(data + dlen, param->v.data, param->v.dlen);
 
     return data;
 }
 
-APREQ_DECLARE(apr_status_t) apreq_parse_query_string(apr_pool_t *pool,
-                                                     apr_table_t *t,
-                                                     const char *qs)
+static apr_status_t parse_query_string(apr_pool_t *pool, apr_table_t *t,
+                                       const char *qs, int lazy)
 {
     const char *start = qs;
     apr_size_t nlen = 0;
 
     for (;;++qs) {
+        qs += strcspn(qs, nlen == 0 ? "=&;" : "&;");
+
         switch (*qs) {
 
         case '=':
@@ -166,7 +224,7 @@ APREQ_DECLARE(apr_status_t) apreq_parse_query_string(apr_pool_t *pool,
                 else
                     vlen = qs - start - nlen - 1;
 
-                s = apreq_param_decode(&param, pool, start, nlen, vlen);
+                s = param_decode(&param, pool, start, nlen, vlen, lazy);
                 if (s != APR_SUCCESS)
                     return s;
 
@@ -185,14 +243,30 @@ APREQ_DECLARE(apr_status_t) apreq_parse_query_string(apr_pool_t *pool,
     return APR_INCOMPLETE;
 }
 
+APREQ_DECLARE(apr_status_t) apreq_parse_query_string(apr_pool_t *pool,
+                                                     apr_table_t *t,
+                                                     const char *qs)
+{
+    return parse_query_string(pool, t, qs, 0);
+}
+
+APREQ_DECLARE(apr_status_t) apreq_parse_query_string_lazy(apr_pool_t *pool,
+                                                          apr_table_t *t,
+                                                          const char *qs)
+{
+    return parse_query_string(pool, t, qs, 1);
+}
+
 
 
 
 static int param_push(void *data, const char *key, const char *val)
 {
     apr_array_header_t *arr = data;
-    *(apreq_param_t **)apr_array_push(arr) =
-        apreq_value_to_param(val);
+    apreq_param_t *p = apreq_value_to_decoded_param(val);
+
+    if (p != NULL)
+        *(apreq_param_t **)apr_array_push(arr) = p;
     return 1;   /* keep going */
 }
 
@@ -21,6 +21,22 @@
 #include "apr_strings.h"
 #include "apr_xml.h"
 #include "apr_hash.h"
+#include "apr_network_io.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_SSE42
+#elif defined(__GNUC__) && defined(__aarch64__) \
+    && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARM
+#endif
+
+/* Preallocation bounds for a new upload spool file: below the minimum
+ * it isn't worth a system call, and no part reserves more than the
+ * maximum however much the body may still hold. */
+#define SPOOL_RESERVE_MIN  (1024 * 1024)
+#define SPOOL_RESERVE_MAX  (64 * 1024 * 1024)
 
 #define PARSER_STATUS_CHECK(PREFIX)   do {         \
     if (ctx->status == PREFIX##_ERROR)             \
@@ -49,9 +65,69 @@ APREQ_DECLARE(apreq_parser_t *) apreq_parser_make(apr_pool_t *pool,
     p->brigade_limit = brigade_limit;
     p->temp_dir = temp_dir;
     p->ctx = ctx;
+    p->parse_only = NULL;
+    p->spool_writer = NULL;
+    p->size_hint = 0;
+    p->sink = NULL;
+    p->decode_transfer_encoding = 0;
+    p->inflate = NULL;
     return p;
 }
 
+APREQ_DECLARE(int) apreq_parser_wants(const apreq_parser_t *parser,
+                                      const char *name, apr_size_t nlen)
+{
+    const apr_array_header_t *only = parser->parse_only;
+    const char *const *names;
+    int i;
+
+    if (only == NULL)
+        return 1;
+
+    names = (const char *const *)only->elts;
+    for (i = 0; i < only->nelts; ++i) {
+        if (strlen(names[i]) == nlen && strncasecmp(names[i], name, nlen) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+APREQ_DECLARE(apr_status_t) apreq_parser_spool(apreq_parser_t *parser,
+                                               apr_pool_t *pool,
+                                               apr_bucket_brigade *upload,
+                                               apr_bucket_brigade *bb,
+                                               int done)
+{
+    apr_file_t *before = apreq_brigade_spoolfile(upload), *after;
+    apr_status_t s;
+
+    s = apreq_brigade_concat_async(parser->spool_writer, pool,
+                                   parser->temp_dir, parser->brigade_limit,
+                                   upload, bb);
+    if (s != APR_SUCCESS)
+        return s;
+
+    /* Only a hint: failing to preallocate is no reason to stop. */
+    after = apreq_brigade_spoolfile(upload);
+    if (parser->size_hint >= SPOOL_RESERVE_MIN
+        && after != NULL && after != before)
+        apreq_brigade_spool_reserve(upload,
+                                    (parser->size_hint > SPOOL_RESERVE_MAX)
+                                    ? SPOOL_RESERVE_MAX : parser->size_hint);
+
+    if (!done)
+        return APR_SUCCESS;
+
+    /* the upload is complete once its queued writes are */
+    s = apreq_spool_writer_wait(parser->spool_writer);
+
+    /* trimming also writes out what direct mode left staged */
+    if (s == APR_SUCCESS)
+        s = apreq_brigade_spool_trim(upload);
+
+    return s;
+}
+
 APREQ_DECLARE(apreq_hook_t *) apreq_hook_make(apr_pool_t *pool,
                                               apreq_hook_function_t hook,
                                               apreq_hook_t *next,
@@ -65,6 +141,17 @@ APREQ_DECLARE(apreq_hook_t *) apreq_hook_make(apr_pool_t *pool,
     return h;
 }
 
+APREQ_DECLARE(apreq_sink_t *) apreq_sink_make(apr_pool_t *pool,
+                                              apreq_sink_function_t sink,
+                                              void *ctx)
+{
+    apreq_sink_t *k = apr_palloc(pool, sizeof *k);
+    k->sink = sink;
+    k->pool = pool;
+    k->ctx = ctx;
+    return k;
+}
+
 
 /*XXX this may need to check the parser's state before modifying the hook list */
 APREQ_DECLARE(apr_status_t) apreq_parser_add_hook(apreq_parser_t *p,
@@ -118,6 +205,8 @@ APREQ_DECLARE(apr_status_t) apreq_pre_initialize(apr_pool_t *pool)
                           apreq_parse_urlencoded);
     apreq_register_parser("multipart/form-data", apreq_parse_multipart);
     apreq_register_parser("multipart/related", apreq_parse_multipart);
+    apreq_register_parser("application/json", apreq_parse_json);
+    apreq_register_parser("application/x-ndjson", apreq_parse_ndjson);
 
     return APR_SUCCESS;
 }
@@ -203,6 +292,81 @@ APREQ_DECLARE_HOOK(apreq_hook_discard_brigade)
 }
 
 
+/* sinks */
+
+typedef apr_status_t (*sink_write_t)(void *baton, apreq_param_t *param,
+                                     const char *data, apr_size_t *len);
+
+/*
+ * Feeds the buckets of bb to write, deleting each part it takes.
+ * EOS buckets are passed on as data == NULL, *len == 0.
+ */
+static apr_status_t sink_drain(apr_bucket_brigade *bb, apreq_param_t *param,
+                               sink_write_t write, void *baton)
+{
+    while (!APR_BRIGADE_EMPTY(bb)) {
+        apr_bucket *e = APR_BRIGADE_FIRST(bb);
+        const char *data = NULL;
+        apr_size_t len = 0, n;
+        apr_status_t s;
+
+        if (!APR_BUCKET_IS_EOS(e)) {
+            s = apr_bucket_read(e, &data, &len, APR_BLOCK_READ);
+            if (s != APR_SUCCESS)
+                return s;
+            if (len == 0) {
+                apr_bucket_delete(e);
+                continue;
+            }
+        }
+
+        n = len;
+        s = write(baton, param, data, &n);
+        if (APR_STATUS_IS_EAGAIN(s))
+            s = APR_EAGAIN;
+        else if (s == APR_SUCCESS && n < len)
+            s = APR_EAGAIN;     /* a short write: the rest must wait */
+
+        if (n > 0 && n < len)
+            apr_bucket_split(e, n);
+        if (n > 0 || s == APR_SUCCESS)
+            apr_bucket_delete(e);
+
+        if (s != APR_SUCCESS)
+            return s;
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t sink_file_write(void *baton, apreq_param_t *param,
+                                    const char *data, apr_size_t *len)
+{
+    return (data == NULL) ? APR_SUCCESS : apr_file_write(baton, data, len);
+}
+
+static apr_status_t sink_socket_write(void *baton, apreq_param_t *param,
+                                      const char *data, apr_size_t *len)
+{
+    return (data == NULL) ? APR_SUCCESS : apr_socket_send(baton, data, len);
+}
+
+APREQ_DECLARE_SINK(apreq_sink_file)
+{
+    return sink_drain(bb, param, sink_file_write, sink->ctx);
+}
+
+APREQ_DECLARE_SINK(apreq_sink_socket)
+{
+    return sink_drain(bb, param, sink_socket_write, sink->ctx);
+}
+
+APREQ_DECLARE_SINK(apreq_sink_callback)
+{
+    apreq_sink_callback_ctx_t *ctx = sink->ctx;
+    return sink_drain(bb, param, ctx->callback, ctx->baton);
+}
+
+
 /* generic parser */
 
 struct gen_ctx {
@@ -251,8 +415,7 @@ APREQ_DECLARE_PARSER(apreq_parse_generic)
     }
 
     apreq_brigade_setaside(bb, pool);
-    s = apreq_brigade_concat(pool, parser->temp_dir, parser->brigade_limit,
-                             ctx->param->upload, bb);
+    s = apreq_parser_spool(parser, pool, ctx->param->upload, bb, saw_eos);
 
     if (s != APR_SUCCESS) {
         ctx->status = GEN_ERROR;
@@ -340,6 +503,1039 @@ APREQ_DECLARE_HOOK(apreq_hook_apr_xml_parser)
 }
 
 
+/* streaming xml */
+
+#define XML_TAG_MAX     8192    /* longest tag, attributes included */
+#define XML_DEPTH_MAX   256     /* deepest element nesting */
+#define XML_ATTRS_MAX   32      /* most attributes on one element */
+
+#define XML_IS_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' \
+                         || (c) == '\r')
+
+struct xml_sax_state {
+    apreq_param_t               *param;     /* upload being parsed */
+    enum {
+        XS_TEXT,
+        XS_ENTITY,
+        XS_LT,
+        XS_TAG,
+        XS_ENDTAG,
+        XS_BANG,
+        XS_COMMENT,
+        XS_CDATA,
+        XS_PI,
+        XS_DECL,
+        XS_ERROR
+    }                            status;
+    int                          seen_root;
+    char                         quote;     /* open quote in a tag */
+    int                          nmatch;    /* progress through "-->" etc */
+    int                          depth;
+    apr_size_t                   tlen;
+    apr_size_t                   nlen;
+    apr_size_t                   starts[XML_DEPTH_MAX];
+    const char                  *attrs[2 * XML_ATTRS_MAX + 1];
+    char                         tag[XML_TAG_MAX + 1];
+    char                         names[XML_TAG_MAX];
+};
+
+/*
+ * Decodes the entity reference e (without its '&' and ';') into out
+ * as utf8, returning its length, or 0 if the entity is unknown.
+ */
+static apr_size_t xml_entity(const char *e, apr_size_t len, char *out)
+{
+    apr_uint32_t u = 0;
+    apr_size_t i;
+
+    if (len == 2 && memcmp(e, "lt", 2) == 0)
+        return (*out = '<'), 1;
+    if (len == 2 && memcmp(e, "gt", 2) == 0)
+        return (*out = '>'), 1;
+    if (len == 3 && memcmp(e, "amp", 3) == 0)
+        return (*out = '&'), 1;
+    if (len == 4 && memcmp(e, "quot", 4) == 0)
+        return (*out = '"'), 1;
+    if (len == 4 && memcmp(e, "apos", 4) == 0)
+        return (*out = '\''), 1;
+
+    if (len < 2 || len > 10 || e[0] != '#')
+        return 0;
+
+    if (e[1] == 'x') {
+        if (len == 2)
+            return 0;
+        for (i = 2; i < len; ++i) {
+            char c = e[i];
+            if (c >= '0' && c <= '9')
+                u = u << 4 | (c - '0');
+            else if (c >= 'a' && c <= 'f')
+                u = u << 4 | (c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F')
+                u = u << 4 | (c - 'A' + 10);
+            else
+                return 0;
+        }
+    }
+    else {
+        for (i = 1; i < len; ++i) {
+            if (e[i] < '0' || e[i] > '9')
+                return 0;
+            u = u * 10 + (e[i] - '0');
+        }
+    }
+
+    if (u == 0 || u > 0x10ffff || (u >= 0xd800 && u <= 0xdfff))
+        return 0;
+
+    if (u < 0x80) {
+        out[0] = (char)u;
+        return 1;
+    }
+    if (u < 0x800) {
+        out[0] = (char)(0xc0 | u >> 6);
+        out[1] = (char)(0x80 | (u & 0x3f));
+        return 2;
+    }
+    if (u < 0x10000) {
+        out[0] = (char)(0xe0 | u >> 12);
+        out[1] = (char)(0x80 | (u >> 6 & 0x3f));
+        out[2] = (char)(0x80 | (u & 0x3f));
+        return 3;
+    }
+    out[0] = (char)(0xf0 | u >> 18);
+    out[1] = (char)(0x80 | (u >> 12 & 0x3f));
+    out[2] = (char)(0x80 | (u >> 6 & 0x3f));
+    out[3] = (char)(0x80 | (u & 0x3f));
+    return 4;
+}
+
+/* Decodes the entity references in v in place. */
+static apr_status_t xml_unescape(char *v, apr_size_t *vlen)
+{
+    const char *src = v, *end = v + *vlen;
+    char *dst = v;
+
+    while (src < end) {
+        const char *semi;
+        apr_size_t n;
+
+        if (*src != '&') {
+            *dst++ = *src++;
+            continue;
+        }
+        for (semi = ++src; semi < end && *semi != ';'; ++semi)
+            ;
+        if (semi == end)
+            return APREQ_ERROR_BADSEQ;
+        /* utf8 is never longer than the reference it replaces */
+        n = xml_entity(src, semi - src, dst);
+        if (n == 0)
+            return APREQ_ERROR_BADSEQ;
+        dst += n;
+        src = semi + 1;
+    }
+    *vlen = dst - v;
+    return APR_SUCCESS;
+}
+
+static apr_status_t xml_text(apreq_hook_xml_sax_ctx_t *ctx,
+                             struct xml_sax_state *st,
+                             const char *data, apr_size_t len)
+{
+    if (st->depth == 0) {
+        /* only whitespace may lie outside the root element */
+        while (len > 0) {
+            --len;
+            if (!XML_IS_SPACE(data[len]))
+                return APREQ_ERROR_BADCHAR;
+        }
+        return APR_SUCCESS;
+    }
+    if (ctx->text == NULL || len == 0)
+        return APR_SUCCESS;
+    return ctx->text(ctx->baton, data, len);
+}
+
+/* Reports the start tag in st->tag. */
+static apr_status_t xml_start_tag(apreq_hook_xml_sax_ctx_t *ctx,
+                                  struct xml_sax_state *st)
+{
+    char *p = st->tag, *end = p + st->tlen, *name = p, *name_end;
+    int empty = 0, n = 0;
+    apr_size_t len;
+    apr_status_t s;
+
+    if (end > p && end[-1] == '/') {
+        empty = 1;
+        --end;
+    }
+    while (p < end && !XML_IS_SPACE(*p))
+        ++p;
+    name_end = p;
+    if (name_end == name)
+        return APREQ_ERROR_BADCHAR;
+
+    for (;;) {
+        char *aname, *aname_end, *val, q;
+
+        while (p < end && XML_IS_SPACE(*p))
+            ++p;
+        if (p == end)
+            break;
+
+        aname = p;
+        while (p < end && !XML_IS_SPACE(*p) && *p != '=')
+            ++p;
+        aname_end = p;
+        while (p < end && XML_IS_SPACE(*p))
+            ++p;
+        if (aname_end == aname || p == end || *p++ != '=')
+            return APREQ_ERROR_BADATTR;
+        while (p < end && XML_IS_SPACE(*p))
+            ++p;
+        if (p == end || (*p != '"' && *p != '\''))
+            return APREQ_ERROR_BADATTR;
+        q = *p++;
+        val = p;
+        while (p < end && *p != q)
+            ++p;
+        if (p == end)
+            return APREQ_ERROR_BADATTR;
+        len = p++ - val;
+        if (p < end && !XML_IS_SPACE(*p))
+            return APREQ_ERROR_BADATTR;
+
+        if (n == XML_ATTRS_MAX)
+            return APREQ_ERROR_OVERLIMIT;
+        s = xml_unescape(val, &len);
+        if (s != APR_SUCCESS)
+            return s;
+        *aname_end = 0;
+        val[len] = 0;
+        st->attrs[2 * n] = aname;
+        st->attrs[2 * n + 1] = val;
+        ++n;
+    }
+    st->attrs[2 * n] = NULL;
+    *name_end = 0;
+
+    /* a document has a single root */
+    if (st->seen_root && st->depth == 0)
+        return APREQ_ERROR_BADDATA;
+    st->seen_root = 1;
+
+    len = name_end - name + 1;
+    if (st->depth == XML_DEPTH_MAX || st->nlen + len > sizeof st->names)
+        return APREQ_ERROR_OVERLIMIT;
+    st->starts[st->depth++] = st->nlen;
+    memcpy(st->names + st->nlen, name, len);
+    st->nlen += len;
+
+    if (ctx->start != NULL) {
+        s = ctx->start(ctx->baton, name, st->attrs);
+        if (s != APR_SUCCESS)
+            return s;
+    }
+    if (!empty)
+        return APR_SUCCESS;
+
+    --st->depth;
+    st->nlen = st->starts[st->depth];
+    return (ctx->end == NULL) ? APR_SUCCESS : ctx->end(ctx->baton, name);
+}
+
+/* Reports the end tag in st->tag, which must close the open element. */
+static apr_status_t xml_end_tag(apreq_hook_xml_sax_ctx_t *ctx,
+                                struct xml_sax_state *st)
+{
+    const char *name;
+
+    while (st->tlen > 0 && XML_IS_SPACE(st->tag[st->tlen - 1]))
+        --st->tlen;
+    st->tag[st->tlen] = 0;
+
+    if (st->depth == 0)
+        return APREQ_ERROR_BADDATA;
+    name = st->names + st->starts[st->depth - 1];
+    if (strcmp(name, st->tag) != 0)
+        return APREQ_ERROR_BADDATA;
+
+    --st->depth;
+    st->nlen = st->starts[st->depth];
+    return (ctx->end == NULL) ? APR_SUCCESS : ctx->end(ctx->baton, name);
+}
+
+static apr_status_t xml_sax_feed(apreq_hook_xml_sax_ctx_t *ctx,
+                                 struct xml_sax_state *st,
+                                 const char *data, apr_size_t dlen)
+{
+    const char *const end = data + dlen;
+    apr_status_t s = APR_SUCCESS;
+
+    while (data < end) {
+        const char *run;
+        char c = *data;
+
+        switch (st->status) {
+
+        case XS_TEXT:
+            if (c == '<' || c == '&') {
+                st->status = (c == '<') ? XS_LT : XS_ENTITY;
+                st->tlen = 0;
+                ++data;
+                break;
+            }
+            for (run = data; data < end && *data != '<' && *data != '&';
+                 ++data)
+                ;
+            s = xml_text(ctx, st, run, data - run);
+            break;
+
+        case XS_ENTITY:
+            ++data;
+            if (c != ';') {
+                if (st->tlen == 10)
+                    return APREQ_ERROR_BADSEQ;
+                st->tag[st->tlen++] = c;
+                break;
+            }
+            {
+                char utf8[4];
+                apr_size_t n = xml_entity(st->tag, st->tlen, utf8);
+                if (n == 0)
+                    return APREQ_ERROR_BADSEQ;
+                s = xml_text(ctx, st, utf8, n);
+                st->status = XS_TEXT;
+            }
+            break;
+
+        case XS_LT:
+            if (c == '/' || c == '!' || c == '?') {
+                st->status = (c == '/') ? XS_ENDTAG
+                           : (c == '!') ? XS_BANG : XS_PI;
+                st->nmatch = 0;
+                ++data;
+            }
+            else if (XML_IS_SPACE(c) || c == '>' || c == '<') {
+                return APREQ_ERROR_BADCHAR;
+            }
+            else {
+                st->quote = 0;
+                st->status = XS_TAG;
+            }
+            break;
+
+        case XS_TAG:
+        case XS_ENDTAG:
+            ++data;
+            if (st->quote) {
+                if (c == st->quote)
+                    st->quote = 0;
+            }
+            else if (c == '"' || c == '\'') {
+                st->quote = c;
+            }
+            else if (c == '>') {
+                s = (st->status == XS_TAG) ? xml_start_tag(ctx, st)
+                                           : xml_end_tag(ctx, st);
+                st->status = XS_TEXT;
+                break;
+            }
+            if (st->tlen == XML_TAG_MAX)
+                return APREQ_ERROR_OVERLIMIT;
+            st->tag[st->tlen++] = c;
+            break;
+
+        case XS_BANG:
+            /* <!-- comment -->, <![CDATA[ ... ]]> or <!DOCTYPE ... > */
+            ++data;
+            st->tag[st->tlen++] = c;
+            if (st->tag[0] == '-') {
+                if (st->tlen == 2)
+                    st->status = XS_COMMENT;
+                if (c != '-')
+                    return APREQ_ERROR_BADCHAR;
+            }
+            else if (st->tag[0] == '[') {
+                if (c != "[CDATA["[st->tlen - 1])
+                    return APREQ_ERROR_BADCHAR;
+                if (st->tlen == 7)
+                    st->status = XS_CDATA;
+            }
+            else if ((c >= 'A' && c <= 'Z') && st->depth == 0) {
+                st->status = XS_DECL;
+            }
+            else {
+                return APREQ_ERROR_BADCHAR;
+            }
+            break;
+
+        case XS_COMMENT:
+            ++data;
+            if (c == '-')
+                ++st->nmatch;
+            else if (c == '>' && st->nmatch >= 2)
+                st->status = XS_TEXT;
+            else
+                st->nmatch = 0;
+            break;
+
+        case XS_PI:
+            ++data;
+            if (c == '>' && st->nmatch)
+                st->status = XS_TEXT;
+            else
+                st->nmatch = (c == '?');
+            break;
+
+        case XS_DECL:
+            /* nmatch counts the brackets of an internal subset */
+            ++data;
+            if (c == '[')
+                ++st->nmatch;
+            else if (c == ']')
+                --st->nmatch;
+            else if (c == '>' && st->nmatch == 0)
+                st->status = XS_TEXT;
+            break;
+
+        case XS_CDATA:
+            /* nmatch counts the ']' held back in case "]]>" follows */
+            if (c == ']') {
+                ++data;
+                if (st->nmatch == 2)
+                    s = xml_text(ctx, st, "]", 1);
+                else
+                    ++st->nmatch;
+                break;
+            }
+            if (c == '>' && st->nmatch == 2) {
+                ++data;
+                st->nmatch = 0;
+                st->status = XS_TEXT;
+                break;
+            }
+            if (st->nmatch > 0) {
+                s = xml_text(ctx, st, "]]", st->nmatch);
+                st->nmatch = 0;
+                if (s != APR_SUCCESS)
+                    return s;
+            }
+            for (run = data++; data < end && *data != ']'; ++data)
+                ;
+            s = xml_text(ctx, st, run, data - run);
+            break;
+
+        default:
+            return APREQ_ERROR_GENERAL;
+        }
+
+        if (s != APR_SUCCESS)
+            return s;
+    }
+    return APR_SUCCESS;
+}
+
+APREQ_DECLARE_HOOK(apreq_hook_xml_sax)
+{
+    apreq_hook_xml_sax_ctx_t *ctx = hook->ctx;
+    struct xml_sax_state *st = ctx->state;
+    apr_status_t s = APR_SUCCESS;
+    apr_bucket *e;
+
+    if (bb == NULL)
+        goto xml_sax_next;
+
+    if (st == NULL) {
+        ctx->state = st = apr_palloc(hook->pool, sizeof *st);
+        st->param = NULL;
+    }
+    if (st->param != param) {
+        st->param = param;
+        st->status = XS_TEXT;
+        st->seen_root = 0;
+        st->depth = 0;
+        st->nlen = 0;
+    }
+    if (st->status == XS_ERROR)
+        return APREQ_ERROR_GENERAL;
+
+    for (e = APR_BRIGADE_FIRST(bb); e != APR_BRIGADE_SENTINEL(bb);
+         e = APR_BUCKET_NEXT(e))
+    {
+        const char *data;
+        apr_size_t dlen;
+
+        if (APR_BUCKET_IS_EOS(e)) {
+            /* the document must be whole */
+            st->param = NULL;
+            if (st->status != XS_TEXT || st->depth > 0 || !st->seen_root)
+                s = APREQ_ERROR_BADDATA;
+            break;
+        }
+        else if (APR_BUCKET_IS_METADATA(e)) {
+            continue;
+        }
+
+        s = apr_bucket_read(e, &data, &dlen, APR_BLOCK_READ);
+        if (s == APR_SUCCESS)
+            s = xml_sax_feed(ctx, st, data, dlen);
+        if (s != APR_SUCCESS)
+            break;
+    }
+
+    if (s != APR_SUCCESS) {
+        st->status = XS_ERROR;
+        return s;
+    }
+
+ xml_sax_next:
+    if (hook->next)
+        return apreq_hook_run(hook->next, param, bb);
+
+    return APR_SUCCESS;
+}
+
+
+/* upload digests */
+
+/*
+ * The digest hooks keep a running digest of each upload as its data
+ * passes, and record it in the param's info table once the upload ends.
+ * Their ctx is private state, and must be NULL when the hook is made.
+ */
+
+struct sha256_state {
+    apr_uint32_t                 h[8];
+    apr_uint64_t                 len;
+    unsigned char                buf[64];
+};
+
+static const apr_uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_init(struct sha256_state *st)
+{
+    st->h[0] = 0x6a09e667; st->h[1] = 0xbb67ae85;
+    st->h[2] = 0x3c6ef372; st->h[3] = 0xa54ff53a;
+    st->h[4] = 0x510e527f; st->h[5] = 0x9b05688c;
+    st->h[6] = 0x1f83d9ab; st->h[7] = 0x5be0cd19;
+    st->len = 0;
+}
+
+static void sha256_block(apr_uint32_t *h, const unsigned char *p)
+{
+    apr_uint32_t w[64], a, b, c, d, e, f, g, k, t1, t2;
+    int i;
+
+    for (i = 0; i < 16; ++i, p += 4)
+        w[i] = (apr_uint32_t)p[0] << 24 | (apr_uint32_t)p[1] << 16
+             | (apr_uint32_t)p[2] << 8 | p[3];
+    for (; i < 64; ++i)
+        w[i] = w[i - 16] + w[i - 7]
+            + (ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18)
+               ^ (w[i - 15] >> 3))
+            + (ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19)
+               ^ (w[i - 2] >> 10));
+
+    a = h[0]; b = h[1]; c = h[2]; d = h[3];
+    e = h[4]; f = h[5]; g = h[6]; k = h[7];
+
+    for (i = 0; i < 64; ++i) {
+        t1 = k + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25))
+            + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22))
+            + ((a & b) ^ (a & c) ^ (b & c));
+        k = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+static void sha256_update(struct sha256_state *st, const unsigned char *p,
+                          apr_size_t len)
+{
+    apr_size_t used = (apr_size_t)(st->len % 64);
+
+    st->len += len;
+    if (used > 0) {
+        apr_size_t n = 64 - used;
+        if (len < n) {
+            memcpy(st->buf + used, p, len);
+            return;
+        }
+        memcpy(st->buf + used, p, n);
+        sha256_block(st->h, st->buf);
+        p += n;
+        len -= n;
+    }
+    for (; len >= 64; p += 64, len -= 64)
+        sha256_block(st->h, p);
+    memcpy(st->buf, p, len);
+}
+
+static void sha256_final(struct sha256_state *st, unsigned char *md)
+{
+    apr_uint64_t bits = st->len * 8;
+    apr_size_t used = (apr_size_t)(st->len % 64);
+    int i;
+
+    st->buf[used++] = 0x80;
+    if (used > 56) {
+        memset(st->buf + used, 0, 64 - used);
+        sha256_block(st->h, st->buf);
+        used = 0;
+    }
+    memset(st->buf + used, 0, 56 - used);
+    for (i = 0; i < 8; ++i)
+        st->buf[56 + i] = (unsigned char)(bits >> (56 - 8 * i));
+    sha256_block(st->h, st->buf);
+
+    for (i = 0; i < 32; ++i)
+        md[i] = (unsigned char)(st->h[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+
+/* CRC32C (Castagnoli), reflected polynomial 0x82f63b78 */
+
+static const apr_uint32_t crc32c_table[256] = {
+    0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4,
+    0xc79a971f, 0x35f1141c, 0x26a1e7e8, 0xd4ca64eb,
+    0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b,
+    0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24,
+    0x105ec76f, 0xe235446c, 0xf165b798, 0x030e349b,
+    0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+    0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54,
+    0x5d1d08bf, 0xaf768bbc, 0xbc267848, 0x4e4dfb4b,
+    0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a,
+    0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35,
+    0xaa64d611, 0x580f5512, 0x4b5fa6e6, 0xb93425e5,
+    0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+    0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45,
+    0xf779deae, 0x05125dad, 0x1642ae59, 0xe4292d5a,
+    0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a,
+    0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595,
+    0x417b1dbc, 0xb3109ebf, 0xa0406d4b, 0x522bee48,
+    0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+    0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687,
+    0x0c38d26c, 0xfe53516f, 0xed03a29b, 0x1f682198,
+    0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927,
+    0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38,
+    0xdbfc821c, 0x2997011f, 0x3ac7f2eb, 0xc8ac71e8,
+    0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+    0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096,
+    0xa65c047d, 0x5437877e, 0x4767748a, 0xb50cf789,
+    0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859,
+    0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46,
+    0x7198540d, 0x83f3d70e, 0x90a324fa, 0x62c8a7f9,
+    0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+    0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36,
+    0x3cdb9bdd, 0xceb018de, 0xdde0eb2a, 0x2f8b6829,
+    0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c,
+    0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93,
+    0x082f63b7, 0xfa44e0b4, 0xe9141340, 0x1b7f9043,
+    0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+    0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3,
+    0x55326b08, 0xa759e80b, 0xb4091bff, 0x466298fc,
+    0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c,
+    0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033,
+    0xa24bb5a6, 0x502036a5, 0x4370c551, 0xb11b4652,
+    0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+    0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d,
+    0xef087a76, 0x1d63f975, 0x0e330a81, 0xfc588982,
+    0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d,
+    0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622,
+    0x38cc2a06, 0xcaa7a905, 0xd9f75af1, 0x2b9cd9f2,
+    0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+    0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530,
+    0x0417b1db, 0xf67c32d8, 0xe52cc12c, 0x1747422f,
+    0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff,
+    0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0,
+    0xd3d3e1ab, 0x21b862a8, 0x32e8915c, 0xc083125f,
+    0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+    0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90,
+    0x9e902e7b, 0x6cfbad78, 0x7fab5e8c, 0x8dc0dd8f,
+    0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee,
+    0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1,
+    0x69e9f0d5, 0x9b8273d6, 0x88d28022, 0x7ab90321,
+    0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+    0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81,
+    0x34f4f86a, 0xc69f7b69, 0xd5cf889d, 0x27a40b9e,
+    0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e,
+    0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351
+};
+
+static apr_uint32_t crc32c_sw(apr_uint32_t crc, const unsigned char *p,
+                              apr_size_t len)
+{
+    while (len--)
+        crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(CRC32C_SSE42)
+#define CRC32C_HW
+
+__attribute__((target("sse4.2")))
+static apr_uint32_t crc32c_hw(apr_uint32_t crc, const unsigned char *p,
+                              apr_size_t len)
+{
+    apr_uint64_t c = crc;
+
+    for (; len >= 8; p += 8, len -= 8) {
+        apr_uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    crc = (apr_uint32_t)c;
+    while (len--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+
+#define crc32c_hw_usable() __builtin_cpu_supports("sse4.2")
+
+#elif defined(CRC32C_ARM)
+#define CRC32C_HW
+
+static apr_uint32_t crc32c_hw(apr_uint32_t crc, const unsigned char *p,
+                              apr_size_t len)
+{
+    for (; len >= 8; p += 8, len -= 8) {
+        apr_uint64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+    }
+    while (len--)
+        crc = __crc32cb(crc, *p++);
+    return crc;
+}
+
+#define crc32c_hw_usable() 1
+
+#endif
+
+static apr_uint32_t crc32c_update(apr_uint32_t crc, const unsigned char *p,
+                                  apr_size_t len)
+{
+#ifdef CRC32C_HW
+    if (crc32c_hw_usable())
+        return crc32c_hw(crc, p, len);
+#endif
+    return crc32c_sw(crc, p, len);
+}
+
+
+/* XXH64, seed 0: four lanes over 32-byte stripes, then the tail */
+
+#define XXH_P1  APR_UINT64_C(0x9e3779b185ebca87)
+#define XXH_P2  APR_UINT64_C(0xc2b2ae3d27d4eb4f)
+#define XXH_P3  APR_UINT64_C(0x165667b19e3779f9)
+#define XXH_P4  APR_UINT64_C(0x85ebca77c2b2ae63)
+#define XXH_P5  APR_UINT64_C(0x27d4eb2f165667c5)
+#define XXH_ROTL(x, b)  (((x) << (b)) | ((x) >> (64 - (b))))
+
+struct xxh64_state {
+    apr_uint64_t                 v[4];
+    apr_uint64_t                 len;
+    unsigned char                buf[32];
+    apr_size_t                   nbuf;
+};
+
+static APR_INLINE apr_uint64_t xxh_read64(const unsigned char *p)
+{
+    return (apr_uint64_t)p[0] | (apr_uint64_t)p[1] << 8
+        | (apr_uint64_t)p[2] << 16 | (apr_uint64_t)p[3] << 24
+        | (apr_uint64_t)p[4] << 32 | (apr_uint64_t)p[5] << 40
+        | (apr_uint64_t)p[6] << 48 | (apr_uint64_t)p[7] << 56;
+}
+
+static APR_INLINE apr_uint64_t xxh_round(apr_uint64_t acc, apr_uint64_t in)
+{
+    acc += in * XXH_P2;
+    return XXH_ROTL(acc, 31) * XXH_P1;
+}
+
+static void xxh64_stripes(struct xxh64_state *st, const unsigned char *p,
+                          apr_size_t n)
+{
+    apr_uint64_t v0 = st->v[0], v1 = st->v[1], v2 = st->v[2], v3 = st->v[3];
+
+    for (; n >= 32; p += 32, n -= 32) {
+        v0 = xxh_round(v0, xxh_read64(p));
+        v1 = xxh_round(v1, xxh_read64(p + 8));
+        v2 = xxh_round(v2, xxh_read64(p + 16));
+        v3 = xxh_round(v3, xxh_read64(p + 24));
+    }
+    st->v[0] = v0; st->v[1] = v1; st->v[2] = v2; st->v[3] = v3;
+}
+
+static void xxh64_init(struct xxh64_state *st)
+{
+    st->v[0] = XXH_P1 + XXH_P2;
+    st->v[1] = XXH_P2;
+    st->v[2] = 0;
+    st->v[3] = 0 - XXH_P1;
+    st->len = 0;
+    st->nbuf = 0;
+}
+
+static void xxh64_update(struct xxh64_state *st, const unsigned char *p,
+                         apr_size_t len)
+{
+    st->len += len;
+
+    if (st->nbuf > 0) {
+        apr_size_t n = 32 - st->nbuf;
+
+        if (n > len)
+            n = len;
+        memcpy(st->buf + st->nbuf, p, n);
+        st->nbuf += n;
+        p += n;
+        len -= n;
+        if (st->nbuf < 32)
+            return;
+        xxh64_stripes(st, st->buf, 32);
+        st->nbuf = 0;
+    }
+
+    xxh64_stripes(st, p, len & ~(apr_size_t)31);
+    p += len & ~(apr_size_t)31;
+    len &= 31;
+    memcpy(st->buf, p, len);
+    st->nbuf = len;
+}
+
+static apr_uint64_t xxh64_final(const struct xxh64_state *st)
+{
+    const unsigned char *p = st->buf, *end = st->buf + st->nbuf;
+    apr_uint64_t h;
+    int i;
+
+    if (st->len >= 32) {
+        h = XXH_ROTL(st->v[0], 1) + XXH_ROTL(st->v[1], 7)
+            + XXH_ROTL(st->v[2], 12) + XXH_ROTL(st->v[3], 18);
+        for (i = 0; i < 4; ++i) {
+            h ^= xxh_round(0, st->v[i]);
+            h = h * XXH_P1 + XXH_P4;
+        }
+    }
+    else {
+        h = XXH_P5;
+    }
+    h += st->len;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxh_round(0, xxh_read64(p));
+        h = XXH_ROTL(h, 27) * XXH_P1 + XXH_P4;
+    }
+    if (p + 4 <= end) {
+        h ^= (apr_uint64_t)((apr_uint32_t)p[0] | (apr_uint32_t)p[1] << 8
+                            | (apr_uint32_t)p[2] << 16
+                            | (apr_uint32_t)p[3] << 24) * XXH_P1;
+        h = XXH_ROTL(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= *p * XXH_P5;
+        h = XXH_ROTL(h, 11) * XXH_P1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+
+struct digest_ctx {
+    apreq_param_t               *param;     /* upload being digested */
+    union {
+        struct sha256_state      sha256;
+        apr_uint32_t             crc32c;
+        struct xxh64_state       xxh64;
+    }                            u;
+};
+
+typedef void (*digest_init_t)(struct digest_ctx *ctx);
+typedef void (*digest_update_t)(struct digest_ctx *ctx,
+                                const unsigned char *data, apr_size_t len);
+typedef const char *(*digest_final_t)(struct digest_ctx *ctx,
+                                      apr_pool_t *pool);
+
+/*
+ * Feeds the data buckets of bb to the digest of param, starting a new
+ * one if param is not the upload last seen.  At EOS the digest is
+ * stored in param->info under key.
+ */
+static apr_status_t digest_brigade(apreq_hook_t *hook, apreq_param_t *param,
+                                   apr_bucket_brigade *bb, const char *key,
+                                   digest_init_t init,
+                                   digest_update_t update,
+                                   digest_final_t final)
+{
+    struct digest_ctx *ctx = hook->ctx;
+    apr_bucket *e;
+
+    if (ctx == NULL) {
+        hook->ctx = ctx = apr_palloc(hook->pool, sizeof *ctx);
+        ctx->param = NULL;
+    }
+    if (ctx->param != param) {
+        ctx->param = param;
+        init(ctx);
+    }
+
+    for (e = APR_BRIGADE_FIRST(bb); e != APR_BRIGADE_SENTINEL(bb);
+         e = APR_BUCKET_NEXT(e))
+    {
+        const char *data;
+        apr_size_t dlen;
+        apr_status_t s;
+
+        if (APR_BUCKET_IS_EOS(e)) {
+            if (param->info == NULL)
+                param->info = apr_table_make(hook->pool, APREQ_DEFAULT_NELTS);
+            apr_table_setn(param->info, key, final(ctx, hook->pool));
+            ctx->param = NULL;
+            break;
+        }
+        else if (APR_BUCKET_IS_METADATA(e)) {
+            continue;
+        }
+
+        s = apr_bucket_read(e, &data, &dlen, APR_BLOCK_READ);
+        if (s != APR_SUCCESS)
+            return s;
+        update(ctx, (const unsigned char *)data, dlen);
+    }
+    return APR_SUCCESS;
+}
+
+static void sha256_ctx_init(struct digest_ctx *ctx)
+{
+    sha256_init(&ctx->u.sha256);
+}
+
+static void sha256_ctx_update(struct digest_ctx *ctx,
+                              const unsigned char *data, apr_size_t len)
+{
+    sha256_update(&ctx->u.sha256, data, len);
+}
+
+static const char *sha256_ctx_final(struct digest_ctx *ctx, apr_pool_t *pool)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned char md[32];
+    char *rv = apr_palloc(pool, 2 * sizeof md + 1);
+    int i;
+
+    sha256_final(&ctx->u.sha256, md);
+    for (i = 0; i < (int)sizeof md; ++i) {
+        rv[2 * i] = hex[md[i] >> 4];
+        rv[2 * i + 1] = hex[md[i] & 0xf];
+    }
+    rv[2 * sizeof md] = 0;
+    return rv;
+}
+
+static void crc32c_ctx_init(struct digest_ctx *ctx)
+{
+    ctx->u.crc32c = 0xffffffff;
+}
+
+static void crc32c_ctx_update(struct digest_ctx *ctx,
+                              const unsigned char *data, apr_size_t len)
+{
+    ctx->u.crc32c = crc32c_update(ctx->u.crc32c, data, len);
+}
+
+static const char *crc32c_ctx_final(struct digest_ctx *ctx, apr_pool_t *pool)
+{
+    return apr_psprintf(pool, "%08x", ctx->u.crc32c ^ 0xffffffff);
+}
+
+static void xxh64_ctx_init(struct digest_ctx *ctx)
+{
+    xxh64_init(&ctx->u.xxh64);
+}
+
+static void xxh64_ctx_update(struct digest_ctx *ctx,
+                             const unsigned char *data, apr_size_t len)
+{
+    xxh64_update(&ctx->u.xxh64, data, len);
+}
+
+static const char *xxh64_ctx_final(struct digest_ctx *ctx, apr_pool_t *pool)
+{
+    return apr_psprintf(pool, "%016" APR_UINT64_T_HEX_FMT,
+                        xxh64_final(&ctx->u.xxh64));
+}
+
+APREQ_DECLARE_HOOK(apreq_hook_digest_sha256)
+{
+    apr_status_t s = APR_SUCCESS;
+
+    if (bb != NULL)
+        s = digest_brigade(hook, param, bb, APREQ_DIGEST_SHA256,
+                           sha256_ctx_init, sha256_ctx_update,
+                           sha256_ctx_final);
+    if (s == APR_SUCCESS && hook->next)
+        s = apreq_hook_run(hook->next, param, bb);
+    return s;
+}
+
+APREQ_DECLARE_HOOK(apreq_hook_digest_crc32c)
+{
+    apr_status_t s = APR_SUCCESS;
+
+    if (bb != NULL)
+        s = digest_brigade(hook, param, bb, APREQ_DIGEST_CRC32C,
+                           crc32c_ctx_init, crc32c_ctx_update,
+                           crc32c_ctx_final);
+    if (s == APR_SUCCESS && hook->next)
+        s = apreq_hook_run(hook->next, param, bb);
+    return s;
+}
+
+APREQ_DECLARE_HOOK(apreq_hook_digest_xxh64)
+{
+    apr_status_t s = APR_SUCCESS;
+
+    if (bb != NULL)
+        s = digest_brigade(hook, param, bb, APREQ_DIGEST_XXH64,
+                           xxh64_ctx_init, xxh64_ctx_update,
+                           xxh64_ctx_final);
+    if (s == APR_SUCCESS && hook->next)
+        s = apreq_hook_run(hook->next, param, bb);
+    return s;
+}
+
+
 APREQ_DECLARE_HOOK(apreq_hook_find_param)
 {
     apreq_hook_find_param_ctx_t *ctx = hook->ctx;
@@ -354,3 +1550,23 @@ APREQ_DECLARE_HOOK(apreq_hook_find_param)
     }
     return s;
 }
+
+APREQ_DECLARE_HOOK(apreq_hook_find_params)
+{
+    apreq_hook_find_params_ctx_t *ctx = hook->ctx;
+    int is_final = (bb == NULL) || APR_BUCKET_IS_EOS(APR_BRIGADE_LAST(bb));
+    apr_status_t s = (hook->next == NULL)
+        ? APR_SUCCESS : apreq_hook_run(hook->next, param, bb);
+    int i;
+
+    if (is_final && s == APR_SUCCESS && ctx->missing > 0) {
+        for (i = 0; i < ctx->nelts; ++i) {
+            if (ctx->params[i] == NULL
+                && strcasecmp(ctx->names[i], param->v.name) == 0) {
+                ctx->params[i] = param;
+                --ctx->missing;
+            }
+        }
+    }
+    return s;
+}
@@ -0,0 +1,324 @@
+/*
+**  Licensed to the Apache Software Foundation (ASF) under one or more
+** contributor license agreements.  See the NOTICE file distributed with
+** this work for additional information regarding copyright ownership.
+** The ASF licenses this file to You under the Apache License, Version 2.0
+** (the "License"); you may not use this file except in compliance with
+** the License.  You may obtain a copy of the License at
+**
+**      http://www.apache.org/licenses/LICENSE-2.0
+**
+**  Unless required by applicable law or agreed to in writing, software
+**  distributed under the License is distributed on an "AS IS" BASIS,
+**  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+**  See the License for the specific language governing permissions and
+**  limitations under the License.
+*/
+
+#include "apreq_parser.h"
+#include "apreq_util.h"
+#include "apreq_error.h"
+#include "apr_strings.h"
+#include "apr_lib.h"
+
+#ifdef HAVE_CONFIG_H
+#include "apreq_config.h"
+#endif
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/* the inflated data is handed to the parser this much at a time */
+#define INFLATE_BLOCK_SIZE  APR_BUCKET_BUFF_SIZE
+
+#ifdef HAVE_ZLIB
+
+struct apreq_inflate_t {
+    apreq_parser_function_t     parser;     /* the one we sit in front of */
+    z_stream                    zs;
+    apr_bucket_brigade          *in;        /* compressed data not taken */
+    apr_bucket_brigade          *out;       /* inflated data for parser */
+    apr_uint64_t                limit;      /* on the inflated size */
+    apr_uint64_t                total;
+    apr_status_t                status;     /* once not APR_INCOMPLETE */
+    int                         busy;       /* the parser pushed back */
+    enum {
+        INFLATE_GZIP,
+        INFLATE_DEFLATE
+    }                           type;
+    enum {
+        INFLATE_START,      /* no data yet */
+        INFLATE_STREAM,
+        INFLATE_MEMBER,     /* a gzip member is over, another may follow */
+        INFLATE_END         /* the compressed stream is over */
+    }                           state;
+};
+
+static apr_status_t inflate_cleanup(void *data)
+{
+    struct apreq_inflate_t *inf = data;
+
+    if (inf->state != INFLATE_START)
+        inflateEnd(&inf->zs);
+    return APR_SUCCESS;
+}
+
+/*
+ * "deflate" is supposed to mean the zlib format, but some clients send
+ * a raw deflate stream.  A zlib stream starts with a byte naming the
+ * deflate method (8) and a window size of at most 32K; a raw stream
+ * starting with such a byte would be a stored block with nonzero
+ * padding bits, which no encoder produces.
+ */
+static int inflate_window_bits(struct apreq_inflate_t *inf, unsigned char c)
+{
+    if (inf->type == INFLATE_GZIP)
+        return 16 + MAX_WBITS;
+    if ((c & 0x0f) == 8 && (c >> 4) <= 7)
+        return MAX_WBITS;
+    return -MAX_WBITS;
+}
+
+/* Hands the inflated data in inf->out to the parser. */
+static apr_status_t inflate_parse(apreq_parser_t *parser, apr_table_t *t,
+                                  struct apreq_inflate_t *inf)
+{
+    apr_status_t s = inf->parser(parser, t, inf->out);
+
+    /* whatever the parser rejected goes no further */
+    apr_brigade_cleanup(inf->out);
+    return s;
+}
+
+/*
+ * Inflates what zlib has been given a block at a time, running the
+ * parser on each block as it is produced.  Stops early, with zlib
+ * possibly holding more output, when the parser doesn't return
+ * APR_INCOMPLETE.
+ */
+static apr_status_t inflate_pump(apreq_parser_t *parser, apr_table_t *t,
+                                 struct apreq_inflate_t *inf)
+{
+    apr_bucket_alloc_t *ba = parser->bucket_alloc;
+
+    do {
+        char *buf = apr_bucket_alloc(INFLATE_BLOCK_SIZE, ba);
+        apr_status_t s;
+        apr_size_t n;
+        int zrv;
+
+        if (inf->state == INFLATE_MEMBER && inf->zs.avail_in > 0)
+            inf->state = INFLATE_STREAM;
+
+        inf->zs.next_out = (Bytef *)buf;
+        inf->zs.avail_out = INFLATE_BLOCK_SIZE;
+        zrv = inflate(&inf->zs, Z_NO_FLUSH);
+        n = INFLATE_BLOCK_SIZE - inf->zs.avail_out;
+
+        if (zrv == Z_STREAM_END) {
+            /* gzip allows several members back to back */
+            if (inf->type == INFLATE_GZIP) {
+                inflateReset(&inf->zs);
+                inf->state = INFLATE_MEMBER;
+            }
+            else
+                inf->state = INFLATE_END;
+        }
+        else if (zrv != Z_OK && zrv != Z_BUF_ERROR) {
+            apr_bucket_free(buf);
+            return (zrv == Z_MEM_ERROR) ? APR_ENOMEM : APREQ_ERROR_BADDATA;
+        }
+
+        if (n == 0) {
+            apr_bucket_free(buf);
+            continue;
+        }
+
+        inf->total += n;
+        if (inf->total > inf->limit) {
+            apr_bucket_free(buf);
+            return APREQ_ERROR_OVERLIMIT;
+        }
+
+        APR_BRIGADE_INSERT_TAIL(inf->out,
+            apr_bucket_heap_create(buf, n, apr_bucket_free, ba));
+        s = inflate_parse(parser, t, inf);
+        if (s != APR_INCOMPLETE)
+            return s;
+
+    } while (inf->state != INFLATE_END
+             && (inf->zs.avail_in > 0 || inf->zs.avail_out == 0));
+
+    return APR_INCOMPLETE;
+}
+
+/*
+ * Sits in front of the parser function apreq_parser_inflate() wrapped,
+ * inflating the body as it arrives so neither the compressed nor the
+ * inflated data piles up.  While the parser pushes back with
+ * APR_EAGAIN, the compressed data is set aside and nothing more is
+ * inflated.
+ */
+static apr_status_t apreq_parse_inflate(APREQ_PARSER_ARGS)
+{
+    struct apreq_inflate_t *inf = parser->inflate;
+    apr_status_t s;
+
+    if (inf->status != APR_INCOMPLETE)
+        return inf->status;
+    if (bb == NULL)
+        return inf->parser(parser, t, NULL);
+
+    APR_BRIGADE_CONCAT(inf->in, bb);
+
+    if (inf->busy) {
+        /* let the parser retry what it holds, then flush zlib */
+        s = inflate_parse(parser, t, inf);
+        if (s == APR_INCOMPLETE && inf->state == INFLATE_STREAM)
+            s = inflate_pump(parser, t, inf);
+        if (s == APR_EAGAIN) {
+            apreq_brigade_setaside(inf->in, parser->pool);
+            return s;
+        }
+        inf->busy = 0;
+        if (s != APR_INCOMPLETE) {
+            inf->status = s;
+            return s;
+        }
+    }
+
+    while (!APR_BRIGADE_EMPTY(inf->in)) {
+        apr_bucket *e = APR_BRIGADE_FIRST(inf->in);
+        const char *data;
+        apr_size_t dlen;
+
+        if (APR_BUCKET_IS_EOS(e)) {
+            if (inf->state == INFLATE_STREAM) {
+                /* truncated */
+                inf->status = APREQ_ERROR_BADDATA;
+                return inf->status;
+            }
+            APR_BUCKET_REMOVE(e);
+            APR_BRIGADE_INSERT_TAIL(inf->out, e);
+            s = inflate_parse(parser, t, inf);
+            if (s == APR_EAGAIN)
+                inf->busy = 1;
+            else if (s != APR_INCOMPLETE)
+                inf->status = s;
+            return s;
+        }
+
+        if (APR_BUCKET_IS_METADATA(e) || inf->state == INFLATE_END) {
+            /* anything after the compressed stream is ignored */
+            apr_bucket_delete(e);
+            continue;
+        }
+
+        s = apr_bucket_read(e, &data, &dlen, APR_BLOCK_READ);
+        if (s != APR_SUCCESS) {
+            inf->status = s;
+            return s;
+        }
+        if (dlen == 0) {
+            apr_bucket_delete(e);
+            continue;
+        }
+
+        if (inf->state == INFLATE_START) {
+            memset(&inf->zs, 0, sizeof inf->zs);
+            if (inflateInit2(&inf->zs, inflate_window_bits(inf, *data))
+                != Z_OK) {
+                inf->status = APR_ENOMEM;
+                return inf->status;
+            }
+            inf->state = INFLATE_STREAM;
+            apr_pool_cleanup_register(parser->pool, inf, inflate_cleanup,
+                                      apr_pool_cleanup_null);
+        }
+
+        inf->zs.next_in = (Bytef *)data;
+        inf->zs.avail_in = (uInt)dlen;
+        s = inflate_pump(parser, t, inf);
+
+        if (s == APR_EAGAIN) {
+            /* keep what zlib hasn't taken for the next run */
+            if (inf->zs.avail_in > 0) {
+                apr_bucket_split(e, dlen - inf->zs.avail_in);
+                inf->zs.avail_in = 0;
+            }
+            apr_bucket_delete(e);
+            apreq_brigade_setaside(inf->in, parser->pool);
+            inf->busy = 1;
+            return s;
+        }
+        if (s != APR_INCOMPLETE) {
+            /* done or failed, maybe before the body ended */
+            inf->status = s;
+            return s;
+        }
+        apr_bucket_delete(e);
+    }
+
+    return APR_INCOMPLETE;
+}
+
+#endif /* HAVE_ZLIB */
+
+APREQ_DECLARE(apr_status_t) apreq_parser_inflate(apreq_parser_t *parser,
+                                                 const char *encoding,
+                                                 apr_uint64_t limit)
+{
+#ifdef HAVE_ZLIB
+    struct apreq_inflate_t *inf;
+#endif
+    const char *end;
+
+    if (encoding == NULL)
+        return APR_SUCCESS;
+
+    while (apr_isspace(*encoding))
+        ++encoding;
+    end = encoding + strlen(encoding);
+    while (end > encoding && apr_isspace(end[-1]))
+        --end;
+
+    if (end == encoding
+        || (end - encoding == 8 && strncasecmp(encoding, "identity", 8) == 0))
+        return APR_SUCCESS;
+
+    if (parser->inflate != NULL)
+        return APREQ_ERROR_MISMATCH;
+
+#ifdef HAVE_ZLIB
+    inf = apr_palloc(parser->pool, sizeof *inf);
+
+    if ((end - encoding == 4 && strncasecmp(encoding, "gzip", 4) == 0)
+        || (end - encoding == 6 && strncasecmp(encoding, "x-gzip", 6) == 0))
+        inf->type = INFLATE_GZIP;
+    else if (end - encoding == 7 && strncasecmp(encoding, "deflate", 7) == 0)
+        inf->type = INFLATE_DEFLATE;
+    else
+        return APR_ENOTIMPL;
+
+    inf->parser = parser->parser;
+    inf->in = apr_brigade_create(parser->pool, parser->bucket_alloc);
+    inf->out = apr_brigade_create(parser->pool, parser->bucket_alloc);
+    inf->limit = limit;
+    inf->total = 0;
+    inf->status = APR_INCOMPLETE;
+    inf->busy = 0;
+    inf->state = INFLATE_START;
+
+    parser->inflate = inf;
+    parser->parser = apreq_parse_inflate;
+
+    /* Content-Length counts compressed bytes, no bound on the body */
+    parser->size_hint = 0;
+
+    return APR_SUCCESS;
+#else
+    (void)limit;
+    return APR_ENOTIMPL;
+#endif
+}
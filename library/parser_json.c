@@ -0,0 +1,651 @@
+/*
+**  Licensed to the Apache Software Foundation (ASF) under one or more
+** contributor license agreements.  See the NOTICE file distributed with
+** this work for additional information regarding copyright ownership.
+** The ASF licenses this file to You under the Apache License, Version 2.0
+** (the "License"); you may not use this file except in compliance with
+** the License.  You may obtain a copy of the License at
+**
+**      http://www.apache.org/licenses/LICENSE-2.0
+**
+**  Unless required by applicable law or agreed to in writing, software
+**  distributed under the License is distributed on an "AS IS" BASIS,
+**  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+**  See the License for the specific language governing permissions and
+**  limitations under the License.
+*/
+
+#include "apreq_parser.h"
+#include "apreq_util.h"
+#include "apreq_error.h"
+#include "apr_strings.h"
+
+
+#define PARSER_STATUS_CHECK(PREFIX)   do {         \
+    if (ctx->status == PREFIX##_ERROR)             \
+        return APREQ_ERROR_GENERAL;                \
+    else if (ctx->status == PREFIX##_COMPLETE)     \
+        return APR_SUCCESS;                        \
+    else if (bb == NULL)                           \
+        return APR_INCOMPLETE;                     \
+} while (0);
+
+/* objects and arrays nested deeper than this are rejected */
+#define JSON_MAX_DEPTH  64
+
+struct json_frame {
+    apr_size_t          plen;   /* length of the container's own name */
+    apr_size_t          index;  /* members or elements seen so far */
+    char                type;   /* '{' or '[' */
+};
+
+struct json_ctx {
+    apr_bucket_brigade *bb;         /* chunks of a spooled string */
+    apreq_param_t      *param;      /* the spooled string's param */
+    char               *path;       /* name of the current value */
+    apr_size_t          plen;
+    apr_size_t          psize;
+    char               *buf;        /* key, string or literal being read */
+    apr_size_t          blen;
+    apr_size_t          bsize;
+    apr_uint32_t        ucs;        /* \u escape being read */
+    apr_uint32_t        surrogate;  /* high surrogate awaiting its pair */
+    int                 nhex;
+    int                 skip;       /* value rejected by parse_only */
+    int                 depth;
+    struct json_frame   stack[JSON_MAX_DEPTH];
+    enum {
+        JSON_KEY,
+        JSON_STRING,
+        JSON_LITERAL
+    }                   kind;       /* what buf holds */
+    enum {
+        JSON_START,
+        JSON_MEMBER,
+        JSON_COLON,
+        JSON_VALUE,
+        JSON_NEXT,
+        JSON_TEXT,
+        JSON_ESCAPE,
+        JSON_UNICODE,
+        JSON_WORD,
+        JSON_END,
+        JSON_COMPLETE,
+        JSON_ERROR
+    }                   status;
+};
+
+
+/********************* application/json *********************/
+
+/*
+ * Spools what buf holds of a long string into its param's upload
+ * brigade, creating the param first if need be.  done ends the string
+ * and adds the param to t.
+ */
+static apr_status_t json_spool(apreq_parser_t *parser, struct json_ctx *ctx,
+                               apr_table_t *t, int done)
+{
+    apr_pool_t *pool = parser->pool;
+    apr_bucket_alloc_t *ba = parser->bucket_alloc;
+    apreq_param_t *param = ctx->param;
+    apr_bucket *eos = NULL;
+    apr_status_t s;
+
+    if (param == NULL) {
+        param = apreq_param_make(pool, ctx->path, ctx->plen, "", 0);
+        param->upload = apr_brigade_create(pool, ba);
+        param->info = apr_table_make(pool, APREQ_DEFAULT_NELTS);
+        apreq_param_tainted_on(param);
+        ctx->param = param;
+    }
+
+    if (ctx->blen > 0)
+        APR_BRIGADE_INSERT_TAIL(ctx->bb,
+            apr_bucket_heap_create(ctx->buf, ctx->blen, NULL, ba));
+    ctx->blen = 0;
+
+    if (parser->hook != NULL) {
+        if (done) {
+            eos = apr_bucket_eos_create(ba);
+            APR_BRIGADE_INSERT_TAIL(ctx->bb, eos);
+        }
+        s = apreq_hook_run(parser->hook, param, ctx->bb);
+        if (eos != NULL)
+            apr_bucket_delete(eos);
+        if (s != APR_SUCCESS)
+            return s;
+    }
+
+    s = apreq_parser_spool(parser, pool, param->upload, ctx->bb, done);
+    if (s != APR_SUCCESS)
+        return s;
+
+    if (done) {
+        apreq_value_table_add(&param->v, t);
+        ctx->param = NULL;
+    }
+    return APR_SUCCESS;
+}
+
+/*
+ * Makes room in buf, growing it up to the brigade limit.  Past that a
+ * string value is spooled, and anything else is rejected.
+ */
+static apr_status_t json_grow(apreq_parser_t *parser, struct json_ctx *ctx,
+                              apr_table_t *t)
+{
+    apr_size_t size = 2 * ctx->bsize;
+    char *buf;
+
+    if (ctx->bsize >= parser->brigade_limit) {
+        if (ctx->kind != JSON_STRING)
+            return APREQ_ERROR_OVERLIMIT;
+        return json_spool(parser, ctx, t, 0);
+    }
+
+    if (size > parser->brigade_limit)
+        size = parser->brigade_limit;
+    buf = apr_palloc(parser->pool, size);
+    memcpy(buf, ctx->buf, ctx->blen);
+    ctx->buf = buf;
+    ctx->bsize = size;
+    return APR_SUCCESS;
+}
+
+static apr_status_t json_put(apreq_parser_t *parser, struct json_ctx *ctx,
+                             apr_table_t *t, const char *data, apr_size_t n)
+{
+    if (ctx->skip && ctx->kind == JSON_STRING)
+        return APR_SUCCESS;
+
+    while (n > 0) {
+        apr_size_t k = ctx->bsize - ctx->blen;
+        apr_status_t s;
+
+        if (k == 0) {
+            s = json_grow(parser, ctx, t);
+            if (s != APR_SUCCESS)
+                return s;
+            continue;
+        }
+        if (k > n)
+            k = n;
+        memcpy(ctx->buf + ctx->blen, data, k);
+        ctx->blen += k;
+        data += k;
+        n -= k;
+    }
+    return APR_SUCCESS;
+}
+
+/* Appends the completed \u escape to buf as utf8. */
+static apr_status_t json_put_ucs(apreq_parser_t *parser,
+                                 struct json_ctx *ctx, apr_table_t *t)
+{
+    apr_uint32_t u = ctx->ucs;
+    char utf8[4];
+    apr_size_t n;
+
+    if (ctx->surrogate) {
+        if (u < 0xdc00 || u > 0xdfff)
+            return APREQ_ERROR_BADSEQ;
+        u = 0x10000 + ((ctx->surrogate - 0xd800) << 10) + (u - 0xdc00);
+        ctx->surrogate = 0;
+    }
+    else if (u >= 0xd800 && u <= 0xdbff) {
+        ctx->surrogate = u;
+        return APR_SUCCESS;
+    }
+    else if (u >= 0xdc00 && u <= 0xdfff) {
+        return APREQ_ERROR_BADSEQ;
+    }
+
+    if (u < 0x80) {
+        utf8[0] = (char)u;
+        n = 1;
+    }
+    else if (u < 0x800) {
+        utf8[0] = (char)(0xc0 | u >> 6);
+        utf8[1] = (char)(0x80 | (u & 0x3f));
+        n = 2;
+    }
+    else if (u < 0x10000) {
+        utf8[0] = (char)(0xe0 | u >> 12);
+        utf8[1] = (char)(0x80 | (u >> 6 & 0x3f));
+        utf8[2] = (char)(0x80 | (u & 0x3f));
+        n = 3;
+    }
+    else {
+        utf8[0] = (char)(0xf0 | u >> 18);
+        utf8[1] = (char)(0x80 | (u >> 12 & 0x3f));
+        utf8[2] = (char)(0x80 | (u >> 6 & 0x3f));
+        utf8[3] = (char)(0x80 | (u & 0x3f));
+        n = 4;
+    }
+    return json_put(parser, ctx, t, utf8, n);
+}
+
+static apr_status_t json_path_put(apreq_parser_t *parser,
+                                  struct json_ctx *ctx,
+                                  const char *data, apr_size_t n)
+{
+    if (ctx->plen + n > ctx->psize) {
+        apr_size_t size = 2 * ctx->psize;
+        char *path;
+
+        if (ctx->plen + n > parser->brigade_limit)
+            return APREQ_ERROR_OVERLIMIT;
+        while (size < ctx->plen + n)
+            size *= 2;
+        path = apr_palloc(parser->pool, size);
+        memcpy(path, ctx->path, ctx->plen);
+        ctx->path = path;
+        ctx->psize = size;
+    }
+    memcpy(ctx->path + ctx->plen, data, n);
+    ctx->plen += n;
+    return APR_SUCCESS;
+}
+
+/* Adds the scalar in buf to t, named by path. */
+static apr_status_t json_emit(apreq_parser_t *parser, struct json_ctx *ctx,
+                              apr_table_t *t)
+{
+    apreq_param_t *param;
+    apr_status_t s;
+
+    param = apreq_param_make(parser->pool, ctx->path, ctx->plen,
+                             ctx->buf, ctx->blen);
+    apreq_param_tainted_on(param);
+    apreq_param_charset_set(param, apreq_charset_divine(ctx->buf,
+                                                        ctx->blen));
+    if (parser->hook != NULL) {
+        s = apreq_hook_run(parser->hook, param, NULL);
+        if (s != APR_SUCCESS)
+            return s;
+    }
+    apreq_value_table_add(&param->v, t);
+    return APR_SUCCESS;
+}
+
+/* Starts reading a string or literal value named by path. */
+static void json_value_start(apreq_parser_t *parser, struct json_ctx *ctx,
+                             int kind)
+{
+    ctx->kind = kind;
+    ctx->blen = 0;
+    ctx->skip = parser->parse_only != NULL
+        && !apreq_parser_wants(parser, ctx->path, ctx->plen);
+}
+
+static void json_value_done(struct json_ctx *ctx)
+{
+    if (ctx->depth == 0) {
+        ctx->status = JSON_END;
+        return;
+    }
+    ++ctx->stack[ctx->depth - 1].index;
+    ctx->status = JSON_NEXT;
+}
+
+static apr_status_t json_open(struct json_ctx *ctx, char type)
+{
+    struct json_frame *f;
+
+    if (ctx->depth == JSON_MAX_DEPTH)
+        return APREQ_ERROR_OVERLIMIT;
+
+    f = &ctx->stack[ctx->depth++];
+    f->plen = ctx->plen;
+    f->index = 0;
+    f->type = type;
+    ctx->status = (type == '{') ? JSON_MEMBER : JSON_VALUE;
+    return APR_SUCCESS;
+}
+
+static void json_close(struct json_ctx *ctx)
+{
+    --ctx->depth;
+    json_value_done(ctx);
+}
+
+/* Checks a bare word against the JSON grammar for literals and numbers. */
+static int json_word_ok(const char *w, apr_size_t len)
+{
+    const char *end = w + len;
+
+    switch (*w) {
+    case 't':
+        return len == 4 && memcmp(w, "true", 4) == 0;
+    case 'f':
+        return len == 5 && memcmp(w, "false", 5) == 0;
+    case 'n':
+        return len == 4 && memcmp(w, "null", 4) == 0;
+    }
+
+    if (w < end && *w == '-')
+        ++w;
+    if (w == end)
+        return 0;
+    if (*w == '0')
+        ++w;
+    else if (*w >= '1' && *w <= '9')
+        while (w < end && *w >= '0' && *w <= '9')
+            ++w;
+    else
+        return 0;
+
+    if (w < end && *w == '.') {
+        if (++w == end || *w < '0' || *w > '9')
+            return 0;
+        while (w < end && *w >= '0' && *w <= '9')
+            ++w;
+    }
+    if (w < end && (*w == 'e' || *w == 'E')) {
+        if (++w < end && (*w == '+' || *w == '-'))
+            ++w;
+        if (w == end || *w < '0' || *w > '9')
+            return 0;
+        while (w < end && *w >= '0' && *w <= '9')
+            ++w;
+    }
+    return w == end;
+}
+
+static int json_hexval(unsigned char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static apr_status_t json_parse(apreq_parser_t *parser, struct json_ctx *ctx,
+                               apr_table_t *t, const char *data,
+                               apr_size_t dlen)
+{
+    const char *const end = data + dlen;
+    struct json_frame *top;
+    apr_status_t s = APR_SUCCESS;
+
+    while (data < end) {
+        unsigned char c = *data;
+
+        switch (ctx->status) {
+
+        case JSON_TEXT:
+            {
+                const char *run = data;
+
+                if (ctx->surrogate && c != '\\')
+                    return APREQ_ERROR_BADSEQ;
+
+                while (data < end && *data != '"' && *data != '\\'
+                       && (unsigned char)*data >= 0x20)
+                    ++data;
+                if (data > run) {
+                    s = json_put(parser, ctx, t, run, data - run);
+                    if (s != APR_SUCCESS)
+                        return s;
+                    continue;
+                }
+
+                ++data;
+                if (c == '\\') {
+                    ctx->status = JSON_ESCAPE;
+                    continue;
+                }
+                if (c != '"')
+                    return APREQ_ERROR_BADCHAR;
+
+                if (ctx->kind == JSON_KEY) {
+                    ctx->plen = ctx->stack[ctx->depth - 1].plen;
+                    if (ctx->plen > 0)
+                        s = json_path_put(parser, ctx, ".", 1);
+                    if (s == APR_SUCCESS)
+                        s = json_path_put(parser, ctx, ctx->buf, ctx->blen);
+                    ctx->status = JSON_COLON;
+                    break;
+                }
+
+                if (ctx->param != NULL)
+                    s = json_spool(parser, ctx, t, 1);
+                else if (!ctx->skip)
+                    s = json_emit(parser, ctx, t);
+                json_value_done(ctx);
+            }
+            break;
+
+        case JSON_ESCAPE:
+            {
+                char x;
+
+                ++data;
+                if (ctx->surrogate && c != 'u')
+                    return APREQ_ERROR_BADSEQ;
+
+                switch (c) {
+                case '"':
+                case '\\':
+                case '/':
+                    x = c;
+                    break;
+                case 'b':
+                    x = '\b';
+                    break;
+                case 'f':
+                    x = '\f';
+                    break;
+                case 'n':
+                    x = '\n';
+                    break;
+                case 'r':
+                    x = '\r';
+                    break;
+                case 't':
+                    x = '\t';
+                    break;
+                case 'u':
+                    ctx->ucs = 0;
+                    ctx->nhex = 0;
+                    ctx->status = JSON_UNICODE;
+                    continue;
+                default:
+                    return APREQ_ERROR_BADSEQ;
+                }
+                s = json_put(parser, ctx, t, &x, 1);
+                ctx->status = JSON_TEXT;
+            }
+            break;
+
+        case JSON_UNICODE:
+            {
+                int d = json_hexval(c);
+
+                ++data;
+                if (d < 0)
+                    return APREQ_ERROR_BADSEQ;
+                ctx->ucs = ctx->ucs << 4 | d;
+                if (++ctx->nhex < 4)
+                    continue;
+                s = json_put_ucs(parser, ctx, t);
+                ctx->status = JSON_TEXT;
+            }
+            break;
+
+        case JSON_WORD:
+            {
+                const char *run = data;
+
+                while (data < end && ((*data >= 'a' && *data <= 'z')
+                                      || (*data >= '0' && *data <= '9')
+                                      || *data == '.' || *data == '-'
+                                      || *data == '+' || *data == 'E'))
+                    ++data;
+                if (data > run) {
+                    s = json_put(parser, ctx, t, run, data - run);
+                    if (s != APR_SUCCESS)
+                        return s;
+                    continue;
+                }
+
+                /* c ends the word and is left to the next state */
+                if (!json_word_ok(ctx->buf, ctx->blen))
+                    return APREQ_ERROR_BADCHAR;
+                if (!ctx->skip)
+                    s = json_emit(parser, ctx, t);
+                json_value_done(ctx);
+            }
+            break;
+
+        default:
+            ++data;
+            if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+                continue;
+
+            switch (ctx->status) {
+
+            case JSON_START:
+                /* the body must be an object */
+                if (c != '{')
+                    return APREQ_ERROR_BADCHAR;
+                s = json_open(ctx, c);
+                break;
+
+            case JSON_MEMBER:
+                top = &ctx->stack[ctx->depth - 1];
+                if (c == '}' && top->index == 0) {
+                    json_close(ctx);
+                    break;
+                }
+                if (c != '"')
+                    return APREQ_ERROR_BADCHAR;
+                ctx->kind = JSON_KEY;
+                ctx->blen = 0;
+                ctx->skip = 0;
+                ctx->status = JSON_TEXT;
+                break;
+
+            case JSON_COLON:
+                if (c != ':')
+                    return APREQ_ERROR_BADCHAR;
+                ctx->status = JSON_VALUE;
+                break;
+
+            case JSON_NEXT:
+                top = &ctx->stack[ctx->depth - 1];
+                if (c == ',')
+                    ctx->status = (top->type == '{') ? JSON_MEMBER
+                                                     : JSON_VALUE;
+                else if (c == (top->type == '{' ? '}' : ']'))
+                    json_close(ctx);
+                else
+                    return APREQ_ERROR_BADCHAR;
+                break;
+
+            case JSON_VALUE:
+                top = &ctx->stack[ctx->depth - 1];
+                if (top->type == '[') {
+                    char idx[24];
+
+                    if (c == ']' && top->index == 0) {
+                        json_close(ctx);
+                        break;
+                    }
+                    ctx->plen = top->plen;
+                    s = json_path_put(parser, ctx, idx,
+                                      apr_snprintf(idx, sizeof idx,
+                                                   "[%" APR_SIZE_T_FMT "]",
+                                                   top->index));
+                    if (s != APR_SUCCESS)
+                        return s;
+                }
+
+                if (c == '{' || c == '[') {
+                    s = json_open(ctx, c);
+                }
+                else if (c == '"') {
+                    json_value_start(parser, ctx, JSON_STRING);
+                    ctx->status = JSON_TEXT;
+                }
+                else if (c == '-' || (c >= '0' && c <= '9')
+                         || c == 't' || c == 'f' || c == 'n') {
+                    json_value_start(parser, ctx, JSON_LITERAL);
+                    ctx->status = JSON_WORD;
+                    --data;
+                }
+                else {
+                    return APREQ_ERROR_BADCHAR;
+                }
+                break;
+
+            default:
+                /* nothing may follow the object */
+                return APREQ_ERROR_BADCHAR;
+            }
+        }
+
+        if (s != APR_SUCCESS)
+            return s;
+    }
+
+    return APR_SUCCESS;
+}
+
+APREQ_DECLARE_PARSER(apreq_parse_json)
+{
+    apr_pool_t *pool = parser->pool;
+    struct json_ctx *ctx = parser->ctx;
+
+    if (ctx == NULL) {
+        parser->ctx = ctx = apr_palloc(pool, sizeof *ctx);
+        ctx->bb = apr_brigade_create(pool, parser->bucket_alloc);
+        ctx->param = NULL;
+        ctx->psize = 64;
+        ctx->path = apr_palloc(pool, ctx->psize);
+        ctx->plen = 0;
+        ctx->bsize = 256;
+        ctx->buf = apr_palloc(pool, ctx->bsize);
+        ctx->blen = 0;
+        ctx->surrogate = 0;
+        ctx->skip = 0;
+        ctx->depth = 0;
+        ctx->kind = JSON_KEY;
+        ctx->status = JSON_START;
+    }
+
+    PARSER_STATUS_CHECK(JSON);
+
+    while (!APR_BRIGADE_EMPTY(bb)) {
+        apr_bucket *e = APR_BRIGADE_FIRST(bb);
+        const char *data;
+        apr_size_t dlen;
+        apr_status_t s;
+
+        if (APR_BUCKET_IS_EOS(e)) {
+            if (ctx->status != JSON_END) {
+                ctx->status = JSON_ERROR;
+                return APREQ_ERROR_NODATA;
+            }
+            ctx->status = JSON_COMPLETE;
+            return APR_SUCCESS;
+        }
+
+        if (!APR_BUCKET_IS_METADATA(e)) {
+            s = apr_bucket_read(e, &data, &dlen, APR_BLOCK_READ);
+            if (s == APR_SUCCESS)
+                s = json_parse(parser, ctx, t, data, dlen);
+            if (s != APR_SUCCESS) {
+                ctx->status = JSON_ERROR;
+                return s;
+            }
+        }
+        apr_bucket_delete(e);
+    }
+
+    return APR_INCOMPLETE;
+}
@@ -19,12 +19,15 @@
 #include "apreq_error.h"
 #include "apreq_util.h"
 #include "apr_strings.h"
-#include "apr_strmatch.h"
 
 #ifndef CRLF
 #define CRLF    "\015\012"
 #endif
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <tmmintrin.h>
+#endif
+
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
 #define PARSER_STATUS_CHECK(PREFIX)   do {         \
@@ -39,13 +42,315 @@
 /* maximum recursion level in the mfd parser */
 #define MAX_LEVEL 8
 
+/* Content-Transfer-Encoding decoding */
+
+struct mfd_cte {
+    enum {
+        CTE_NONE,
+        CTE_BASE64,
+        CTE_QP
+    }                           type;
+    apr_uint32_t                acc;    /* base64 bits not yet written */
+    int                         n;      /* base64 chars in acc */
+    int                         done;   /* base64 padding seen */
+    char                        held;   /* quoted-printable after '=' */
+    int                         nheld;
+};
+
+/* base64 alphabet values; 0xff for bytes outside it, which are skipped */
+static const unsigned char b64_value[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b,
+    0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+    0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16,
+    0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20,
+    0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
+    0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+static apr_size_t b64_decode_scalar(struct mfd_cte *cte, const char *src,
+                                    apr_size_t len, char *dst,
+                                    const char **next)
+{
+    const unsigned char *s = (const unsigned char *)src;
+    const unsigned char *const end = s + len;
+    char *d = dst;
+
+    while (s < end) {
+        unsigned char c = *s++, v = b64_value[c];
+
+        if (v == 0xff) {
+            if (c == '=') {
+                /* padding: flush the partial quantum and stop */
+                if (cte->n == 2)
+                    *d++ = (char)(cte->acc >> 4);
+                else if (cte->n == 3) {
+                    *d++ = (char)(cte->acc >> 10);
+                    *d++ = (char)(cte->acc >> 2);
+                }
+                cte->n = 0;
+                cte->acc = 0;
+                cte->done = 1;
+                s = end;
+            }
+            continue;
+        }
+        cte->acc = cte->acc << 6 | v;
+        if (++cte->n == 4) {
+            *d++ = (char)(cte->acc >> 16);
+            *d++ = (char)(cte->acc >> 8);
+            *d++ = (char)cte->acc;
+            cte->n = 0;
+            cte->acc = 0;
+            if (next != NULL) {
+                *next = (const char *)s;
+                return d - dst;
+            }
+        }
+    }
+    if (next != NULL)
+        *next = (const char *)s;
+    return d - dst;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define B64_SSSE3
+
+/*
+ * Decodes 16 base64 chars at a time into 12 bytes, after W. Mula and
+ * D. Lemire, "Faster Base64 Encoding and Decoding Using AVX2
+ * Instructions".  Returns the number of chars consumed, stopping at
+ * the first block holding anything outside the alphabet (line breaks,
+ * padding), which is left to the scalar decoder.  dst needs 4 bytes of
+ * slack past the decoded data.
+ */
+__attribute__((target("ssse3")))
+static apr_size_t b64_decode_ssse3(const char *src, apr_size_t len,
+                                   char *dst, apr_size_t *dlen)
+{
+    const __m128i lut_lo = _mm_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lut_hi = _mm_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+    const __m128i pack = _mm_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    apr_size_t i = 0, o = 0;
+
+    for (; i + 16 <= len; i += 16, o += 12) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i hi_nib = _mm_and_si128(_mm_srli_epi32(in, 4), mask_2f);
+        __m128i lo_nib = _mm_and_si128(in, mask_2f);
+        __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nib);
+        __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nib);
+        __m128i roll;
+
+        if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi),
+                                             _mm_setzero_si128())))
+            break;
+
+        roll = _mm_shuffle_epi8(lut_roll,
+                                _mm_add_epi8(_mm_cmpeq_epi8(in, mask_2f),
+                                             hi_nib));
+        in = _mm_add_epi8(in, roll);
+        in = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+        in = _mm_madd_epi16(in, _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128((__m128i *)(dst + o), _mm_shuffle_epi8(in, pack));
+    }
+    *dlen = o;
+    return i;
+}
+#endif
+
+static apr_size_t b64_decode(struct mfd_cte *cte, const char *src,
+                             apr_size_t len, char *dst)
+{
+    const char *const end = src + len;
+    char *d = dst;
+
+    if (cte->done)
+        return 0;
+
+#ifdef B64_SSSE3
+    if (__builtin_cpu_supports("ssse3")) {
+        while (src < end && !cte->done) {
+            apr_size_t used, n;
+
+            /* realign on a quantum, then take whole blocks */
+            if (cte->n > 0) {
+                d += b64_decode_scalar(cte, src, end - src, d, &src);
+                continue;
+            }
+            used = b64_decode_ssse3(src, end - src, d, &n);
+            src += used;
+            d += n;
+            if (src == end)
+                break;
+            /* get past what stopped the block, one quantum's worth */
+            d += b64_decode_scalar(cte, src, MIN(16, end - src), d, &src);
+        }
+        return d - dst;
+    }
+#endif
+
+    return b64_decode_scalar(cte, src, len, dst, NULL);
+}
+
+static int qp_hex(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/*
+ * Decodes quoted-printable.  "=XX" becomes the byte XX and a '=' ending
+ * a line (a soft line break) goes away; a '=' followed by anything
+ * else is kept as it is, as RFC 2045 suggests.
+ */
+static apr_size_t qp_decode(struct mfd_cte *cte, const char *src,
+                            apr_size_t len, char *dst)
+{
+    const char *const end = src + len;
+    char *d = dst;
+
+    while (src < end) {
+        char c = *src;
+
+        switch (cte->nheld) {
+
+        case 0:
+            {
+                const char *eq = memchr(src, '=', end - src);
+
+                if (eq == NULL)
+                    eq = end;
+                memcpy(d, src, eq - src);
+                d += eq - src;
+                src = eq;
+                if (src < end) {
+                    ++src;
+                    cte->nheld = 1;
+                }
+            }
+            break;
+
+        case 1:
+            /* after '=' */
+            if (c == '\n') {
+                ++src;
+                cte->nheld = 0;
+            }
+            else if (c == '\r' || qp_hex(c) >= 0) {
+                ++src;
+                cte->held = c;
+                cte->nheld = 2;
+            }
+            else {
+                *d++ = '=';
+                cte->nheld = 0;
+            }
+            break;
+
+        default:
+            /* after "=\r" or "=X" */
+            if (cte->held == '\r') {
+                if (c == '\n')
+                    ++src;
+                else {
+                    *d++ = '=';
+                    *d++ = '\r';
+                }
+            }
+            else if (qp_hex(c) >= 0) {
+                *d++ = (char)(qp_hex(cte->held) << 4 | qp_hex(c));
+                ++src;
+            }
+            else {
+                *d++ = '=';
+                *d++ = cte->held;
+            }
+            cte->nheld = 0;
+        }
+    }
+    return d - dst;
+}
+
+/* Writes out what the decoder holds at the end of a part. */
+static apr_size_t cte_flush(struct mfd_cte *cte, char *dst)
+{
+    apr_size_t n = 0;
+
+    if (cte->type == CTE_QP && cte->nheld > 0) {
+        dst[n++] = '=';
+        if (cte->nheld == 2)
+            dst[n++] = cte->held;
+    }
+    else if (cte->type == CTE_BASE64) {
+        /* tolerate missing padding */
+        if (cte->n == 2)
+            dst[n++] = (char)(cte->acc >> 4);
+        else if (cte->n == 3) {
+            dst[n++] = (char)(cte->acc >> 10);
+            dst[n++] = (char)(cte->acc >> 2);
+        }
+    }
+    cte->nheld = 0;
+    cte->n = 0;
+    cte->acc = 0;
+    return n;
+}
+
+struct mfd_matcher {
+    const char                  *ndl;
+    apr_size_t                  nlen;
+    apr_size_t                  *fail;
+    const apreq_index_pattern_t *pattern;
+    apr_size_t                  held;
+};
+
 struct mfd_ctx {
     apr_table_t                 *info;
     apr_bucket_brigade          *in;
     apr_bucket_brigade          *bb;
     apreq_parser_t              *hdr_parser;
     apreq_parser_t              *next_parser;
-    const apr_strmatch_pattern  *pattern;
+    struct mfd_matcher          init_match;
+    struct mfd_matcher          crlf_match;
+    struct mfd_matcher          bdry_match;
     char                        *bdry;
     enum {
         MFD_INIT,
@@ -54,6 +359,8 @@ struct mfd_ctx {
         MFD_POST_HEADER,
         MFD_PARAM,
         MFD_UPLOAD,
+        MFD_SINK,
+        MFD_SKIP,
         MFD_MIXED,
         MFD_COMPLETE,
         MFD_ERROR
@@ -62,11 +369,89 @@ struct mfd_ctx {
     const char                  *param_name;
     apreq_param_t               *upload;
     unsigned                    level;
+    int                         sink_eos;   /* ctx->bb ends the upload */
+    struct mfd_cte              cte;        /* decoder for the part */
 };
 
 
 /********************* multipart/form-data *********************/
 
+/*
+ * Replaces the part data in ctx->bb with its decoded form, in a single
+ * heap bucket.  last ends the part, flushing what the decoder holds.
+ */
+static apr_status_t mfd_decode(struct mfd_ctx *ctx, apr_bucket_alloc_t *ba,
+                               int last)
+{
+    apr_bucket_brigade *bb = ctx->bb;
+    apr_size_t n = 0;
+    apr_off_t off;
+    apr_status_t s;
+    char *buf;
+
+    s = apr_brigade_length(bb, 1, &off);
+    if (s != APR_SUCCESS)
+        return s;
+
+    /* Decoding never grows the data by more than what the decoder held
+     * over from the last chunk; the slack covers that and the SIMD
+     * decoder's whole-block stores.
+     */
+    buf = apr_bucket_alloc((apr_size_t)off + 16, ba);
+
+    while (!APR_BRIGADE_EMPTY(bb)) {
+        apr_bucket *e = APR_BRIGADE_FIRST(bb);
+        const char *data;
+        apr_size_t dlen;
+
+        if (!APR_BUCKET_IS_METADATA(e)) {
+            s = apr_bucket_read(e, &data, &dlen, APR_BLOCK_READ);
+            if (s != APR_SUCCESS) {
+                apr_bucket_free(buf);
+                return s;
+            }
+            n += (ctx->cte.type == CTE_BASE64)
+                ? b64_decode(&ctx->cte, data, dlen, buf + n)
+                : qp_decode(&ctx->cte, data, dlen, buf + n);
+        }
+        apr_bucket_delete(e);
+    }
+    if (last)
+        n += cte_flush(&ctx->cte, buf + n);
+
+    if (n == 0)
+        apr_bucket_free(buf);
+    else
+        APR_BRIGADE_INSERT_TAIL(bb,
+            apr_bucket_heap_create(buf, n, apr_bucket_free, ba));
+    return APR_SUCCESS;
+}
+
+/*
+ * Offers the upload data in ctx->bb to the parser's sink.  Whatever it
+ * leaves there is set aside, to be offered again from MFD_SINK.
+ */
+static apr_status_t mfd_sink(apreq_parser_t *parser, struct mfd_ctx *ctx)
+{
+    apr_status_t s = apreq_sink_run(parser->sink, ctx->upload, ctx->bb);
+
+    if (s == APR_SUCCESS && !APR_BRIGADE_EMPTY(ctx->bb))
+        s = APR_EAGAIN;
+
+    switch (s) {
+    case APR_SUCCESS:
+        return s;
+    case APR_EAGAIN:
+        apreq_brigade_setaside(ctx->bb, parser->pool);
+        apreq_brigade_setaside(ctx->in, parser->pool);
+        ctx->status = MFD_SINK;
+        return s;
+    default:
+        ctx->status = MFD_ERROR;
+        return s;
+    }
+}
+
 APR_INLINE
 static apr_status_t brigade_start_string(apr_bucket_brigade *bb,
                                          const char *start_string)
@@ -104,24 +489,93 @@ static apr_status_t brigade_start_string(apr_bucket_brigade *bb,
         start_string += bytes_to_check;
     }
 
+    if (slen == 0)
+        return APR_SUCCESS;
+
     /* slen > 0, so brigade isn't large enough yet */
     return APR_INCOMPLETE;
 }
 
 
+/*
+ * Boundaries are matched with a streaming KMP matcher.  Within a part's
+ * data (bdry_match, and crlf_match on the line after a boundary) each
+ * byte is read once, however the body is cut into buckets: the bytes of
+ * a partial match stay at the front of the input brigade between calls,
+ * and "held" counts them so split_on_bdry() skips past them.  While
+ * nothing is held, the vectorized apreq_index_match() skips ahead to the
+ * next candidate.
+ *
+ * Nothing more is promised for the "--boundary" start of the body
+ * (init_match), whose bytes may be read more than once, nor for
+ * brigade_start_string(), which MFD_POST_HEADER uses to spot an empty
+ * part and which rereads the front of the brigade on every call until
+ * enough of the part has arrived.
+ */
+
+static void matcher_init(struct mfd_matcher *m, apr_pool_t *pool,
+                         const char *ndl, apr_size_t nlen)
+{
+    apr_size_t i, k = 0;
+
+    m->ndl = ndl;
+    m->nlen = nlen;
+    m->held = 0;
+    m->fail = apr_palloc(pool, nlen * sizeof *m->fail);
+    m->fail[0] = 0;
+
+    for (i = 1; i < nlen; ++i) {
+        while (k > 0 && ndl[i] != ndl[k])
+            k = m->fail[k - 1];
+        if (ndl[i] == ndl[k])
+            ++k;
+        m->fail[i] = k;
+    }
+
+    /* apreq_index_match() confirms each candidate with memcmp, which
+     * stays linear only if the first byte of ndl does not recur in it
+     * (true of every boundary, which starts with CR or '-' followed
+     * by a different byte).
+     */
+    if (nlen > 1 && memchr(ndl + 1, ndl[0], nlen - 1) == NULL)
+        m->pattern = apreq_index_precompile(pool, ndl, nlen);
+    else
+        m->pattern = NULL;
+}
+
+/* Moves the first len bytes of "in" to the end of "out". */
+static apr_status_t move_front(apr_bucket_brigade *out,
+                               apr_bucket_brigade *in,
+                               apr_size_t len)
+{
+    apr_bucket *f;
+    apr_status_t s = apr_brigade_partition(in, len, &f);
+
+    if (s != APR_SUCCESS)
+        return s;
+
+    while (APR_BRIGADE_FIRST(in) != f) {
+        apr_bucket *e = APR_BRIGADE_FIRST(in);
+        APR_BUCKET_REMOVE(e);
+        APR_BRIGADE_INSERT_TAIL(out, e);
+    }
+    return APR_SUCCESS;
+}
+
 static apr_status_t split_on_bdry(apr_bucket_brigade *out,
                                   apr_bucket_brigade *in,
-                                  const apr_strmatch_pattern *pattern,
-                                  const char *bdry)
+                                  struct mfd_matcher *m)
 {
-    apr_bucket *e = APR_BRIGADE_FIRST(in);
-    apr_size_t blen = strlen(bdry), off = 0;
+    apr_bucket *e, *f, *after;
+    apr_size_t scanned = m->held, len = 0, i = 0;
+    apr_status_t s;
+
+    s = apr_brigade_partition(in, m->held, &e);
+    if (s != APR_SUCCESS)
+        return s;
 
     while ( e != APR_BRIGADE_SENTINEL(in) ) {
-        apr_ssize_t idx;
-        apr_size_t len;
         const char *buf;
-        apr_status_t s;
 
         if (APR_BUCKET_IS_EOS(e))
             return APR_EOF;
@@ -131,81 +585,66 @@ static apr_status_t split_on_bdry(apr_bucket_brigade *out,
             return s;
 
         if (len == 0) {
-            apr_bucket *f = e;
+            f = e;
             e = APR_BUCKET_NEXT(e);
             apr_bucket_delete(f);
             continue;
         }
 
-    look_for_boundary_up_front:
-        if (strncmp(bdry + off, buf, MIN(len, blen - off)) == 0) {
-            if ( len >= blen - off ) {
-                /* complete match */
-                if (len > blen - off)
-                    apr_bucket_split(e, blen - off);
-                e = APR_BUCKET_NEXT(e);
+        for (i = 0; i < len; ) {
+            if (m->held == 0 && m->pattern != NULL) {
+                apr_ssize_t idx = apreq_index_match(m->pattern, buf + i,
+                                                    len - i,
+                                                    APREQ_MATCH_PARTIAL);
+                if (idx < 0) {
+                    i = len;
+                    break;
+                }
+                i += idx;
+                if (len - i >= m->nlen) {
+                    i += m->nlen;
+                    goto boundary_found;
+                }
+                m->held = len - i;
+                i = len;
+                break;
+            }
 
-                do {
-                    apr_bucket *f = APR_BRIGADE_FIRST(in);
-                    apr_bucket_delete(f);
-                } while (APR_BRIGADE_FIRST(in) != e);
+            while (m->held > 0 && buf[i] != m->ndl[m->held])
+                m->held = m->fail[m->held - 1];
+            if (buf[i] == m->ndl[m->held])
+                ++m->held;
+            ++i;
 
-                return APR_SUCCESS;
-            }
-            /* partial match */
-            off += len;
-            e = APR_BUCKET_NEXT(e);
-            continue;
+            if (m->held == m->nlen)
+                goto boundary_found;
         }
-        else if (off > 0) {
-            /* prior (partial) strncmp failed,
-             * so we can move previous buckets across
-             * and retest buf against the full bdry.
-             */
 
-            /* give hints to GCC by making the brigade volatile, otherwise the
-             * loop below will end up being endless. See:
-             * https://bugzilla.redhat.com/bugzilla/show_bug.cgi?id=193740
-             */
-            apr_bucket_brigade * volatile in_v = in;
-
-            do {
-                apr_bucket *f = APR_BRIGADE_FIRST(in_v);
-                APR_BUCKET_REMOVE(f);
-                APR_BRIGADE_INSERT_TAIL(out, f);
-            } while (e != APR_BRIGADE_FIRST(in_v));
-            off = 0;
-            goto look_for_boundary_up_front;
-        }
+        scanned += len;
+        e = APR_BUCKET_NEXT(e);
+    }
 
-        if (pattern != NULL && len >= blen) {
-            const char *match = apr_strmatch(pattern, buf, len);
-            if (match != NULL)
-                idx = match - buf;
-            else {
-                idx = apreq_index(buf + len-blen, blen, bdry, blen,
-                                  APREQ_MATCH_PARTIAL);
-                if (idx >= 0)
-                    idx += len-blen;
-            }
-        }
-        else
-            idx = apreq_index(buf, len, bdry, blen, APREQ_MATCH_PARTIAL);
+    /* Everything but the bytes of a partial match goes out. */
+    s = move_front(out, in, scanned - m->held);
+    return (s == APR_SUCCESS) ? APR_INCOMPLETE : s;
 
-        /* Theoretically idx should never be 0 here, because we
-         * already tested the front of the brigade for a potential match.
-         * However, it doesn't hurt to allow for the possibility,
-         * since this will just start the whole loop over again.
-         */
-        if (idx >= 0)
-            apr_bucket_split(e, idx);
+ boundary_found:
+    m->held = 0;
 
-        APR_BUCKET_REMOVE(e);
-        APR_BRIGADE_INSERT_TAIL(out, e);
-        e = APR_BRIGADE_FIRST(in);
+    if (i < len)
+        apr_bucket_split(e, i);
+    after = APR_BUCKET_NEXT(e);
+
+    s = move_front(out, in, scanned + i - m->nlen);
+    if (s != APR_SUCCESS)
+        return s;
+
+    while (APR_BRIGADE_FIRST(in) != after) {
+        f = APR_BRIGADE_FIRST(in);
+        apr_bucket_delete(f);
     }
 
-    return APR_INCOMPLETE;
+    return APR_SUCCESS;
 }
 
 
@@ -242,7 +681,9 @@ struct mfd_ctx * create_multipart_context(const char *content_type,
     *--ctx->bdry = '\r';
 
     ctx->status = MFD_INIT;
-    ctx->pattern = apr_strmatch_precompile(pool, ctx->bdry, 1);
+    matcher_init(&ctx->init_match, pool, ctx->bdry + 2, blen + 2);
+    matcher_init(&ctx->crlf_match, pool, CRLF, 2);
+    matcher_init(&ctx->bdry_match, pool, ctx->bdry, blen + 4);
     ctx->hdr_parser = apreq_parser_make(pool, ba, "",
                                         apreq_parse_headers,
                                         brigade_limit,
@@ -255,6 +696,8 @@ struct mfd_ctx * create_multipart_context(const char *content_type,
     ctx->param_name = NULL;
     ctx->upload = NULL;
     ctx->level = level;
+    ctx->sink_eos = 0;
+    ctx->cte.type = CTE_NONE;
 
     return ctx;
 }
@@ -287,7 +730,7 @@ APREQ_DECLARE_PARSER(apreq_parse_multipart)
 
     case MFD_INIT:
         {
-            s = split_on_bdry(ctx->bb, ctx->in, NULL, ctx->bdry + 2);
+            s = split_on_bdry(ctx->bb, ctx->in, &ctx->init_match);
             if (s != APR_SUCCESS) {
                 apreq_brigade_setaside(ctx->in, pool);
                 apreq_brigade_setaside(ctx->bb, pool);
@@ -302,7 +745,7 @@ APREQ_DECLARE_PARSER(apreq_parse_multipart)
 
     case MFD_NEXTLINE:
         {
-            s = split_on_bdry(ctx->bb, ctx->in, NULL, CRLF);
+            s = split_on_bdry(ctx->bb, ctx->in, &ctx->crlf_match);
             if (s == APR_EOF) {
                 ctx->status = MFD_COMPLETE;
                 return APR_SUCCESS;
@@ -313,11 +756,10 @@ APREQ_DECLARE_PARSER(apreq_parse_multipart)
                 return s;
             }
             if (!APR_BRIGADE_EMPTY(ctx->bb)) {
-                char *line;
-                apr_size_t len;
-                apr_brigade_pflatten(ctx->bb, &line, &len, pool);
-
-                if (len >= 2 && strncmp(line, "--", 2) == 0) {
+                /* Look for the closing "--" in the buckets themselves;
+                 * flattening the line would cost an allocation per part.
+                 */
+                if (brigade_start_string(ctx->bb, "--") == APR_SUCCESS) {
                     APR_BRIGADE_CONCAT(bb, ctx->in);
                     ctx->status = MFD_COMPLETE;
                     return APR_SUCCESS;
@@ -400,46 +842,79 @@ APREQ_DECLARE_PARSER(apreq_parse_multipart)
 
             if (ct != NULL && strncmp(ct, "multipart/", 10) == 0) {
                 struct mfd_ctx *next_ctx;
+                const char *cid = NULL;
 
                 if (ctx->level >= MAX_LEVEL) {
                     ctx->status = MFD_ERROR;
                     goto mfd_parse_brigade;
                 }
 
-                next_ctx = create_multipart_context(ct, pool, ba,
-                                                    parser->brigade_limit,
-                                                    parser->temp_dir,
-                                                    ctx->level + 1);
-
-                next_ctx->param_name = "";
+                name = "";
+                nlen = 0;
 
                 if (cd != NULL) {
                     s = apreq_header_attribute(cd, "name", 4,
                                                &name, &nlen);
-                    if (s == APR_SUCCESS) {
-                        next_ctx->param_name
-                            = apr_pstrmemdup(pool, name, nlen);
-                    }
-                    else {
-                        const char *cid = apr_table_get(ctx->info,
-                                                        "Content-ID");
-                        if (cid != NULL)
-                            next_ctx->param_name = apr_pstrdup(pool, cid);
+                    if (s != APR_SUCCESS) {
+                        cid = apr_table_get(ctx->info, "Content-ID");
+                        name = (cid != NULL) ? cid : "";
+                        nlen = strlen(name);
                     }
+                }
 
+                if (!apreq_parser_wants(parser, name, nlen)) {
+                    ctx->status = MFD_SKIP;
+                    goto mfd_parse_brigade;
                 }
 
+                next_ctx = create_multipart_context(ct, pool, ba,
+                                                    parser->brigade_limit,
+                                                    parser->temp_dir,
+                                                    ctx->level + 1);
+
+                next_ctx->param_name = (cid != NULL)
+                    ? apr_pstrdup(pool, cid)
+                    : apr_pstrmemdup(pool, name, nlen);
+
                 ctx->next_parser = apreq_parser_make(pool, ba, ct,
                                                      apreq_parse_multipart,
                                                      parser->brigade_limit,
                                                      parser->temp_dir,
                                                      parser->hook,
                                                      next_ctx);
+                ctx->next_parser->parse_only = parser->parse_only;
+                ctx->next_parser->spool_writer = parser->spool_writer;
+                ctx->next_parser->size_hint = parser->size_hint;
+                ctx->next_parser->sink = parser->sink;
+                ctx->next_parser->decode_transfer_encoding
+                    = parser->decode_transfer_encoding;
                 ctx->status = MFD_MIXED;
                 goto mfd_parse_brigade;
 
             }
 
+            /* Only a leaf part's own data is decoded here */
+            ctx->cte.type = CTE_NONE;
+            if (parser->decode_transfer_encoding) {
+                const char *cte = apr_table_get(ctx->info,
+                                                "Content-Transfer-Encoding");
+                if (cte != NULL && strcasecmp(cte, "base64") == 0)
+                    ctx->cte.type = CTE_BASE64;
+                else if (cte != NULL
+                         && strcasecmp(cte, "quoted-printable") == 0)
+                    ctx->cte.type = CTE_QP;
+
+                if (ctx->cte.type != CTE_NONE) {
+                    ctx->cte.acc = 0;
+                    ctx->cte.n = 0;
+                    ctx->cte.done = 0;
+                    ctx->cte.nheld = 0;
+                    /* the data will reach the application decoded */
+                    apr_table_setn(ctx->info, "Content-Transfer-Encoding",
+                                   "binary");
+                }
+            }
+
             /* Look for a normal form-data part. */
 
             if (cd != NULL && strncmp(cd, "form-data", 9) == 0) {
@@ -449,6 +924,11 @@ APREQ_DECLARE_PARSER(apreq_parse_multipart)
                     goto mfd_parse_brigade;
                 }
 
+                if (!apreq_parser_wants(parser, name, nlen)) {
+                    ctx->status = MFD_SKIP;
+                    goto mfd_parse_brigade;
+                }
+
                 s = apreq_header_attribute(cd, "filename",
                                            8, &filename, &flen);
                 if (s == APR_SUCCESS) {
@@ -483,6 +963,10 @@ APREQ_DECLARE_PARSER(apreq_parse_multipart)
                 }
                 name = ctx->param_name;
                 nlen = strlen(name);
+                if (!apreq_parser_wants(parser, name, nlen)) {
+                    ctx->status = MFD_SKIP;
+                    goto mfd_parse_brigade;
+                }
                 param = apreq_param_make(pool, name, nlen,
                                          filename, flen);
                 apreq_param_tainted_on(param);
@@ -507,6 +991,10 @@ APREQ_DECLARE_PARSER(apreq_parse_multipart)
                     name = "";
                     nlen = 0;
                 }
+                if (!apreq_parser_wants(parser, name, nlen)) {
+                    ctx->status = MFD_SKIP;
+                    goto mfd_parse_brigade;
+                }
 
                 filename = "";
                 flen = 0;
@@ -530,7 +1018,7 @@ APREQ_DECLARE_PARSER(apreq_parse_multipart)
             apr_size_t len;
             apr_off_t off;
 
-            s = split_on_bdry(ctx->bb, ctx->in, ctx->pattern, ctx->bdry);
+            s = split_on_bdry(ctx->bb, ctx->in, &ctx->bdry_match);
 
             switch (s) {
 
@@ -540,7 +1028,10 @@ APREQ_DECLARE_PARSER(apreq_parse_multipart)
                 return s;
 
             case APR_SUCCESS:
-                s = apr_brigade_length(ctx->bb, 1, &off);
+                if (ctx->cte.type != CTE_NONE)
+                    s = mfd_decode(ctx, ba, 1);
+                if (s == APR_SUCCESS)
+                    s = apr_brigade_length(ctx->bb, 1, &off);
                 if (s != APR_SUCCESS) {
                     ctx->status = MFD_ERROR;
                     return s;
@@ -585,10 +1076,17 @@ APREQ_DECLARE_PARSER(apreq_parse_multipart)
         {
             apreq_param_t *param = ctx->upload;
 
-            s = split_on_bdry(ctx->bb, ctx->in, ctx->pattern, ctx->bdry);
+            s = split_on_bdry(ctx->bb, ctx->in, &ctx->bdry_match);
             switch (s) {
 
             case APR_INCOMPLETE:
+                if (ctx->cte.type != CTE_NONE) {
+                    s = mfd_decode(ctx, ba, 0);
+                    if (s != APR_SUCCESS) {
+                        ctx->status = MFD_ERROR;
+                        return s;
+                    }
+                }
                 if (parser->hook != NULL) {
                     s = apreq_hook_run(parser->hook, param, ctx->bb);
                     if (s != APR_SUCCESS) {
@@ -596,14 +1094,27 @@ APREQ_DECLARE_PARSER(apreq_parse_multipart)
                         return s;
                     }
                 }
+                if (parser->sink != NULL) {
+                    ctx->sink_eos = 0;
+                    s = mfd_sink(parser, ctx);
+                    if (s == APR_SUCCESS)
+                        apreq_brigade_setaside(ctx->in, pool);
+                    return (s == APR_SUCCESS) ? APR_INCOMPLETE : s;
+                }
                 apreq_brigade_setaside(ctx->bb, pool);
                 apreq_brigade_setaside(ctx->in, pool);
-                s = apreq_brigade_concat(pool, parser->temp_dir,
-                                         parser->brigade_limit,
-                                         param->upload, ctx->bb);
+                s = apreq_parser_spool(parser, pool, param->upload,
+                                       ctx->bb, 0);
                 return (s == APR_SUCCESS) ? APR_INCOMPLETE : s;
 
             case APR_SUCCESS:
+                if (ctx->cte.type != CTE_NONE) {
+                    s = mfd_decode(ctx, ba, 1);
+                    if (s != APR_SUCCESS) {
+                        ctx->status = MFD_ERROR;
+                        return s;
+                    }
+                }
                 if (parser->hook != NULL) {
                     APR_BRIGADE_INSERT_TAIL(ctx->bb, ctx->eos);
                     s = apreq_hook_run(parser->hook, param, ctx->bb);
@@ -614,13 +1125,21 @@ APREQ_DECLARE_PARSER(apreq_parse_multipart)
                     }
                 }
                 apreq_value_table_add(&param->v, t);
-                apreq_brigade_setaside(ctx->bb, pool);
-                s = apreq_brigade_concat(pool, parser->temp_dir,
-                                         parser->brigade_limit,
-                                         param->upload, ctx->bb);
-
-                if (s != APR_SUCCESS)
-                    return s;
+                if (parser->sink != NULL) {
+                    APR_BRIGADE_INSERT_TAIL(ctx->bb,
+                                            apr_bucket_eos_create(ba));
+                    ctx->sink_eos = 1;
+                    s = mfd_sink(parser, ctx);
+                    if (s != APR_SUCCESS)
+                        return s;
+                }
+                else {
+                    apreq_brigade_setaside(ctx->bb, pool);
+                    s = apreq_parser_spool(parser, pool, param->upload,
+                                           ctx->bb, 1);
+                    if (s != APR_SUCCESS)
+                        return s;
+                }
 
                 ctx->status = MFD_NEXTLINE;
                 goto mfd_parse_brigade;
@@ -634,8 +1153,46 @@ APREQ_DECLARE_PARSER(apreq_parse_multipart)
         break;  /* not reached */
 
 
+    case MFD_SINK:
+        {
+            /* the sink has yet to take all of the last chunk */
+            s = mfd_sink(parser, ctx);
+            if (s != APR_SUCCESS)
+                return s;
+
+            ctx->status = ctx->sink_eos ? MFD_NEXTLINE : MFD_UPLOAD;
+            goto mfd_parse_brigade;
+        }
+        break;  /* not reached */
+
+
+    case MFD_SKIP:
+        {
+            /* an unwanted part: drop its data as the boundary scan passes */
+            s = split_on_bdry(ctx->bb, ctx->in, &ctx->bdry_match);
+            apr_brigade_cleanup(ctx->bb);
+
+            switch (s) {
+
+            case APR_INCOMPLETE:
+                apreq_brigade_setaside(ctx->in, pool);
+                return s;
+
+            case APR_SUCCESS:
+                ctx->status = MFD_NEXTLINE;
+                goto mfd_parse_brigade;
+
+            default:
+                ctx->status = MFD_ERROR;
+                return s;
+            }
+        }
+        break;  /* not reached */
+
+
     case MFD_MIXED:
         {
+            ctx->next_parser->size_hint = parser->size_hint;
             s = apreq_parser_run(ctx->next_parser, t, ctx->in);
             switch (s) {
             case APR_SUCCESS:
@@ -643,8 +1200,9 @@ APREQ_DECLARE_PARSER(apreq_parse_multipart)
                 ctx->param_name = NULL;
                 goto mfd_parse_brigade;
             case APR_INCOMPLETE:
+            case APR_EAGAIN:
                 APR_BRIGADE_CONCAT(bb, ctx->in);
-                return APR_INCOMPLETE;
+                return s;
             default:
                 ctx->status = MFD_ERROR;
                 return s;
@@ -0,0 +1,292 @@
+/*
+**  Licensed to the Apache Software Foundation (ASF) under one or more
+** contributor license agreements.  See the NOTICE file distributed with
+** this work for additional information regarding copyright ownership.
+** The ASF licenses this file to You under the Apache License, Version 2.0
+** (the "License"); you may not use this file except in compliance with
+** the License.  You may obtain a copy of the License at
+**
+**      http://www.apache.org/licenses/LICENSE-2.0
+**
+**  Unless required by applicable law or agreed to in writing, software
+**  distributed under the License is distributed on an "AS IS" BASIS,
+**  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+**  See the License for the specific language governing permissions and
+**  limitations under the License.
+*/
+
+#include "apreq_parser.h"
+#include "apreq_util.h"
+#include "apreq_error.h"
+
+
+#define PARSER_STATUS_CHECK(PREFIX)   do {         \
+    if (ctx->status == PREFIX##_ERROR)             \
+        return APREQ_ERROR_GENERAL;                \
+    else if (ctx->status == PREFIX##_COMPLETE)     \
+        return APR_SUCCESS;                        \
+    else if (bb == NULL)                           \
+        return APR_INCOMPLETE;                     \
+} while (0);
+
+
+/********************* application/x-ndjson *********************/
+
+struct ndjson_ctx {
+    apr_bucket_brigade          *in;        /* input not yet split */
+    apr_bucket_brigade          *out;       /* the record being read */
+    const apreq_index_pattern_t *nl;
+    apreq_param_t               *param;     /* record handed to the sink */
+    apr_size_t                   rlen;      /* bytes in out */
+    int                          sink_eos;  /* out ends the record */
+    enum {
+        NDJSON_RECORD,
+        NDJSON_SINK,
+        NDJSON_COMPLETE,
+        NDJSON_ERROR
+    }                            status;
+};
+
+/*
+ * Splits a '\r' at the end of out into a bucket of its own, and
+ * returns that bucket, or NULL if out doesn't end with one.
+ */
+static apr_bucket *ndjson_cr(apr_bucket_brigade *out)
+{
+    apr_bucket *e;
+    const char *data;
+    apr_size_t dlen;
+
+    if (APR_BRIGADE_EMPTY(out))
+        return NULL;
+    e = APR_BRIGADE_LAST(out);
+    if (APR_BUCKET_IS_METADATA(e)
+        || apr_bucket_read(e, &data, &dlen, APR_BLOCK_READ) != APR_SUCCESS
+        || dlen == 0 || data[dlen - 1] != '\r')
+        return NULL;
+
+    if (dlen > 1) {
+        apr_bucket_split(e, dlen - 1);
+        e = APR_BUCKET_NEXT(e);
+    }
+    return e;
+}
+
+/*
+ * Offers what out holds of the current record to the parser's hooks,
+ * then to its sink.  Whatever the sink leaves there is set aside, to
+ * be offered again, to the sink alone, on the next run.  A '\r' ending
+ * a chunk is held back, as the newline that follows would make it part
+ * of the line ending.
+ */
+static apr_status_t ndjson_sink(apreq_parser_t *parser,
+                                struct ndjson_ctx *ctx)
+{
+    apr_bucket *cr = ctx->sink_eos ? NULL : ndjson_cr(ctx->out);
+    apr_status_t s;
+
+    if (cr != NULL)
+        APR_BUCKET_REMOVE(cr);
+
+    if (ctx->param == NULL) {
+        ctx->param = apreq_param_make(parser->pool, APREQ_NDJSON_RECORD,
+                                      strlen(APREQ_NDJSON_RECORD), "", 0);
+        apreq_param_tainted_on(ctx->param);
+    }
+
+    if (parser->hook != NULL && ctx->status != NDJSON_SINK) {
+        s = apreq_hook_run(parser->hook, ctx->param, ctx->out);
+        if (s != APR_SUCCESS) {
+            if (cr != NULL)
+                apr_bucket_destroy(cr);
+            ctx->status = NDJSON_ERROR;
+            return s;
+        }
+    }
+
+    s = apreq_sink_run(parser->sink, ctx->param, ctx->out);
+    if (s == APR_SUCCESS && !APR_BRIGADE_EMPTY(ctx->out))
+        s = APR_EAGAIN;
+    if (cr != NULL)
+        APR_BRIGADE_INSERT_TAIL(ctx->out, cr);
+
+    switch (s) {
+    case APR_SUCCESS:
+        ctx->rlen = (cr != NULL);
+        if (ctx->sink_eos)
+            ctx->param = NULL;
+        return s;
+    case APR_EAGAIN:
+        apreq_brigade_setaside(ctx->out, parser->pool);
+        apreq_brigade_setaside(ctx->in, parser->pool);
+        ctx->status = NDJSON_SINK;
+        return s;
+    default:
+        ctx->status = NDJSON_ERROR;
+        return s;
+    }
+}
+
+/*
+ * Ends the record in out, less the '\r' of a CRLF line ending; empty
+ * lines are dropped.
+ */
+static apr_status_t ndjson_record(apreq_parser_t *parser,
+                                  struct ndjson_ctx *ctx, apr_table_t *t)
+{
+    apreq_param_t *param;
+    apreq_value_t *v;
+    apr_bucket *cr = ndjson_cr(ctx->out);
+    apr_size_t len;
+    apr_status_t s;
+
+    if (cr != NULL) {
+        apr_bucket_delete(cr);
+        --ctx->rlen;
+    }
+    len = ctx->rlen;
+
+    if (parser->sink != NULL) {
+        if (ctx->param == NULL && ctx->rlen == 0)
+            return APR_SUCCESS;
+        APR_BRIGADE_INSERT_TAIL(ctx->out,
+                                apr_bucket_eos_create(parser->bucket_alloc));
+        ctx->sink_eos = 1;
+        return ndjson_sink(parser, ctx);
+    }
+
+    if (len == 0)
+        return APR_SUCCESS;
+
+    param = apreq_param_make(parser->pool, APREQ_NDJSON_RECORD,
+                             strlen(APREQ_NDJSON_RECORD), NULL, len);
+    *(const apreq_value_t **)&v = &param->v;
+
+    s = apr_brigade_flatten(ctx->out, v->data, &len);
+    apr_brigade_cleanup(ctx->out);
+    ctx->rlen = 0;
+    if (s != APR_SUCCESS)
+        return s;
+    v->data[len] = 0;
+    v->dlen = len;
+
+    apreq_param_tainted_on(param);
+    apreq_param_charset_set(param, apreq_charset_divine(v->data, len));
+
+    if (parser->hook != NULL) {
+        s = apreq_hook_run(parser->hook, param, NULL);
+        if (s != APR_SUCCESS)
+            return s;
+    }
+    apreq_value_table_add(&param->v, t);
+    return APR_SUCCESS;
+}
+
+APREQ_DECLARE_PARSER(apreq_parse_ndjson)
+{
+    apr_pool_t *pool = parser->pool;
+    struct ndjson_ctx *ctx = parser->ctx;
+    apr_status_t s;
+
+    if (ctx == NULL) {
+        parser->ctx = ctx = apr_palloc(pool, sizeof *ctx);
+        ctx->in = apr_brigade_create(pool, parser->bucket_alloc);
+        ctx->out = apr_brigade_create(pool, parser->bucket_alloc);
+        ctx->nl = apreq_index_precompile(pool, "\n", 1);
+        ctx->param = NULL;
+        ctx->rlen = 0;
+        ctx->sink_eos = 0;
+        ctx->status = NDJSON_RECORD;
+    }
+
+    PARSER_STATUS_CHECK(NDJSON);
+    APR_BRIGADE_CONCAT(ctx->in, bb);
+
+    if (ctx->status == NDJSON_SINK) {
+        /* the sink has yet to take all of the last chunk */
+        s = ndjson_sink(parser, ctx);
+        if (s != APR_SUCCESS)
+            return s;
+        ctx->status = NDJSON_RECORD;
+    }
+
+    while (!APR_BRIGADE_EMPTY(ctx->in)) {
+        apr_bucket *e = APR_BRIGADE_FIRST(ctx->in);
+        const char *data;
+        apr_size_t dlen;
+        apr_ssize_t idx;
+
+        if (APR_BUCKET_IS_EOS(e)) {
+            /* the last record needn't end with a newline */
+            s = ndjson_record(parser, ctx, t);
+            if (s != APR_SUCCESS) {
+                if (s != APR_EAGAIN)
+                    ctx->status = NDJSON_ERROR;
+                return s;
+            }
+            APR_BRIGADE_CONCAT(bb, ctx->in);
+            ctx->status = NDJSON_COMPLETE;
+            return APR_SUCCESS;
+        }
+        if (APR_BUCKET_IS_METADATA(e)) {
+            apr_bucket_delete(e);
+            continue;
+        }
+
+        s = apr_bucket_read(e, &data, &dlen, APR_BLOCK_READ);
+        if (s != APR_SUCCESS) {
+            ctx->status = NDJSON_ERROR;
+            return s;
+        }
+        if (dlen == 0) {
+            apr_bucket_delete(e);
+            continue;
+        }
+
+        idx = apreq_index_match(ctx->nl, data, dlen, APREQ_MATCH_FULL);
+
+        if (idx < 0) {
+            APR_BUCKET_REMOVE(e);
+            APR_BRIGADE_INSERT_TAIL(ctx->out, e);
+            ctx->rlen += dlen;
+
+            if (parser->sink != NULL) {
+                /* records of any length stream through the sink */
+                ctx->sink_eos = 0;
+                s = ndjson_sink(parser, ctx);
+                if (s != APR_SUCCESS)
+                    return s;
+            }
+            else if (ctx->rlen > parser->brigade_limit) {
+                ctx->status = NDJSON_ERROR;
+                return APREQ_ERROR_OVERLIMIT;
+            }
+            continue;
+        }
+
+        if (idx > 0) {
+            apr_bucket_split(e, idx);
+            APR_BUCKET_REMOVE(e);
+            APR_BRIGADE_INSERT_TAIL(ctx->out, e);
+            ctx->rlen += idx;
+            e = APR_BRIGADE_FIRST(ctx->in);
+        }
+        if (dlen - idx > 1)
+            apr_bucket_split(e, 1);
+        apr_bucket_delete(e);   /* the newline */
+
+        if (parser->sink == NULL && ctx->rlen > parser->brigade_limit) {
+            ctx->status = NDJSON_ERROR;
+            return APREQ_ERROR_OVERLIMIT;
+        }
+        s = ndjson_record(parser, ctx, t);
+        if (s != APR_SUCCESS) {
+            if (s != APR_EAGAIN)
+                ctx->status = NDJSON_ERROR;
+            return s;
+        }
+    }
+
+    apreq_brigade_setaside(ctx->out, pool);
+    return APR_INCOMPLETE;
+}
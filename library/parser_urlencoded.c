@@ -38,9 +38,11 @@ struct url_ctx {
     enum {
         URL_NAME,
         URL_VALUE,
+        URL_SKIP,
         URL_COMPLETE,
         URL_ERROR
     }                   status;
+    int                 lazy;
 };
 
 
@@ -49,7 +51,8 @@ struct url_ctx {
 static apr_status_t split_urlword(apreq_param_t **p, apr_pool_t *pool,
                                   apr_bucket_brigade *bb,
                                   apr_size_t nlen,
-                                  apr_size_t vlen)
+                                  apr_size_t vlen,
+                                  int lazy)
 {
     apreq_param_t *param;
     apreq_value_t *v;
@@ -58,7 +61,7 @@ static apr_status_t split_urlword(apreq_param_t **p, apr_pool_t *pool,
     struct iovec vec[APREQ_DEFAULT_NELTS];
     apr_array_header_t arr;
     apr_size_t mark;
-    apreq_charset_t charset;
+    apreq_charset_t charset, name_charset;
 
     if (nlen == 0)
         return APR_EBADARG;
@@ -116,21 +119,39 @@ static apr_status_t split_urlword(apreq_param_t **p, apr_pool_t *pool,
 
     }
 
-    s = apreq_decodev(v->data, &vlen,
-                      (struct iovec *)arr.elts + mark, arr.nelts - mark);
-    if (s != APR_SUCCESS)
-        return s;
+    if (lazy) {
+        /* copy the raw value; apreq_param_value_decode() does the rest */
+        struct iovec *iov = (struct iovec *)arr.elts + mark;
+        struct iovec *const end = (struct iovec *)arr.elts + arr.nelts;
+        char *d = v->data;
 
-    charset = apreq_charset_divine(v->data, vlen);
+        for (; iov < end; ++iov) {
+            memcpy(d, iov->iov_base, iov->iov_len);
+            d += iov->iov_len;
+        }
+        *d = 0;
+        vlen = d - v->data;
+        charset = APREQ_CHARSET_ASCII;
+        if (vlen > 0)
+            APREQ_FLAGS_ON(param->flags, APREQ_ENCODED);
+    }
+    else {
+        s = apreq_decodev_charset(v->data, &vlen, &charset,
+                                  (struct iovec *)arr.elts + mark,
+                                  arr.nelts - mark);
+        if (s != APR_SUCCESS)
+            return s;
+    }
 
     v->name = v->data + vlen + 1;
     v->dlen = vlen;
 
-    s = apreq_decodev(v->name, &nlen, (struct iovec *)arr.elts, mark);
+    s = apreq_decodev_charset(v->name, &nlen, &name_charset,
+                              (struct iovec *)arr.elts, mark);
     if (s != APR_SUCCESS)
         return s;
 
-    switch (apreq_charset_divine(v->name, nlen)) {
+    switch (name_charset) {
     case APREQ_CHARSET_UTF8:
         if (charset == APREQ_CHARSET_ASCII)
             charset = APREQ_CHARSET_UTF8;
@@ -156,7 +177,37 @@ static apr_status_t split_urlword(apreq_param_t **p, apr_pool_t *pool,
     return APR_SUCCESS;
 }
 
-APREQ_DECLARE_PARSER(apreq_parse_urlencoded)
+/* Deletes the buckets in front of e. */
+static void discard_front(apr_bucket_brigade *bb, apr_bucket *e)
+{
+    apr_bucket *f;
+
+    while ((f = APR_BRIGADE_FIRST(bb)) != e)
+        apr_bucket_delete(f);
+}
+
+/* Decodes the name at the front of bb and checks it against parse_only. */
+static int url_name_wanted(apreq_parser_t *parser, apr_bucket_brigade *bb,
+                           apr_size_t nlen)
+{
+    char buf[256], *name = buf;
+    apr_size_t len = nlen;
+
+    if (nlen >= sizeof buf)
+        name = apr_palloc(parser->pool, nlen + 1);
+
+    if (apr_brigade_flatten(bb, name, &len) != APR_SUCCESS || len != nlen)
+        return 1;
+
+    /* a malformed name can't be on the list */
+    if (apreq_decode(name, &len, name, nlen) != APR_SUCCESS)
+        return 0;
+
+    return apreq_parser_wants(parser, name, len);
+}
+
+static apr_status_t parse_urlencoded(apreq_parser_t *parser, apr_table_t *t,
+                                     apr_bucket_brigade *bb, int lazy)
 {
     apr_pool_t *pool = parser->pool;
     apr_bucket *e;
@@ -167,6 +218,7 @@ APREQ_DECLARE_PARSER(apreq_parse_urlencoded)
         ctx->bb = apr_brigade_create(pool, parser->bucket_alloc);
         parser->ctx = ctx;
         ctx->status = URL_NAME;
+        ctx->lazy = lazy;
     }
     else
         ctx = parser->ctx;
@@ -190,8 +242,14 @@ APREQ_DECLARE_PARSER(apreq_parse_urlencoded)
             if (ctx->status == URL_NAME) {
                 s = APR_SUCCESS;
             }
+            else if (ctx->status == URL_SKIP) {
+                discard_front(ctx->bb, e);
+                ctx->status = URL_COMPLETE;
+                s = APR_SUCCESS;
+            }
             else {
-                s = split_urlword(&param, pool, ctx->bb, ctx->nlen, ctx->vlen);
+                s = split_urlword(&param, pool, ctx->bb, ctx->nlen, ctx->vlen,
+                                  ctx->lazy);
                 if (parser->hook != NULL && s == APR_SUCCESS)
                     s = apreq_hook_run(parser->hook, param, NULL);
 
@@ -228,6 +286,13 @@ APREQ_DECLARE_PARSER(apreq_parse_urlencoded)
                     off = 0;
                     e = APR_BUCKET_NEXT(e);
                     ctx->status = URL_VALUE;
+                    if (parser->parse_only != NULL
+                        && !url_name_wanted(parser, ctx->bb, ctx->nlen))
+                    {
+                        discard_front(ctx->bb, e);
+                        ctx->status = URL_SKIP;
+                        ctx->nlen = 0;
+                    }
                     goto parse_url_bucket;
                 default:
                     ++ctx->nlen;
@@ -243,7 +308,7 @@ APREQ_DECLARE_PARSER(apreq_parse_urlencoded)
                 case ';':
                     apr_bucket_split(e, off);
                     s = split_urlword(&param, pool, ctx->bb,
-                                      ctx->nlen, ctx->vlen);
+                                      ctx->nlen, ctx->vlen, ctx->lazy);
                     if (parser->hook != NULL && s == APR_SUCCESS)
                         s = apreq_hook_run(parser->hook, param, NULL);
 
@@ -264,12 +329,42 @@ APREQ_DECLARE_PARSER(apreq_parse_urlencoded)
                 }
             }
             break;
+
+        case URL_SKIP:
+            while (off < dlen) {
+                switch (data[off++]) {
+                case '&':
+                case ';':
+                    apr_bucket_split(e, off);
+                    discard_front(ctx->bb, APR_BUCKET_NEXT(e));
+                    ctx->status = URL_NAME;
+                    e = APR_BRIGADE_SENTINEL(ctx->bb);
+                    goto parse_url_brigade;
+                }
+            }
+            break;
+
         default:
             ; /* not reached */
         }
     }
+
+    /* nothing held back belongs to a field we want */
+    if (ctx->status == URL_SKIP)
+        apr_brigade_cleanup(ctx->bb);
+
     apreq_brigade_setaside(ctx->bb, pool);
     return APR_INCOMPLETE;
 }
 
+APREQ_DECLARE_PARSER(apreq_parse_urlencoded)
+{
+    return parse_urlencoded(parser, t, bb, 0);
+}
+
+APREQ_DECLARE_PARSER(apreq_parse_urlencoded_lazy)
+{
+    return parse_urlencoded(parser, t, bb, 1);
+}
+
 
@@ -0,0 +1,887 @@
+/*
+**  Licensed to the Apache Software Foundation (ASF) under one or more
+** contributor license agreements.  See the NOTICE file distributed with
+** this work for additional information regarding copyright ownership.
+** The ASF licenses this file to You under the Apache License, Version 2.0
+** (the "License"); you may not use this file except in compliance with
+** the License.  You may obtain a copy of the License at
+**
+**      http://www.apache.org/licenses/LICENSE-2.0
+**
+**  Unless required by applicable law or agreed to in writing, software
+**  distributed under the License is distributed on an "AS IS" BASIS,
+**  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+**  See the License for the specific language governing permissions and
+**  limitations under the License.
+*/
+
+/*
+ * Throughput benchmarks for the parser hot paths.  These are not part
+ * of the test suite; run "make benchmark" in library/t, optionally passing
+ * benchmark names on the command line (./bench bdry_scan).
+ */
+
+#include "apreq_parser.h"
+#include "apreq_util.h"
+#include "apreq_error.h"
+#include "apr_strings.h"
+#include "apr_strmatch.h"
+#include "apr_time.h"
+#include "apr_thread_proc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CRLF "\015\012"
+
+#define BODY_SIZE   (16 * 1024 * 1024)
+#define BUCKET_SIZE 8000
+#define ROUNDS      8
+#define SPOOL_SIZE  ((apr_uint64_t)2 * 1024 * 1024 * 1024)
+
+#ifdef WIN32
+#define LIST_SEP ";"
+#else
+#define LIST_SEP ":"
+#endif
+
+static apr_pool_t *p;
+
+static const char bdry[] = CRLF "--AaB03x";
+
+static double mb_per_sec(apr_uint64_t bytes, apr_time_t usec)
+{
+    if (usec <= 0)
+        usec = 1;
+    return (double)bytes / (1024 * 1024) / ((double)usec / APR_USEC_PER_SEC);
+}
+
+static void report(const char *name, const char *variant,
+                   apr_uint64_t bytes, apr_time_t usec)
+{
+    printf("%-12s %-30s %10.1f MB/s\n", name, variant,
+           mb_per_sec(bytes, usec));
+}
+
+/* Pseudo-random binary body, reproducible across runs. */
+static char *make_body(apr_size_t len)
+{
+    char *body = apr_palloc(p, len);
+    apr_uint32_t x = 2463534242U;
+    apr_size_t i;
+
+    for (i = 0; i < len; ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        body[i] = (char)x;
+    }
+    return body;
+}
+
+/* The per-bucket scan split_on_bdry() did before apreq_index_precompile(). */
+static apr_ssize_t strmatch_index(const apr_strmatch_pattern *pattern,
+                                  const char *buf, apr_size_t len)
+{
+    const apr_size_t blen = sizeof bdry - 1;
+    const char *match;
+    apr_ssize_t idx;
+
+    if (len < blen)
+        return apreq_index(buf, len, bdry, blen, APREQ_MATCH_PARTIAL);
+
+    match = apr_strmatch(pattern, buf, len);
+    if (match != NULL)
+        return match - buf;
+
+    idx = apreq_index(buf + len - blen, blen, bdry, blen, APREQ_MATCH_PARTIAL);
+    return idx >= 0 ? idx + (apr_ssize_t)(len - blen) : -1;
+}
+
+static void bench_bdry_scan(void)
+{
+    const apr_size_t blen = sizeof bdry - 1;
+    const apr_strmatch_pattern *sm = apr_strmatch_precompile(p, bdry, 1);
+    const apreq_index_pattern_t *ip = apreq_index_precompile(p, bdry, blen);
+    const char *body = make_body(BODY_SIZE);
+    apr_size_t off, hits_old = 0, hits_new = 0;
+    apr_time_t start;
+    int r;
+
+    start = apr_time_now();
+    for (r = 0; r < ROUNDS; ++r)
+        for (off = 0; off < BODY_SIZE; off += BUCKET_SIZE)
+            if (strmatch_index(sm, body + off, BUCKET_SIZE) >= 0)
+                ++hits_old;
+    report("bdry_scan", "apr_strmatch + apreq_index",
+           (apr_uint64_t)BODY_SIZE * ROUNDS, apr_time_now() - start);
+
+    start = apr_time_now();
+    for (r = 0; r < ROUNDS; ++r)
+        for (off = 0; off < BODY_SIZE; off += BUCKET_SIZE)
+            if (apreq_index_match(ip, body + off, BUCKET_SIZE,
+                                  APREQ_MATCH_PARTIAL) >= 0)
+                ++hits_new;
+    report("bdry_scan", "apreq_index_match",
+           (apr_uint64_t)BODY_SIZE * ROUNDS, apr_time_now() - start);
+
+    if (hits_old != hits_new)
+        printf("bdry_scan: MISMATCH (%lu vs %lu hits)\n",
+               (unsigned long)hits_old, (unsigned long)hits_new);
+}
+
+/* Feeds body to a fresh multipart parser in bsize-byte buckets. */
+static apr_status_t run_multipart(const char *body, apr_size_t len,
+                                  apr_size_t bsize,
+                                  const apr_array_header_t *only,
+                                  apreq_spool_writer_t *writer)
+{
+    apr_bucket_alloc_t *ba = apr_bucket_alloc_create(p);
+    apr_bucket_brigade *bb = apr_brigade_create(p, ba);
+    apr_table_t *t = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    apreq_parser_t *parser;
+    apr_size_t off;
+    apr_status_t s = APR_INCOMPLETE;
+
+    parser = apreq_parser_make(p, ba,
+                               "multipart/form-data; boundary=AaB03x",
+                               apreq_parse_multipart,
+                               APREQ_DEFAULT_BRIGADE_LIMIT, NULL, NULL, NULL);
+    parser->parse_only = only;
+    parser->spool_writer = writer;
+
+    for (off = 0; off < len; off += bsize) {
+        apr_size_t n = len - off < bsize ? len - off : bsize;
+        APR_BRIGADE_INSERT_TAIL(bb,
+            apr_bucket_immortal_create(body + off, n, ba));
+        if (off + n == len)
+            APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+        s = apreq_parser_run(parser, t, bb);
+        if (s != APR_INCOMPLETE)
+            break;
+    }
+    return s;
+}
+
+static char *make_upload(const char *content, apr_size_t clen,
+                         apr_size_t *len)
+{
+    static const char head[] =
+        "--AaB03x" CRLF
+        "content-disposition: form-data; name=\"upload\"; "
+        "filename=\"bench.bin\"" CRLF
+        "content-type: application/octet-stream" CRLF CRLF;
+    static const char tail[] = CRLF "--AaB03x--" CRLF;
+    char *body = apr_palloc(p, sizeof head + clen + sizeof tail);
+
+    memcpy(body, head, sizeof head - 1);
+    memcpy(body + sizeof head - 1, content, clen);
+    memcpy(body + sizeof head - 1 + clen, tail, sizeof tail - 1);
+    *len = sizeof head - 1 + clen + sizeof tail - 1;
+    return body;
+}
+
+static void bench_multipart(void)
+{
+    apr_size_t len;
+    char *body = make_upload(make_body(BODY_SIZE), BODY_SIZE, &len);
+    apr_time_t start = apr_time_now();
+    int r;
+
+    for (r = 0; r < ROUNDS; ++r) {
+        apr_pool_t *saved = p;
+        apr_status_t s;
+
+        apr_pool_create(&p, saved);
+        s = run_multipart(body, len, BUCKET_SIZE, NULL, NULL);
+        apr_pool_destroy(p);
+        p = saved;
+
+        if (s != APR_SUCCESS) {
+            printf("multipart: parser failed (%d)\n", s);
+            return;
+        }
+    }
+    report("multipart", "apreq_parse_multipart",
+           (apr_uint64_t)len * ROUNDS, apr_time_now() - start);
+}
+
+/* The same upload, when the application only reads some other field. */
+static void bench_parse_only(void)
+{
+    apr_size_t len;
+    char *body = make_upload(make_body(BODY_SIZE), BODY_SIZE, &len);
+    apr_array_header_t *only = apr_array_make(p, 1, sizeof(char *));
+    apr_time_t start = apr_time_now();
+    int r;
+
+    *(const char **)apr_array_push(only) = "title";
+
+    for (r = 0; r < ROUNDS; ++r) {
+        apr_pool_t *saved = p;
+        apr_status_t s;
+
+        apr_pool_create(&p, saved);
+        s = run_multipart(body, len, BUCKET_SIZE, only, NULL);
+        apr_pool_destroy(p);
+        p = saved;
+
+        if (s != APR_SUCCESS) {
+            printf("parse_only: parser failed (%d)\n", s);
+            return;
+        }
+    }
+    report("parse_only", "upload skipped",
+           (apr_uint64_t)len * ROUNDS, apr_time_now() - start);
+}
+
+/*
+ * Spooling a large upload with the writes done in place, then queued
+ * on an asynchronous spool writer.
+ */
+static void bench_async_spool(void)
+{
+    apr_size_t len;
+    char *body = make_upload(make_body(BODY_SIZE), BODY_SIZE, &len);
+    int async, r;
+
+    for (async = 0; async <= 1; ++async) {
+        apr_time_t start = apr_time_now();
+
+        for (r = 0; r < ROUNDS; ++r) {
+            apr_pool_t *saved = p;
+            apr_status_t s;
+
+            apr_pool_create(&p, saved);
+            s = run_multipart(body, len, BUCKET_SIZE, NULL, async
+                              ? apreq_spool_writer_make(p, 0) : NULL);
+            apr_pool_destroy(p);
+            p = saved;
+
+            if (s != APR_SUCCESS) {
+                printf("async_spool: parser failed (%d)\n", s);
+                return;
+            }
+        }
+        report("async_spool", async ? "queued on spool writer"
+                                    : "written in place",
+               (apr_uint64_t)len * ROUNDS, apr_time_now() - start);
+    }
+}
+
+/*
+ * Write syscalls made by this process so far, as counted in
+ * /proc/self/io (Linux), or 0 where that is not available.  Seeks are
+ * not counted there; the spool path no longer makes any.
+ */
+static apr_uint64_t write_syscalls(void)
+{
+    FILE *f = fopen("/proc/self/io", "r");
+    char line[128];
+    apr_uint64_t n = 0;
+
+    if (f == NULL)
+        return 0;
+    while (fgets(line, sizeof line, f) != NULL)
+        if (strncmp(line, "syscw:", 6) == 0)
+            n = apr_strtoi64(line + 6, NULL, 10);
+    fclose(f);
+    return n;
+}
+
+/* Streams a SPOOL_SIZE upload through the multipart parser. */
+static void bench_spool_one(const char *variant, int async)
+{
+    static const char head[] =
+        "--AaB03x" CRLF
+        "content-disposition: form-data; name=\"upload\"; "
+        "filename=\"bench.bin\"" CRLF CRLF;
+    static const char tail[] = CRLF "--AaB03x--" CRLF;
+    apr_pool_t *saved = p;
+    apr_bucket_alloc_t *ba;
+    apr_bucket_brigade *bb;
+    apr_table_t *t;
+    apreq_parser_t *parser;
+    apr_uint64_t off, chunks = 0, calls = write_syscalls();
+    apr_time_t start = apr_time_now();
+    apr_status_t s;
+    char *chunk;
+
+    apr_pool_create(&p, saved);
+    ba = apr_bucket_alloc_create(p);
+    bb = apr_brigade_create(p, ba);
+    t = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    chunk = make_body(BUCKET_SIZE);
+    parser = apreq_parser_make(p, ba, "multipart/form-data; boundary=AaB03x",
+                               apreq_parse_multipart,
+                               APREQ_DEFAULT_BRIGADE_LIMIT, NULL, NULL, NULL);
+    if (async)
+        parser->spool_writer = apreq_spool_writer_make(p, 0);
+
+    APR_BRIGADE_INSERT_TAIL(bb,
+        apr_bucket_immortal_create(head, sizeof head - 1, ba));
+    s = apreq_parser_run(parser, t, bb);
+
+    for (off = 0; off < SPOOL_SIZE && s == APR_INCOMPLETE;
+         off += BUCKET_SIZE, ++chunks) {
+        APR_BRIGADE_INSERT_TAIL(bb,
+            apr_bucket_immortal_create(chunk, BUCKET_SIZE, ba));
+        s = apreq_parser_run(parser, t, bb);
+    }
+
+    APR_BRIGADE_INSERT_TAIL(bb,
+        apr_bucket_immortal_create(tail, sizeof tail - 1, ba));
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+    if (s == APR_INCOMPLETE)
+        s = apreq_parser_run(parser, t, bb);
+
+    report("spool", variant, off, apr_time_now() - start);
+    calls = write_syscalls() - calls;
+    printf("%-12s %-30s %10.2f writes per chunk\n", "spool", variant,
+           chunks ? (double)calls / chunks : 0.0);
+
+    apr_pool_destroy(p);
+    p = saved;
+
+    if (s != APR_SUCCESS)
+        printf("spool: parser failed (%d)\n", s);
+}
+
+static void bench_spool(void)
+{
+    bench_spool_one("2GB written in place", 0);
+    bench_spool_one("2GB queued on spool writer", 1);
+}
+
+/*
+ * Many uploads just past APREQ_DEFAULT_BRIGADE_LIMIT, one request pool
+ * each, so every one of them needs a spool file.
+ */
+static void bench_tempfile_pool(void)
+{
+    apr_size_t clen = APREQ_DEFAULT_BRIGADE_LIMIT + 4096, len;
+    char *body = make_upload(make_body(clen), clen, &len);
+    apr_pool_t *gp;
+    int pooled, r;
+
+    for (pooled = 0; pooled <= 1; ++pooled) {
+        apr_time_t start;
+
+        apr_pool_create(&gp, p);
+        apreq_tempfile_pool_init(gp, pooled ? 4 : 0);
+        start = apr_time_now();
+
+        for (r = 0; r < 1000; ++r) {
+            apr_pool_t *saved = p;
+            apr_status_t s;
+
+            apr_pool_create(&p, saved);
+            s = run_multipart(body, len, BUCKET_SIZE, NULL, NULL);
+            apr_pool_destroy(p);
+            p = saved;
+
+            if (s != APR_SUCCESS) {
+                printf("tempfile: parser failed (%d)\n", s);
+                apr_pool_destroy(gp);
+                return;
+            }
+        }
+        report("tempfile", pooled ? "1000 uploads, pooled files"
+                                  : "1000 uploads, mkstemp",
+               (apr_uint64_t)len * 1000, apr_time_now() - start);
+        apr_pool_destroy(gp);
+    }
+}
+
+#if APR_HAS_THREADS
+
+#define STRIPE_THREADS 4
+#define STRIPE_UPLOADS 2
+#define STRIPE_SIZE    (32 * 1024 * 1024)
+
+static char stripe_chunk[64 * 1024];
+
+/* Spools STRIPE_UPLOADS uploads into temp_dir, syncing each to disk. */
+static void * APR_THREAD_FUNC stripe_thread(apr_thread_t *t, void *data)
+{
+    const char *temp_dir = data;
+    apr_status_t s = APR_SUCCESS;
+    int u;
+
+    for (u = 0; u < STRIPE_UPLOADS && s == APR_SUCCESS; ++u) {
+        apr_pool_t *tp;
+        apr_bucket_alloc_t *ba;
+        apr_bucket_brigade *out, *in;
+        apr_size_t off;
+
+        apr_pool_create(&tp, NULL);
+        ba = apr_bucket_alloc_create(tp);
+        out = apr_brigade_create(tp, ba);
+        in = apr_brigade_create(tp, ba);
+
+        for (off = 0; off < STRIPE_SIZE && s == APR_SUCCESS;
+             off += sizeof stripe_chunk)
+        {
+            APR_BRIGADE_INSERT_TAIL(in,
+                apr_bucket_immortal_create(stripe_chunk,
+                                           sizeof stripe_chunk, ba));
+            s = apreq_brigade_concat(tp, temp_dir,
+                                     APREQ_DEFAULT_BRIGADE_LIMIT, out, in);
+        }
+        if (s == APR_SUCCESS)
+            s = apr_file_datasync(apreq_brigade_spoolfile(out));
+        apr_pool_destroy(tp);
+    }
+
+    apr_thread_exit(t, s);
+    return NULL;
+}
+
+/*
+ * Aggregate spool throughput of STRIPE_THREADS concurrent uploads over
+ * the first 1, 2, ... of the directories in APREQ_BENCH_TEMP_DIRS (a
+ * PATH-style list, ideally one per device).  It should scale with the
+ * number of devices until something else becomes the bottleneck.
+ */
+static void bench_stripe(void)
+{
+    const char *env = getenv("APREQ_BENCH_TEMP_DIRS");
+    apr_array_header_t *dirs;
+    int k, i;
+
+    if (env == NULL || apr_filepath_list_split(&dirs, env, p) != APR_SUCCESS) {
+        printf("stripe: set APREQ_BENCH_TEMP_DIRS to a list of spool "
+               "directories\n");
+        return;
+    }
+
+    for (k = 1; k <= dirs->nelts; ++k) {
+        apr_thread_t *t[STRIPE_THREADS];
+        const char *temp_dir = ((const char **)dirs->elts)[0];
+        apr_status_t s, rv = APR_SUCCESS;
+        apr_time_t start;
+        char variant[64];
+
+        for (i = 1; i < k; ++i)
+            temp_dir = apr_pstrcat(p, temp_dir, LIST_SEP,
+                                   ((const char **)dirs->elts)[i], NULL);
+
+        start = apr_time_now();
+        for (i = 0; i < STRIPE_THREADS; ++i)
+            apr_thread_create(&t[i], NULL, stripe_thread, (void *)temp_dir, p);
+        for (i = 0; i < STRIPE_THREADS; ++i) {
+            apr_thread_join(&s, t[i]);
+            if (s != APR_SUCCESS)
+                rv = s;
+        }
+
+        apr_snprintf(variant, sizeof variant, "%d uploads, %d temp dirs",
+                     STRIPE_THREADS, k);
+        report("stripe", variant,
+               (apr_uint64_t)STRIPE_THREADS * STRIPE_UPLOADS * STRIPE_SIZE,
+               apr_time_now() - start);
+        if (rv != APR_SUCCESS) {
+            printf("stripe: spooling failed (%d)\n", rv);
+            return;
+        }
+    }
+}
+
+#else
+
+static void bench_stripe(void)
+{
+    printf("stripe: needs threads\n");
+}
+
+#endif
+
+/* 1MB uploads spooled to a temp file, then to memory. */
+static void bench_spool_memory(void)
+{
+    apr_size_t clen = 1024 * 1024, len;
+    char *body = make_upload(make_body(clen), clen, &len);
+    int mem, r;
+
+    for (mem = 0; mem <= 1; ++mem) {
+        apr_time_t start;
+
+        if (apreq_spool_memory_set(mem ? 2 * clen : 0,
+                                   (apr_uint64_t)64 * clen) != APR_SUCCESS) {
+            printf("memspool: no memory spool on this platform\n");
+            return;
+        }
+        start = apr_time_now();
+
+        for (r = 0; r < 200; ++r) {
+            apr_pool_t *saved = p;
+            apr_status_t s;
+
+            apr_pool_create(&p, saved);
+            s = run_multipart(body, len, BUCKET_SIZE, NULL, NULL);
+            apr_pool_destroy(p);
+            p = saved;
+
+            if (s != APR_SUCCESS) {
+                printf("memspool: parser failed (%d)\n", s);
+                return;
+            }
+        }
+        report("memspool", mem ? "200 x 1MB, memfd" : "200 x 1MB, temp file",
+               (apr_uint64_t)len * 200, apr_time_now() - start);
+    }
+    apreq_spool_memory_set(0, 0);
+}
+
+/*
+ * Uploads made of nothing but near-boundaries ("\r\n--AaB03" without the
+ * final 'x'), cut into buckets that split them.  Throughput should not
+ * drop as the body grows: the matcher must stay linear.
+ */
+static void bench_adversarial(void)
+{
+    static const char frag[] = CRLF "--AaB03";
+    static const apr_size_t bsizes[] = { 61, BUCKET_SIZE };
+    apr_size_t size, i, j;
+
+    for (j = 0; j < sizeof bsizes / sizeof bsizes[0]; ++j) {
+        for (size = BODY_SIZE / 16; size <= BODY_SIZE / 2; size *= 2) {
+            char *content = apr_palloc(p, size);
+            char variant[64];
+            apr_size_t len;
+            char *body;
+            apr_time_t start;
+            apr_pool_t *saved = p;
+            apr_status_t s;
+
+            for (i = 0; i < size; ++i)
+                content[i] = frag[i % (sizeof frag - 1)];
+            body = make_upload(content, size, &len);
+
+            apr_pool_create(&p, saved);
+            start = apr_time_now();
+            s = run_multipart(body, len, bsizes[j], NULL, NULL);
+            apr_snprintf(variant, sizeof variant, "%luMB in %lu-byte buckets",
+                         (unsigned long)(size >> 20),
+                         (unsigned long)bsizes[j]);
+            report("adversarial", variant, len, apr_time_now() - start);
+            apr_pool_destroy(p);
+            p = saved;
+
+            if (s != APR_SUCCESS) {
+                printf("adversarial: parser failed (%d)\n", s);
+                return;
+            }
+        }
+    }
+}
+
+/* A form body of long base64-ish tokens, as sent by many API clients. */
+static char *make_form(apr_size_t len, apr_size_t vlen)
+{
+    static const char b64[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+    static const char *esc[] = { "%2B", "%2F", "%3D" };
+    char *body = apr_palloc(p, len + 1);
+    apr_uint32_t x = 88172645U;
+    apr_size_t i = 0, n = 0, v = 0;
+
+    while (i < len) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        if (v == 0) {
+            i += apr_snprintf(body + i, len + 1 - i, "%sf%lu=",
+                              n ? "&" : "", (unsigned long)n);
+            ++n;
+            v = vlen;
+        }
+        else if (x % 64 == 0 && i + 3 <= len) {
+            memcpy(body + i, esc[x % 3], 3);
+            i += 3;
+            v = v > 3 ? v - 3 : 0;
+        }
+        else {
+            body[i++] = b64[x % (sizeof b64 - 1)];
+            --v;
+        }
+    }
+    body[len] = 0;
+    return body;
+}
+
+static void bench_urldecode(void)
+{
+    const apr_size_t vlen = 1024;
+    char *body = make_form(BODY_SIZE, vlen);
+    char *dest = apr_palloc(p, vlen + 1);
+    apr_bucket_alloc_t *ba;
+    apr_bucket_brigade *bb;
+    apreq_parser_t *parser;
+    apr_table_t *t;
+    apr_time_t start;
+    const char *v, *end = body + BODY_SIZE;
+    apr_uint64_t bytes = 0;
+    apr_size_t dlen;
+    int r;
+
+    start = apr_time_now();
+    for (r = 0; r < ROUNDS; ++r) {
+        for (v = strchr(body, '='); v != NULL; v = strchr(v, '=')) {
+            const char *amp = memchr(v + 1, '&', end - v - 1);
+            apr_size_t slen = (amp ? amp : end) - ++v;
+            apreq_decode(dest, &dlen, v, slen);
+            bytes += slen;
+        }
+    }
+    report("urldecode", "apreq_decode", bytes, apr_time_now() - start);
+
+    start = apr_time_now();
+    for (r = 0; r < ROUNDS; ++r) {
+        apr_pool_t *saved = p;
+
+        apr_pool_create(&p, saved);
+        ba = apr_bucket_alloc_create(p);
+        bb = apr_brigade_create(p, ba);
+        t = apr_table_make(p, APREQ_DEFAULT_NELTS);
+        parser = apreq_parser_make(p, ba, "application/x-www-form-urlencoded",
+                                   apreq_parse_urlencoded,
+                                   APREQ_DEFAULT_BRIGADE_LIMIT,
+                                   NULL, NULL, NULL);
+        APR_BRIGADE_INSERT_TAIL(bb,
+            apr_bucket_immortal_create(body, BODY_SIZE, ba));
+        APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+        if (apreq_parser_run(parser, t, bb) != APR_SUCCESS)
+            printf("urldecode: parser failed\n");
+        apr_pool_destroy(p);
+        p = saved;
+    }
+    report("urldecode", "apreq_parse_urlencoded",
+           (apr_uint64_t)BODY_SIZE * ROUNDS, apr_time_now() - start);
+    /* a form-heavy page: many short fields */
+    body = make_form(BODY_SIZE / 16, 24);
+    start = apr_time_now();
+    for (r = 0; r < ROUNDS; ++r) {
+        apr_pool_t *saved = p;
+
+        apr_pool_create(&p, saved);
+        t = apr_table_make(p, APREQ_DEFAULT_NELTS);
+        if (apreq_parse_query_string(p, t, body) != APR_SUCCESS)
+            printf("urldecode: query string failed\n");
+        apr_pool_destroy(p);
+        p = saved;
+    }
+    report("urldecode", "apreq_parse_query_string",
+           (apr_uint64_t)BODY_SIZE / 16 * ROUNDS, apr_time_now() - start);
+}
+
+/*
+ * Decoded text in 1 KB values: every 1 in "every" characters is the
+ * multibyte sequence mb, the rest are ascii letters.  No sequence
+ * straddles two values.
+ */
+static char *make_text(apr_size_t len, const char *mb, unsigned every)
+{
+    char *text = apr_palloc(p, len);
+    const apr_size_t mblen = strlen(mb);
+    apr_uint32_t x = 2463534242U;
+    apr_size_t i = 0;
+
+    while (i < len) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        if (x % every == 0 && i % 1024 + mblen <= 1024) {
+            memcpy(text + i, mb, mblen);
+            i += mblen;
+        }
+        else {
+            text[i++] = 'a' + x % 26;
+        }
+    }
+    return text;
+}
+
+static void bench_charset_one(const char *variant, const char *text)
+{
+    const apr_size_t vlen = 1024;
+    volatile unsigned sink = 0;
+    apr_uint64_t bytes = 0;
+    apr_time_t start;
+    apr_size_t i;
+    int r;
+
+    start = apr_time_now();
+    for (r = 0; r < ROUNDS; ++r) {
+        for (i = 0; i + vlen <= BODY_SIZE; i += vlen) {
+            sink += apreq_charset_divine(text + i, vlen);
+            bytes += vlen;
+        }
+    }
+    report("charset", variant, bytes, apr_time_now() - start);
+}
+
+static void bench_charset(void)
+{
+    bench_charset_one("ascii", make_text(BODY_SIZE, "a", 1000));
+    bench_charset_one("utf8 (1 in 16)",
+                      make_text(BODY_SIZE, "\xC3\xA9", 16));
+    bench_charset_one("utf8 (cjk)",
+                      make_text(BODY_SIZE, "\xE3\x82\xA2", 2));
+    bench_charset_one("latin1 (1 in 16)", make_text(BODY_SIZE, "\xE9", 16));
+}
+
+/* Every field of an n-field form looked up once, by name. */
+static void bench_lookup_one(int n)
+{
+    apr_pool_t *pool;
+    apr_table_t *t;
+    const char **keys;
+    apr_uint64_t found = 0;
+    apr_time_t start, usec_linear, usec_index;
+    /* apr_table_get() is quadratic over the whole form */
+    const int linear_rounds = 40000000 / n / n + 1;
+    const int rounds = 4000000 / n + 1;
+    int i, r;
+
+    apr_pool_create(&pool, p);
+    t = apr_table_make(pool, APREQ_DEFAULT_NELTS);
+    keys = apr_palloc(pool, n * sizeof *keys);
+    for (i = 0; i < n; ++i) {
+        keys[i] = apr_psprintf(pool, "form_field_%d", i);
+        apr_table_addn(t, keys[i], "");
+    }
+
+    start = apr_time_now();
+    for (r = 0; r < linear_rounds; ++r)
+        for (i = 0; i < n; ++i)
+            found += apr_table_get(t, keys[i]) != NULL;
+    usec_linear = apr_time_now() - start;
+
+    start = apr_time_now();
+    for (r = 0; r < rounds; ++r) {
+        /* a fresh index per round, as for a new request */
+        apreq_table_index_t *idx = apreq_table_index_make(pool);
+        for (i = 0; i < n; ++i)
+            found += apreq_table_index_get(idx, t, keys[i]) != NULL;
+    }
+    usec_index = apr_time_now() - start;
+
+    if (found != (apr_uint64_t)(linear_rounds + rounds) * n)
+        printf("lookup: missing keys\n");
+    printf("%-12s %5d fields: apr_table_get %8.1f ns, "
+           "apreq_table_index_get %6.1f ns\n", "lookup", n,
+           1000.0 * usec_linear / ((double)linear_rounds * n),
+           1000.0 * usec_index / ((double)rounds * n));
+    apr_pool_destroy(pool);
+}
+
+static void bench_lookup(void)
+{
+    static const int sizes[] = { 8, 16, 32, 64, 256, 2000, 10000 };
+    unsigned i;
+
+    for (i = 0; i < sizeof sizes / sizeof *sizes; ++i)
+        bench_lookup_one(sizes[i]);
+}
+
+/*
+ * A query string as left by ad and analytics redirects: a few short args
+ * the handler reads, behind forty long escaped tracking values it doesn't.
+ */
+static char *make_tracking_qs(void)
+{
+    char *qs = apr_pstrdup(p, "id=42;page=3;sort=name");
+    char *val = make_form(160, 160);
+    int i;
+
+    for (i = 0; i < 40; ++i)
+        qs = apr_psprintf(p, "%s&utm_%d=%s", qs, i, strchr(val, '=') + 1);
+    return qs;
+}
+
+static void bench_lazy_one(const char *variant, const char *qs,
+                           apr_status_t (*parse)(apr_pool_t *, apr_table_t *,
+                                                 const char *))
+{
+    static const char *const keys[] = { "id", "page", "sort" };
+    const int rounds = 200000;
+    apr_size_t len = strlen(qs), found = 0;
+    apr_time_t start;
+    int r;
+    unsigned i;
+
+    start = apr_time_now();
+    for (r = 0; r < rounds; ++r) {
+        apr_pool_t *pool;
+        apr_table_t *t;
+
+        apr_pool_create(&pool, p);
+        t = apr_table_make(pool, APREQ_DEFAULT_NELTS);
+        if (parse(pool, t, qs) != APR_SUCCESS)
+            printf("lazy: query string failed\n");
+        for (i = 0; i < sizeof keys / sizeof *keys; ++i) {
+            const char *val = apr_table_get(t, keys[i]);
+            found += apreq_value_to_decoded_param(val)->v.dlen;
+        }
+        apr_pool_destroy(pool);
+    }
+    if (found != (apr_size_t)rounds * 7)
+        printf("lazy: wrong values\n");
+    report("lazy", variant, (apr_uint64_t)len * rounds,
+           apr_time_now() - start);
+}
+
+static void bench_lazy(void)
+{
+    const char *qs = make_tracking_qs();
+
+    bench_lazy_one("apreq_parse_query_string", qs, apreq_parse_query_string);
+    bench_lazy_one("apreq_parse_query_string_lazy", qs,
+                   apreq_parse_query_string_lazy);
+}
+
+typedef struct {
+    const char *name;
+    void (*func)(void);
+} bench_t;
+
+static const bench_t bench_list[] = {
+    { "bdry_scan", bench_bdry_scan },
+    { "multipart", bench_multipart },
+    { "parse_only", bench_parse_only },
+    { "async_spool", bench_async_spool },
+    { "spool", bench_spool },
+    { "tempfile", bench_tempfile_pool },
+    { "memspool", bench_spool_memory },
+    { "stripe", bench_stripe },
+    { "adversarial", bench_adversarial },
+    { "urldecode", bench_urldecode },
+    { "charset", bench_charset },
+    { "lookup", bench_lookup },
+    { "lazy", bench_lazy },
+};
+
+int main(int argc, char *argv[])
+{
+    unsigned i;
+    int j;
+
+    apr_initialize();
+    atexit(apr_terminate);
+    apr_pool_create(&p, NULL);
+    apreq_initialize(p);
+
+    for (i = 0; i < sizeof(bench_list) / sizeof(bench_t); ++i) {
+        if (argc > 1) {
+            for (j = 1; j < argc; ++j)
+                if (strcmp(argv[j], bench_list[i].name) == 0)
+                    break;
+            if (j == argc)
+                continue;
+        }
+        bench_list[i].func();
+    }
+
+    return 0;
+}
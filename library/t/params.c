@@ -71,6 +71,48 @@ static void params_as(dAT, void *ctx)
     AT_str_eq(val, "");
 }
 
+static void lazy_args(dAT, void *ctx)
+{
+    apr_table_t *t = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    apreq_param_t *param;
+    const char *val;
+    apr_status_t s;
+
+    s = apreq_parse_query_string_lazy(p, t, "utm=a%2Bb;%C3%A9t%C3%A9=caf%C3%A9;"
+                                            "bad=%zz;q=foo+bar;none");
+    AT_int_eq(s, APR_SUCCESS);
+    AT_int_eq(apr_table_elts(t)->nelts, 5);
+
+    val = apr_table_get(t, "utm");
+    AT_str_eq(val, "a%2Bb");
+    param = apreq_value_to_param(val);
+    AT_int_eq(apreq_param_is_encoded(param), 1);
+    AT_int_eq(apreq_param_value_decode(param), APR_SUCCESS);
+    AT_str_eq(param->v.data, "a+b");
+    AT_int_eq(param->v.dlen, 3);
+    AT_int_eq(apreq_param_is_encoded(param), 0);
+    AT_int_eq(apreq_param_value_decode(param), APR_SUCCESS);
+    AT_str_eq(param->v.data, "a+b");
+
+    val = apr_table_get(t, "\xC3\xA9t\xC3\xA9");
+    param = apreq_value_to_decoded_param(val);
+    AT_int_eq(param->v.dlen, 5);
+    AT_mem_eq(param->v.data, "caf\xC3\xA9", 5);
+    AT_int_eq(apreq_param_charset_get(param), APREQ_CHARSET_UTF8);
+
+    param = apreq_value_to_param(apr_table_get(t, "bad"));
+    AT_int_eq(apreq_param_value_decode(param), APREQ_ERROR_BADSEQ);
+    AT_str_eq(param->v.data, "%zz");
+    AT_int_eq(apreq_param_is_encoded(param), 1);
+    AT_is_null(apreq_value_to_decoded_param(param->v.data));
+
+    param = apreq_value_to_param(apr_table_get(t, "none"));
+    AT_int_eq(apreq_param_is_encoded(param), 0);
+
+    val = apreq_params_as_string(p, t, "q", APREQ_JOIN_AS_IS);
+    AT_str_eq(val, "foo bar");
+}
+
 static void string_decoding_in_place(dAT, void *ctx)
 {
     char *s1 = apr_palloc(p,4096);
@@ -200,6 +242,7 @@ int main(int argc, char *argv[])
         dT(request_make, 3),
         dT(request_args_get, 8),
         dT(params_as, 3),
+        dT(lazy_args, 19),
         dT(string_decoding_in_place, 8),
         dT(header_attributes, 13),
         dT(make_param, 8),
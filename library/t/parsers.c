@@ -16,6 +16,7 @@
 */
 
 #include "apreq_parser.h"
+#include "apreq_module.h"
 #include "apreq_util.h"
 #include "apreq_error.h"
 #include "apr_strings.h"
@@ -173,6 +174,46 @@ static void parse_urlencoded(dAT, void *ctx)
 
 }
 
+static void parse_urlencoded_lazy(dAT, void *ctx)
+{
+    apr_status_t rv;
+    apr_bucket_alloc_t *ba;
+    apr_bucket_brigade *bb;
+    apreq_parser_t *parser;
+    apr_table_t *body;
+    apreq_param_t *param;
+
+    body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    ba = apr_bucket_alloc_create(p);
+    bb = apr_brigade_create(p, ba);
+    parser = apreq_parser_make(p, ba, URL_ENCTYPE, apreq_parse_urlencoded_lazy,
+                               100, NULL, NULL, NULL);
+
+    APR_BRIGADE_INSERT_HEAD(bb,
+        apr_bucket_immortal_create(url_data,strlen(url_data),
+                                   bb->bucket_alloc));
+
+    rv = apreq_parser_run(parser, body, bb);
+    AT_int_eq(rv, APR_INCOMPLETE);
+
+    APR_BRIGADE_INSERT_HEAD(bb,
+        apr_bucket_immortal_create("blast",5,
+                                   bb->bucket_alloc));
+    APR_BRIGADE_INSERT_TAIL(bb,
+           apr_bucket_eos_create(bb->bucket_alloc));
+
+    rv = apreq_parser_run(parser, body, bb);
+    AT_int_eq(rv, APR_SUCCESS);
+
+    AT_str_eq(apr_table_get(body,"alpha"), "one");
+    AT_str_eq(apr_table_get(body,"omega"),"last%2blast");
+
+    param = apreq_value_to_decoded_param(apr_table_get(body,"omega"));
+    AT_not_null(param);
+    AT_int_eq(param->v.dlen, 9);
+    AT_mem_eq(param->v.data, "last+last", 9);
+}
+
 static void parse_multipart(dAT, void *ctx)
 {
     apr_size_t i, j;
@@ -266,6 +307,877 @@ static void parse_multipart(dAT, void *ctx)
     }
 }
 
+#define NEAR_BDRY CRLF "--AaB03" CRLF "--AaB0\r" CRLF "--AaB03y--AaB03x" \
+                  CRLF "-" CRLF "--AaB03"
+
+static char near_data[] =
+"--AaB03x" CRLF
+"content-disposition: form-data; name=\"near\"" CRLF CRLF
+NEAR_BDRY CRLF
+"--AaB03x--" CRLF;
+
+static void parse_only(dAT, void *ctx)
+{
+    static const char url[] = "alpha=one&beta=two;junk%zz=x&omega=last%2blast";
+    apr_array_header_t *names = apr_array_make(p, 2, sizeof(char *));
+    apr_bucket_alloc_t *ba = apr_bucket_alloc_create(p);
+    apr_size_t i, len, url_bad = 0, mfd_bad = 0;
+
+    *(const char **)apr_array_push(names) = "BETA";
+    *(const char **)apr_array_push(names) = "omega";
+
+    for (i = 0; i <= strlen(url); ++i) {
+        apr_bucket_brigade *bb = apr_brigade_create(p, ba), *tail;
+        apr_table_t *body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+        apreq_parser_t *parser;
+        apr_bucket *e;
+
+        parser = apreq_parser_make(p, ba, URL_ENCTYPE, apreq_parse_urlencoded,
+                                   100, NULL, NULL, NULL);
+        parser->parse_only = names;
+        e = apr_bucket_immortal_create(url, strlen(url), ba);
+        APR_BRIGADE_INSERT_HEAD(bb, e);
+        APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+        apr_bucket_split(e, i);
+        tail = apr_brigade_split(bb, APR_BUCKET_NEXT(e));
+
+        if (apreq_parser_run(parser, body, bb) != APR_INCOMPLETE
+            || apreq_parser_run(parser, body, tail) != APR_SUCCESS
+            || apr_table_elts(body)->nelts != 2
+            || apr_table_get(body, "alpha") != NULL
+            || strcmp(apr_table_get(body, "beta"), "two") != 0
+            || strcmp(apr_table_get(body, "omega"), "last+last") != 0)
+            ++url_bad;
+    }
+    AT_int_eq(url_bad, 0);
+
+    /* only the upload */
+    names = apr_array_make(p, 1, sizeof(char *));
+    *(const char **)apr_array_push(names) = "pics";
+
+    for (i = 0; i <= strlen(form_data); ++i) {
+        apr_bucket_brigade *bb = apr_brigade_create(p, ba), *tail;
+        apr_table_t *body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+        apreq_parser_t *parser;
+        const char *val;
+        char *data;
+        apr_bucket *e;
+
+        parser = apreq_parser_make(p, ba, MFD_ENCTYPE
+                                   "; boundary=\"AaB03x\"",
+                                   apreq_parse_multipart,
+                                   1000, NULL, NULL, NULL);
+        parser->parse_only = names;
+        e = apr_bucket_immortal_create(form_data, strlen(form_data), ba);
+        APR_BRIGADE_INSERT_HEAD(bb, e);
+        APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+        apr_bucket_split(e, i);
+        tail = apr_brigade_split(bb, APR_BUCKET_NEXT(e));
+
+        apreq_parser_run(parser, body, bb);
+        if (apreq_parser_run(parser, body, tail) != APR_SUCCESS
+            || apr_table_elts(body)->nelts != 1
+            || (val = apr_table_get(body, "pics")) == NULL) {
+            ++mfd_bad;
+            continue;
+        }
+        apr_brigade_pflatten(apreq_value_to_param(val)->upload,
+                             &data, &len, p);
+        if (len != strlen("... contents of file1.txt ..." CRLF)
+            || memcmp(data, "... contents of file1.txt ..." CRLF, len) != 0)
+            ++mfd_bad;
+    }
+    AT_int_eq(mfd_bad, 0);
+    apr_pool_clear(p);
+}
+
+static void parse_async_spool(dAT, void *ctx)
+{
+    static const char head[] =
+        "--AaB03x" CRLF
+        "content-disposition: form-data; name=\"pics\"; filename=\"a.bin\""
+        CRLF CRLF;
+    static const char tail[] = CRLF "--AaB03x--" CRLF;
+    apr_size_t i, clen = 200000, len = strlen(head) + clen + strlen(tail);
+    apr_bucket_alloc_t *ba = apr_bucket_alloc_create(p);
+    apr_bucket_brigade *bb = apr_brigade_create(p, ba);
+    apr_table_t *body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    char *data = apr_palloc(p, len), *upload;
+    apreq_parser_t *parser;
+    apr_status_t rv = APR_INCOMPLETE;
+    const char *val;
+
+    memcpy(data, head, strlen(head));
+    for (i = 0; i < clen; ++i)
+        data[strlen(head) + i] = 'a' + i % 23;
+    memcpy(data + strlen(head) + clen, tail, strlen(tail));
+
+    parser = apreq_parser_make(p, ba, MFD_ENCTYPE "; boundary=AaB03x",
+                               apreq_parse_multipart, 1000, NULL, NULL, NULL);
+    parser->spool_writer = apreq_spool_writer_make(p, 2);
+
+    for (i = 0; i < len && rv == APR_INCOMPLETE; i += 777) {
+        apr_size_t n = (len - i < 777) ? len - i : 777;
+        APR_BRIGADE_INSERT_TAIL(bb,
+            apr_bucket_transient_create(data + i, n, ba));
+        if (i + n == len)
+            APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+        rv = apreq_parser_run(parser, body, bb);
+    }
+    AT_int_eq(rv, APR_SUCCESS);
+
+    val = apr_table_get(body, "pics");
+    AT_not_null(val);
+    if (val == NULL) {
+        AT_skip(2, "upload not found");
+        return;
+    }
+    AT_not_null(apreq_brigade_spoolfile(apreq_value_to_param(val)->upload));
+    apr_brigade_pflatten(apreq_value_to_param(val)->upload, &upload, &i, p);
+    AT_ok(i == clen && memcmp(upload, data + strlen(head), clen) == 0,
+          "spooled upload matches");
+    apr_pool_clear(p);
+}
+
+static void parse_size_hint(dAT, void *ctx)
+{
+    static const char head[] =
+        "--AaB03x" CRLF
+        "content-disposition: form-data; name=\"pics\"; filename=\"a.bin\""
+        CRLF CRLF;
+    static const char tail[] = CRLF "--AaB03x--" CRLF;
+    apr_size_t i, clen = 100000, len = strlen(head) + clen + strlen(tail);
+    apr_bucket_alloc_t *ba = apr_bucket_alloc_create(p);
+    apr_bucket_brigade *bb = apr_brigade_create(p, ba);
+    apr_table_t *body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    char *data = apr_palloc(p, len), *upload;
+    apreq_parser_t *parser;
+    apr_status_t rv = APR_INCOMPLETE;
+    apr_finfo_t finfo;
+    const char *val;
+
+    memcpy(data, head, strlen(head));
+    for (i = 0; i < clen; ++i)
+        data[strlen(head) + i] = 'a' + i % 19;
+    memcpy(data + strlen(head) + clen, tail, strlen(tail));
+
+    parser = apreq_parser_make(p, ba, MFD_ENCTYPE "; boundary=AaB03x",
+                               apreq_parse_multipart, 1000, NULL, NULL, NULL);
+    parser->size_hint = 16 * len;
+
+    for (i = 0; i < len && rv == APR_INCOMPLETE; i += 1500) {
+        apr_size_t n = (len - i < 1500) ? len - i : 1500;
+        APR_BRIGADE_INSERT_TAIL(bb,
+            apr_bucket_transient_create(data + i, n, ba));
+        if (i + n == len)
+            APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+        apreq_parser_hint_read(parser, n);
+        rv = apreq_parser_run(parser, body, bb);
+    }
+    AT_int_eq(rv, APR_SUCCESS);
+    AT_int_eq(parser->size_hint, 15 * len);
+
+    val = apr_table_get(body, "pics");
+    AT_not_null(val);
+    if (val == NULL) {
+        AT_skip(2, "upload not found");
+        return;
+    }
+
+    /* the preallocated tail is trimmed once the upload completes */
+    apr_file_info_get(&finfo, APR_FINFO_SIZE,
+        apreq_brigade_spoolfile(apreq_value_to_param(val)->upload));
+    AT_int_eq(finfo.size, clen);
+    apr_brigade_pflatten(apreq_value_to_param(val)->upload, &upload, &i, p);
+    AT_ok(i == clen && memcmp(upload, data + strlen(head), clen) == 0,
+          "spooled upload matches");
+    apr_pool_clear(p);
+}
+
+struct sink_baton {
+    char       *buf;
+    apr_size_t  len;
+    apr_size_t  budget;
+    int         eos;
+};
+
+/* takes no more than its budget, then asks to be called back */
+static apr_status_t sink_collect(void *baton, apreq_param_t *param,
+                                 const char *data, apr_size_t *len)
+{
+    struct sink_baton *b = baton;
+    apr_size_t n = (*len < b->budget) ? *len : b->budget;
+
+    if (data == NULL) {
+        ++b->eos;
+        return APR_SUCCESS;
+    }
+    memcpy(b->buf + b->len, data, n);
+    b->len += n;
+    b->budget -= n;
+    *len = n;
+    return APR_SUCCESS;
+}
+
+/* records what the parser shows its hooks, as sink_collect does */
+static apr_status_t hook_collect(APREQ_HOOK_ARGS)
+{
+    struct sink_baton *b = hook->ctx;
+    apr_bucket *e;
+
+    for (e = APR_BRIGADE_FIRST(bb); e != APR_BRIGADE_SENTINEL(bb);
+         e = APR_BUCKET_NEXT(e))
+    {
+        const char *data;
+        apr_size_t dlen;
+
+        if (APR_BUCKET_IS_EOS(e)) {
+            ++b->eos;
+            continue;
+        }
+        if (apr_bucket_read(e, &data, &dlen, APR_BLOCK_READ) != APR_SUCCESS)
+            return APREQ_ERROR_GENERAL;
+        memcpy(b->buf + b->len, data, dlen);
+        b->len += dlen;
+    }
+    return (hook->next != NULL) ? apreq_hook_run(hook->next, param, bb)
+                                : APR_SUCCESS;
+}
+
+static void parse_sink(dAT, void *ctx)
+{
+    static const char head[] =
+        "--AaB03x" CRLF
+        "content-disposition: form-data; name=\"pics\"; filename=\"a.bin\""
+        CRLF CRLF;
+    static const char tail[] = CRLF "--AaB03x--" CRLF;
+    apr_size_t i = 0, clen = 50000, len = strlen(head) + clen + strlen(tail);
+    apr_bucket_alloc_t *ba = apr_bucket_alloc_create(p);
+    apr_bucket_brigade *bb = apr_brigade_create(p, ba);
+    apr_table_t *body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    char *data = apr_palloc(p, len);
+    struct sink_baton b = { NULL, 0, 0, 0 };
+    apreq_sink_callback_ctx_t cb = { sink_collect, &b };
+    apreq_parser_t *parser;
+    apr_status_t rv = APR_INCOMPLETE;
+    int stalls = 0;
+    const char *val;
+
+    memcpy(data, head, strlen(head));
+    for (i = 0; i < clen; ++i)
+        data[strlen(head) + i] = 'a' + i % 17;
+    memcpy(data + strlen(head) + clen, tail, strlen(tail));
+    b.buf = apr_palloc(p, clen);
+
+    parser = apreq_parser_make(p, ba, MFD_ENCTYPE "; boundary=AaB03x",
+                               apreq_parse_multipart, 1000, NULL, NULL, NULL);
+    parser->sink = apreq_sink_make(p, apreq_sink_callback, &cb);
+
+    /* the sink drains 1000 bytes per run, the body arrives 4000 at a time;
+     * while it is full, the parser is run without new data */
+    for (i = 0; rv == APR_INCOMPLETE || rv == APR_EAGAIN; ) {
+        b.budget = 1000;
+        if (rv == APR_EAGAIN)
+            ++stalls;
+        else if (i < len) {
+            apr_size_t n = (len - i < 4000) ? len - i : 4000;
+            APR_BRIGADE_INSERT_TAIL(bb,
+                apr_bucket_transient_create(data + i, n, ba));
+            i += n;
+            if (i == len)
+                APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+        }
+        else
+            break;
+        rv = apreq_parser_run(parser, body, bb);
+    }
+    AT_int_eq(rv, APR_SUCCESS);
+    AT_ok(stalls > 0, "sink pushed back");
+    AT_ok(b.len == clen && memcmp(b.buf, data + strlen(head), clen) == 0,
+          "sink got the upload");
+    AT_int_eq(b.eos, 1);
+
+    val = apr_table_get(body, "pics");
+    AT_ok(val != NULL
+          && APR_BRIGADE_EMPTY(apreq_value_to_param(val)->upload),
+          "upload left unspooled");
+    apr_pool_clear(p);
+}
+
+static void parse_transfer_encoding(dAT, void *ctx)
+{
+    static const char b64[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    static const char head[] =
+        "--AaB03x" CRLF
+        "content-disposition: form-data; name=\"pics\"; filename=\"a.bin\""
+        CRLF "content-transfer-encoding: BASE64" CRLF CRLF;
+    static const char tail[] = CRLF "--AaB03x--" CRLF;
+    apr_size_t i, j, clen = 5000, len;
+    apr_bucket_alloc_t *ba = apr_bucket_alloc_create(p);
+    apr_bucket_brigade *bb = apr_brigade_create(p, ba);
+    apr_table_t *body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    char *raw = apr_palloc(p, clen), *data, *upload;
+    apreq_parser_t *parser;
+    apreq_param_t *param;
+    apr_status_t rv = APR_INCOMPLETE;
+    const char *val;
+    int bad = 0;
+
+    /* quoted-printable, split everywhere */
+    for (j = 0; j <= strlen(form_data); ++j) {
+        apr_bucket_brigade *tbb;
+        apr_bucket *e;
+
+        body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+        parser = apreq_parser_make(p, ba, MFD_ENCTYPE "; boundary=AaB03x",
+                                   apreq_parse_multipart, 1000,
+                                   NULL, NULL, NULL);
+        parser->decode_transfer_encoding = 1;
+        bb = apr_brigade_create(p, ba);
+        e = apr_bucket_immortal_create(form_data, strlen(form_data), ba);
+        APR_BRIGADE_INSERT_HEAD(bb, e);
+        APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+        apr_bucket_split(e, j);
+        tbb = apr_brigade_split(bb, APR_BUCKET_NEXT(e));
+
+        apreq_parser_run(parser, body, bb);
+        if (apreq_parser_run(parser, body, tbb) != APR_SUCCESS
+            || (val = apr_table_get(body, "field1")) == NULL
+            || strcmp(val, "Joe owes \x80" "100.") != 0
+            || strcmp(apr_table_get(apreq_value_to_param(val)->info,
+                                    "Content-Transfer-Encoding"),
+                      "binary") != 0)
+            ++bad;
+    }
+    AT_int_eq(bad, 0);
+
+    /* off by default */
+    body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    parser = apreq_parser_make(p, ba, MFD_ENCTYPE "; boundary=AaB03x",
+                               apreq_parse_multipart, 1000, NULL, NULL, NULL);
+    bb = apr_brigade_create(p, ba);
+    APR_BRIGADE_INSERT_TAIL(bb,
+        apr_bucket_immortal_create(form_data, strlen(form_data), ba));
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+    apreq_parser_run(parser, body, bb);
+    AT_str_eq(apr_table_get(body, "field1"), "Joe owes =80100.");
+
+    /* nested parts decode their own leaves */
+    body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    parser = apreq_parser_make(p, ba, MFD_ENCTYPE "; boundary=AaB03x",
+                               apreq_parse_multipart, 1000, NULL, NULL, NULL);
+    parser->decode_transfer_encoding = 1;
+    bb = apr_brigade_create(p, ba);
+    APR_BRIGADE_INSERT_TAIL(bb,
+        apr_bucket_immortal_create(mix_data, strlen(mix_data), ba));
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+    AT_int_eq(apreq_parser_run(parser, body, bb), APR_SUCCESS);
+    AT_str_eq(apr_table_get(body, "field1"), "Joe owes \x80" "100.");
+
+    /* a base64 upload in 76 char lines, spooled as it is decoded */
+    for (i = 0; i < clen; ++i)
+        raw[i] = (char)(i * 7 + i / 251);
+    data = apr_palloc(p, strlen(head) + clen * 2 + strlen(tail));
+    memcpy(data, head, strlen(head));
+    len = strlen(head);
+    for (i = 0; i < clen; i += 3) {
+        apr_uint32_t q = (unsigned char)raw[i] << 16;
+        if (i + 1 < clen)
+            q |= (unsigned char)raw[i + 1] << 8;
+        if (i + 2 < clen)
+            q |= (unsigned char)raw[i + 2];
+        data[len++] = b64[q >> 18];
+        data[len++] = b64[q >> 12 & 0x3f];
+        data[len++] = (i + 1 < clen) ? b64[q >> 6 & 0x3f] : '=';
+        data[len++] = (i + 2 < clen) ? b64[q & 0x3f] : '=';
+        if (i % 57 == 54) {
+            data[len++] = '\r';
+            data[len++] = '\n';
+        }
+    }
+    memcpy(data + len, tail, strlen(tail));
+    len += strlen(tail);
+
+    body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    parser = apreq_parser_make(p, ba, MFD_ENCTYPE "; boundary=AaB03x",
+                               apreq_parse_multipart, 1000, NULL, NULL, NULL);
+    parser->decode_transfer_encoding = 1;
+    bb = apr_brigade_create(p, ba);
+    for (i = 0; i < len && rv == APR_INCOMPLETE; i += 37) {
+        apr_size_t n = (len - i < 37) ? len - i : 37;
+        APR_BRIGADE_INSERT_TAIL(bb,
+            apr_bucket_transient_create(data + i, n, ba));
+        if (i + n == len)
+            APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+        rv = apreq_parser_run(parser, body, bb);
+    }
+    AT_int_eq(rv, APR_SUCCESS);
+
+    val = apr_table_get(body, "pics");
+    param = apreq_value_to_param(val);
+    apr_brigade_pflatten(param->upload, &upload, &i, p);
+    AT_ok(i == clen && memcmp(upload, raw, clen) == 0, "decoded upload");
+    AT_str_eq(apr_table_get(param->info, "Content-Transfer-Encoding"),
+              "binary");
+    apr_pool_clear(p);
+}
+
+static void parse_json(dAT, void *ctx)
+{
+    static const char json[] =
+        "{\"name\":\"Joe\", \"n\": -1.5e3, \"ok\":true, \"nil\":null,\n"
+        " \"tags\":[\"a\",\"b\"], \"empty\":{}, \"none\":[],\n"
+        " \"addr\":{\"city\":\"Z\\u00fcrich\",\"zip\":\"8001\"},\n"
+        " \"esc\":\"q\\\"\\\\\\/\\t\\u20ac\\ud83d\\ude00\",\n"
+        " \"arr\":[[1,2],{\"k\":\"v\"}], \"big\":\"";
+    apr_size_t i, blen = 2500, len = strlen(json) + blen + 3;
+    apr_bucket_alloc_t *ba = apr_bucket_alloc_create(p);
+    apr_bucket_brigade *bb = apr_brigade_create(p, ba);
+    apr_table_t *body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    char *data = apr_palloc(p, len), *big;
+    apreq_parser_t *parser;
+    apr_status_t rv = APR_INCOMPLETE;
+    const char *val;
+
+    memcpy(data, json, strlen(json));
+    memset(data + strlen(json), 'x', blen);
+    memcpy(data + strlen(json) + blen, "\"}\n", 3);
+
+    parser = apreq_parser_make(p, ba, "application/json; charset=utf-8",
+                               apreq_parse_json, 1000, NULL, NULL, NULL);
+
+    /* a byte at a time, to split every token across buckets */
+    for (i = 0; i < len && rv == APR_INCOMPLETE; ++i) {
+        APR_BRIGADE_INSERT_TAIL(bb,
+            apr_bucket_transient_create(data + i, 1, ba));
+        if (i + 1 == len)
+            APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+        rv = apreq_parser_run(parser, body, bb);
+    }
+    AT_int_eq(rv, APR_SUCCESS);
+
+    AT_str_eq(apr_table_get(body, "name"), "Joe");
+    AT_str_eq(apr_table_get(body, "n"), "-1.5e3");
+    AT_str_eq(apr_table_get(body, "ok"), "true");
+    AT_str_eq(apr_table_get(body, "nil"), "null");
+    AT_str_eq(apr_table_get(body, "tags[0]"), "a");
+    AT_str_eq(apr_table_get(body, "tags[1]"), "b");
+    AT_is_null(apr_table_get(body, "empty"));
+    AT_str_eq(apr_table_get(body, "addr.city"), "Z\xc3\xbcrich");
+    val = apr_table_get(body, "addr.city");
+    AT_int_eq(apreq_param_charset_get(apreq_value_to_param(val)),
+              APREQ_CHARSET_UTF8);
+    AT_str_eq(apr_table_get(body, "addr.zip"), "8001");
+    AT_str_eq(apr_table_get(body, "esc"),
+              "q\"\\/\t\xe2\x82\xac\xf0\x9f\x98\x80");
+    AT_str_eq(apr_table_get(body, "arr[0][1]"), "2");
+    AT_str_eq(apr_table_get(body, "arr[1].k"), "v");
+
+    val = apr_table_get(body, "big");
+    AT_not_null(val);
+    if (val == NULL) {
+        AT_skip(1, "big string not found");
+        return;
+    }
+    apr_brigade_pflatten(apreq_value_to_param(val)->upload, &big, &i, p);
+    AT_ok(*val == 0 && i == blen && big[0] == 'x' && big[blen - 1] == 'x',
+          "long string spooled");
+    apr_pool_clear(p);
+}
+
+static void parse_json_errors(dAT, void *ctx)
+{
+    static const struct {
+        const char   *body;
+        apr_status_t  rv;
+    } bad[] = {
+        { "[1]",                    APREQ_ERROR_BADCHAR },
+        { "{\"a\":1,}",             APREQ_ERROR_BADCHAR },
+        { "{\"a\":01}",             APREQ_ERROR_BADCHAR },
+        { "{\"a\":[1,]}",           APREQ_ERROR_BADCHAR },
+        { "{\"a\":\"\\ud800x\"}",   APREQ_ERROR_BADSEQ },
+        { "{\"a\":\"\\q\"}",        APREQ_ERROR_BADSEQ },
+        { "{\"a\":1} x",            APREQ_ERROR_BADCHAR },
+        { "{\"a\":1",               APREQ_ERROR_NODATA },
+    };
+    apr_bucket_alloc_t *ba = apr_bucket_alloc_create(p);
+    int i;
+
+    for (i = 0; i < (int)(sizeof bad / sizeof bad[0]); ++i) {
+        apr_bucket_brigade *bb = apr_brigade_create(p, ba);
+        apr_table_t *body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+        apreq_parser_t *parser;
+
+        APR_BRIGADE_INSERT_TAIL(bb,
+            apr_bucket_immortal_create(bad[i].body, strlen(bad[i].body),
+                                       ba));
+        APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+        parser = apreq_parser_make(p, ba, "application/json",
+                                   apreq_parse_json, 1000, NULL, NULL, NULL);
+        AT_int_eq(apreq_parser_run(parser, body, bb), bad[i].rv);
+    }
+    apr_pool_clear(p);
+}
+
+static void parse_ndjson(dAT, void *ctx)
+{
+    static const char nd[] = "{\"a\":1}\n\n{\"b\":2}\r\n[3]";
+    static const char crlf[] = "[1]\r\n\r\n[2]\r\n";
+    apr_size_t i, len = strlen(nd);
+    apr_bucket_alloc_t *ba = apr_bucket_alloc_create(p);
+    apr_bucket_brigade *bb = apr_brigade_create(p, ba);
+    apr_table_t *body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    const apr_array_header_t *arr;
+    apreq_parser_t *parser;
+    apr_status_t rv = APR_INCOMPLETE;
+    char *big, *expect;
+    struct sink_baton b = { NULL, 0, 0, 0 }, h = { NULL, 0, 0, 0 };
+    apreq_sink_callback_ctx_t cb = { sink_collect, &b };
+    int stalls = 0;
+
+    parser = apreq_parser_make(p, ba, "application/x-ndjson",
+                               apreq_parse_ndjson, 1000, NULL, NULL, NULL);
+    for (i = 0; i < len && rv == APR_INCOMPLETE; i += 5) {
+        apr_size_t n = (len - i < 5) ? len - i : 5;
+        APR_BRIGADE_INSERT_TAIL(bb,
+            apr_bucket_immortal_create(nd + i, n, ba));
+        if (i + n == len)
+            APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+        rv = apreq_parser_run(parser, body, bb);
+    }
+    AT_int_eq(rv, APR_SUCCESS);
+    arr = apr_table_elts(body);
+    AT_int_eq(arr->nelts, 3);
+    if (arr->nelts != 3) {
+        AT_skip(3, "wrong number of records");
+    }
+    else {
+        const apr_table_entry_t *te = (const apr_table_entry_t *)arr->elts;
+        AT_str_eq(te[0].val, "{\"a\":1}");
+        AT_str_eq(te[1].val, "{\"b\":2}");
+        AT_str_eq(te[2].val, "[3]");
+    }
+
+    /* CRLF line endings, with the CR and LF in separate buckets */
+    bb = apr_brigade_create(p, ba);
+    body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    parser = apreq_parser_make(p, ba, "application/x-ndjson",
+                               apreq_parse_ndjson, 1000, NULL, NULL, NULL);
+    len = strlen(crlf);
+    for (i = 0, rv = APR_INCOMPLETE; i < len && rv == APR_INCOMPLETE; ++i) {
+        APR_BRIGADE_INSERT_TAIL(bb,
+            apr_bucket_immortal_create(crlf + i, 1, ba));
+        if (i + 1 == len)
+            APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+        rv = apreq_parser_run(parser, body, bb);
+    }
+    AT_int_eq(rv, APR_SUCCESS);
+    AT_str_eq(apr_table_get(body, APREQ_NDJSON_RECORD), "[1]");
+    arr = apr_table_elts(body);
+    AT_int_eq(arr->nelts, 2);
+
+    /* a record must fit within the brigade limit */
+    big = apr_palloc(p, 1501);
+    memset(big, 'x', 1500);
+    big[1500] = '\n';
+    bb = apr_brigade_create(p, ba);
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_immortal_create(big, 1501, ba));
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+    parser = apreq_parser_make(p, ba, "application/x-ndjson",
+                               apreq_parse_ndjson, 1000, NULL, NULL, NULL);
+    AT_int_eq(apreq_parser_run(parser, body, bb), APREQ_ERROR_OVERLIMIT);
+
+    /* but a sink takes records of any length, 1000 bytes per run, and
+     * the hooks see each chunk once, however often the sink stalls */
+    bb = apr_brigade_create(p, ba);
+    body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    b.buf = apr_palloc(p, 3 * 1500);
+    h.buf = apr_palloc(p, 3 * 1500);
+    parser = apreq_parser_make(p, ba, "application/x-ndjson",
+                               apreq_parse_ndjson, 1000, NULL,
+                               apreq_hook_make(p, hook_collect, NULL, &h),
+                               NULL);
+    parser->sink = apreq_sink_make(p, apreq_sink_callback, &cb);
+    for (i = 0, rv = APR_INCOMPLETE; rv == APR_INCOMPLETE || rv == APR_EAGAIN;)
+    {
+        b.budget = 1000;
+        if (rv == APR_EAGAIN) {
+            ++stalls;
+        }
+        else if (i < 3) {
+            APR_BRIGADE_INSERT_TAIL(bb,
+                apr_bucket_immortal_create(big, 1501, ba));
+            if (++i == 3)
+                APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+        }
+        else {
+            break;
+        }
+        rv = apreq_parser_run(parser, body, bb);
+    }
+    AT_int_eq(rv, APR_SUCCESS);
+    AT_int_eq(b.eos, 3);
+    expect = apr_palloc(p, 3 * 1500);
+    memset(expect, 'x', 3 * 1500);
+    AT_ok(b.len == 3 * 1500 && memcmp(b.buf, expect, b.len) == 0,
+          "sink got the records");
+    AT_ok(stalls > 0, "sink pushed back");
+    AT_ok(h.eos == 3 && h.len == b.len && memcmp(h.buf, b.buf, b.len) == 0,
+          "hooks saw what the sink got");
+    AT_ok(apr_is_empty_table(body), "records kept out of the table");
+
+    /* neither sees the CR of a CRLF, even when it ends a run */
+    bb = apr_brigade_create(p, ba);
+    b.len = b.eos = h.len = h.eos = 0;
+    b.budget = 1000;
+    parser = apreq_parser_make(p, ba, "application/x-ndjson",
+                               apreq_parse_ndjson, 1000, NULL,
+                               apreq_hook_make(p, hook_collect, NULL, &h),
+                               NULL);
+    parser->sink = apreq_sink_make(p, apreq_sink_callback, &cb);
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_immortal_create("[1]\r", 4, ba));
+    rv = apreq_parser_run(parser, body, bb);
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_immortal_create("\n[2]", 4, ba));
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+    if (rv == APR_INCOMPLETE)
+        rv = apreq_parser_run(parser, body, bb);
+    AT_int_eq(rv, APR_SUCCESS);
+    AT_ok(b.eos == 2 && b.len == 6 && memcmp(b.buf, "[1][2]", 6) == 0,
+          "sink got the records without the CR");
+    AT_ok(h.eos == 2 && h.len == 6 && memcmp(h.buf, "[1][2]", 6) == 0,
+          "hooks saw the records without the CR");
+    apr_pool_clear(p);
+}
+
+/* Runs a urlencoded parser, behind apreq_parser_inflate(), over a
+ * compressed body fed step bytes at a time. */
+static apr_status_t inflate_parse(const char *encoding,
+                                  const unsigned char *data, apr_size_t len,
+                                  apr_size_t step, apr_uint64_t limit,
+                                  apr_table_t *body)
+{
+    apr_bucket_alloc_t *ba = apr_bucket_alloc_create(p);
+    apr_bucket_brigade *bb = apr_brigade_create(p, ba);
+    apreq_parser_t *parser;
+    apr_status_t rv;
+    apr_size_t i;
+
+    parser = apreq_parser_make(p, ba, URL_ENCTYPE, apreq_parse_urlencoded,
+                               APREQ_DEFAULT_BRIGADE_LIMIT, NULL, NULL, NULL);
+    rv = apreq_parser_inflate(parser, encoding, limit);
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    for (i = 0, rv = APR_INCOMPLETE; rv == APR_INCOMPLETE; i += step) {
+        apr_size_t n = (len - i < step) ? len - i : step;
+        if (n > 0)
+            APR_BRIGADE_INSERT_TAIL(bb,
+                apr_bucket_transient_create((const char *)data + i, n, ba));
+        if (i + n == len)
+            APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+        rv = apreq_parser_run(parser, body, bb);
+        apr_brigade_cleanup(bb);
+        if (i + n == len)
+            break;
+    }
+    return rv;
+}
+
+static void parse_inflate(dAT, void *ctx)
+{
+    /* "alpha=one&beta=" and "two;omega=last" as two gzip members */
+    static const unsigned char gz[] = {
+    0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x4b, 0xcc,
+    0x29, 0xc8, 0x48, 0xb4, 0xcd, 0xcf, 0x4b, 0x55, 0x4b, 0x4a, 0x2d, 0x49,
+    0xb4, 0x05, 0x00, 0x18, 0x29, 0x7f, 0xc4, 0x0f, 0x00, 0x00, 0x00, 0x1f,
+    0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x2b, 0x29, 0xcf,
+    0xb7, 0xce, 0xcf, 0x4d, 0x4d, 0x4f, 0xb4, 0xcd, 0x49, 0x2c, 0x2e, 0x01,
+    0x00, 0xaa, 0x33, 0x2e, 0x1e, 0x0e, 0x00, 0x00, 0x00
+    };
+    /* "alpha=one&beta=two;omega=last", zlib format */
+    static const unsigned char zl[] = {
+    0x78, 0xda, 0x4b, 0xcc, 0x29, 0xc8, 0x48, 0xb4, 0xcd, 0xcf, 0x4b, 0x55,
+    0x4b, 0x4a, 0x2d, 0x49, 0xb4, 0x2d, 0x29, 0xcf, 0xb7, 0xce, 0xcf, 0x4d,
+    0x4d, 0x4f, 0xb4, 0xcd, 0x49, 0x2c, 0x2e, 0x01, 0x00, 0xa4, 0xc8, 0x0b,
+    0x14
+    };
+    /* the same as a raw deflate stream */
+    static const unsigned char raw[] = {
+    0x4b, 0xcc, 0x29, 0xc8, 0x48, 0xb4, 0xcd, 0xcf, 0x4b, 0x55, 0x4b, 0x4a,
+    0x2d, 0x49, 0xb4, 0x2d, 0x29, 0xcf, 0xb7, 0xce, 0xcf, 0x4d, 0x4d, 0x4f,
+    0xb4, 0xcd, 0x49, 0x2c, 0x2e, 0x01, 0x00
+    };
+    /* "a=" followed by 200000 zeros */
+    static const unsigned char big[] = {
+    0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0xed, 0xc1,
+    0x31, 0x01, 0x00, 0x00, 0x0c, 0x02, 0xa0, 0x4a, 0x2b, 0x60, 0x98, 0xf5,
+    0x2f, 0x61, 0x06, 0x7f, 0xe0, 0x73, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xc0, 0xac, 0x6c, 0x76, 0x0d,
+    0xb0, 0x42, 0x0d, 0x03, 0x00
+    };
+    apr_bucket_alloc_t *ba = apr_bucket_alloc_create(p);
+    apr_table_t *body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    apreq_parser_t *parser;
+    apr_status_t rv;
+    apr_size_t step;
+    const char *val;
+    int bad = 0;
+
+    parser = apreq_parser_make(p, ba, URL_ENCTYPE, apreq_parse_urlencoded,
+                               100, NULL, NULL, NULL);
+    AT_int_eq(apreq_parser_inflate(parser, " Identity", 1000), APR_SUCCESS);
+    AT_ok(parser->inflate == NULL, "identity left alone");
+    AT_int_eq(apreq_parser_inflate(parser, "br", 1000), APR_ENOTIMPL);
+    rv = apreq_parser_inflate(parser, "gzip", 1000);
+    if (rv == APR_ENOTIMPL) {
+        AT_skip(8, "built without zlib");
+        apr_pool_clear(p);
+        return;
+    }
+    AT_int_eq(rv, APR_SUCCESS);
+    AT_int_eq(apreq_parser_inflate(parser, "deflate", 1000),
+              APREQ_ERROR_MISMATCH);
+
+    for (step = 1; step <= sizeof gz; ++step) {
+        body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+        if (inflate_parse("GZIP", gz, sizeof gz, step, 1000, body)
+            != APR_SUCCESS
+            || apr_table_elts(body)->nelts != 3
+            || strcmp(apr_table_get(body, "alpha"), "one") != 0
+            || strcmp(apr_table_get(body, "beta"), "two") != 0
+            || strcmp(apr_table_get(body, "omega"), "last") != 0)
+            ++bad;
+    }
+    AT_int_eq(bad, 0);
+
+    body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    rv = inflate_parse("deflate", zl, sizeof zl, 5, 1000, body);
+    AT_ok(rv == APR_SUCCESS
+          && strcmp(apr_table_get(body, "omega"), "last") == 0,
+          "zlib deflate");
+
+    body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    rv = inflate_parse("deflate", raw, sizeof raw, 5, 1000, body);
+    AT_ok(rv == APR_SUCCESS
+          && strcmp(apr_table_get(body, "omega"), "last") == 0,
+          "raw deflate");
+
+    body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    rv = inflate_parse("gzip", gz, sizeof gz - 5, 11, 1000, body);
+    AT_int_eq(rv, APREQ_ERROR_BADDATA);
+
+    /* the limit is on the inflated size */
+    body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    rv = inflate_parse("gzip", big, sizeof big, 64, 100000, body);
+    AT_int_eq(rv, APREQ_ERROR_OVERLIMIT);
+
+    body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    rv = inflate_parse("gzip", big, sizeof big, 64, 200002, body);
+    val = apr_table_get(body, "a");
+    AT_ok(rv == APR_SUCCESS && val != NULL && strlen(val) == 200000
+          && strspn(val, "0") == 200000, "inflated to the limit");
+
+    apr_pool_clear(p);
+}
+
+static void parse_near_boundary(dAT, void *ctx)
+{
+    apr_size_t i, len = strlen(near_data);
+    apr_bucket_alloc_t *ba;
+    apr_bucket_brigade *bb;
+    apreq_parser_t *parser;
+    apr_table_t *body;
+    apr_status_t rv = APR_INCOMPLETE;
+    int early = 0;
+
+    ba = apr_bucket_alloc_create(p);
+    bb = apr_brigade_create(p, ba);
+    body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    parser = apreq_parser_make(p, ba, MFD_ENCTYPE "; boundary=\"AaB03x\"",
+                               apreq_parse_multipart,
+                               1000, NULL, NULL, NULL);
+
+    /* one byte at a time, so every partial match spans buckets */
+    for (i = 0; i < len; ++i) {
+        APR_BRIGADE_INSERT_TAIL(bb,
+            apr_bucket_immortal_create(near_data + i, 1, ba));
+        if (i == len - 1)
+            APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+        rv = apreq_parser_run(parser, body, bb);
+        if (i < len - 1 && rv != APR_INCOMPLETE)
+            ++early;
+    }
+
+    AT_int_eq(early, 0);
+    AT_int_eq(rv, APR_SUCCESS);
+    AT_int_eq(apr_table_elts(body)->nelts, 1);
+    AT_str_eq(apr_table_get(body, "near"), NEAR_BDRY);
+}
+
+/* Bytes allocated from pool since the allocation at mark. */
+static apr_size_t pool_used_since(apr_pool_t *pool, const char *mark)
+{
+    return (const char *)apr_palloc(pool, 1) - mark - APR_ALIGN_DEFAULT(1);
+}
+
+static void parse_nextline_alloc(dAT, void *ctx)
+{
+#ifndef APR_POOL_DEBUG
+    static const char head[] =
+        "--AaB03x" CRLF
+        "content-disposition: form-data; name=\"a\"" CRLF CRLF
+        "1" CRLF "--AaB03x";
+    static const char tail[] = "--" CRLF;
+    apr_pool_t *sp;
+    apr_bucket_alloc_t *ba;
+    apr_bucket_brigade *bb;
+    apreq_parser_t *parser;
+    apr_table_t *body;
+    const char *mark;
+
+    apr_pool_create(&sp, p);
+    ba = apr_bucket_alloc_create(sp);
+    bb = apr_brigade_create(sp, ba);
+    body = apr_table_make(sp, APREQ_DEFAULT_NELTS);
+    parser = apreq_parser_make(sp, ba, MFD_ENCTYPE "; boundary=\"AaB03x\"",
+                               apreq_parse_multipart,
+                               1000, NULL, NULL, NULL);
+
+    APR_BRIGADE_INSERT_TAIL(bb,
+        apr_bucket_immortal_create(head, sizeof head - 1, ba));
+    AT_int_eq(apreq_parser_run(parser, body, bb), APR_INCOMPLETE);
+
+    /* The closing "--" line must be recognized without flattening it. */
+    APR_BRIGADE_INSERT_TAIL(bb,
+        apr_bucket_immortal_create(tail, sizeof tail - 1, ba));
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+    mark = apr_palloc(sp, 1);
+    AT_int_eq(apreq_parser_run(parser, body, bb), APR_SUCCESS);
+    AT_int_eq(pool_used_since(sp, mark), 0);
+    AT_str_eq(apr_table_get(body, "a"), "1");
+
+    apr_pool_destroy(sp);
+#else
+    AT_skip(4, "allocations are not contiguous under APR_POOL_DEBUG");
+#endif
+}
+
 static void parse_disable_uploads(dAT, void *ctx)
 {
     const char *val;
@@ -373,6 +1285,218 @@ static void hook_discard(dAT, void *ctx)
 }
 
 
+static apr_status_t sax_start(void *baton, const char *name,
+                              const char *const *attrs)
+{
+    char **trace = baton;
+
+    *trace = apr_pstrcat(p, *trace, "<", name, NULL);
+    for (; *attrs != NULL; attrs += 2)
+        *trace = apr_pstrcat(p, *trace, " ", attrs[0], "=", attrs[1], NULL);
+    *trace = apr_pstrcat(p, *trace, ">", NULL);
+    return APR_SUCCESS;
+}
+
+static apr_status_t sax_end(void *baton, const char *name)
+{
+    char **trace = baton;
+
+    *trace = apr_pstrcat(p, *trace, "</", name, ">", NULL);
+    return APR_SUCCESS;
+}
+
+static apr_status_t sax_text(void *baton, const char *data, apr_size_t len)
+{
+    char **trace = baton;
+
+    *trace = apr_pstrcat(p, *trace, apr_pstrmemdup(p, data, len), NULL);
+    return APR_SUCCESS;
+}
+
+static apr_status_t sax_run(const char *doc, apr_size_t chunk, char **trace)
+{
+    apreq_hook_xml_sax_ctx_t sax = { sax_start, sax_end, sax_text };
+    apr_bucket_alloc_t *ba = apr_bucket_alloc_create(p);
+    apr_bucket_brigade *bb = apr_brigade_create(p, ba);
+    apr_table_t *body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    apr_size_t i, len = strlen(doc);
+    apreq_parser_t *parser;
+    apreq_hook_t *hook;
+    apr_status_t rv = APR_INCOMPLETE;
+
+    *trace = "";
+    sax.baton = trace;
+    sax.state = NULL;
+    hook = apreq_hook_make(p, apreq_hook_xml_sax, NULL, &sax);
+    hook->next = apreq_hook_make(p, apreq_hook_discard_brigade, NULL, NULL);
+    parser = apreq_parser_make(p, ba, XML_ENCTYPE, apreq_parse_generic,
+                               1000, NULL, hook, NULL);
+
+    for (i = 0; i < len && rv == APR_INCOMPLETE; i += chunk) {
+        apr_size_t n = (len - i < chunk) ? len - i : chunk;
+        APR_BRIGADE_INSERT_TAIL(bb,
+            apr_bucket_immortal_create(doc + i, n, ba));
+        if (i + n == len)
+            APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+        rv = apreq_parser_run(parser, body, bb);
+    }
+    return rv;
+}
+
+static void hook_xml_sax(dAT, void *ctx)
+{
+    static const char doc[] =
+        "<?xml version=\"1.0\"?>\n<!-- a > comment -->\n"
+        "<!DOCTYPE r [<!ENTITY x \"y\">]>\n"
+        "<r a=\"1&amp;2\" b='&#x20AC;'><e/>t&lt;&#233;"
+        "<![CDATA[a]]b]<]]]>z</r >\n";
+    static const char expect[] =
+        "<r a=1&2 b=\xe2\x82\xac><e></e>t<\xc3\xa9" "a]]b]<]z</r>";
+    char *trace;
+
+    AT_int_eq(sax_run(doc, 3, &trace), APR_SUCCESS);
+    AT_str_eq(trace, expect);
+    AT_int_eq(sax_run(doc, 1, &trace), APR_SUCCESS);
+    AT_str_eq(trace, expect);
+
+    AT_int_eq(sax_run(xml_data, 7, &trace), APR_SUCCESS);
+    AT_int_eq(sax_run("<a><b></a></b>", 5, &trace), APREQ_ERROR_BADDATA);
+    AT_int_eq(sax_run("<a/><b/>", 5, &trace), APREQ_ERROR_BADDATA);
+    AT_int_eq(sax_run("<a>&nbsp;</a>", 5, &trace), APREQ_ERROR_BADSEQ);
+    AT_int_eq(sax_run("<a x=1/>", 5, &trace), APREQ_ERROR_BADATTR);
+    AT_int_eq(sax_run("<a><b>", 5, &trace), APREQ_ERROR_BADDATA);
+    apr_pool_clear(p);
+}
+
+static void hook_digest(dAT, void *ctx)
+{
+    static const char head1[] =
+        "--AaB03x" CRLF
+        "content-disposition: form-data; name=\"a\"; filename=\"a.txt\"" CRLF
+        "APREQ-SHA256: forged" CRLF CRLF
+        "123456789" CRLF
+        "--AaB03x" CRLF
+        "content-disposition: form-data; name=\"field\"" CRLF CRLF
+        "text" CRLF
+        "--AaB03x" CRLF
+        "content-disposition: form-data; name=\"b\"; filename=\"b.bin\""
+        CRLF CRLF;
+    static const char tail[] = CRLF "--AaB03x--" CRLF;
+    apr_size_t i, blen = 1000;
+    apr_size_t len = strlen(head1) + blen + strlen(tail);
+    apr_bucket_alloc_t *ba = apr_bucket_alloc_create(p);
+    apr_bucket_brigade *bb = apr_brigade_create(p, ba);
+    apr_table_t *body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    char *data = apr_palloc(p, len);
+    apreq_parser_t *parser;
+    apreq_hook_t *hook;
+    apr_status_t rv = APR_INCOMPLETE;
+    apreq_param_t *a = NULL, *b = NULL;
+    const char *val;
+
+    memcpy(data, head1, strlen(head1));
+    for (i = 0; i < blen; ++i)
+        data[strlen(head1) + i] = 'a' + i % 23;
+    memcpy(data + strlen(head1) + blen, tail, strlen(tail));
+
+    hook = apreq_hook_make(p, apreq_hook_digest_sha256, NULL, NULL);
+    hook->next = apreq_hook_make(p, apreq_hook_digest_crc32c, NULL, NULL);
+    hook->next->next = apreq_hook_make(p, apreq_hook_digest_xxh64, NULL, NULL);
+    parser = apreq_parser_make(p, ba, MFD_ENCTYPE "; boundary=AaB03x",
+                               apreq_parse_multipart, 100, NULL, hook, NULL);
+
+    /* odd-sized chunks split the uploads across many hook calls */
+    for (i = 0; i < len && rv == APR_INCOMPLETE; i += 13) {
+        apr_size_t n = (len - i < 13) ? len - i : 13;
+        APR_BRIGADE_INSERT_TAIL(bb,
+            apr_bucket_transient_create(data + i, n, ba));
+        if (i + n == len)
+            APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+        rv = apreq_parser_run(parser, body, bb);
+    }
+    AT_int_eq(rv, APR_SUCCESS);
+
+    if ((val = apr_table_get(body, "a")) != NULL)
+        a = apreq_value_to_param(val);
+    if ((val = apr_table_get(body, "b")) != NULL)
+        b = apreq_value_to_param(val);
+    if (a == NULL || b == NULL) {
+        AT_skip(6, "uploads not found");
+        return;
+    }
+    AT_str_eq(apr_table_get(a->info, APREQ_DIGEST_SHA256),
+              "15e2b0d3c33891ebb0f1ef609ec41942"
+              "0c20e320ce94c65fbc8c3312448eb225");
+    AT_str_eq(apr_table_get(a->info, APREQ_DIGEST_CRC32C), "e3069283");
+    AT_str_eq(apr_table_get(a->info, APREQ_DIGEST_XXH64), "8cb841db40e6ae83");
+    AT_str_eq(apr_table_get(b->info, APREQ_DIGEST_SHA256),
+              "f399f531ab8d90d7e21ed9b38a588526"
+              "081af93fd39d4fcab7f74a94e2e99a8f");
+    AT_str_eq(apr_table_get(b->info, APREQ_DIGEST_CRC32C), "257d25b2");
+    AT_str_eq(apr_table_get(b->info, APREQ_DIGEST_XXH64), "9e161e48e04330f4");
+    apr_pool_clear(p);
+}
+
+
+static void hook_find_params(dAT, void *ctx)
+{
+    static const char url[] = "alpha=one&beta=two&alpha=again"
+                              "&omega=last%2blast";
+    static const char *const names[] = { "OMEGA", "nope", "alpha", "beta" };
+    apreq_param_t *params[4] = { NULL, NULL, NULL, NULL };
+    apreq_hook_find_params_ctx_t hook_ctx;
+    apreq_handle_t *handle;
+    apreq_parser_t *parser;
+    apreq_hook_t *hook;
+    apr_table_t *body;
+    apr_status_t rv;
+    apr_bucket_alloc_t *ba = apr_bucket_alloc_create(p);
+    apr_bucket_brigade *bb = apr_brigade_create(p, ba);
+
+    APR_BRIGADE_INSERT_HEAD(bb,
+        apr_bucket_immortal_create(url, strlen(url), ba));
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+
+    hook_ctx.names = names;
+    hook_ctx.params = params;
+    hook_ctx.nelts = 4;
+    hook_ctx.missing = 4;
+    hook = apreq_hook_make(p, apreq_hook_find_params, NULL, &hook_ctx);
+    parser = apreq_parser_make(p, ba, URL_ENCTYPE, apreq_parse_urlencoded,
+                               100, NULL, hook, NULL);
+    body = apr_table_make(p, APREQ_DEFAULT_NELTS);
+
+    rv = apreq_parser_run(parser, body, bb);
+    AT_int_eq(rv, APR_SUCCESS);
+    AT_int_eq(hook_ctx.missing, 1);
+    AT_ok(params[0] != NULL && strcmp(params[0]->v.data, "last+last") == 0,
+          "found omega");
+    AT_is_null(params[1]);
+    AT_ok(params[2] != NULL && strcmp(params[2]->v.data, "one") == 0,
+          "found first alpha");
+
+    /* the same lookup through a handle's body_getv */
+    bb = apr_brigade_create(p, ba);
+    APR_BRIGADE_INSERT_HEAD(bb,
+        apr_bucket_immortal_create(url, strlen(url), ba));
+    parser = apreq_parser_make(p, ba, URL_ENCTYPE, apreq_parse_urlencoded,
+                               100, NULL, NULL, NULL);
+    handle = apreq_handle_custom(p, NULL, NULL, parser, 1000, bb);
+
+    rv = apreq_body_getv(handle, names, 4, params);
+    AT_int_eq(rv, APR_SUCCESS);
+    AT_ok(params[0] != NULL && strcmp(params[0]->v.data, "last+last") == 0,
+          "getv found omega");
+    AT_is_null(params[1]);
+    AT_ok(params[3] != NULL && strcmp(params[3]->v.data, "two") == 0,
+          "getv found beta");
+
+    /* too late once the body has been read from */
+    AT_int_eq(apreq_parse_only_set(handle, NULL), APREQ_ERROR_NOTEMPTY);
+    apr_pool_clear(p);
+}
+
+
 static void parse_related(dAT, void *ctx)
 {
     char ct[] = "multipart/related; boundary=f93dcbA3; "
@@ -521,10 +1645,25 @@ int main(int argc, char *argv[])
     at_test_t test_list [] = {
         dT(locate_default_parsers, 3),
         dT(parse_urlencoded, 5),
+        dT(parse_urlencoded_lazy, 7),
         dT(parse_multipart, sizeof form_data),
+        dT(parse_only, 2),
+        dT(parse_async_spool, 4),
+        dT(parse_size_hint, 5),
+        dT(parse_sink, 5),
+        dT(parse_transfer_encoding, 7),
+        dT(parse_json, 16),
+        dT(parse_json_errors, 8),
+        dT(parse_ndjson, 18),
+        dT(parse_inflate, 11),
+        dT(parse_near_boundary, 4),
+        dT(parse_nextline_alloc, 4),
         dT(parse_disable_uploads, 5),
         dT(parse_generic, 4),
         dT(hook_discard, 4),
+        dT(hook_xml_sax, 10),
+        dT(hook_digest, 7),
+        dT(hook_find_params, 10),
         dT(parse_related, 20),
         dT(parse_mixed, 15)
     };
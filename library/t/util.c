@@ -20,6 +20,7 @@
 #include "apreq_util.h"
 #include "at.h"
 
+static apr_pool_t *p;
 
 static void test_atoi64f(dAT, void *ctx)
 {
@@ -68,6 +69,57 @@ static void test_index(dAT, void *ctx)
               hlen - 3);
 }
 
+static void test_index_match(dAT, void *ctx)
+{
+    const char bdry[] = "\r\n--AaB03x";
+    const apr_size_t blen = sizeof bdry - 1;
+    const apreq_index_pattern_t *pattern;
+    char hay[256];
+    apr_size_t i;
+    int failures = 0;
+
+    pattern = apreq_index_precompile(p, bdry, blen);
+
+    memset(hay, '-', sizeof hay);
+    AT_int_eq(apreq_index_match(pattern, hay, sizeof hay, APREQ_MATCH_FULL),
+              -1);
+    AT_int_eq(apreq_index_match(pattern, hay, sizeof hay, APREQ_MATCH_PARTIAL),
+              -1);
+
+    /* near miss: first and last bytes line up, middle does not */
+    memcpy(hay + 17, "\r\n--AaB04x", blen);
+    memcpy(hay + 100, bdry, blen);
+    memcpy(hay + 251, bdry, 5);
+    AT_int_eq(apreq_index_match(pattern, hay, sizeof hay, APREQ_MATCH_FULL),
+              100);
+    AT_int_eq(apreq_index_match(pattern, hay + 101, 155, APREQ_MATCH_PARTIAL),
+              150);
+    AT_int_eq(apreq_index_match(pattern, hay + 101, 155, APREQ_MATCH_FULL),
+              -1);
+
+    /* boundary at every offset, then every partial boundary at the end */
+    for (i = 0; i + blen <= sizeof hay; ++i) {
+        memset(hay, '-', sizeof hay);
+        memcpy(hay + i, bdry, blen);
+        if (apreq_index_match(pattern, hay, sizeof hay, APREQ_MATCH_FULL)
+            != (apr_ssize_t)i)
+            ++failures;
+        if (apreq_index(hay, sizeof hay, bdry, blen, APREQ_MATCH_PARTIAL)
+            != (apr_ssize_t)i)
+            ++failures;
+    }
+    for (i = 1; i < blen; ++i) {
+        memset(hay, '-', sizeof hay);
+        memcpy(hay + sizeof hay - i, bdry, i);
+        if (apreq_index_match(pattern, hay, sizeof hay, APREQ_MATCH_PARTIAL)
+            != (apr_ssize_t)(sizeof hay - i))
+            ++failures;
+        if (apreq_index_match(pattern, hay, sizeof hay, APREQ_MATCH_FULL) != -1)
+            ++failures;
+    }
+    AT_int_eq(failures, 0);
+}
+
 #define A_GRAVE  0xE5
 #define KATAKANA_A 0xFF71
 
@@ -85,6 +137,11 @@ static void test_decode(dAT, void *ctx)
     AT_int_eq(expect[2], 0xE3);
     AT_int_eq(expect[3], 0x82);
     AT_int_eq(expect[4], 0xA2);
+
+    AT_int_eq(apreq_decode_check(src1, sizeof(src1) - 1), APR_SUCCESS);
+    AT_int_eq(apreq_decode_check("a%u00e", 6), APR_INCOMPLETE);
+    AT_int_eq(apreq_decode_check("a%zz", 4), APREQ_ERROR_BADSEQ);
+    AT_int_eq(apreq_decode_check("a\0b", 3), APREQ_ERROR_BADCHAR);
 }
 
 static void test_charset_divine(dAT, void *ctx)
@@ -112,6 +169,98 @@ static void test_charset_divine(dAT, void *ctx)
 }
 
 
+static void test_charset_divine_long(dAT, void *ctx)
+{
+    /* 40 bytes of ascii puts the interesting part past the first block */
+#define PAD40 "0123456789abcdef0123456789abcdef01234567"
+    const char ascii[] = PAD40 PAD40;
+    const char utf8[] = PAD40 "\xC3\x80\xE3\x82\xA2\xF0\x9F\x98\x80" PAD40;
+    const char surrogate[] = PAD40 "\xED\xA0\x80" PAD40;
+    const char latin1[] = PAD40 "\xA3" PAD40 "\xC3\xA9";
+    const char cp1252[] = PAD40 "\xC3\x80" PAD40 "\x80";
+    const char cut[] = PAD40 PAD40 "\xE3\xA2";
+#undef PAD40
+
+    AT_int_eq(apreq_charset_divine(ascii, sizeof ascii - 1),
+              APREQ_CHARSET_ASCII);
+    AT_int_eq(apreq_charset_divine(utf8, sizeof utf8 - 1),
+              APREQ_CHARSET_UTF8);
+    /* not strict utf8, but accepted all the same */
+    AT_int_eq(apreq_charset_divine(surrogate, sizeof surrogate - 1),
+              APREQ_CHARSET_UTF8);
+    AT_int_eq(apreq_charset_divine(latin1, sizeof latin1 - 1),
+              APREQ_CHARSET_LATIN1);
+    AT_int_eq(apreq_charset_divine(cp1252, sizeof cp1252 - 1),
+              APREQ_CHARSET_CP1252);
+    AT_int_eq(apreq_charset_divine(cut, sizeof cut - 1),
+              APREQ_CHARSET_LATIN1);
+}
+
+
+static void test_decode_charset(dAT, void *ctx)
+{
+    char src1[] = "abc%C3%80%E3%82%a2";
+    char src2[] = "pound%A3";
+    char src3[] = "%C3%80%u00e9+euro%80";
+    char src4[] = "in+place";
+    char expect[32];
+    apr_size_t elen;
+    apreq_charset_t charset;
+    struct iovec iov[2];
+
+    AT_int_eq(apreq_decode_charset(expect, &elen, &charset,
+                                   src1, sizeof src1 - 1), APR_SUCCESS);
+    AT_int_eq(charset, APREQ_CHARSET_UTF8);
+    AT_int_eq(apreq_decode_charset(expect, &elen, &charset,
+                                   src2, sizeof src2 - 1), APR_SUCCESS);
+    AT_int_eq(charset, APREQ_CHARSET_LATIN1);
+
+    /* an escape split across iovecs */
+    iov[0].iov_base = src3;
+    iov[0].iov_len = 8;
+    iov[1].iov_base = src3 + 8;
+    iov[1].iov_len = sizeof src3 - 9;
+    AT_int_eq(apreq_decodev_charset(expect, &elen, &charset, iov, 2),
+              APR_SUCCESS);
+    AT_int_eq(charset, APREQ_CHARSET_CP1252);
+
+    /* the undecoded prefix counts toward dlen */
+    AT_int_eq(apreq_decode_charset(src4, &elen, &charset,
+                                   src4, sizeof src4 - 1), APR_SUCCESS);
+    AT_int_eq(elen, sizeof src4 - 1);
+}
+
+
+static void test_decode_long(dAT, void *ctx)
+{
+    /* escapes on both sides of 16- and 32-byte block edges */
+    char src1[] = "abcdefghijklmno%41pqrstuvwxyz0123456789ABCDEFGHIJK+LM"
+                  "NOPQRSTUVWXYZabcdef%u0041ghijklmnopqrstuvwxyz01234%2";
+    const char expect1[] = "abcdefghijklmnoApqrstuvwxyz0123456789ABCDEFGHIJK LM"
+                           "NOPQRSTUVWXYZabcdefAghijklmnopqrstuvwxyz01234";
+    char src2[] = "0123456789abcdef0123456789abcdef0123\xC3\xA9";
+    char dest[sizeof src1];
+    apr_size_t dlen;
+
+    AT_int_eq(apreq_decode(dest, &dlen, src1, sizeof src1 - 1),
+              APR_INCOMPLETE);
+    AT_int_eq(dlen, sizeof expect1 - 1);
+    AT_mem_eq(dest, expect1, sizeof expect1 - 1);
+
+    /* in place, with the output trailing the input */
+    src1[15] = '+';
+    src1[16] = ' ';
+    src1[17] = ' ';
+    AT_int_eq(apreq_decode(src1 + 1, &dlen, src1 + 1, sizeof src1 - 5),
+              APR_SUCCESS);
+    AT_mem_eq(src1 + 1, "bcdefghijklmno   pqrstuvwxyz", 28);
+
+    /* 8-bit bytes are still rejected inside a clean run */
+    AT_int_eq(apreq_decode(dest, &dlen, src2, sizeof src2 - 1),
+              APREQ_ERROR_BADCHAR);
+    AT_int_eq(dlen, 36);
+}
+
 static void test_decodev(dAT, void *ctx)
 {
     char src1[] = "%2540%2";
@@ -268,6 +417,71 @@ static void test_file_mktemp(dAT, void *ctx)
 
 }
 
+#ifdef WIN32
+#define LIST_SEP ";"
+#else
+#define LIST_SEP ":"
+#endif
+
+static void test_file_mktemp_striped(dAT, void *ctx)
+{
+    apr_pool_t *tp;
+    const char *tmp, *a, *b, *c, *name;
+    apr_file_t *f;
+    apr_status_t rc;
+    int i, na = 0, nb = 0;
+
+    apr_pool_create(&tp, p);
+    apr_temp_dir_get(&tmp, p);
+    a = apr_pstrcat(p, tmp, "/apreq_t_a", NULL);
+    b = apr_pstrcat(p, tmp, "/apreq_t_b", NULL);
+    apr_dir_make(a, APR_OS_DEFAULT, tp);
+    apr_dir_make(b, APR_OS_DEFAULT, tp);
+
+    /* files alternate between the listed directories */
+    for (i = 0; i < 4; ++i) {
+        rc = apreq_file_mktemp(&f, tp, apr_pstrcat(tp, a, LIST_SEP, b, NULL));
+        if (rc != APR_SUCCESS)
+            break;
+        apr_file_name_get(&name, f);
+        if (strncmp(name, a, strlen(a)) == 0)
+            ++na;
+        else if (strncmp(name, b, strlen(b)) == 0)
+            ++nb;
+    }
+    AT_int_eq(na, 2);
+    AT_int_eq(nb, 2);
+
+    /* a directory that won't take a file is skipped */
+    rc = apreq_file_mktemp(&f, tp, apr_pstrcat(tp, a, "/missing", LIST_SEP,
+                                               b, NULL));
+    AT_int_eq(rc, APR_SUCCESS);
+    if (rc == APR_SUCCESS) {
+        apr_file_name_get(&name, f);
+        AT_int_eq(strncmp(name, b, strlen(b)), 0);
+    }
+    else
+        AT_skip(1, "no temp file");
+
+    /* a directory whose name holds the separator is not split */
+    c = apr_pstrcat(p, a, LIST_SEP, "c", NULL);
+    apr_dir_make(c, APR_OS_DEFAULT, tp);
+    rc = apreq_file_mktemp(&f, tp, c);
+    AT_int_eq(rc, APR_SUCCESS);
+    if (rc == APR_SUCCESS) {
+        apr_file_name_get(&name, f);
+        AT_int_eq(strncmp(name, c, strlen(c)), 0);
+    }
+    else
+        AT_skip(1, "no temp file");
+
+    apr_pool_clear(tp);
+    apr_dir_remove(c, tp);
+    apr_dir_remove(a, tp);
+    apr_dir_remove(b, tp);
+    apr_pool_destroy(tp);
+}
+
 static void test_header_attribute(dAT, void *ctx)
 {
     const char hdr[] = "filename=\"filename=foo\" filename=\"quux.txt\"";
@@ -291,7 +505,313 @@ static void test_brigade_concat(dAT, void *ctx)
 
 }
 
+static void test_brigade_concat_async(dAT, void *ctx)
+{
+    apr_bucket_alloc_t *ba = apr_bucket_alloc_create(p);
+    apr_bucket_brigade *out = apr_brigade_create(p, ba);
+    apr_bucket_brigade *in = apr_brigade_create(p, ba);
+    apreq_spool_writer_t *w = apreq_spool_writer_make(p, 4);
+    char *expect = apr_palloc(p, 500 * 1000), *data;
+    apr_size_t len;
+    apr_status_t s = APR_SUCCESS;
+    int i, j;
+
+    for (i = 0; i < 500 && s == APR_SUCCESS; ++i) {
+        for (j = 0; j < 10; ++j) {
+            char *chunk = apr_palloc(p, 100);
+            memset(chunk, 'a' + (i + j) % 26, 100);
+            memcpy(expect + i * 1000 + j * 100, chunk, 100);
+            APR_BRIGADE_INSERT_TAIL(in,
+                apr_bucket_pool_create(chunk, 100, p, ba));
+        }
+        s = apreq_brigade_concat_async(w, p, NULL, 4096, out, in);
+    }
+    AT_int_eq(s, APR_SUCCESS);
+    AT_not_null(apreq_brigade_spoolfile(out));
+    AT_int_eq(apreq_spool_writer_wait(w), APR_SUCCESS);
+
+    apr_brigade_pflatten(out, &data, &len, p);
+    AT_int_eq(len, 500 * 1000);
+    AT_mem_eq(expect, data, 500 * 1000);
+}
+
+
+
+static void test_spool_memory(dAT, void *ctx)
+{
+    apr_pool_t *rp;
+    apr_bucket_alloc_t *ba;
+    apr_bucket_brigade *out, *in;
+    char *expect, *data;
+    apr_size_t len;
+    apr_status_t s = APR_SUCCESS;
+    const char *name;
+    int i;
+
+    if (apreq_spool_memory_set(64 * 1024, 1024 * 1024) != APR_SUCCESS) {
+        AT_skip(6, "no memory spool on this platform");
+        return;
+    }
+
+    apr_pool_create(&rp, p);
+    ba = apr_bucket_alloc_create(rp);
+    out = apr_brigade_create(rp, ba);
+    in = apr_brigade_create(rp, ba);
+    expect = apr_palloc(rp, 100 * 1000);
+
+    /* heap up to 4KB, then memory up to 64KB, then a temp file */
+    for (i = 0; i < 100 && s == APR_SUCCESS; ++i) {
+        memset(expect + i * 1000, 'a' + i % 26, 1000);
+        APR_BRIGADE_INSERT_TAIL(in,
+            apr_bucket_pool_create(expect + i * 1000, 1000, rp, ba));
+        s = apreq_brigade_concat(rp, NULL, 4096, out, in);
+
+        if (i == 30) {
+            AT_not_null(apreq_brigade_spoolfile(out));
+            apr_file_name_get(&name, apreq_brigade_spoolfile(out));
+            AT_is_null(name);
+        }
+    }
+    AT_int_eq(s, APR_SUCCESS);
+    apr_file_name_get(&name, apreq_brigade_spoolfile(out));
+    AT_not_null(name);
+
+    apr_brigade_pflatten(out, &data, &len, rp);
+    AT_int_eq(len, 100 * 1000);
+    AT_mem_eq(expect, data, 100 * 1000);
+
+    apr_pool_destroy(rp);
+    apreq_spool_memory_set(0, 0);
+}
+
 
+static void test_spool_direct(dAT, void *ctx)
+{
+    apr_pool_t *rp;
+    apr_bucket_alloc_t *ba;
+    apr_bucket_brigade *out, *in;
+    apr_file_t *file;
+    char *expect, *data;
+    apr_size_t len;
+    apr_finfo_t finfo;
+    apr_status_t s = APR_SUCCESS;
+    int i;
+
+    if (apreq_spool_direct_set(10000) != APR_SUCCESS) {
+        AT_skip(6, "no direct spool mode on this platform");
+        return;
+    }
+
+    apr_pool_create(&rp, p);
+    ba = apr_bucket_alloc_create(rp);
+    out = apr_brigade_create(rp, ba);
+    in = apr_brigade_create(rp, ba);
+    expect = apr_palloc(rp, 100 * 3001);
+
+    /* unaligned appends, some filling the staging buffer */
+    for (i = 0; i < 100 && s == APR_SUCCESS; ++i) {
+        int n = (i % 10 == 9) ? 40 : 1;
+        int j;
+
+        for (j = 0; j < 3001; ++j)
+            expect[i * 3001 + j] = 'a' + (i + j) % 26;
+        APR_BRIGADE_INSERT_TAIL(in,
+            apr_bucket_pool_create(expect + i * 3001, 3001, rp, ba));
+        if (n > 1 && i + n <= 100) {
+            for (j = 3001; j < n * 3001; ++j)
+                expect[i * 3001 + j] = 'A' + j % 26;
+            APR_BRIGADE_INSERT_TAIL(in,
+                apr_bucket_pool_create(expect + i * 3001 + 3001,
+                                       (n - 1) * 3001, rp, ba));
+            i += n - 1;
+        }
+        s = apreq_brigade_concat(rp, NULL, 4096, out, in);
+    }
+    AT_int_eq(s, APR_SUCCESS);
+
+    /* the unaligned end is still staged, but reads see it */
+    file = apreq_brigade_spoolfile(out);
+    apr_file_info_get(&finfo, APR_FINFO_SIZE, file);
+    AT_ok(finfo.size < 100 * 3001, "tail staged");
+    apr_brigade_pflatten(out, &data, &len, rp);
+    AT_int_eq(len, 100 * 3001);
+    AT_mem_eq(expect, data, 100 * 3001);
+
+    AT_int_eq(apreq_brigade_spool_trim(out), APR_SUCCESS);
+    apr_file_info_get(&finfo, APR_FINFO_SIZE, file);
+    AT_int_eq(finfo.size, 100 * 3001);
+
+    apr_pool_destroy(rp);
+    apreq_spool_direct_set(0);
+}
+
+/* Does the file at path hold exactly len bytes of data? */
+static int file_holds(const char *path, const char *data, apr_size_t len,
+                      apr_pool_t *pool)
+{
+    apr_file_t *f;
+    apr_finfo_t finfo;
+    char *buf = apr_palloc(pool, len + 1);
+    int ok;
+
+    if (apr_file_open(&f, path, APR_READ | APR_BINARY, APR_OS_DEFAULT,
+                      pool) != APR_SUCCESS)
+        return 0;
+    ok = apr_file_info_get(&finfo, APR_FINFO_SIZE, f) == APR_SUCCESS
+        && finfo.size == (apr_off_t)len
+        && apr_file_read_full(f, buf, len, NULL) == APR_SUCCESS
+        && memcmp(buf, data, len) == 0;
+    apr_file_close(f);
+    return ok;
+}
+
+static void test_brigade_persist(dAT, void *ctx)
+{
+    apr_pool_t *gp, *rp;
+    apr_bucket_alloc_t *ba;
+    apr_bucket_brigade *out, *in;
+    const char *tmp, *path, *name;
+    char *expect, *data;
+    apr_size_t len;
+    apr_file_t *f;
+    apr_finfo_t finfo;
+    int i;
+
+    apr_pool_create(&gp, p);
+    apr_pool_create(&rp, p);
+    apr_temp_dir_get(&tmp, p);
+    path = apr_pstrcat(p, tmp, "/apreq_t_persist", NULL);
+    apr_file_remove(path, p);
+
+    ba = apr_bucket_alloc_create(rp);
+    out = apr_brigade_create(rp, ba);
+    in = apr_brigade_create(rp, ba);
+    expect = apr_palloc(p, 50 * 1000);
+    for (i = 0; i < 50; ++i) {
+        memset(expect + i * 1000, 'a' + i % 26, 1000);
+        APR_BRIGADE_INSERT_TAIL(in,
+            apr_bucket_pool_create(expect + i * 1000, 1000, rp, ba));
+        apreq_brigade_concat(rp, NULL, 4096, out, in);
+    }
+
+    /* a named spool file moves, dropping its temp name */
+    apr_file_name_get(&name, apreq_brigade_spoolfile(out));
+    AT_int_eq(apreq_brigade_persist(rp, path, out), APR_SUCCESS);
+    AT_ok(file_holds(path, expect, 50 * 1000, rp), "persisted upload");
+    apr_stat(&finfo, path, APR_FINFO_PROT, rp);
+    AT_int_eq(finfo.protection, APR_FPROT_UREAD | APR_FPROT_UWRITE);
+    AT_int_eq(apr_file_open(&f, name, APR_READ, APR_OS_DEFAULT, rp),
+              APR_ENOENT);
+    AT_int_eq(apreq_brigade_persist(rp, path, out), APR_EEXIST);
+
+    /* and the upload stays readable */
+    apr_brigade_pflatten(out, &data, &len, rp);
+    AT_int_eq(len, 50 * 1000);
+    AT_mem_eq(expect, data, 50 * 1000);
+    apr_pool_clear(rp);
+    apr_file_remove(path, p);
+
+    /* an anonymous one survives its return to the temp file pool */
+    apreq_tempfile_pool_init(gp, 1);
+    ba = apr_bucket_alloc_create(rp);
+    out = apr_brigade_create(rp, ba);
+    in = apr_brigade_create(rp, ba);
+    for (i = 0; i < 50; ++i) {
+        APR_BRIGADE_INSERT_TAIL(in,
+            apr_bucket_pool_create(expect + i * 1000, 1000, rp, ba));
+        apreq_brigade_concat(rp, NULL, 4096, out, in);
+    }
+    AT_int_eq(apreq_brigade_persist(rp, path, out), APR_SUCCESS);
+    apr_pool_clear(rp);
+    AT_ok(file_holds(path, expect, 50 * 1000, p), "persisted pooled upload");
+    apr_file_remove(path, p);
+
+    /* a brigade on the heap is written out */
+    ba = apr_bucket_alloc_create(rp);
+    out = apr_brigade_create(rp, ba);
+    APR_BRIGADE_INSERT_TAIL(out,
+        apr_bucket_pool_create(expect, 3000, rp, ba));
+    AT_int_eq(apreq_brigade_persist(rp, path, out), APR_SUCCESS);
+    AT_ok(file_holds(path, expect, 3000, rp), "persisted heap upload");
+    apr_stat(&finfo, path, APR_FINFO_PROT, rp);
+    AT_int_eq(finfo.protection, APR_FPROT_UREAD | APR_FPROT_UWRITE);
+    apr_file_remove(path, p);
+
+    apr_pool_destroy(rp);
+    apr_pool_destroy(gp);
+}
+
+
+static void test_tempfile_pool(dAT, void *ctx)
+{
+    apr_pool_t *gp, *rp;
+    apr_file_t *f;
+    apr_os_file_t fd, fd2;
+    apr_finfo_t finfo;
+    apr_size_t len = 5;
+    const char *name;
+
+    apr_pool_create(&gp, p);
+    apr_pool_create(&rp, p);
+    AT_int_eq(apreq_tempfile_pool_init(gp, 1), APR_SUCCESS);
+
+    AT_int_eq(apreq_tempfile_pool_get(&f, rp, NULL), APR_SUCCESS);
+    apr_file_name_get(&name, f);
+    AT_is_null(name);
+    apr_file_write(f, "hello", &len);
+    apr_os_file_get(&fd, f);
+    apr_pool_clear(rp);
+
+    /* the same, now empty, file comes back */
+    AT_int_eq(apreq_tempfile_pool_get(&f, rp, NULL), APR_SUCCESS);
+    apr_os_file_get(&fd2, f);
+    AT_int_eq(fd2, fd);
+    apr_file_info_get(&finfo, APR_FINFO_SIZE, f);
+    AT_int_eq(finfo.size, 0);
+    apr_pool_clear(rp);
+
+    /* once the pool is gone, it's apreq_file_mktemp() again */
+    apr_pool_destroy(gp);
+    AT_int_eq(apreq_tempfile_pool_get(&f, rp, NULL), APR_SUCCESS);
+    apr_file_name_get(&name, f);
+    AT_not_null(name);
+    apr_pool_destroy(rp);
+}
+
+static void test_table_index(dAT, void *ctx)
+{
+    apr_table_t *t = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    apr_table_t *small = apr_table_make(p, APREQ_DEFAULT_NELTS);
+    apreq_table_index_t *idx = apreq_table_index_make(p);
+    int i, mismatches = 0;
+
+    apr_table_addn(small, "a", "1");
+    AT_str_eq(apreq_table_index_get(idx, small, "A"), "1");
+
+    for (i = 0; i < 500; ++i) {
+        const char *key = apr_psprintf(p, "Field%d", i % 300);
+        apr_table_addn(t, key, apr_psprintf(p, "%d", i));
+    }
+
+    for (i = 0; i < 320; ++i) {
+        const char *key = apr_psprintf(p, "fIELD%d", i);
+        const char *a = apr_table_get(t, key);
+        const char *b = apreq_table_index_get(idx, t, key);
+        if (a != b)
+            ++mismatches;
+    }
+    AT_int_eq(mismatches, 0);
+    /* a repeated key still finds its first value */
+    AT_str_eq(apreq_table_index_get(idx, t, "field7"), "7");
+    AT_is_null(apreq_table_index_get(idx, t, "field300"));
+
+    /* appended entries are picked up on the next lookup */
+    apr_table_addn(t, "field300", "new");
+    apr_table_addn(t, "field7", "later");
+    AT_str_eq(apreq_table_index_get(idx, t, "FIELD300"), "new");
+    AT_str_eq(apreq_table_index_get(idx, t, "field7"), "7");
+    AT_is_null(apreq_table_index_get(idx, NULL, "field7"));
+}
 
 #define dT(func, plan) #func, func, plan, NULL
 
@@ -299,14 +819,17 @@ static void test_brigade_concat(dAT, void *ctx)
 int main(int argc, char *argv[])
 {
     unsigned i, plan = 0;
-    apr_pool_t *p;
     dAT;
     at_test_t test_list [] = {
         { dT(test_atoi64f, 9) },
         { dT(test_atoi64t, 9) },
         { dT(test_index, 6) },
-        { dT(test_decode, 7) },
+        { dT(test_index_match, 6) },
+        { dT(test_decode, 11) },
+        { dT(test_decode_long, 7) },
+        { dT(test_decode_charset, 8) },
         { dT(test_charset_divine, 6) },
+        { dT(test_charset_divine_long, 6) },
         { dT(test_decodev, 6) },
         { dT(test_encode, 0) },
         { dT(test_cp1252_to_utf8, 14) },
@@ -315,8 +838,15 @@ int main(int argc, char *argv[])
         { dT(test_join, 0) },
         { dT(test_brigade_fwrite, 0) },
         { dT(test_file_mktemp, 0) },
+        { dT(test_file_mktemp_striped, 6) },
         { dT(test_header_attribute, 6) },
         { dT(test_brigade_concat, 0) },
+        { dT(test_brigade_concat_async, 5) },
+        { dT(test_spool_memory, 6) },
+        { dT(test_spool_direct, 6) },
+        { dT(test_brigade_persist, 12) },
+        { dT(test_tempfile_pool, 8) },
+        { dT(test_table_index, 7) },
     };
 
     apr_initialize();
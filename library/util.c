@@ -20,8 +20,62 @@
 #include "apr_time.h"
 #include "apr_strings.h"
 #include "apr_lib.h"
+#include "apr_general.h"
+#include "apr_portable.h"
+#include "apr_atomic.h"
+#include "apr_hash.h"
 #include <assert.h>
 
+#ifdef HAVE_CONFIG_H
+#include "apreq_config.h"
+#endif
+
+#if APR_HAS_THREADS
+#include "apr_thread_proc.h"
+#include "apr_thread_mutex.h"
+#include "apr_thread_cond.h"
+#endif
+
+#if APR_HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#if defined(HAVE_FALLOCATE) || defined(HAVE_POSIX_FALLOCATE)
+#include <errno.h>
+#endif
+
+#if !defined(WIN32) && APR_HAVE_UNISTD_H
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#ifdef HAVE_LINUX_FS_H
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+#if defined(HAVE_MEMFD_CREATE) && APR_HAS_MMAP
+#define SPOOL_MEMFD
+#include <sys/mman.h>
+#include <errno.h>
+#endif
+
+#if !defined(WIN32) && (defined(O_DIRECT) || defined(HAVE_POSIX_FADVISE))
+#define SPOOL_DIRECT
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#ifdef HAVE_PWRITEV
+#include <sys/uio.h>
+#include <errno.h>
+#endif
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#include <errno.h>
+#endif
+
 #undef MAX
 #undef MIN
 #define MIN(a,b) ( (a) < (b) ? (a) : (b) )
@@ -89,9 +143,40 @@ APREQ_DECLARE(apr_int64_t) apreq_atoi64t(const char *s)
 }
 
 
-APREQ_DECLARE(apr_ssize_t ) apreq_index(const char* hay, apr_size_t hlen,
-                                        const char* ndl, apr_size_t nlen,
-                                        const apreq_match_t type)
+#if !defined(APREQ_NO_SIMD) && (defined(__x86_64__) || defined(__i386__)) \
+    && (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define APREQ_X86_SIMD
+#include <immintrin.h>
+#endif
+
+enum { SIMD_UNKNOWN = -1, SIMD_NONE, SIMD_SSE2, SIMD_AVX2 };
+
+/* Probing twice is harmless, so no locking is needed here. */
+static int simd = SIMD_UNKNOWN;
+
+static int simd_level(void)
+{
+    if (simd == SIMD_UNKNOWN) {
+        int level = SIMD_NONE;
+#ifdef APREQ_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            level = SIMD_AVX2;
+        else if (__builtin_cpu_supports("sse2"))
+            level = SIMD_SSE2;
+#endif
+        simd = level;
+    }
+    return simd;
+}
+
+typedef apr_ssize_t (*index_fn_t)(const char *hay, apr_size_t hlen,
+                                  const char *ndl, apr_size_t nlen,
+                                  const apreq_match_t type);
+
+static apr_ssize_t index_scalar(const char* hay, apr_size_t hlen,
+                                const char* ndl, apr_size_t nlen,
+                                const apreq_match_t type)
 {
     apr_size_t len = hlen;
     const char *end = hay + hlen;
@@ -113,6 +198,152 @@ APREQ_DECLARE(apr_ssize_t ) apreq_index(const char* hay, apr_size_t hlen,
     return hay ? hay - begin : -1;
 }
 
+#ifdef APREQ_X86_SIMD
+
+/*
+ * Vector scanners: a position is a candidate when both the first and the
+ * last byte of ndl line up there, which rules out nearly every position
+ * 16 or 32 at a time.  Candidates are confirmed with memcmp.  The vector
+ * loop stops once a load would run past the end of hay; the scalar loop
+ * takes over from there, which is also where any trailing partial match
+ * has to begin.
+ */
+
+__attribute__((target("sse2")))
+static apr_ssize_t index_sse2(const char* hay, apr_size_t hlen,
+                              const char* ndl, apr_size_t nlen,
+                              const apreq_match_t type)
+{
+    apr_size_t i = 0;
+    apr_ssize_t idx;
+
+    if (nlen > 0 && hlen >= nlen + 15) {
+        const __m128i first = _mm_set1_epi8(ndl[0]);
+        const __m128i last = _mm_set1_epi8(ndl[nlen - 1]);
+        const apr_size_t stop = hlen - nlen - 15;
+
+        for (; i <= stop; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(hay + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(hay + i + nlen - 1));
+            unsigned mask = _mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(a, first),
+                              _mm_cmpeq_epi8(b, last)));
+
+            while (mask != 0) {
+                apr_size_t pos = i + __builtin_ctz(mask);
+                if (memcmp(hay + pos, ndl, nlen) == 0)
+                    return pos;
+                mask &= mask - 1;
+            }
+        }
+    }
+
+    idx = index_scalar(hay + i, hlen - i, ndl, nlen, type);
+    return idx < 0 ? -1 : idx + (apr_ssize_t)i;
+}
+
+__attribute__((target("avx2")))
+static apr_ssize_t index_avx2(const char* hay, apr_size_t hlen,
+                              const char* ndl, apr_size_t nlen,
+                              const apreq_match_t type)
+{
+    apr_size_t i = 0;
+    apr_ssize_t idx;
+
+    if (nlen > 0 && hlen >= nlen + 31) {
+        const __m256i first = _mm256_set1_epi8(ndl[0]);
+        const __m256i last = _mm256_set1_epi8(ndl[nlen - 1]);
+        const apr_size_t stop = hlen - nlen - 31;
+
+        for (; i <= stop; i += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(hay + i));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(hay + i + nlen - 1));
+            unsigned mask = (unsigned)_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                 _mm256_cmpeq_epi8(b, last)));
+
+            while (mask != 0) {
+                apr_size_t pos = i + __builtin_ctz(mask);
+                if (memcmp(hay + pos, ndl, nlen) == 0)
+                    return pos;
+                mask &= mask - 1;
+            }
+        }
+    }
+
+    idx = index_sse2(hay + i, hlen - i, ndl, nlen, type);
+    return idx < 0 ? -1 : idx + (apr_ssize_t)i;
+}
+
+#endif /* APREQ_X86_SIMD */
+
+static index_fn_t index_select(void)
+{
+#ifdef APREQ_X86_SIMD
+    switch (simd_level()) {
+    case SIMD_AVX2:
+        return index_avx2;
+    case SIMD_SSE2:
+        return index_sse2;
+    }
+#endif
+    return index_scalar;
+}
+
+APREQ_DECLARE(apr_ssize_t ) apreq_index(const char* hay, apr_size_t hlen,
+                                        const char* ndl, apr_size_t nlen,
+                                        const apreq_match_t type)
+{
+    return index_select()(hay, hlen, ndl, nlen, type);
+}
+
+static apr_ssize_t pattern_index_scalar(const apreq_index_pattern_t *pattern,
+                                        const char *hay, apr_size_t hlen,
+                                        const apreq_match_t type)
+{
+    return index_scalar(hay, hlen, pattern->ndl, pattern->nlen, type);
+}
+
+#ifdef APREQ_X86_SIMD
+
+static apr_ssize_t pattern_index_sse2(const apreq_index_pattern_t *pattern,
+                                      const char *hay, apr_size_t hlen,
+                                      const apreq_match_t type)
+{
+    return index_sse2(hay, hlen, pattern->ndl, pattern->nlen, type);
+}
+
+static apr_ssize_t pattern_index_avx2(const apreq_index_pattern_t *pattern,
+                                      const char *hay, apr_size_t hlen,
+                                      const apreq_match_t type)
+{
+    return index_avx2(hay, hlen, pattern->ndl, pattern->nlen, type);
+}
+
+#endif
+
+APREQ_DECLARE(const apreq_index_pattern_t *)
+    apreq_index_precompile(apr_pool_t *p, const char *ndl, apr_size_t nlen)
+{
+    apreq_index_pattern_t *pattern = apr_palloc(p, sizeof *pattern);
+    index_fn_t fn = index_select();
+
+    pattern->ndl = ndl;
+    pattern->nlen = nlen;
+    pattern->index = pattern_index_scalar;
+
+#ifdef APREQ_X86_SIMD
+    if (fn == index_avx2)
+        pattern->index = pattern_index_avx2;
+    else if (fn == index_sse2)
+        pattern->index = pattern_index_sse2;
+#else
+    (void)fn;
+#endif
+
+    return pattern;
+}
+
 
 static const char c2x_table[] = "0123456789ABCDEF";
 static APR_INLINE unsigned char hex2_to_char(const char *what)
@@ -217,6 +448,193 @@ APREQ_DECLARE(apr_size_t) apreq_cp1252_to_utf8(char *dest,
 }
 
 
+#ifdef APREQ_X86_SIMD
+
+/*
+ * Length of the leading run of ascii bytes in s, 16 or 32 at a time.
+ * As with decode_run_*(), the final partial block is left to the caller.
+ */
+
+__attribute__((target("sse2")))
+static apr_size_t ascii_run_sse2(const unsigned char *s, apr_size_t len)
+{
+    apr_size_t n = 0;
+
+    for (; len - n >= 16; n += 16) {
+        unsigned mask = _mm_movemask_epi8(
+            _mm_loadu_si128((const __m128i *)(s + n)));
+        if (mask != 0)
+            return n + __builtin_ctz(mask);
+    }
+    return n;
+}
+
+__attribute__((target("avx2")))
+static apr_size_t ascii_run_avx2(const unsigned char *s, apr_size_t len)
+{
+    apr_size_t n = 0;
+
+    for (; len - n >= 32; n += 32) {
+        unsigned mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_loadu_si256((const __m256i *)(s + n)));
+        if (mask != 0)
+            return n + __builtin_ctz(mask);
+    }
+    return n + ascii_run_sse2(s + n, len - n);
+}
+
+static APR_INLINE apr_size_t ascii_run(int level, const unsigned char *s,
+                                       apr_size_t len)
+{
+    return level == SIMD_AVX2 ? ascii_run_avx2(s, len)
+                              : ascii_run_sse2(s, len);
+}
+
+/*
+ * Strict (RFC 3629) utf8 validation, 32 bytes at a time, with the
+ * nibble lookup tables from Keiser & Lemire, "Validating UTF-8 In Less
+ * Than One Instruction Per Byte".  Each table entry is the set of errors
+ * a byte pair could belong to, keyed by the high or low nibble of the
+ * first byte or the high nibble of the second; an error needs all
+ * three to agree.  Third and fourth bytes of a sequence are checked
+ * separately, against the lead byte two or three positions back.
+ *
+ * Strictly valid utf8 is always classified as utf8 by
+ * apreq_charset_divine(), so a pass settles the answer; a failure
+ * just hands the string to the scalar classifier.
+ */
+
+#define U8_TOO_SHORT   0x01
+#define U8_TOO_LONG    0x02
+#define U8_OVERLONG_3  0x04
+#define U8_TOO_LARGE   0x08
+#define U8_SURROGATE   0x10
+#define U8_OVERLONG_2  0x20
+#define U8_TOO_LARGE_1000 0x40
+#define U8_OVERLONG_4  0x40
+#define U8_TWO_CONTS   0x80
+#define U8_CARRY       (U8_TOO_SHORT | U8_TOO_LONG | U8_TWO_CONTS)
+
+static const unsigned char utf8_byte1_high[16] = {
+    /* 0xxx: ascii */
+    U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+    U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+    /* 10xx: continuation */
+    U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS,
+    /* 1100, 1101: two byte lead */
+    U8_TOO_SHORT | U8_OVERLONG_2,
+    U8_TOO_SHORT,
+    /* 1110: three byte lead */
+    U8_TOO_SHORT | U8_OVERLONG_3 | U8_SURROGATE,
+    /* 1111: four (or more) byte lead */
+    U8_TOO_SHORT | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_OVERLONG_4
+};
+
+static const unsigned char utf8_byte1_low[16] = {
+    U8_CARRY | U8_OVERLONG_3 | U8_OVERLONG_2 | U8_OVERLONG_4,
+    U8_CARRY | U8_OVERLONG_2,
+    U8_CARRY,
+    U8_CARRY,
+    U8_CARRY | U8_TOO_LARGE,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_SURROGATE,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000
+};
+
+static const unsigned char utf8_byte2_high[16] = {
+    /* 0xxx: ascii */
+    U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+    U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+    /* 1000 */
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3
+        | U8_TOO_LARGE_1000 | U8_OVERLONG_4,
+    /* 1001 */
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3
+        | U8_TOO_LARGE,
+    /* 101x */
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE
+        | U8_TOO_LARGE,
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE
+        | U8_TOO_LARGE,
+    /* 11xx: lead */
+    U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT
+};
+
+__attribute__((target("avx2")))
+static APR_INLINE __m256i utf8_errors_avx2(__m256i in, __m256i prev)
+{
+    const __m256i b1h = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)utf8_byte1_high));
+    const __m256i b1l = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)utf8_byte1_low));
+    const __m256i b2h = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)utf8_byte2_high));
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    /* the 16 bytes before each lane: high lane of prev, low lane of in */
+    const __m256i back = _mm256_permute2x128_si256(prev, in, 0x21);
+    __m256i prev1 = _mm256_alignr_epi8(in, back, 15);
+    __m256i prev2 = _mm256_alignr_epi8(in, back, 14);
+    __m256i prev3 = _mm256_alignr_epi8(in, back, 13);
+    __m256i special, must23;
+
+    special = _mm256_and_si256(
+        _mm256_and_si256(
+            _mm256_shuffle_epi8(b1h, _mm256_and_si256(
+                                    _mm256_srli_epi16(prev1, 4), nibble)),
+            _mm256_shuffle_epi8(b1l, _mm256_and_si256(prev1, nibble))),
+        _mm256_shuffle_epi8(b2h, _mm256_and_si256(
+                                _mm256_srli_epi16(in, 4), nibble)));
+
+    must23 = _mm256_or_si256(
+        _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 1))),
+        _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 1))));
+    must23 = _mm256_and_si256(
+        _mm256_cmpgt_epi8(must23, _mm256_setzero_si256()),
+        _mm256_set1_epi8((char)0x80));
+
+    return _mm256_xor_si256(must23, special);
+}
+
+/*
+ * The block holding the end of s is zero padded, and so always has at
+ * least one ascii byte after the data (a whole block of them when len
+ * is a multiple of 32): a sequence cut short at the end is an error.
+ */
+
+__attribute__((target("avx2")))
+static int utf8_valid_avx2(const unsigned char *s, apr_size_t len)
+{
+    unsigned char tail[32];
+    __m256i prev = _mm256_setzero_si256();
+    __m256i in, err;
+    apr_size_t n = 0;
+
+    for (; len - n >= 32; n += 32) {
+        in = _mm256_loadu_si256((const __m256i *)(s + n));
+        err = utf8_errors_avx2(in, prev);
+        if (!_mm256_testz_si256(err, err))
+            return 0;
+        prev = in;
+    }
+
+    memset(tail, 0, sizeof tail);
+    memcpy(tail, s + n, len - n);
+    in = _mm256_loadu_si256((const __m256i *)tail);
+    err = utf8_errors_avx2(in, prev);
+    return _mm256_testz_si256(err, err);
+}
+
+#endif /* APREQ_X86_SIMD */
+
+
 /**
  * Valid utf8 bit patterns: (true utf8 must satisfy a minimality condition)
  *
@@ -237,87 +655,144 @@ APREQ_DECLARE(apr_size_t) apreq_cp1252_to_utf8(char *dest,
  * about earlier control characters presumed to be valid utf8.
  */
 
-APREQ_DECLARE(apreq_charset_t) apreq_charset_divine(const char *src,
-                                                    apr_size_t slen)
+/*
+ * The heuristics above as a byte-at-a-time state machine, so that
+ * url_decode() can divine the charset of its output as it goes.  Once
+ * the answer is cp1252 nothing can change it, and divine_step() says so.
+ */
 
-{
-    apreq_charset_t rv = APREQ_CHARSET_ASCII;
-    register unsigned char trail = 0, saw_cntrl = 0, mask = 0;
-    register const unsigned char *s = (const unsigned char *)src;
-    const unsigned char *end = s + slen;
+struct divine_state {
+    apreq_charset_t rv;
+    unsigned char trail, saw_cntrl, mask;
+};
 
-    for (; s < end; ++s) {
-        if (trail) {
-            if ((*s & 0xC0) == 0x80 && (mask == 0 || (mask & *s))) {
-                mask = 0;
-                --trail;
+#define DIVINE_STATE_INIT { APREQ_CHARSET_ASCII, 0, 0, 0 }
 
-                if ((*s & 0xE0) == 0x80) {
-                    saw_cntrl = 1;
-                }
-            }
-            else {
-                trail = 0;
-                if (saw_cntrl)
-                    return APREQ_CHARSET_CP1252;
-                rv = APREQ_CHARSET_LATIN1;
+static APR_INLINE int divine_step(struct divine_state *ds, unsigned char c)
+{
+    if (ds->rv == APREQ_CHARSET_CP1252) {
+        return 0;
+    }
+    else if (ds->trail) {
+        if ((c & 0xC0) == 0x80 && (ds->mask == 0 || (ds->mask & c))) {
+            ds->mask = 0;
+            --ds->trail;
+
+            if ((c & 0xE0) == 0x80) {
+                ds->saw_cntrl = 1;
             }
         }
-        else if (*s < 0x80) {
-            /* do nothing */
-        }
-        else if (*s < 0xA0) {
-            return APREQ_CHARSET_CP1252;
-        }
-        else if (*s < 0xC0) {
-            if (saw_cntrl)
-                return APREQ_CHARSET_CP1252;
-            rv = APREQ_CHARSET_LATIN1;
-        }
-        else if (rv == APREQ_CHARSET_LATIN1) {
-            /* do nothing */
+        else {
+            ds->trail = 0;
+            if (ds->saw_cntrl)
+                goto cp1252;
+            ds->rv = APREQ_CHARSET_LATIN1;
         }
+    }
+    else if (c < 0x80) {
+        /* do nothing */
+    }
+    else if (c < 0xA0) {
+        goto cp1252;
+    }
+    else if (c < 0xC0) {
+        if (ds->saw_cntrl)
+            goto cp1252;
+        ds->rv = APREQ_CHARSET_LATIN1;
+    }
+    else if (ds->rv == APREQ_CHARSET_LATIN1) {
+        /* do nothing */
+    }
 
-        /* utf8 cases */
+    /* utf8 cases */
 
-        else if (*s < 0xE0) {
-            if (*s & 0x1E) {
-                rv = APREQ_CHARSET_UTF8;
-                trail = 1;
-                mask = 0;
-            }
-            else if (saw_cntrl)
-                return APREQ_CHARSET_CP1252;
-            else
-                rv = APREQ_CHARSET_LATIN1;
+    else if (c < 0xE0) {
+        if (c & 0x1E) {
+            ds->rv = APREQ_CHARSET_UTF8;
+            ds->trail = 1;
+            ds->mask = 0;
         }
-        else if (*s < 0xF0) {
-            mask = (*s & 0x0F) ? 0 : 0x20;
-            rv = APREQ_CHARSET_UTF8;
-            trail = 2;
-        }
-        else if (*s < 0xF8) {
-            mask = (*s & 0x07) ? 0 : 0x30;
-            rv = APREQ_CHARSET_UTF8;
-            trail = 3;
-        }
-        else if (*s < 0xFC) {
-            mask = (*s & 0x03) ? 0 : 0x38;
-            rv = APREQ_CHARSET_UTF8;
-            trail = 4;
-        }
-        else if (*s < 0xFE) {
-            mask = (*s & 0x01) ? 0 : 0x3C;
-            rv = APREQ_CHARSET_UTF8;
-            trail = 5;
-        }
-        else {
-            rv = APREQ_CHARSET_UTF8;
+        else if (ds->saw_cntrl)
+            goto cp1252;
+        else
+            ds->rv = APREQ_CHARSET_LATIN1;
+    }
+    else if (c < 0xF0) {
+        ds->mask = (c & 0x0F) ? 0 : 0x20;
+        ds->rv = APREQ_CHARSET_UTF8;
+        ds->trail = 2;
+    }
+    else if (c < 0xF8) {
+        ds->mask = (c & 0x07) ? 0 : 0x30;
+        ds->rv = APREQ_CHARSET_UTF8;
+        ds->trail = 3;
+    }
+    else if (c < 0xFC) {
+        ds->mask = (c & 0x03) ? 0 : 0x38;
+        ds->rv = APREQ_CHARSET_UTF8;
+        ds->trail = 4;
+    }
+    else if (c < 0xFE) {
+        ds->mask = (c & 0x01) ? 0 : 0x3C;
+        ds->rv = APREQ_CHARSET_UTF8;
+        ds->trail = 5;
+    }
+    else {
+        ds->rv = APREQ_CHARSET_UTF8;
+    }
+    return 1;
+
+ cp1252:
+    ds->rv = APREQ_CHARSET_CP1252;
+    ds->trail = 0;
+    return 0;
+}
+
+/* ascii can only matter in the middle of a sequence */
+#define DIVINE_BYTE(ds, c) do {                                         \
+    if ((ds) != NULL && ((unsigned char)(c) >= 0x80 || (ds)->trail))    \
+        divine_step(ds, c);                                             \
+} while (0)
+
+static APR_INLINE apreq_charset_t divine_result(const struct divine_state *ds)
+{
+    return ds->trail ? ds->saw_cntrl ?
+        APREQ_CHARSET_CP1252 : APREQ_CHARSET_LATIN1 : ds->rv;
+}
+
+APREQ_DECLARE(apreq_charset_t) apreq_charset_divine(const char *src,
+                                                    apr_size_t slen)
+
+{
+    struct divine_state ds = DIVINE_STATE_INIT;
+    register const unsigned char *s = (const unsigned char *)src;
+    const unsigned char *end = s + slen;
+#ifdef APREQ_X86_SIMD
+    const int level = simd_level();
+
+    if (slen >= 16 && level != SIMD_NONE) {
+        s += ascii_run(level, s, slen);
+        if (s < end && *s >= 0x80 && level == SIMD_AVX2
+            && utf8_valid_avx2(s, end - s))
+            return APREQ_CHARSET_UTF8;
+    }
+#endif
+
+    for (; s < end; ++s) {
+#ifdef APREQ_X86_SIMD
+        /* ascii leaves the state alone between sequences */
+        if (ds.trail == 0 && *s < 0x80 && end - s >= 16
+            && level != SIMD_NONE) {
+            s += ascii_run(level, s, end - s);
+            if (s == end)
+                break;
         }
+#endif
+        if (!divine_step(&ds, *s))
+            return APREQ_CHARSET_CP1252;
     }
 
-    return trail ? saw_cntrl ?
-        APREQ_CHARSET_CP1252 : APREQ_CHARSET_LATIN1 : rv;
+    return divine_result(&ds);
 }
 
 
@@ -348,68 +823,188 @@ static APR_INLINE apr_uint16_t hex4_to_bmp(const char *what) {
 }
 
 
+#ifdef APREQ_X86_SIMD
+
+/*
+ * Copies the leading run of bytes that url_decode() passes through
+ * unchanged, 16 or 32 at a time; returns its length.  Such bytes are
+ * 0x01-0x7F other than '%' and '+' (char is signed on x86, so the
+ * scalar loop rejects 0x80-0xFF as well as NUL).  The run stops short
+ * of the final partial block, which the scalar loop handles.  dest may
+ * trail src in the same buffer: a full block is always loaded before it
+ * is stored, and a partial one is moved with memmove().
+ */
+
+__attribute__((target("sse2")))
+static apr_size_t decode_run_sse2(unsigned char *d, const char *s,
+                                  apr_size_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i pct = _mm_set1_epi8('%');
+    const __m128i plus = _mm_set1_epi8('+');
+    apr_size_t n = 0;
+
+    for (; len - n >= 16; n += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + n));
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, pct),
+                                       _mm_cmpeq_epi8(v, plus));
+        unsigned mask = _mm_movemask_epi8(
+            _mm_andnot_si128(special, _mm_cmpgt_epi8(v, zero)));
+
+        if (mask != 0xFFFF) {
+            unsigned k = __builtin_ctz(~mask);
+            memmove(d + n, s + n, k);
+            return n + k;
+        }
+        _mm_storeu_si128((__m128i *)(d + n), v);
+    }
+    return n;
+}
+
+__attribute__((target("avx2")))
+static apr_size_t decode_run_avx2(unsigned char *d, const char *s,
+                                  apr_size_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i pct = _mm256_set1_epi8('%');
+    const __m256i plus = _mm256_set1_epi8('+');
+    apr_size_t n = 0;
+
+    for (; len - n >= 32; n += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + n));
+        __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(v, pct),
+                                          _mm256_cmpeq_epi8(v, plus));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_andnot_si256(special, _mm256_cmpgt_epi8(v, zero)));
+
+        if (mask != 0xFFFFFFFFU) {
+            unsigned k = __builtin_ctz(~mask);
+            memmove(d + n, s + n, k);
+            return n + k;
+        }
+        _mm256_storeu_si256((__m256i *)(d + n), v);
+    }
+    return n + decode_run_sse2(d + n, s + n, len - n);
+}
+
+#endif /* APREQ_X86_SIMD */
+
+/*
+ * Checks the escape sequence at the '%' at s, which ends by end.
+ * Returns its length: 3 for %XX, 6 for %uXXXX, 0 if it is malformed,
+ * or -1 if it may be complete once more data follows.
+ */
+static int escape_len(const char *s, const char *end)
+{
+    if (s + 2 < end && apr_isxdigit(s[1]) && apr_isxdigit(s[2]))
+        return 3;
+
+    if (s + 5 < end && (s[1] == 'u' || s[1] == 'U') &&
+        apr_isxdigit(s[2]) && apr_isxdigit(s[3]) &&
+        apr_isxdigit(s[4]) && apr_isxdigit(s[5]))
+        return 6;
+
+    if (s + 5 < end
+        || (s + 2 < end && !apr_isxdigit(s[2]))
+        || (s + 1 < end && !apr_isxdigit(s[1])
+            && s[1] != 'u' && s[1] != 'U'))
+        return 0;
+
+    return -1;
+}
+
+/*
+ * When ds is not NULL, every decoded byte is also fed to the charset
+ * state machine.  A run of pass-through bytes is ascii, so only its
+ * first byte can make a difference there.
+ */
+
 static apr_status_t url_decode(char *dest, apr_size_t *dlen,
-                               const char *src, apr_size_t *slen)
+                               const char *src, apr_size_t *slen,
+                               struct divine_state *ds)
 {
     register const char *s = src;
     unsigned char *start = (unsigned char *)dest;
     register unsigned char *d = (unsigned char *)dest;
     const char *end = src + *slen;
+#ifdef APREQ_X86_SIMD
+    const int level = simd_level();
+#endif
 
     for (; s < end; ++d, ++s) {
+#ifdef APREQ_X86_SIMD
+        if (end - s >= 16 && level != SIMD_NONE) {
+            apr_size_t n = (level == SIMD_AVX2)
+                ? decode_run_avx2(d, s, end - s)
+                : decode_run_sse2(d, s, end - s);
+            if (n > 0)
+                DIVINE_BYTE(ds, *d);
+            d += n;
+            s += n;
+            if (s == end)
+                break;
+        }
+#endif
         switch (*s) {
 
         case '+':
             *d = ' ';
+            DIVINE_BYTE(ds, ' ');
             break;
 
         case '%':
-	    if (s + 2 < end && apr_isxdigit(s[1]) && apr_isxdigit(s[2]))
-            {
+            switch (escape_len(s, end)) {
+
+            case 3:
                 *d = hex2_to_char(s + 1);
+                DIVINE_BYTE(ds, *d);
                 s += 2;
-	    }
-            else if (s + 5 < end && (s[1] == 'u' || s[1] == 'U') &&
-                     apr_isxdigit(s[2]) && apr_isxdigit(s[3]) &&
-                     apr_isxdigit(s[4]) && apr_isxdigit(s[5]))
-            {
+                break;
+
+            case 6: {
                 apr_uint16_t c = hex4_to_bmp(s+2);
 
                 if (c < 0x80) {
                     *d = c;
+                    DIVINE_BYTE(ds, *d);
                 }
                 else if (c < 0x800) {
                     *d++ = 0xC0 | (c >> 6);
                     *d   = 0x80 | (c & 0x3F);
+                    DIVINE_BYTE(ds, d[-1]);
+                    DIVINE_BYTE(ds, d[0]);
                 }
                 else {
                     *d++ = 0xE0 | (c >> 12);
                     *d++ = 0x80 | ((c >> 6) & 0x3F);
                     *d   = 0x80 | (c & 0x3F);
+                    DIVINE_BYTE(ds, d[-2]);
+                    DIVINE_BYTE(ds, d[-1]);
+                    DIVINE_BYTE(ds, d[0]);
                 }
                 s += 5;
+                break;
             }
-	    else {
+
+            case 0:
                 *dlen = d - start;
                 *slen = s - src;
-                if (s + 5 < end
-                    || (s + 2 < end && !apr_isxdigit(s[2]))
-                    || (s + 1 < end && !apr_isxdigit(s[1])
-                        && s[1] != 'u' && s[1] != 'U'))
-                {
-                    *d = 0;
-                    return APREQ_ERROR_BADSEQ;
-                }
+                *d = 0;
+                return APREQ_ERROR_BADSEQ;
 
+            default:
+                *dlen = d - start;
+                *slen = s - src;
                 memmove(d, s, end - s);
                 d[end - s] = 0;
                 return APR_INCOMPLETE;
-	    }
+            }
             break;
 
         default:
             if (*s > 0) {
                 *d = *s;
+                DIVINE_BYTE(ds, *d);
             }
             else {
                 *d = 0;
@@ -427,9 +1022,11 @@ static apr_status_t url_decode(char *dest, apr_size_t *dlen,
 }
 
 
-APREQ_DECLARE(apr_status_t) apreq_decode(char *d, apr_size_t *dlen,
-                                         const char *s, apr_size_t slen)
+static apr_status_t decode(char *d, apr_size_t *dlen,
+                           const char *s, apr_size_t slen,
+                           struct divine_state *ds)
 {
+    apr_status_t status;
     apr_size_t len = 0;
     const char *end = s + slen;
 
@@ -443,15 +1040,23 @@ APREQ_DECLARE(apr_status_t) apreq_decode(char *d, apr_size_t *dlen,
             }
         }
         len = (const char *)d - s;
+        if (ds != NULL) {
+            const char *c;
+            for (c = s; c < (const char *)d; ++c)
+                DIVINE_BYTE(ds, *c);
+        }
         s = (const char *)d;
         slen -= len;
     }
 
-    return url_decode(d, dlen, s, &slen);
+    status = url_decode(d, dlen, s, &slen, ds);
+    *dlen += len;
+    return status;
 }
 
-APREQ_DECLARE(apr_status_t) apreq_decodev(char *d, apr_size_t *dlen,
-                                          struct iovec *v, int nelts)
+static apr_status_t decodev(char *d, apr_size_t *dlen,
+                            struct iovec *v, int nelts,
+                            struct divine_state *ds)
 {
     apr_status_t status = APR_SUCCESS;
     int n = 0;
@@ -462,7 +1067,7 @@ APREQ_DECLARE(apr_status_t) apreq_decodev(char *d, apr_size_t *dlen,
         apr_size_t slen, len;
 
         slen = v[n].iov_len;
-        switch (status = url_decode(d, &len, v[n].iov_base, &slen)) {
+        switch (status = url_decode(d, &len, v[n].iov_base, &slen, ds)) {
 
         case APR_SUCCESS:
             d += len;
@@ -492,20 +1097,77 @@ APREQ_DECLARE(apr_status_t) apreq_decodev(char *d, apr_size_t *dlen,
     return status;
 }
 
+APREQ_DECLARE(apr_status_t) apreq_decode(char *d, apr_size_t *dlen,
+                                         const char *s, apr_size_t slen)
+{
+    return decode(d, dlen, s, slen, NULL);
+}
 
-APREQ_DECLARE(apr_size_t) apreq_encode(char *dest, const char *src,
-                                       const apr_size_t slen)
+APREQ_DECLARE(apr_status_t) apreq_decodev(char *d, apr_size_t *dlen,
+                                          struct iovec *v, int nelts)
 {
-    char *d = dest;
-    const unsigned char *s = (const unsigned char *)src;
-    unsigned char c;
+    return decodev(d, dlen, v, nelts, NULL);
+}
 
-    for ( ; s < (const unsigned char *)src + slen; ++s) {
-        c = *s;
-        if ( c < 0x80 && (apr_isalnum(c)
-                          || c == '-' || c == '.'
-                          || c == '_' || c == '~') )
-            *d++ = c;
+APREQ_DECLARE(apr_status_t) apreq_decode_check(const char *src,
+                                               apr_size_t slen)
+{
+    const char *s, *end = src + slen;
+
+    for (s = src; s < end; ++s) {
+        if (*s == '%') {
+            int n = escape_len(s, end);
+
+            if (n == 0)
+                return APREQ_ERROR_BADSEQ;
+            if (n < 0)
+                return APR_INCOMPLETE;
+            s += n - 1;
+        }
+        else if (*s <= 0) {
+            return APREQ_ERROR_BADCHAR;
+        }
+    }
+    return APR_SUCCESS;
+}
+
+APREQ_DECLARE(apr_status_t) apreq_decode_charset(char *d, apr_size_t *dlen,
+                                                 apreq_charset_t *charset,
+                                                 const char *s,
+                                                 apr_size_t slen)
+{
+    struct divine_state ds = DIVINE_STATE_INIT;
+    apr_status_t status = decode(d, dlen, s, slen, &ds);
+
+    *charset = divine_result(&ds);
+    return status;
+}
+
+APREQ_DECLARE(apr_status_t) apreq_decodev_charset(char *d, apr_size_t *dlen,
+                                                  apreq_charset_t *charset,
+                                                  struct iovec *v, int nelts)
+{
+    struct divine_state ds = DIVINE_STATE_INIT;
+    apr_status_t status = decodev(d, dlen, v, nelts, &ds);
+
+    *charset = divine_result(&ds);
+    return status;
+}
+
+
+APREQ_DECLARE(apr_size_t) apreq_encode(char *dest, const char *src,
+                                       const apr_size_t slen)
+{
+    char *d = dest;
+    const unsigned char *s = (const unsigned char *)src;
+    unsigned char c;
+
+    for ( ; s < (const unsigned char *)src + slen; ++s) {
+        c = *s;
+        if ( c < 0x80 && (apr_isalnum(c)
+                          || c == '-' || c == '.'
+                          || c == '_' || c == '~') )
+            *d++ = c;
 
         else if ( c == ' ' )
             *d++ = '+';
@@ -778,6 +1440,9 @@ struct cleanup_data {
     apr_pool_t *pool;
 };
 
+/* Pool userdata key, with the file name appended, for a cleanup_data */
+#define FILE_CLEANUP_KEY "apreq_file_cleanup:"
+
 static apr_status_t apreq_file_cleanup(void *d)
 {
     struct cleanup_data *data = d;
@@ -795,6 +1460,48 @@ static apr_status_t apreq_file_cleanup(void *d)
  * apreq_file_cleanup workaround is necessary.
  */
 
+/*
+ * A temp dir may be a list of directories, separated as in PATH, to
+ * spread spool files over several devices.  Each new file goes to the
+ * next directory in turn; one that fails is skipped for the next.
+ */
+static volatile apr_uint32_t temp_dir_turn;
+
+/* The separator apr_filepath_list_split() splits on */
+#ifdef WIN32
+#define TEMP_DIR_LIST_SEP ';'
+#else
+#define TEMP_DIR_LIST_SEP ':'
+#endif
+
+/*
+ * NULL when path names a single directory, which it does if it holds
+ * no separator, or if it is the name of an existing directory.
+ */
+static apr_array_header_t *temp_dir_split(const char *path, apr_pool_t *p)
+{
+    apr_array_header_t *dirs;
+    apr_finfo_t finfo;
+
+    if (strchr(path, TEMP_DIR_LIST_SEP) == NULL)
+        return NULL;
+    if (apr_stat(&finfo, path, APR_FINFO_TYPE, p) == APR_SUCCESS
+        && finfo.filetype == APR_DIR)
+        return NULL;
+    if (apr_filepath_list_split(&dirs, path, p) != APR_SUCCESS
+        || dirs->nelts < 2)
+        return NULL;
+    return dirs;
+}
+
+static APR_INLINE int temp_dir_first(const apr_array_header_t *dirs)
+{
+    return (int)(apr_atomic_inc32(&temp_dir_turn) % dirs->nelts);
+}
+
+#define TEMP_DIR(dirs, first, i) \
+    (((const char **)(dirs)->elts)[((first) + (i)) % (dirs)->nelts])
+
 APREQ_DECLARE(apr_status_t) apreq_file_mktemp(apr_file_t **fp,
                                               apr_pool_t *pool,
                                               const char *path)
@@ -803,12 +1510,24 @@ APREQ_DECLARE(apr_status_t) apreq_file_mktemp(apr_file_t **fp,
     char *tmpl;
     struct cleanup_data *data;
     apr_int32_t flag;
+    apr_array_header_t *dirs;
 
     if (path == NULL) {
         rc = apr_temp_dir_get(&path, pool);
         if (rc != APR_SUCCESS)
             return rc;
     }
+    else if ((dirs = temp_dir_split(path, pool)) != NULL) {
+        int i, first = temp_dir_first(dirs);
+
+        rc = APR_SUCCESS;
+        for (i = 0; i < dirs->nelts; ++i) {
+            rc = apreq_file_mktemp(fp, pool, TEMP_DIR(dirs, first, i));
+            if (rc == APR_SUCCESS)
+                break;
+        }
+        return rc;
+    }
     rc = apr_filepath_merge(&tmpl, path, "apreqXXXXXX",
                             APR_FILEPATH_NOTRELATIVE, pool);
 
@@ -829,6 +1548,10 @@ APREQ_DECLARE(apr_status_t) apreq_file_mktemp(apr_file_t **fp,
     if (rc == APR_SUCCESS) {
         apr_file_name_get(&data->fname, *fp);
         data->pool = pool;
+        /* so that apreq_brigade_persist() can move the file away */
+        apr_pool_userdata_setn(data, apr_pstrcat(pool, FILE_CLEANUP_KEY,
+                                                 data->fname, NULL),
+                               NULL, pool);
     }
     else {
         apr_pool_cleanup_kill(pool, data, apreq_file_cleanup);
@@ -838,6 +1561,277 @@ APREQ_DECLARE(apr_status_t) apreq_file_mktemp(apr_file_t **fp,
 }
 
 
+/*
+ * Process-wide pool of unlinked temp files.  Each one is handed to a
+ * request pool as a nameless apr_file_t, and comes back truncated when
+ * that pool is cleared.  Descriptors beyond the high-water mark are
+ * closed instead.
+ */
+
+struct pooled_file {
+    struct pooled_file *next;
+    apr_os_file_t       fd;
+    const char         *dir;
+};
+
+static struct {
+    apr_pool_t         *pool;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *lock;
+#endif
+    struct pooled_file *idle;
+    struct pooled_file *spare;
+    int                 nidle;
+    int                 max;
+    unsigned            gen;
+} tempfile_pool;
+
+#if APR_HAS_THREADS
+#define TEMPFILE_POOL_LOCK()   do { if (tempfile_pool.lock != NULL) \
+            apr_thread_mutex_lock(tempfile_pool.lock); } while (0)
+#define TEMPFILE_POOL_UNLOCK() do { if (tempfile_pool.lock != NULL) \
+            apr_thread_mutex_unlock(tempfile_pool.lock); } while (0)
+#else
+#define TEMPFILE_POOL_LOCK()
+#define TEMPFILE_POOL_UNLOCK()
+#endif
+
+struct tempfile_lease {
+    struct pooled_file *pf;
+    apr_file_t         *file;
+    unsigned            gen;
+};
+
+static void tempfile_close(apr_os_file_t fd, apr_pool_t *p)
+{
+    apr_file_t *f;
+    if (apr_os_file_put(&f, &fd, 0, p) == APR_SUCCESS)
+        apr_file_close(f);
+}
+
+static apr_status_t tempfile_pool_shutdown(void *data)
+{
+    struct pooled_file *pf;
+    (void)data;
+
+    TEMPFILE_POOL_LOCK();
+    for (pf = tempfile_pool.idle; pf != NULL; pf = pf->next)
+        tempfile_close(pf->fd, tempfile_pool.pool);
+
+    tempfile_pool.idle = tempfile_pool.spare = NULL;
+    tempfile_pool.nidle = tempfile_pool.max = 0;
+    tempfile_pool.pool = NULL;
+    tempfile_pool.gen++;
+    TEMPFILE_POOL_UNLOCK();
+
+    return APR_SUCCESS;
+}
+
+#if APR_HAS_THREADS
+static apr_status_t tempfile_pool_lock_cleanup(void *data)
+{
+    (void)data;
+    tempfile_pool.lock = NULL;
+    return APR_SUCCESS;
+}
+#endif
+
+static apr_status_t tempfile_release(void *data)
+{
+    struct tempfile_lease *l = data;
+    struct pooled_file *pf = l->pf;
+    apr_finfo_t finfo;
+    int reuse;
+
+    /* Linked into place by apreq_brigade_persist(): no longer ours */
+    if (apr_file_info_get(&finfo, APR_FINFO_NLINK, l->file) == APR_SUCCESS
+        && finfo.nlink > 0)
+        reuse = 0;
+    else
+        /* A failed truncate would hand the next request our data. */
+        reuse = apr_file_trunc(l->file, 0) == APR_SUCCESS;
+
+    TEMPFILE_POOL_LOCK();
+    if (tempfile_pool.pool == NULL || tempfile_pool.gen != l->gen) {
+        /* pf went away with the pool it was leased from */
+        TEMPFILE_POOL_UNLOCK();
+        return apr_file_close(l->file);
+    }
+    if (reuse && tempfile_pool.nidle < tempfile_pool.max) {
+        pf->next = tempfile_pool.idle;
+        tempfile_pool.idle = pf;
+        tempfile_pool.nidle++;
+        TEMPFILE_POOL_UNLOCK();
+        return APR_SUCCESS;
+    }
+    pf->next = tempfile_pool.spare;
+    tempfile_pool.spare = pf;
+    TEMPFILE_POOL_UNLOCK();
+
+    return apr_file_close(l->file);
+}
+
+/* Creates an anonymous file in dir, allocating only from p. */
+static apr_status_t tempfile_create(apr_os_file_t *fd, apr_pool_t *p,
+                                    const char *dir)
+{
+    apr_status_t rc;
+    apr_file_t *f;
+    const char *fname;
+    char *tmpl;
+    apr_array_header_t *dirs = temp_dir_split(dir, p);
+
+    if (dirs != NULL) {
+        int i, first = temp_dir_first(dirs);
+
+        rc = APR_SUCCESS;
+        for (i = 0; i < dirs->nelts; ++i) {
+            rc = tempfile_create(fd, p, TEMP_DIR(dirs, first, i));
+            if (rc == APR_SUCCESS)
+                break;
+        }
+        return rc;
+    }
+
+#ifdef O_TMPFILE
+    *fd = open(dir, O_TMPFILE | O_RDWR, 0600);
+    if (*fd >= 0)
+        return APR_SUCCESS;
+    /* EOPNOTSUPP and friends: fall back to mkstemp + unlink */
+#endif
+
+    rc = apr_filepath_merge(&tmpl, dir, "apreqXXXXXX",
+                            APR_FILEPATH_NOTRELATIVE, p);
+    if (rc != APR_SUCCESS)
+        return rc;
+
+    rc = apr_file_mktemp(&f, tmpl, APR_CREATE | APR_READ | APR_WRITE
+                         | APR_EXCL | APR_BINARY | APR_FOPEN_NOCLEANUP, p);
+    if (rc != APR_SUCCESS)
+        return rc;
+
+    apr_file_name_get(&fname, f);
+    rc = apr_file_remove(fname, p);
+    if (rc != APR_SUCCESS) {
+        /* can't unlink an open file here (win32), so it can't be reused */
+        apr_file_close(f);
+        apr_file_remove(fname, p);
+        return rc;
+    }
+    return apr_os_file_get(fd, f);
+}
+
+APREQ_DECLARE(apr_status_t) apreq_tempfile_pool_init(apr_pool_t *pool,
+                                                     int max)
+{
+    if (tempfile_pool.pool != NULL)
+        apr_pool_cleanup_run(tempfile_pool.pool, &tempfile_pool,
+                             tempfile_pool_shutdown);
+    if (max <= 0)
+        return APR_SUCCESS;
+
+#ifdef WIN32
+    /* open files can't be unlinked, so there is nothing to recycle */
+    return APR_ENOTIMPL;
+#endif
+
+#if APR_HAS_THREADS
+    /* The mutex outlives every temp file pool, so that a thread still
+     * releasing a file into one that is being shut down has it to take.
+     * Only apr_terminate() destroys it, once no thread is left.
+     */
+    if (tempfile_pool.lock == NULL) {
+        apr_pool_t *lp;
+        apr_status_t rc;
+
+        rc = apr_pool_create(&lp, NULL);
+        if (rc != APR_SUCCESS)
+            return rc;
+        rc = apr_thread_mutex_create(&tempfile_pool.lock,
+                                     APR_THREAD_MUTEX_DEFAULT, lp);
+        if (rc != APR_SUCCESS) {
+            apr_pool_destroy(lp);
+            return rc;
+        }
+        apr_pool_cleanup_register(lp, NULL, tempfile_pool_lock_cleanup,
+                                  apr_pool_cleanup_null);
+    }
+#endif
+
+    tempfile_pool.pool = pool;
+    tempfile_pool.max = max;
+    apr_pool_cleanup_register(pool, &tempfile_pool, tempfile_pool_shutdown,
+                              apr_pool_cleanup_null);
+    return APR_SUCCESS;
+}
+
+APREQ_DECLARE(apr_status_t) apreq_tempfile_pool_get(apr_file_t **fp,
+                                                    apr_pool_t *pool,
+                                                    const char *path)
+{
+    struct pooled_file *pf, **pp;
+    struct tempfile_lease *l;
+    apr_os_file_t fd;
+    apr_status_t rc;
+    unsigned gen;
+
+    if (tempfile_pool.pool == NULL)
+        return apreq_file_mktemp(fp, pool, path);
+
+    if (path == NULL) {
+        rc = apr_temp_dir_get(&path, pool);
+        if (rc != APR_SUCCESS)
+            return rc;
+    }
+
+    TEMPFILE_POOL_LOCK();
+    for (pp = &tempfile_pool.idle; (pf = *pp) != NULL; pp = &pf->next)
+        if (strcmp(pf->dir, path) == 0)
+            break;
+
+    if (pf != NULL) {
+        *pp = pf->next;
+        tempfile_pool.nidle--;
+        gen = tempfile_pool.gen;
+        TEMPFILE_POOL_UNLOCK();
+    }
+    else {
+        TEMPFILE_POOL_UNLOCK();
+
+        rc = tempfile_create(&fd, pool, path);
+        if (rc != APR_SUCCESS)
+            return apreq_file_mktemp(fp, pool, path);
+
+        TEMPFILE_POOL_LOCK();
+        if (tempfile_pool.pool == NULL) {
+            TEMPFILE_POOL_UNLOCK();
+            tempfile_close(fd, pool);
+            return apreq_file_mktemp(fp, pool, path);
+        }
+        if ((pf = tempfile_pool.spare) != NULL)
+            tempfile_pool.spare = pf->next;
+        else
+            pf = apr_pcalloc(tempfile_pool.pool, sizeof *pf);
+
+        if (pf->dir == NULL || strcmp(pf->dir, path) != 0)
+            pf->dir = apr_pstrdup(tempfile_pool.pool, path);
+        pf->fd = fd;
+        gen = tempfile_pool.gen;
+        TEMPFILE_POOL_UNLOCK();
+    }
+
+    l = apr_palloc(pool, sizeof *l);
+    l->pf = pf;
+    l->gen = gen;
+    apr_os_file_put(&l->file, &pf->fd,
+                    APR_READ | APR_WRITE | APR_BINARY, pool);
+    apr_pool_cleanup_register(pool, l, tempfile_release,
+                              apr_pool_cleanup_null);
+    *fp = l->file;
+    return APR_SUCCESS;
+}
+
+
 /*
  * is_2616_token() is the verbatim definition from section 2.2
  * in the rfc itself.  We try to optimize it around the
@@ -938,19 +1932,33 @@ APREQ_DECLARE(apr_status_t)
 
 
 
-#define BUCKET_IS_SPOOL(e) ((e)->type == &spool_bucket_type)
+#define BUCKET_IS_SPOOL(e) ((e)->type == &spool_bucket_type \
+                            || (e)->type == &spool_mem_bucket_type)
+#define BUCKET_IS_MEM_SPOOL(e) ((e)->type == &spool_mem_bucket_type)
 #define FILE_BUCKET_LIMIT      ((apr_size_t)-1 - 1)
 
+/* iovecs per spool write */
+#define SPOOL_NELTS 64
+
 static
 void spool_bucket_destroy(void *data)
 {
     apr_bucket_type_file.destroy(data);
 }
 
+static apr_status_t spool_direct_sync(apr_file_t *f);
+
+/* Data staged in direct spool mode must be in the file before any of
+ * it is read, including through a split or copy, which read the file
+ * as a plain file bucket.
+ */
 static
 apr_status_t spool_bucket_read(apr_bucket *e, const char **str,
                                    apr_size_t *len, apr_read_type_e block)
 {
+    apr_status_t rv = spool_direct_sync(((apr_bucket_file *)e->data)->fd);
+    if (rv != APR_SUCCESS)
+        return rv;
     return apr_bucket_type_file.read(e, str, len, block);
 }
 
@@ -963,7 +1971,10 @@ apr_status_t spool_bucket_setaside(apr_bucket *data, apr_pool_t *reqpool)
 static
 apr_status_t spool_bucket_split(apr_bucket *a, apr_size_t point)
 {
-    apr_status_t rv = apr_bucket_shared_split(a, point);
+    apr_status_t rv = spool_direct_sync(((apr_bucket_file *)a->data)->fd);
+    if (rv != APR_SUCCESS)
+        return rv;
+    rv = apr_bucket_shared_split(a, point);
     a->type = &apr_bucket_type_file;
     return rv;
 }
@@ -971,7 +1982,10 @@ apr_status_t spool_bucket_split(apr_bucket *a, apr_size_t point)
 static
 apr_status_t spool_bucket_copy(apr_bucket *e, apr_bucket **c)
 {
-    apr_status_t rv = apr_bucket_shared_copy(e, c);
+    apr_status_t rv = spool_direct_sync(((apr_bucket_file *)e->data)->fd);
+    if (rv != APR_SUCCESS)
+        return rv;
+    rv = apr_bucket_shared_copy(e, c);
     (*c)->type = &apr_bucket_type_file;
     return rv;
 }
@@ -985,184 +1999,1801 @@ static const apr_bucket_type_t spool_bucket_type = {
     spool_bucket_copy,
 };
 
-APREQ_DECLARE(apr_file_t *)apreq_brigade_spoolfile(apr_bucket_brigade *bb)
-{
-    apr_bucket *last;
-
-    last = APR_BRIGADE_LAST(bb);
-    if (BUCKET_IS_SPOOL(last))
-        return ((apr_bucket_file *)last->data)->fd;
+/*
+ * Memory spool tier: a memfd, mapped once at its full size limit, so
+ * that its buckets are read in place and never need remapping as it
+ * grows.  The mapping, the descriptor and the budget it holds all
+ * belong to the pool that created it.
+ */
 
-    return NULL;
-}
+/* The budget is counted in chunks of this many bytes */
+#define SPOOL_MEM_CHUNK ((apr_uint64_t)64 * 1024)
+
+static struct {
+    apr_size_t            limit;
+    apr_uint32_t          budget;
+    volatile apr_uint32_t used;
+} spool_mem_conf;
+
+struct spool_mem {
+    apr_bucket_refcount refcount;
+    apr_file_t         *file;
+    char               *base;
+    apr_size_t          size;
+    apr_uint32_t        chunks;
+    apr_pool_t         *pool;
+};
 
-APREQ_DECLARE(apr_status_t) apreq_brigade_concat(apr_pool_t *pool,
-                                                 const char *temp_dir,
-                                                 apr_size_t heap_limit,
-                                                 apr_bucket_brigade *out,
-                                                 apr_bucket_brigade *in)
+APREQ_DECLARE(apr_status_t) apreq_spool_memory_set(apr_size_t limit,
+                                                   apr_uint64_t budget)
 {
-    apr_status_t s;
-    apr_bucket_file *f;
-    apr_off_t wlen;
-    apr_file_t *file;
-    apr_off_t in_len, out_len;
-    apr_bucket *last_in, *last_out;
+#ifdef SPOOL_MEMFD
+    apr_uint64_t chunks = budget / SPOOL_MEM_CHUNK;
 
-    last_out = APR_BRIGADE_LAST(out);
+    spool_mem_conf.budget = (chunks > APR_UINT32_MAX)
+                          ? APR_UINT32_MAX : (apr_uint32_t)chunks;
+    spool_mem_conf.limit = (spool_mem_conf.budget > 0) ? limit : 0;
+    return APR_SUCCESS;
+#else
+    return (limit == 0 || budget == 0) ? APR_SUCCESS : APR_ENOTIMPL;
+#endif
+}
 
-    if (APR_BUCKET_IS_EOS(last_out))
-        return APR_EOF;
+#ifdef SPOOL_MEMFD
 
-    s = apr_brigade_length(out, 0, &out_len);
-    if (s != APR_SUCCESS)
-        return s;
+/* Grows m's share of the budget to cover len bytes. */
+static apr_status_t spool_mem_reserve(struct spool_mem *m, apr_uint64_t len)
+{
+    apr_uint32_t want, old, add;
 
-    /* This cast, when out_len = -1, is intentional */
-    if ((apr_uint64_t)out_len < heap_limit) {
+    if (len > m->size)
+        return APR_ENOSPC;
 
-        s = apr_brigade_length(in, 0, &in_len);
-        if (s != APR_SUCCESS)
-            return s;
+    want = (apr_uint32_t)((len + SPOOL_MEM_CHUNK - 1) / SPOOL_MEM_CHUNK);
+    if (want <= m->chunks)
+        return APR_SUCCESS;
 
-        /* This cast, when in_len = -1, is intentional */
-        if ((apr_uint64_t)in_len < heap_limit - (apr_uint64_t)out_len) {
-            APR_BRIGADE_CONCAT(out, in);
-            return APR_SUCCESS;
-        }
-    }
+    add = want - m->chunks;
+    do {
+        old = apr_atomic_read32(&spool_mem_conf.used);
+        if (old > spool_mem_conf.budget
+            || add > spool_mem_conf.budget - old)
+            return APR_ENOSPC;
+    } while (apr_atomic_cas32(&spool_mem_conf.used, old + add, old) != old);
 
-    if (!BUCKET_IS_SPOOL(last_out)) {
+    m->chunks = want;
+    return APR_SUCCESS;
+}
 
-        s = apreq_file_mktemp(&file, pool, temp_dir);
-        if (s != APR_SUCCESS)
-            return s;
+static void spool_mem_release(struct spool_mem *m)
+{
+    apr_atomic_sub32(&spool_mem_conf.used, m->chunks);
+    m->chunks = 0;
+}
 
-        s = apreq_brigade_fwrite(file, &wlen, out);
+#else
 
-        if (s != APR_SUCCESS)
-            return s;
+static apr_status_t spool_mem_reserve(struct spool_mem *m, apr_uint64_t len)
+{
+    return APR_ENOSPC;
+}
 
-        last_out = apr_bucket_file_create(file, wlen, 0,
-                                          out->p, out->bucket_alloc);
-        last_out->type = &spool_bucket_type;
-        APR_BRIGADE_INSERT_TAIL(out, last_out);
-        f = last_out->data;
-    }
-    else {
-        f = last_out->data;
-        /* Need to seek here, just in case our spool bucket
-         * was read from between apreq_brigade_concat calls.
-         */
-        wlen = last_out->start + last_out->length;
-        s = apr_file_seek(f->fd, APR_SET, &wlen);
-        if (s != APR_SUCCESS)
-            return s;
-    }
+#endif
 
-    if (in == out)
-        return APR_SUCCESS;
+static const apr_bucket_type_t memfd_bucket_type;
 
-    last_in = APR_BRIGADE_LAST(in);
+static
+void spool_mem_bucket_destroy(void *data)
+{
+    /* nothing to free: see spool_mem_cleanup() */
+    apr_bucket_shared_destroy(data);
+}
 
-    if (APR_BUCKET_IS_EOS(last_in))
-        APR_BUCKET_REMOVE(last_in);
+static
+apr_status_t spool_mem_bucket_read(apr_bucket *e, const char **str,
+                                   apr_size_t *len, apr_read_type_e block)
+{
+    struct spool_mem *m = e->data;
 
-    s = apreq_brigade_fwrite(f->fd, &wlen, in);
+    *str = m->base + e->start;
+    *len = e->length;
+    return APR_SUCCESS;
+}
 
-    if (s == APR_SUCCESS) {
+static
+apr_status_t spool_mem_bucket_setaside(apr_bucket *e, apr_pool_t *reqpool)
+{
+    struct spool_mem *m = e->data;
+    const char *data = m->base + e->start;
 
-        /* We have to deal with the possibility that the new
-         * data may be too large to be represented by a single
-         * temp_file bucket.
-         */
+    if (apr_pool_is_ancestor(m->pool, reqpool))
+        return APR_SUCCESS;
 
-        while ((apr_uint64_t)wlen > FILE_BUCKET_LIMIT - last_out->length) {
-            apr_bucket *e;
+    /* reqpool outlives the mapping */
+    apr_bucket_shared_destroy(m);
+    apr_bucket_heap_make(e, data, e->length, NULL);
+    return APR_SUCCESS;
+}
 
-            apr_bucket_copy(last_out, &e);
-            e->length = 0;
-            e->start = last_out->start + FILE_BUCKET_LIMIT;
-            wlen -= FILE_BUCKET_LIMIT - last_out->length;
-            last_out->length = FILE_BUCKET_LIMIT;
+static
+apr_status_t spool_mem_bucket_split(apr_bucket *a, apr_size_t point)
+{
+    apr_status_t rv = apr_bucket_shared_split(a, point);
+    a->type = &memfd_bucket_type;
+    return rv;
+}
 
-            /* Copying makes the bucket types exactly the
-             * opposite of what we need here.
-             */
-            last_out->type = &apr_bucket_type_file;
-            e->type = &spool_bucket_type;
+static
+apr_status_t spool_mem_bucket_copy(apr_bucket *e, apr_bucket **c)
+{
+    apr_status_t rv = apr_bucket_shared_copy(e, c);
+    (*c)->type = &memfd_bucket_type;
+    return rv;
+}
 
-            APR_BRIGADE_INSERT_TAIL(out, e);
-            last_out = e;
-        }
+static const apr_bucket_type_t spool_mem_bucket_type = {
+    "APREQ_SPOOL", 5, APR_BUCKET_DATA,
+    spool_mem_bucket_destroy,
+    spool_mem_bucket_read,
+    spool_mem_bucket_setaside,
+    spool_mem_bucket_split,
+    spool_mem_bucket_copy,
+};
 
-        last_out->length += wlen;
+/* What splitting or copying a memory spool bucket leaves behind */
+static const apr_bucket_type_t memfd_bucket_type = {
+    "APREQ_MEMFD", 5, APR_BUCKET_DATA,
+    spool_mem_bucket_destroy,
+    spool_mem_bucket_read,
+    spool_mem_bucket_setaside,
+    apr_bucket_shared_split,
+    apr_bucket_shared_copy,
+};
 
-        if (APR_BUCKET_IS_EOS(last_in))
-            APR_BRIGADE_INSERT_TAIL(out, last_in);
+APREQ_DECLARE(apr_file_t *)apreq_brigade_spoolfile(apr_bucket_brigade *bb)
+{
+    apr_bucket *last;
+
+    last = APR_BRIGADE_LAST(bb);
+    if (BUCKET_IS_MEM_SPOOL(last))
+        return ((struct spool_mem *)last->data)->file;
+    if (BUCKET_IS_SPOOL(last))
+        return ((apr_bucket_file *)last->data)->fd;
+
+    return NULL;
+}
+
+/*
+ * Writes v to f at offset.  With pwritev() this leaves the file pointer
+ * alone, so a spool file read from between writes needs no seek.
+ * The iovecs are consumed in the process.
+ */
+static apr_status_t spool_pwritev(apr_file_t *f, apr_off_t offset,
+                                  struct iovec *v, int nelts)
+{
+#ifdef HAVE_PWRITEV
+    apr_os_file_t fd;
+    apr_status_t s = apr_os_file_get(&fd, f);
+
+    if (s != APR_SUCCESS)
+        return s;
+
+    while (nelts > 0) {
+        apr_ssize_t n = pwritev(fd, v, nelts, offset);
+        int i = 0;
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return APR_FROM_OS_ERROR(errno);
+        }
+        if (n == 0)
+            return APREQ_ERROR_GENERAL;
 
+        offset += n;
+        while (i < nelts && (apr_size_t)n >= v[i].iov_len)
+            n -= v[i++].iov_len;
+        v += i;
+        nelts -= i;
+        if (nelts > 0) {
+            v->iov_base = (char *)v->iov_base + n;
+            v->iov_len -= n;
+        }
     }
-    else if (APR_BUCKET_IS_EOS(last_in))
-        APR_BRIGADE_INSERT_TAIL(in, last_in);
+    return APR_SUCCESS;
+#else
+    apr_size_t len;
+    apr_status_t s = apr_file_seek(f, APR_SET, &offset);
+
+    while (s == APR_SUCCESS && nelts > 0)
+        s = apreq_fwritev(f, v, &nelts, &len);
 
-    apr_brigade_cleanup(in);
     return s;
+#endif
 }
 
-APREQ_DECLARE(apr_status_t) apreq_brigade_fwrite(apr_file_t *f,
-                                                 apr_off_t *wlen,
-                                                 apr_bucket_brigade *bb)
+/*
+ * Writes the data in bb to f from offset onwards, SPOOL_NELTS buckets
+ * per call.  Buckets are read in place rather than from a copy of bb,
+ * since data read from a bucket stays put until the bucket is deleted.
+ */
+static apr_status_t spool_write_brigade(apr_file_t *f, apr_off_t offset,
+                                        apr_bucket_brigade *bb,
+                                        apr_off_t *wlen)
 {
-    struct iovec v[APREQ_DEFAULT_NELTS];
+    struct iovec v[SPOOL_NELTS];
+    apr_size_t batch = 0;
+    apr_bucket *e;
     apr_status_t s;
-    apr_bucket *e, *first;
     int n = 0;
-    apr_bucket_brigade *tmp = bb;
+
     *wlen = 0;
 
-    if (BUCKET_IS_SPOOL(APR_BRIGADE_LAST(bb))) {
-        tmp = apr_brigade_create(bb->p, bb->bucket_alloc);
+    for (e = APR_BRIGADE_FIRST(bb); e != APR_BRIGADE_SENTINEL(bb);
+         e = APR_BUCKET_NEXT(e))
+    {
+        const char *data;
+        apr_size_t len;
 
-        s = apreq_brigade_copy(tmp, bb);
+        s = apr_bucket_read(e, &data, &len, APR_BLOCK_READ);
         if (s != APR_SUCCESS)
             return s;
-    }
+        if (len == 0)
+            continue;
 
-    for (e = APR_BRIGADE_FIRST(tmp); e != APR_BRIGADE_SENTINEL(tmp);
-         e = APR_BUCKET_NEXT(e))
-    {
-        apr_size_t len;
-        if (n == APREQ_DEFAULT_NELTS) {
-            s = apreq_fwritev(f, v, &n, &len);
+        if (n == SPOOL_NELTS) {
+            s = spool_pwritev(f, offset + *wlen, v, n);
             if (s != APR_SUCCESS)
                 return s;
+            *wlen += batch;
+            batch = 0;
+            n = 0;
+        }
+        v[n].iov_base = (char *)data;
+        v[n++].iov_len = len;
+        batch += len;
+    }
 
-            if (tmp != bb) {
-                while ((first = APR_BRIGADE_FIRST(tmp)) != e)
-                    apr_bucket_delete(first);
-            }
+    if (n > 0) {
+        s = spool_pwritev(f, offset + *wlen, v, n);
+        if (s != APR_SUCCESS)
+            return s;
+        *wlen += batch;
+    }
+    return APR_SUCCESS;
+}
 
-            *wlen += len;
+/*
+ * Direct spool mode, for uploads past a size threshold.  Appends are
+ * staged in an aligned buffer that stays with the spool file, and each
+ * time the buffer fills it is written through a second descriptor
+ * opened with O_DIRECT, so the data stays out of the page cache.
+ * Whatever is staged past the last full buffer reaches the file only
+ * when it has to: when the upload ends, when the spool is trimmed or
+ * persisted, or before the spool bucket is read, split or copied.  Its
+ * unaligned tail then goes through the page cache, and stays staged
+ * so that its block is later rewritten directly.  Where O_DIRECT is
+ * not available, or the file system refuses it, the buffer is written
+ * through the cache and the kernel is asked to drop it.
+ */
+
+#define SPOOL_DIRECT_ALIGN   4096
+#define SPOOL_DIRECT_BUFSIZE (128 * 1024)
+#define SPOOL_DIRECT_KEY     "apreq_spool_direct"
+
+static apr_off_t spool_direct_threshold = 0;
+
+APREQ_DECLARE(apr_status_t) apreq_spool_direct_set(apr_off_t threshold)
+{
+#ifdef SPOOL_DIRECT
+    spool_direct_threshold = (threshold > 0) ? threshold : 0;
+    return APR_SUCCESS;
+#else
+    return (threshold <= 0) ? APR_SUCCESS : APR_ENOTIMPL;
+#endif
+}
+
+#ifdef SPOOL_DIRECT
+
+struct spool_direct {
+    apr_file_t     *file;       /* the spool file, also the lookup key */
+    apr_os_file_t   fd;
+    int             dfd;        /* O_DIRECT descriptor on it, or -1 */
+    char           *buf;        /* aligned staging buffer */
+    apr_off_t       base;       /* file offset of buf[0], aligned */
+    apr_size_t      fill;       /* bytes staged */
+    apr_size_t      synced;     /* of those, bytes already in the file */
+    int             cached;     /* staged data went through the cache */
+};
+
+/* Asks the kernel to drop the cached blocks of fd before end. */
+static void spool_drop_cache(int fd, apr_off_t end)
+{
+#ifdef HAVE_POSIX_FADVISE
+    end &= ~(apr_off_t)(SPOOL_DIRECT_ALIGN - 1);
+    if (end > 0)
+        posix_fadvise(fd, 0, end, POSIX_FADV_DONTNEED);
+#endif
+}
+
+/* Writes all of buf to fd at offset. */
+static apr_status_t spool_pwrite(int fd, const char *buf, apr_size_t len,
+                                 apr_off_t offset)
+{
+    while (len > 0) {
+        apr_ssize_t n = pwrite(fd, buf, len, offset);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return APR_FROM_OS_ERROR(errno);
+        if (n == 0)
+            return APREQ_ERROR_GENERAL;
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t spool_direct_cleanup(void *data)
+{
+    struct spool_direct *d = data;
+
+    if (d->dfd >= 0)
+        close(d->dfd);
+    return APR_SUCCESS;
+}
+
+/*
+ * The direct spool state of f, which lives in f's pool.  If create is
+ * set, it is made as needed, or reset if f no longer ends at offset;
+ * either way the partial block before offset is staged again.
+ */
+static struct spool_direct *spool_direct_get(apr_file_t *f, int create,
+                                             apr_off_t offset)
+{
+    apr_pool_t *pool = apr_file_pool_get(f);
+    struct spool_direct *d = NULL;
+    apr_hash_t *files;
+    apr_size_t got;
+    void *data;
+
+    apr_pool_userdata_get(&data, SPOOL_DIRECT_KEY, pool);
+    files = data;
+    if (files != NULL)
+        d = apr_hash_get(files, &f, sizeof f);
+
+    if (!create || (d != NULL && d->base + d->fill == offset))
+        return d;
+
+    if (d != NULL && spool_direct_sync(f) != APR_SUCCESS)
+        return NULL;
+
+    if (d == NULL) {
+        char *raw;
+
+        d = apr_palloc(pool, sizeof *d);
+        if (apr_os_file_get(&d->fd, f) != APR_SUCCESS)
+            return NULL;
+        raw = apr_palloc(pool, SPOOL_DIRECT_BUFSIZE + SPOOL_DIRECT_ALIGN);
+        d->buf = (char *)APR_ALIGN((apr_uintptr_t)raw, SPOOL_DIRECT_ALIGN);
+        d->file = f;
+        d->dfd = -1;
+#ifdef O_DIRECT
+        {
+            const char *fname = NULL;
+            char proc[32];
+
+            /* a nameless (O_TMPFILE or unlinked) file is reopened
+             * through /proc */
+            apr_file_name_get(&fname, f);
+            if (fname == NULL) {
+                apr_snprintf(proc, sizeof proc, "/proc/self/fd/%d", d->fd);
+                fname = proc;
+            }
+            d->dfd = open(fname, O_WRONLY | O_DIRECT);
         }
-        s = apr_bucket_read(e, (const char **)&(v[n].iov_base),
-                            &len, APR_BLOCK_READ);
-        if (s != APR_SUCCESS)
+#endif
+        apr_pool_cleanup_register(pool, d, spool_direct_cleanup,
+                                  apr_pool_cleanup_null);
+        if (files == NULL) {
+            files = apr_hash_make(pool);
+            apr_pool_userdata_setn(files, SPOOL_DIRECT_KEY, NULL, pool);
+        }
+        apr_hash_set(files, &d->file, sizeof d->file, d);
+    }
+
+    d->base = offset & ~(apr_off_t)(SPOOL_DIRECT_ALIGN - 1);
+    d->fill = d->synced = 0;
+    d->cached = 0;
+
+    for (got = 0; got < (apr_size_t)(offset - d->base); ) {
+        apr_ssize_t n = pread(d->fd, d->buf + got,
+                              (apr_size_t)(offset - d->base) - got,
+                              d->base + got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return NULL;
+        got += n;
+    }
+    d->fill = d->synced = got;
+    return d;
+}
+
+/* Writes the first len (aligned) staged bytes, directly if possible. */
+static apr_status_t spool_direct_out(struct spool_direct *d, apr_size_t len)
+{
+    if (d->dfd >= 0) {
+        apr_status_t s = spool_pwrite(d->dfd, d->buf, len, d->base);
+
+        if (!APR_STATUS_IS_EINVAL(s))
             return s;
 
-        v[n++].iov_len = len;
+        /* unaligned for this device after all */
+        close(d->dfd);
+        d->dfd = -1;
     }
+    d->cached = 1;
+    return spool_pwrite(d->fd, d->buf, len, d->base);
+}
 
-    while (n > 0) {
+/* Moves the aligned part of the staged data to the file. */
+static apr_status_t spool_direct_shift(struct spool_direct *d)
+{
+    apr_size_t tail = d->fill & (SPOOL_DIRECT_ALIGN - 1);
+    apr_size_t len = d->fill - tail;
+    apr_status_t s;
+
+    if (len == 0)
+        return APR_SUCCESS;
+
+    s = spool_direct_out(d, len);
+    if (s != APR_SUCCESS)
+        return s;
+
+    memmove(d->buf, d->buf + len, tail);
+    d->base += len;
+    d->fill = tail;
+    d->synced = (d->synced > len) ? d->synced - len : 0;
+
+    if (d->cached)
+        spool_drop_cache(d->fd, d->base);
+    return APR_SUCCESS;
+}
+
+/* Brings the file up to date with what is staged for it. */
+static apr_status_t spool_direct_sync(apr_file_t *f)
+{
+    struct spool_direct *d = spool_direct_get(f, 0, 0);
+    apr_status_t s;
+
+    if (d == NULL || d->synced == d->fill)
+        return APR_SUCCESS;
+
+    s = spool_direct_shift(d);
+    if (s == APR_SUCCESS && d->fill > d->synced)
+        s = spool_pwrite(d->fd, d->buf + d->synced, d->fill - d->synced,
+                         d->base + d->synced);
+    if (s == APR_SUCCESS)
+        d->synced = d->fill;
+    return s;
+}
+
+/* As spool_write_brigade(), in direct spool mode. */
+static apr_status_t spool_direct_write(apr_file_t *f, apr_off_t offset,
+                                       apr_bucket_brigade *bb,
+                                       apr_off_t *wlen)
+{
+    struct spool_direct *d = spool_direct_get(f, 1, offset);
+    apr_bucket *e;
+    apr_status_t s;
+
+    if (d == NULL)
+        return spool_write_brigade(f, offset, bb, wlen);
+
+    *wlen = 0;
+
+    for (e = APR_BRIGADE_FIRST(bb); e != APR_BRIGADE_SENTINEL(bb);
+         e = APR_BUCKET_NEXT(e))
+    {
+        const char *data;
         apr_size_t len;
-        s = apreq_fwritev(f, v, &n, &len);
+
+        s = apr_bucket_read(e, &data, &len, APR_BLOCK_READ);
         if (s != APR_SUCCESS)
             return s;
-        *wlen += len;
 
-        if (tmp != bb) {
-            while ((first = APR_BRIGADE_FIRST(tmp)) != e)
-                apr_bucket_delete(first);
+        while (len > 0) {
+            apr_size_t n = MIN(len, SPOOL_DIRECT_BUFSIZE - d->fill);
+
+            memcpy(d->buf + d->fill, data, n);
+            d->fill += n;
+            data += n;
+            len -= n;
+            *wlen += n;
+
+            if (d->fill == SPOOL_DIRECT_BUFSIZE) {
+                s = spool_direct_shift(d);
+                if (s != APR_SUCCESS)
+                    return s;
+            }
         }
     }
     return APR_SUCCESS;
 }
+
+#else
+
+static apr_status_t spool_direct_sync(apr_file_t *f)
+{
+    return APR_SUCCESS;
+}
+
+static apr_status_t spool_direct_write(apr_file_t *f, apr_off_t offset,
+                                       apr_bucket_brigade *bb,
+                                       apr_off_t *wlen)
+{
+    return spool_write_brigade(f, offset, bb, wlen);
+}
+
+#endif
+
+#ifdef SPOOL_MEMFD
+
+static apr_status_t spool_mem_cleanup(void *data)
+{
+    struct spool_mem *m = data;
+
+    munmap(m->base, m->size);
+    spool_mem_release(m);
+    return apr_file_close(m->file);
+}
+
+/*
+ * Starts spooling out into a memfd, provided len bytes, out and the
+ * data about to be appended to it, fit within the memory spool limit
+ * and what is left of the budget.
+ */
+static apr_status_t spool_mem_create(apr_bucket **last_out,
+                                     apr_pool_t *pool,
+                                     apr_bucket_brigade *out,
+                                     apr_off_t len)
+{
+    struct spool_mem *m;
+    apr_os_file_t fd;
+    apr_bucket *e;
+    apr_off_t wlen;
+    apr_status_t s;
+    void *base;
+
+    if (spool_mem_conf.limit == 0 || len < 0
+        || (apr_uint64_t)len > spool_mem_conf.limit)
+        return APR_ENOSPC;
+
+    m = apr_pcalloc(pool, sizeof *m);
+    m->size = spool_mem_conf.limit;
+    m->pool = pool;
+
+    s = spool_mem_reserve(m, len);
+    if (s != APR_SUCCESS)
+        return s;
+
+    fd = memfd_create("apreq", MFD_CLOEXEC);
+    if (fd < 0) {
+        spool_mem_release(m);
+        return APR_FROM_OS_ERROR(errno);
+    }
+
+    /* Past EOF, but never read from beyond the data written */
+    base = mmap(NULL, m->size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        s = APR_FROM_OS_ERROR(errno);
+        close(fd);
+        spool_mem_release(m);
+        return s;
+    }
+    m->base = base;
+
+    apr_os_file_put(&m->file, &fd, APR_READ | APR_WRITE | APR_BINARY, pool);
+    apr_pool_cleanup_register(pool, m, spool_mem_cleanup,
+                              apr_pool_cleanup_null);
+
+    s = spool_write_brigade(m->file, 0, out, &wlen);
+    if (s != APR_SUCCESS) {
+        spool_mem_release(m);
+        return s;
+    }
+
+    e = apr_bucket_alloc(sizeof *e, out->bucket_alloc);
+    APR_BUCKET_INIT(e);
+    e->free = apr_bucket_free;
+    e->list = out->bucket_alloc;
+    apr_bucket_shared_make(e, m, wlen, 0);
+    e->type = &spool_mem_bucket_type;
+    APR_BRIGADE_INSERT_TAIL(out, e);
+
+    *last_out = e;
+    return APR_SUCCESS;
+}
+
+#else
+
+static apr_status_t spool_mem_create(apr_bucket **last_out,
+                                     apr_pool_t *pool,
+                                     apr_bucket_brigade *out,
+                                     apr_off_t len)
+{
+    return APR_ENOTIMPL;
+}
+
+#endif
+
+/*
+ * Moves the memory spool at the end of out to a temp file, once it
+ * has outgrown its limit or the budget.  Buckets split or copied from
+ * it keep reading the mapping, which lasts as long as its pool.
+ */
+static apr_status_t spool_mem_migrate(apr_bucket **last_out,
+                                      apr_pool_t *pool,
+                                      const char *temp_dir,
+                                      apr_bucket_brigade *out)
+{
+    apr_bucket *e = *last_out, *d;
+    struct spool_mem *m = e->data;
+    apr_file_t *file;
+    struct iovec v;
+    apr_status_t s;
+
+    s = apreq_tempfile_pool_get(&file, pool, temp_dir);
+    if (s != APR_SUCCESS)
+        return s;
+
+    v.iov_base = m->base;
+    v.iov_len = (apr_size_t)(e->start + e->length);
+    if (v.iov_len > 0) {
+        s = spool_pwritev(file, 0, &v, 1);
+        if (s != APR_SUCCESS)
+            return s;
+    }
+
+    d = apr_bucket_file_create(file, e->start, (apr_size_t)e->length,
+                               out->p, out->bucket_alloc);
+    d->type = &spool_bucket_type;
+    APR_BUCKET_INSERT_AFTER(e, d);
+    apr_bucket_delete(e);
+
+    *last_out = d;
+    return APR_SUCCESS;
+}
+
+/*
+ * Extends the spool bucket at the end of out by wlen bytes.  We have
+ * to deal with the possibility that the new data may be too large to
+ * be represented by a single temp_file bucket.
+ */
+static void spool_bucket_grow(apr_bucket_brigade *out, apr_bucket *last_out,
+                              apr_off_t wlen)
+{
+    while ((apr_uint64_t)wlen > FILE_BUCKET_LIMIT - last_out->length) {
+        apr_bucket *e;
+
+        apr_bucket_copy(last_out, &e);
+        e->length = 0;
+        e->start = last_out->start + FILE_BUCKET_LIMIT;
+        wlen -= FILE_BUCKET_LIMIT - last_out->length;
+        last_out->length = FILE_BUCKET_LIMIT;
+
+        /* Copying makes the bucket types exactly the
+         * opposite of what we need here.
+         */
+        last_out->type = &apr_bucket_type_file;
+        e->type = &spool_bucket_type;
+
+        APR_BRIGADE_INSERT_TAIL(out, e);
+        last_out = e;
+    }
+
+    last_out->length += wlen;
+}
+
+APREQ_DECLARE(apr_status_t) apreq_brigade_concat(apr_pool_t *pool,
+                                                 const char *temp_dir,
+                                                 apr_size_t heap_limit,
+                                                 apr_bucket_brigade *out,
+                                                 apr_bucket_brigade *in)
+{
+    apr_status_t s;
+    apr_bucket_file *f;
+    apr_off_t wlen;
+    apr_file_t *file;
+    apr_off_t in_len, out_len;
+    apr_bucket *last_in, *last_out;
+
+    last_out = APR_BRIGADE_LAST(out);
+
+    if (APR_BUCKET_IS_EOS(last_out))
+        return APR_EOF;
+
+    /* Once spooling has begun, out is already past heap_limit; skip the
+     * length check, which would walk every bucket set aside before it.
+     */
+    if (BUCKET_IS_SPOOL(last_out))
+        out_len = -1;
+    else {
+        s = apr_brigade_length(out, 0, &out_len);
+        if (s != APR_SUCCESS)
+            return s;
+    }
+
+    /* This cast, when out_len = -1, is intentional */
+    if ((apr_uint64_t)out_len < heap_limit) {
+
+        s = apr_brigade_length(in, 0, &in_len);
+        if (s != APR_SUCCESS)
+            return s;
+
+        /* This cast, when in_len = -1, is intentional */
+        if ((apr_uint64_t)in_len < heap_limit - (apr_uint64_t)out_len) {
+            APR_BRIGADE_CONCAT(out, in);
+            return APR_SUCCESS;
+        }
+    }
+
+    /* A memory spool, where it fits; but in == out asks for a file. */
+    if (!BUCKET_IS_SPOOL(last_out)) {
+
+        if (in != out && out_len >= 0 && spool_mem_conf.limit > 0) {
+            s = apr_brigade_length(in, 1, &in_len);
+            if (s == APR_SUCCESS && in_len >= 0)
+                spool_mem_create(&last_out, pool, out, out_len + in_len);
+        }
+    }
+    else if (BUCKET_IS_MEM_SPOOL(last_out)) {
+
+        s = APR_ENOSPC;
+        if (in != out) {
+            s = apr_brigade_length(in, 1, &in_len);
+            if (s == APR_SUCCESS)
+                s = spool_mem_reserve(last_out->data, last_out->start
+                                      + last_out->length + in_len);
+        }
+        if (s != APR_SUCCESS) {
+            s = spool_mem_migrate(&last_out, pool, temp_dir, out);
+            if (s != APR_SUCCESS)
+                return s;
+        }
+    }
+
+    if (!BUCKET_IS_SPOOL(last_out)) {
+
+        s = apreq_tempfile_pool_get(&file, pool, temp_dir);
+        if (s != APR_SUCCESS)
+            return s;
+
+        s = spool_write_brigade(file, 0, out, &wlen);
+
+        if (s != APR_SUCCESS)
+            return s;
+
+        last_out = apr_bucket_file_create(file, wlen, 0,
+                                          out->p, out->bucket_alloc);
+        last_out->type = &spool_bucket_type;
+        APR_BRIGADE_INSERT_TAIL(out, last_out);
+    }
+
+    if (in == out)
+        return APR_SUCCESS;
+
+    last_in = APR_BRIGADE_LAST(in);
+
+    if (APR_BUCKET_IS_EOS(last_in))
+        APR_BUCKET_REMOVE(last_in);
+
+    /* Positional, so it doesn't matter if our spool bucket
+     * was read from between apreq_brigade_concat calls.
+     */
+    if (BUCKET_IS_MEM_SPOOL(last_out)) {
+        struct spool_mem *m = last_out->data;
+
+        s = spool_write_brigade(m->file, last_out->start + last_out->length,
+                                in, &wlen);
+        if (s == APR_SUCCESS)
+            last_out->length += wlen;
+    }
+    else {
+        apr_off_t offset = last_out->start + last_out->length;
+
+        f = last_out->data;
+        if (spool_direct_threshold > 0 && offset >= spool_direct_threshold)
+            s = spool_direct_write(f->fd, offset, in, &wlen);
+        else
+            s = spool_write_brigade(f->fd, offset, in, &wlen);
+        if (s == APR_SUCCESS)
+            spool_bucket_grow(out, last_out, wlen);
+        /* the upload is over: nothing may stay staged */
+        if (s == APR_SUCCESS && APR_BUCKET_IS_EOS(last_in))
+            s = spool_direct_sync(f->fd);
+    }
+
+    if (s == APR_SUCCESS) {
+        if (APR_BUCKET_IS_EOS(last_in))
+            APR_BRIGADE_INSERT_TAIL(out, last_in);
+
+    }
+    else if (APR_BUCKET_IS_EOS(last_in))
+        APR_BRIGADE_INSERT_TAIL(in, last_in);
+
+    apr_brigade_cleanup(in);
+    return s;
+}
+
+/* The spool bucket at the end of bb, looking past a final EOS */
+static apr_bucket *spool_tail(apr_bucket_brigade *bb)
+{
+    apr_bucket *e;
+
+    if (APR_BRIGADE_EMPTY(bb))
+        return NULL;
+
+    e = APR_BRIGADE_LAST(bb);
+    if (APR_BUCKET_IS_EOS(e)) {
+        e = APR_BUCKET_PREV(e);
+        if (e == APR_BRIGADE_SENTINEL(bb))
+            return NULL;
+    }
+    return BUCKET_IS_SPOOL(e) ? e : NULL;
+}
+
+APREQ_DECLARE(apr_status_t) apreq_brigade_spool_reserve(apr_bucket_brigade *bb,
+                                                        apr_off_t size)
+{
+    apr_bucket *e = spool_tail(bb);
+    apr_os_file_t fd;
+    apr_status_t s;
+
+    /* a memory spool is bounded by its mapping already */
+    if (e == NULL || BUCKET_IS_MEM_SPOOL(e))
+        return APR_SUCCESS;
+
+    s = apr_os_file_get(&fd, ((apr_bucket_file *)e->data)->fd);
+    if (s != APR_SUCCESS)
+        return s;
+
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+    /* KEEP_SIZE: the file still ends where the data written so far does */
+    return (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) == 0)
+        ? APR_SUCCESS : APR_FROM_OS_ERROR(errno);
+#elif defined(HAVE_POSIX_FALLOCATE)
+    {
+        /* reports its error instead of setting errno */
+        int rc = posix_fallocate(fd, 0, size);
+        return (rc == 0) ? APR_SUCCESS : APR_FROM_OS_ERROR(rc);
+    }
+#else
+    return APR_ENOTIMPL;
+#endif
+}
+
+APREQ_DECLARE(apr_status_t) apreq_brigade_spool_trim(apr_bucket_brigade *bb)
+{
+    apr_bucket *e = spool_tail(bb);
+    apr_file_t *f;
+    apr_status_t s;
+
+    if (e == NULL || BUCKET_IS_MEM_SPOOL(e))
+        return APR_SUCCESS;
+
+    f = ((apr_bucket_file *)e->data)->fd;
+    s = spool_direct_sync(f);
+    if (s != APR_SUCCESS)
+        return s;
+
+    /* Also frees blocks preallocated past the new end. */
+    return apr_file_trunc(f, e->start + e->length);
+}
+
+/*
+ * Persisting an upload.  A spool file holding the whole upload is
+ * linked into place: by name if it came from apreq_file_mktemp(),
+ * whose temp name is then dropped, or through /proc if it is an
+ * O_TMPFILE from the temp file pool.  Across devices it is cloned,
+ * or copied within the kernel.  Only an upload held in memory, or
+ * one the kernel can't copy, is written out from its buckets.
+ */
+
+static apr_status_t persist_link(apr_file_t *f, const char *path,
+                                 apr_pool_t *p)
+{
+#ifndef WIN32
+    const char *fname = NULL;
+
+    apr_file_name_get(&fname, f);
+    if (fname != NULL) {
+        apr_pool_t *fpool = apr_file_pool_get(f);
+        void *data;
+
+        if (link(fname, path) != 0)
+            return APR_FROM_OS_ERROR(errno);
+
+        /* Its cleanup would remove whatever next takes the temp name */
+        apr_pool_userdata_get(&data, apr_pstrcat(p, FILE_CLEANUP_KEY,
+                                                 fname, NULL), fpool);
+        if (data != NULL && apr_file_remove(fname, p) == APR_SUCCESS)
+            apr_pool_cleanup_kill(fpool, data, apreq_file_cleanup);
+        return APR_SUCCESS;
+    }
+#if defined(HAVE_LINKAT) && defined(AT_SYMLINK_FOLLOW)
+    else {
+        apr_os_file_t fd;
+        char proc[32];
+        apr_status_t s = apr_os_file_get(&fd, f);
+
+        if (s != APR_SUCCESS)
+            return s;
+
+        /* Only O_TMPFILE files can be linked back from nlink 0 */
+        apr_snprintf(proc, sizeof proc, "/proc/self/fd/%d", fd);
+        if (linkat(AT_FDCWD, proc, AT_FDCWD, path, AT_SYMLINK_FOLLOW) != 0)
+            return APR_FROM_OS_ERROR(errno);
+        return APR_SUCCESS;
+    }
+#endif
+#endif
+    return APR_ENOTIMPL;
+}
+
+/* Copies f, len bytes long, into out without leaving the kernel. */
+static apr_status_t persist_copy(apr_file_t *out, apr_file_t *f,
+                                 apr_off_t len)
+{
+    apr_os_file_t in_fd, out_fd;
+
+    if (apr_os_file_get(&in_fd, f) != APR_SUCCESS
+        || apr_os_file_get(&out_fd, out) != APR_SUCCESS)
+        return APR_ENOTIMPL;
+
+#ifdef FICLONE
+    if (ioctl(out_fd, FICLONE, in_fd) == 0)
+        return APR_SUCCESS;
+#endif
+
+#ifdef HAVE_COPY_FILE_RANGE
+    {
+        loff_t off_in = 0, off_out = 0;
+
+        while (off_in < len) {
+            apr_ssize_t n = copy_file_range(in_fd, &off_in, out_fd, &off_out,
+                                            (size_t)MIN(len - off_in,
+                                                        0x40000000), 0);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && off_in == 0)
+                break;          /* EXDEV, ENOSYS, ...: nothing copied */
+            if (n < 0)
+                return APR_FROM_OS_ERROR(errno);
+            if (n == 0)
+                return APR_EOF;
+        }
+        if (off_in >= len)
+            return APR_SUCCESS;
+    }
+#endif
+
+    return APR_ENOTIMPL;
+}
+
+APREQ_DECLARE(apr_status_t) apreq_brigade_persist(apr_pool_t *pool,
+                                                  const char *path,
+                                                  apr_bucket_brigade *bb)
+{
+    apr_bucket *e = spool_tail(bb);
+    apr_file_t *f = NULL, *out;
+    apr_off_t len, wlen;
+    apr_status_t s;
+
+    s = apr_brigade_length(bb, 1, &len);
+    if (s != APR_SUCCESS)
+        return s;
+
+    /* The buckets before the spool bucket are at the start of its file */
+    if (e != NULL && !BUCKET_IS_MEM_SPOOL(e) && e->start + e->length == len
+        && apreq_brigade_spool_trim(bb) == APR_SUCCESS)
+        f = ((apr_bucket_file *)e->data)->fd;
+
+    if (f != NULL) {
+        s = persist_link(f, path, pool);
+        if (s == APR_SUCCESS || APR_STATUS_IS_EEXIST(s))
+            return s;
+    }
+
+    /* owner-only, as a linked spool file is */
+    s = apr_file_open(&out, path, APR_CREATE | APR_EXCL | APR_WRITE
+                      | APR_BINARY, APR_FPROT_UREAD | APR_FPROT_UWRITE, pool);
+    if (s != APR_SUCCESS)
+        return s;
+
+    s = (f != NULL) ? persist_copy(out, f, len) : APR_ENOTIMPL;
+    if (s == APR_ENOTIMPL)
+        s = apreq_brigade_fwrite(out, &wlen, bb);
+
+    apr_file_close(out);
+    if (s != APR_SUCCESS)
+        apr_file_remove(path, pool);
+    return s;
+}
+
+APREQ_DECLARE(apr_status_t) apreq_brigade_fwrite(apr_file_t *f,
+                                                 apr_off_t *wlen,
+                                                 apr_bucket_brigade *bb)
+{
+    struct iovec v[APREQ_DEFAULT_NELTS];
+    apr_status_t s;
+    apr_bucket *e, *first;
+    int n = 0;
+    apr_bucket_brigade *tmp = bb;
+    *wlen = 0;
+
+    if (BUCKET_IS_SPOOL(APR_BRIGADE_LAST(bb))) {
+        tmp = apr_brigade_create(bb->p, bb->bucket_alloc);
+
+        s = apreq_brigade_copy(tmp, bb);
+        if (s != APR_SUCCESS)
+            return s;
+    }
+
+    for (e = APR_BRIGADE_FIRST(tmp); e != APR_BRIGADE_SENTINEL(tmp);
+         e = APR_BUCKET_NEXT(e))
+    {
+        apr_size_t len;
+        if (n == APREQ_DEFAULT_NELTS) {
+            s = apreq_fwritev(f, v, &n, &len);
+            if (s != APR_SUCCESS)
+                return s;
+
+            if (tmp != bb) {
+                while ((first = APR_BRIGADE_FIRST(tmp)) != e)
+                    apr_bucket_delete(first);
+            }
+
+            *wlen += len;
+        }
+        s = apr_bucket_read(e, (const char **)&(v[n].iov_base),
+                            &len, APR_BLOCK_READ);
+        if (s != APR_SUCCESS)
+            return s;
+
+        v[n++].iov_len = len;
+    }
+
+    while (n > 0) {
+        apr_size_t len;
+        s = apreq_fwritev(f, v, &n, &len);
+        if (s != APR_SUCCESS)
+            return s;
+        *wlen += len;
+
+        if (tmp != bb) {
+            while ((first = APR_BRIGADE_FIRST(tmp)) != e)
+                apr_bucket_delete(first);
+        }
+    }
+    return APR_SUCCESS;
+}
+
+
+/*
+ * Asynchronous spool writer.  Once a spool file exists, chunks appended
+ * to it are handed to the writer as positional writes, and the buckets
+ * holding their data are parked in a job until the write completes.
+ * Writes go through io_uring where it is available, else through a
+ * writer thread, else they are done on the spot.  Jobs are only ever
+ * filled, reaped and recycled by the caller's thread, so the writer
+ * thread never touches a bucket allocator.
+ */
+
+#define SPOOL_JOB_BYTES (256 * 1024)
+
+struct spool_job {
+    struct spool_job    *next;
+    apr_bucket_brigade  *bb;        /* keeps the queued data alive */
+    apr_file_t          *file;
+    apr_off_t            offset;
+    apr_size_t           len;
+    struct iovec         v[SPOOL_NELTS];
+    int                  nelts;
+    apr_status_t         status;
+};
+
+enum spool_backend {
+    SPOOL_IDLE,                     /* nothing queued yet */
+    SPOOL_SYNC,
+    SPOOL_THREAD,
+    SPOOL_URING
+};
+
+struct apreq_spool_writer_t {
+    apr_pool_t          *pool;
+    apr_pool_t          *jobpool;   /* outlives pool's own cleanups */
+    enum spool_backend   backend;
+    int                  depth;
+    int                  inflight;
+    apr_status_t         status;    /* first failed write, if any */
+    struct spool_job    *fill;      /* being filled, not yet queued */
+    struct spool_job    *free;
+#if APR_HAS_THREADS
+    apr_thread_t        *thread;
+    apr_thread_mutex_t  *lock;
+    apr_thread_cond_t   *cond;      /* new work or new completions */
+    struct spool_job    *queue, **queue_tail, *done;
+    int                  idle;      /* the thread waits for work */
+    int                  shutdown;
+#endif
+#ifdef HAVE_LIBURING
+    struct io_uring      ring;
+#endif
+};
+
+/* Writes whatever is left of the job at its offset. */
+static apr_status_t spool_job_write(struct spool_job *job)
+{
+    return spool_pwritev(job->file, job->offset, job->v, job->nelts);
+}
+
+static void spool_job_done(apreq_spool_writer_t *w, struct spool_job *job)
+{
+    if (job->status != APR_SUCCESS && w->status == APR_SUCCESS)
+        w->status = job->status;
+
+#ifdef SPOOL_DIRECT
+    /* Queued writes stay buffered; drop what went before this one */
+    if (job->status == APR_SUCCESS && spool_direct_threshold > 0
+        && job->offset >= spool_direct_threshold) {
+        apr_os_file_t fd;
+
+        if (apr_os_file_get(&fd, job->file) == APR_SUCCESS)
+            spool_drop_cache(fd, job->offset);
+    }
+#endif
+
+    apr_brigade_cleanup(job->bb);
+    job->next = w->free;
+    w->free = job;
+    --w->inflight;
+}
+
+#if APR_HAS_THREADS
+
+static void * APR_THREAD_FUNC spool_thread(apr_thread_t *t, void *data)
+{
+    apreq_spool_writer_t *w = data;
+    struct spool_job *job;
+
+    apr_thread_mutex_lock(w->lock);
+
+    while (1) {
+        struct spool_job *last;
+
+        while (w->queue == NULL && !w->shutdown) {
+            w->idle = 1;
+            apr_thread_cond_wait(w->cond, w->lock);
+        }
+        w->idle = 0;
+
+        if ((job = w->queue) == NULL)
+            break;
+
+        w->queue = NULL;
+        w->queue_tail = &w->queue;
+        apr_thread_mutex_unlock(w->lock);
+
+        for (last = job; ; last = last->next) {
+            last->status = spool_job_write(last);
+            if (last->next == NULL)
+                break;
+        }
+
+        apr_thread_mutex_lock(w->lock);
+        last->next = w->done;
+        w->done = job;
+        apr_thread_cond_broadcast(w->cond);
+    }
+
+    apr_thread_mutex_unlock(w->lock);
+    apr_thread_exit(t, APR_SUCCESS);
+    return NULL;
+}
+
+#endif
+
+#ifdef HAVE_LIBURING
+
+static void spool_uring_submit(apreq_spool_writer_t *w, struct spool_job *job)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&w->ring);
+    apr_os_file_t fd;
+
+    if (sqe != NULL && apr_os_file_get(&fd, job->file) == APR_SUCCESS) {
+        io_uring_prep_writev(sqe, fd, job->v, job->nelts, job->offset);
+        io_uring_sqe_set_data(sqe, job);
+        if (io_uring_submit(&w->ring) >= 0)
+            return;
+    }
+
+    /* the ring is unusable for this one; write it here instead */
+    job->status = spool_job_write(job);
+    spool_job_done(w, job);
+}
+
+static void spool_uring_reap(apreq_spool_writer_t *w, int block)
+{
+    struct io_uring_cqe *cqe;
+
+    while ((block ? io_uring_wait_cqe(&w->ring, &cqe)
+                  : io_uring_peek_cqe(&w->ring, &cqe)) == 0) {
+        struct spool_job *job = io_uring_cqe_get_data(cqe);
+        int res = cqe->res;
+
+        io_uring_cqe_seen(&w->ring, cqe);
+        block = 0;
+
+        if (res < 0 && res != -EINTR && res != -EAGAIN) {
+            job->status = APR_FROM_OS_ERROR(-res);
+        }
+        else if (res < 0 || (apr_size_t)res < job->len) {
+            /* Short writes are rare enough to finish synchronously */
+            apr_size_t done = (res < 0) ? 0 : res;
+            int n = 0;
+
+            while (done >= job->v[n].iov_len)
+                done -= job->v[n++].iov_len;
+            job->v[n].iov_base = (char *)job->v[n].iov_base + done;
+            job->v[n].iov_len -= done;
+            job->nelts -= n;
+            memmove(job->v, job->v + n, job->nelts * sizeof *job->v);
+            job->offset += (res < 0) ? 0 : res;
+            job->status = spool_job_write(job);
+        }
+        spool_job_done(w, job);
+    }
+}
+
+#endif
+
+/* Collects finished jobs; with block set, waits for at least one. */
+static void spool_reap(apreq_spool_writer_t *w, int block)
+{
+    switch (w->backend) {
+
+#if APR_HAS_THREADS
+    case SPOOL_THREAD:
+        {
+            struct spool_job *job;
+
+            apr_thread_mutex_lock(w->lock);
+            while (block && w->done == NULL)
+                apr_thread_cond_wait(w->cond, w->lock);
+            job = w->done;
+            w->done = NULL;
+            apr_thread_mutex_unlock(w->lock);
+
+            while (job != NULL) {
+                struct spool_job *next = job->next;
+                spool_job_done(w, job);
+                job = next;
+            }
+        }
+        break;
+#endif
+
+#ifdef HAVE_LIBURING
+    case SPOOL_URING:
+        spool_uring_reap(w, block);
+        break;
+#endif
+
+    default:
+        /* synchronous jobs are reaped as they are queued */
+        break;
+    }
+}
+
+static void spool_queue(apreq_spool_writer_t *w, struct spool_job *job)
+{
+    ++w->inflight;
+
+    switch (w->backend) {
+
+#if APR_HAS_THREADS
+    case SPOOL_THREAD:
+        job->next = NULL;
+        apr_thread_mutex_lock(w->lock);
+        *w->queue_tail = job;
+        w->queue_tail = &job->next;
+        if (w->idle)
+            apr_thread_cond_broadcast(w->cond);
+        apr_thread_mutex_unlock(w->lock);
+        break;
+#endif
+
+#ifdef HAVE_LIBURING
+    case SPOOL_URING:
+        spool_uring_submit(w, job);
+        break;
+#endif
+
+    default:
+        job->status = spool_job_write(job);
+        spool_job_done(w, job);
+    }
+}
+
+static apr_status_t spool_writer_cleanup(void *data)
+{
+    apreq_spool_writer_t *w = data;
+
+    apreq_spool_writer_wait(w);
+
+    switch (w->backend) {
+
+#if APR_HAS_THREADS
+    case SPOOL_THREAD:
+        {
+            apr_status_t s;
+
+            apr_thread_mutex_lock(w->lock);
+            w->shutdown = 1;
+            apr_thread_cond_broadcast(w->cond);
+            apr_thread_mutex_unlock(w->lock);
+            apr_thread_join(&s, w->thread);
+        }
+        break;
+#endif
+
+#ifdef HAVE_LIBURING
+    case SPOOL_URING:
+        io_uring_queue_exit(&w->ring);
+        break;
+#endif
+
+    default:
+        break;
+    }
+
+    w->backend = SPOOL_SYNC;
+    return APR_SUCCESS;
+}
+
+/* Picks a backend the first time something is queued. */
+static void spool_writer_start(apreq_spool_writer_t *w)
+{
+    w->backend = SPOOL_SYNC;
+
+    if (apr_pool_create(&w->jobpool, w->pool) != APR_SUCCESS)
+        w->jobpool = w->pool;
+
+#ifdef HAVE_LIBURING
+    if (io_uring_queue_init(w->depth, &w->ring, 0) == 0)
+        w->backend = SPOOL_URING;
+#endif
+
+#if APR_HAS_THREADS
+    if (w->backend == SPOOL_SYNC
+        && apr_thread_mutex_create(&w->lock, APR_THREAD_MUTEX_DEFAULT,
+                                   w->pool) == APR_SUCCESS
+        && apr_thread_cond_create(&w->cond, w->pool) == APR_SUCCESS) {
+
+        w->queue = w->done = NULL;
+        w->queue_tail = &w->queue;
+        w->idle = 0;
+        w->shutdown = 0;
+
+        if (apr_thread_create(&w->thread, NULL, spool_thread, w,
+                              w->pool) == APR_SUCCESS)
+            w->backend = SPOOL_THREAD;
+    }
+#endif
+
+    apr_pool_cleanup_register(w->pool, w, spool_writer_cleanup,
+                              apr_pool_cleanup_null);
+}
+
+static struct spool_job *spool_job_get(apreq_spool_writer_t *w,
+                                       apr_bucket_alloc_t *ba)
+{
+    struct spool_job *job;
+
+    spool_reap(w, 0);
+    while (w->inflight >= w->depth)
+        spool_reap(w, 1);
+
+    if ((job = w->free) != NULL)
+        w->free = job->next;
+    else {
+        job = apr_palloc(w->jobpool, sizeof *job);
+        job->bb = apr_brigade_create(w->jobpool, ba);
+    }
+
+    job->nelts = 0;
+    job->len = 0;
+    job->status = APR_SUCCESS;
+    return job;
+}
+
+/* Queues the job being filled, if any. */
+static void spool_flush(apreq_spool_writer_t *w)
+{
+    struct spool_job *job = w->fill;
+
+    if (job != NULL) {
+        w->fill = NULL;
+        spool_queue(w, job);
+    }
+}
+
+/*
+ * Moves every bucket in bb into jobs writing file from offset onwards.
+ * Contiguous chunks share a job until it is full, so small appends
+ * don't each cost a queued write.
+ */
+static apr_status_t spool_queue_brigade(apreq_spool_writer_t *w,
+                                        apr_file_t *file, apr_off_t offset,
+                                        apr_bucket_brigade *bb,
+                                        apr_off_t *wlen)
+{
+    struct spool_job *job = w->fill;
+
+    *wlen = 0;
+
+    if (job != NULL
+        && (job->file != file || job->offset + job->len != offset))
+        spool_flush(w);
+
+    while (!APR_BRIGADE_EMPTY(bb)) {
+        apr_bucket *e = APR_BRIGADE_FIRST(bb);
+        const char *data;
+        apr_size_t len;
+        apr_status_t s;
+
+        s = apr_bucket_read(e, &data, &len, APR_BLOCK_READ);
+        if (s != APR_SUCCESS)
+            return s;
+
+        if (len == 0) {
+            apr_bucket_delete(e);
+            continue;
+        }
+
+        if ((job = w->fill) == NULL) {
+            job = w->fill = spool_job_get(w, bb->bucket_alloc);
+            job->file = file;
+            job->offset = offset + *wlen;
+        }
+
+        APR_BUCKET_REMOVE(e);
+        APR_BRIGADE_INSERT_TAIL(job->bb, e);
+        job->v[job->nelts].iov_base = (char *)data;
+        job->v[job->nelts++].iov_len = len;
+        job->len += len;
+        *wlen += len;
+
+        if (job->nelts == SPOOL_NELTS || job->len >= SPOOL_JOB_BYTES)
+            spool_flush(w);
+    }
+
+    return APR_SUCCESS;
+}
+
+APREQ_DECLARE(apreq_spool_writer_t *)
+    apreq_spool_writer_make(apr_pool_t *pool, int depth)
+{
+    apreq_spool_writer_t *w = apr_pcalloc(pool, sizeof *w);
+
+    w->pool = pool;
+    w->backend = SPOOL_IDLE;
+    w->depth = (depth > 0) ? depth : APREQ_DEFAULT_SPOOL_DEPTH;
+    w->status = APR_SUCCESS;
+    return w;
+}
+
+APREQ_DECLARE(apr_status_t) apreq_spool_writer_wait(apreq_spool_writer_t *w)
+{
+    if (w == NULL)
+        return APR_SUCCESS;
+
+    spool_flush(w);
+
+    while (w->inflight > 0)
+        spool_reap(w, 1);
+
+    return w->status;
+}
+
+static apr_status_t spool_writer_drain(void *data)
+{
+    apreq_spool_writer_wait(data);
+    return APR_SUCCESS;
+}
+
+APREQ_DECLARE(apr_status_t)
+    apreq_brigade_concat_async(apreq_spool_writer_t *w,
+                               apr_pool_t *pool,
+                               const char *temp_dir,
+                               apr_size_t heap_limit,
+                               apr_bucket_brigade *out,
+                               apr_bucket_brigade *in)
+{
+    apr_status_t s;
+    apr_bucket *last_in, *last_out;
+    apr_off_t wlen;
+
+    if (w == NULL)
+        return apreq_brigade_concat(pool, temp_dir, heap_limit, out, in);
+
+    if (w->status != APR_SUCCESS)
+        return w->status;
+
+    last_out = APR_BRIGADE_LAST(out);
+
+    if (!BUCKET_IS_SPOOL(last_out) || BUCKET_IS_MEM_SPOOL(last_out)) {
+        /* Filling the heap or a memory spool, or creating the spool
+         * file: all stay synchronous.  A new spool file must not be
+         * closed by its pool cleanup while writes to it are still in
+         * flight, so drain the writer first; cleanups run in reverse
+         * order.
+         */
+        s = apreq_brigade_concat(pool, temp_dir, heap_limit, out, in);
+        last_out = APR_BRIGADE_LAST(out);
+
+        if (s == APR_SUCCESS && BUCKET_IS_SPOOL(last_out)
+            && !BUCKET_IS_MEM_SPOOL(last_out))
+            apr_pool_cleanup_register(pool, w, spool_writer_drain,
+                                      apr_pool_cleanup_null);
+        return s;
+    }
+
+    if (in == out)
+        return APR_SUCCESS;
+
+    if (w->backend == SPOOL_IDLE)
+        spool_writer_start(w);
+
+    last_in = APR_BRIGADE_LAST(in);
+
+    if (APR_BUCKET_IS_EOS(last_in))
+        APR_BUCKET_REMOVE(last_in);
+
+    s = spool_queue_brigade(w, ((apr_bucket_file *)last_out->data)->fd,
+                            last_out->start + last_out->length, in, &wlen);
+
+    /* The queued data counts as written; readers must wait for it */
+    spool_bucket_grow(out, last_out, wlen);
+
+    if (APR_BUCKET_IS_EOS(last_in)) {
+        if (s == APR_SUCCESS)
+            APR_BRIGADE_INSERT_TAIL(out, last_in);
+        else
+            APR_BRIGADE_INSERT_TAIL(in, last_in);
+    }
+
+    apr_brigade_cleanup(in);
+    return s;
+}
+
+
+/*
+ * Hashed lookups into apr tables.  Slots hold the position (plus one)
+ * of the first table entry carrying each key, so a lookup returns what
+ * apr_table_get() would.  Keys are hashed case-folded with SipHash-1-3
+ * under a per-process random key, so colliding field names can't be
+ * precomputed to flood a slot chain.  Entries appended to the table
+ * since the last lookup are picked up on the next one.
+ */
+
+struct apreq_table_index_t {
+    apr_pool_t          *pool;
+    const apr_table_t   *t;
+    int                  nindexed;
+    apr_uint32_t         nslots;        /* power of two, or 0 if unbuilt */
+    struct index_slot {
+        apr_uint32_t     hash;
+        int              elt;           /* 0 for an empty slot */
+    }                   *slots;
+    apr_uint64_t         seed[2];
+};
+
+static apr_uint64_t index_seed[2];
+
+/* index_seed is written once, by whichever thread wins the
+ * NONE -> BUSY swap; the others wait for READY before reading it. */
+enum { INDEX_SEED_NONE, INDEX_SEED_BUSY, INDEX_SEED_READY };
+static volatile apr_uint32_t index_seed_state = INDEX_SEED_NONE;
+
+static void index_seed_init(void)
+{
+    unsigned char buf[16];
+    apr_uint64_t fallback;
+    int i;
+
+    if (apr_atomic_read32(&index_seed_state) == INDEX_SEED_READY)
+        return;
+
+    if (apr_atomic_cas32(&index_seed_state, INDEX_SEED_BUSY,
+                         INDEX_SEED_NONE) != INDEX_SEED_NONE) {
+        while (apr_atomic_read32(&index_seed_state) != INDEX_SEED_READY) {
+#if APR_HAS_THREADS
+            apr_thread_yield();
+#endif
+        }
+        return;
+    }
+
+    fallback = (apr_uint64_t)apr_time_now();
+#if APR_HAS_RANDOM
+    if (apr_generate_random_bytes(buf, sizeof buf) != APR_SUCCESS)
+#endif
+    {
+        /* not cryptographic, but still differs per process */
+        fallback ^= (apr_uint64_t)(apr_uintptr_t)&fallback;
+        for (i = 0; i < 16; ++i) {
+            fallback = fallback * APR_UINT64_C(6364136223846793005)
+                + APR_UINT64_C(1442695040888963407);
+            buf[i] = (unsigned char)(fallback >> 56);
+        }
+    }
+
+    for (i = 0; i < 8; ++i) {
+        index_seed[0] = (index_seed[0] << 8) | buf[i];
+        index_seed[1] = (index_seed[1] << 8) | buf[i + 8];
+    }
+    apr_atomic_set32(&index_seed_state, INDEX_SEED_READY);
+}
+
+#define ROTL64(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND do {                                                   \
+    v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32);       \
+    v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2;                            \
+    v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0;                            \
+    v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32);       \
+} while (0)
+
+/*
+ * SipHash-1-3 of the nul-terminated key.  Bit 0x20 is cleared in every
+ * byte, as in apr_table_get()'s key checksum, so keys that differ only
+ * in ascii case hash alike.
+ */
+static apr_uint32_t index_hash(const apr_uint64_t *seed, const char *key)
+{
+    const apr_uint64_t fold = APR_UINT64_C(0xDFDFDFDFDFDFDFDF);
+    const apr_size_t len = strlen(key);
+    const char *end = key + (len & ~(apr_size_t)7);
+    apr_uint64_t v0 = seed[0] ^ APR_UINT64_C(0x736f6d6570736575);
+    apr_uint64_t v1 = seed[1] ^ APR_UINT64_C(0x646f72616e646f6d);
+    apr_uint64_t v2 = seed[0] ^ APR_UINT64_C(0x6c7967656e657261);
+    apr_uint64_t v3 = seed[1] ^ APR_UINT64_C(0x7465646279746573);
+    apr_uint64_t m;
+
+    for (; key < end; key += 8) {
+        memcpy(&m, key, 8);
+        m &= fold;
+        v3 ^= m;
+        SIPROUND;
+        v0 ^= m;
+    }
+
+    m = 0;
+    memcpy(&m, key, len & 7);
+    m = (m & fold) | ((apr_uint64_t)len << 56);
+    v3 ^= m;
+    SIPROUND;
+    v0 ^= m;
+    v2 ^= 0xFF;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+
+    return (apr_uint32_t)(v0 ^ v1 ^ v2 ^ v3);
+}
+
+/* Slot holding key, or the empty slot where it belongs. */
+static struct index_slot *index_probe(const apreq_table_index_t *idx,
+                                      const apr_table_entry_t *elts,
+                                      apr_uint32_t hash, const char *key)
+{
+    const apr_uint32_t mask = idx->nslots - 1;
+    apr_uint32_t i = hash & mask;
+
+    for (;; i = (i + 1) & mask) {
+        struct index_slot *slot = idx->slots + i;
+        if (slot->elt == 0)
+            return slot;
+        if (slot->hash == hash && !strcasecmp(elts[slot->elt - 1].key, key))
+            return slot;
+    }
+}
+
+static void index_insert(apreq_table_index_t *idx,
+                         const apr_table_entry_t *elts, int elt)
+{
+    const char *key = elts[elt].key;
+    apr_uint32_t hash;
+    struct index_slot *slot;
+
+    if (key == NULL)
+        return;
+
+    hash = index_hash(idx->seed, key);
+    slot = index_probe(idx, elts, hash, key);
+
+    /* a repeated key keeps pointing at its first entry */
+    if (slot->elt == 0) {
+        slot->hash = hash;
+        slot->elt = elt + 1;
+    }
+}
+
+/* Index entries appended since the last call, growing past 1/2 full. */
+static void index_update(apreq_table_index_t *idx)
+{
+    const apr_array_header_t *arr = apr_table_elts(idx->t);
+    const apr_table_entry_t *elts = (const apr_table_entry_t *)arr->elts;
+
+    if ((apr_uint32_t)arr->nelts * 2 > idx->nslots) {
+        apr_uint32_t n = idx->nslots ? idx->nslots : 64;
+        while (n < (apr_uint32_t)arr->nelts * 2)
+            n *= 2;
+        idx->slots = apr_pcalloc(idx->pool, n * sizeof *idx->slots);
+        idx->nslots = n;
+        idx->nindexed = 0;
+    }
+
+    for (; idx->nindexed < arr->nelts; ++idx->nindexed)
+        index_insert(idx, elts, idx->nindexed);
+}
+
+APREQ_DECLARE(apreq_table_index_t *) apreq_table_index_make(apr_pool_t *p)
+{
+    apreq_table_index_t *idx = apr_pcalloc(p, sizeof *idx);
+
+    index_seed_init();
+
+    idx->pool = p;
+    idx->seed[0] = index_seed[0];
+    idx->seed[1] = index_seed[1];
+    return idx;
+}
+
+APREQ_DECLARE(const char *) apreq_table_index_get(apreq_table_index_t *idx,
+                                                  const apr_table_t *t,
+                                                  const char *key)
+{
+    const apr_array_header_t *arr;
+    const apr_table_entry_t *elts;
+    const struct index_slot *slot;
+
+    if (t == NULL || key == NULL)
+        return NULL;
+
+    arr = apr_table_elts(t);
+
+    /* a different table, or one that has shrunk: start over */
+    if (t != idx->t || arr->nelts < idx->nindexed) {
+        idx->t = t;
+        idx->nslots = 0;
+        idx->nindexed = 0;
+        idx->slots = NULL;
+    }
+
+    if (idx->nslots == 0 && arr->nelts < APREQ_TABLE_INDEX_MIN)
+        return apr_table_get(t, key);
+
+    if (idx->nindexed < arr->nelts)
+        index_update(idx);
+
+    elts = (const apr_table_entry_t *)arr->elts;
+    slot = index_probe(idx, elts, index_hash(idx->seed, key), key);
+
+    return slot->elt ? elts[slot->elt - 1].val : NULL;
+}
@@ -42,6 +42,7 @@ struct apache_handle {
     apreq_hook_t                *hook_queue;
 
     const char                  *temp_dir;
+    const apr_array_header_t    *parse_only;
     apr_size_t                   brigade_limit;
     apr_uint64_t                 read_limit;
     apr_uint64_t                 bytes_read;
@@ -78,6 +79,7 @@ static void init_body(apreq_handle_t *env)
     const char *cl_header = apache_header_in(env, "Content-Length");
     apr_bucket_alloc_t *ba = req->bucket_alloc;
     request_rec *r = req->r;
+    apr_off_t size_hint = 0;
 
     req->body  = apr_table_make(req->pool, APREQ_DEFAULT_NELTS);
 #ifdef APR_POOL_DEBUG
@@ -101,6 +103,7 @@ static void init_body(apreq_handle_t *env)
                           cl_header, req->read_limit);
             return;
         }
+        size_hint = content_length;
     }
 
     if (req->parser == NULL) {
@@ -118,6 +121,7 @@ static void init_body(apreq_handle_t *env)
                                                 req->temp_dir,
                                                 req->hook_queue,
                                                 NULL);
+                req->parser->parse_only = req->parse_only;
             }
             else {
                 req->body_status = APREQ_ERROR_NOPARSER;
@@ -136,8 +140,11 @@ static void init_body(apreq_handle_t *env)
             req->parser->temp_dir = req->temp_dir;
         if (req->hook_queue != NULL)
             apreq_parser_add_hook(req->parser, req->hook_queue);
+        if (req->parse_only != NULL)
+            req->parser->parse_only = req->parse_only;
     }
 
+    req->parser->size_hint = size_hint;
     req->hook_queue = NULL;
     req->in         = apr_brigade_create(req->pool, ba);
     req->body_status = APR_INCOMPLETE;
@@ -176,6 +183,7 @@ static apr_status_t apache_read(apreq_handle_t *env,
     if (got > 0) {
         e = apr_bucket_transient_create(buf, got, req->bucket_alloc);
         req->bytes_read += got;
+        apreq_parser_hint_read(req->parser, got);
     }
     else
         e = apr_bucket_eos_create(req->bucket_alloc);
@@ -284,7 +292,7 @@ static apreq_param_t *apache_args_get(apreq_handle_t *env, const char *name)
     if (val == NULL)
         return NULL;
 
-    return apreq_value_to_param(val);
+    return apreq_value_to_decoded_param(val);
 }
 
 
@@ -326,7 +334,7 @@ static apreq_param_t *apache_body_get(apreq_handle_t *env, const char *name)
 
         val = apr_table_get(req->body, name);
         if (val != NULL)
-            return apreq_value_to_param(val);
+            return apreq_value_to_decoded_param(val);
 
         do {
             /* riff on Duff's device */
@@ -336,7 +344,7 @@ static apreq_param_t *apache_body_get(apreq_handle_t *env, const char *name)
 
             val = apr_table_get(req->body, name);
             if (val != NULL)
-                return apreq_value_to_param(val);
+                return apreq_value_to_decoded_param(val);
 
         } while (req->body_status == APR_INCOMPLETE);
 
@@ -345,6 +353,45 @@ static apreq_param_t *apache_body_get(apreq_handle_t *env, const char *name)
     return NULL;
 }
 
+static apr_status_t apache_body_getv(apreq_handle_t *env,
+                                     const char *const *names, int n,
+                                     apreq_param_t **params)
+{
+    struct apache_handle *req = (struct apache_handle *)env;
+    const char *val;
+    int i, missing;
+
+    for (i = 0; i < n; ++i)
+        params[i] = NULL;
+
+    if (req->body_status == APR_EINIT) {
+        init_body(env);
+        if (req->body_status == APR_INCOMPLETE)
+            apache_read(env, APREQ_DEFAULT_READ_BLOCK_SIZE);
+    }
+
+    while (1) {
+        missing = 0;
+        for (i = 0; i < n; ++i) {
+            if (params[i] != NULL)
+                continue;
+            val = (req->body == NULL) ? NULL
+                : apr_table_get(req->body, names[i]);
+            if (val != NULL)
+                params[i] = apreq_value_to_decoded_param(val);
+            else
+                ++missing;
+        }
+
+        if (missing == 0 || req->body_status != APR_INCOMPLETE)
+            break;
+
+        apache_read(env, APREQ_DEFAULT_READ_BLOCK_SIZE);
+    }
+
+    return req->body_status;
+}
+
 static
 apr_status_t apache_parser_get(apreq_handle_t *env,
                                   const apreq_parser_t **parser)
@@ -483,6 +530,21 @@ apr_status_t apache_temp_dir_get(apreq_handle_t *env,
     return APR_SUCCESS;
 }
 
+static
+apr_status_t apache_parse_only_set(apreq_handle_t *env,
+                                   const apr_array_header_t *names)
+{
+    struct apache_handle *req = (struct apache_handle *)env;
+
+    if (req->bytes_read != 0)
+        return APREQ_ERROR_NOTEMPTY;
+
+    req->parse_only = names;
+    if (req->parser != NULL)
+        req->parser->parse_only = names;
+    return APR_SUCCESS;
+}
+
 static APREQ_MODULE(apache, APREQ_APACHE_MMN);
 
 static void apreq_cleanup(void *data)
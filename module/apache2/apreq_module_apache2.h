@@ -120,9 +120,84 @@
  *     <TD> Sets the location of the temporary directory apreq will use to spool
  *          overflow brigade data (based on the APREQ2_BrigadeLimit setting).
  *          If left unset, libapreq2 will select a platform-specific location
- *          via apr_temp_dir_get().
+ *          via apr_temp_dir_get().  Several directories, separated as
+ *          in PATH, spread spool files across them in turn.
  *     </TD>
  *  </TR>
+ *   <TR>
+ *     <TD>APREQ2_LazyDecode</TD>
+ *     <TD>directory</TD>
+ *     <TD>Off</TD>
+ *     <TD> When On, query string and application/x-www-form-urlencoded
+ *          values are kept url-encoded until they are first fetched
+ *          through the apreq handle, so unread values are never decoded.
+ *          Code reading the args or body tables directly must call
+ *          apreq_param_value_decode() on each param it uses.
+ *     </TD>
+ *   </TR>
+ *   <TR class="odd">
+ *     <TD>APREQ2_ParseOnly</TD>
+ *     <TD>directory</TD>
+ *     <TD>(all fields)</TD>
+ *     <TD> Space-separated names of the only body fields mod_apreq2 will
+ *          parse.  Other fields and uploads are skipped without being
+ *          stored or spooled.  See apreq_parse_only_set().
+ *     </TD>
+ *   </TR>
+ *   <TR>
+ *     <TD>APREQ2_AsyncSpool</TD>
+ *     <TD>directory</TD>
+ *     <TD>Off</TD>
+ *     <TD> When On, upload data past APREQ2_BrigadeLimit is queued to
+ *          the spool file through io_uring or a writer thread, so the
+ *          parser goes on to the next chunk while the disk catches up.
+ *          Each upload's writes are complete before the parser hands
+ *          it over.  See apreq_brigade_concat_async().
+ *     </TD>
+ *   </TR>
+ *   <TR class="odd">
+ *     <TD>APREQ2_DecodeTransferEncoding</TD>
+ *     <TD>directory</TD>
+ *     <TD>Off</TD>
+ *     <TD> When On, multipart/form-data parts sent with a base64 or
+ *          quoted-printable Content-Transfer-Encoding are decoded as
+ *          they are parsed, so params, hooks and spooled uploads see
+ *          the decoded data.  See apreq_parser_t::decode_transfer_encoding.
+ *     </TD>
+ *   </TR>
+ *   <TR>
+ *     <TD>APREQ2_TempFilePool</TD>
+ *     <TD>server</TD>
+ *     <TD>0</TD>
+ *     <TD> Keeps up to this many spent upload spool files open in each
+ *          child, unlinked and truncated, for the next upload to reuse
+ *          instead of creating a new temp file.  Pooled files have no
+ *          name, so upload_tempname() can't be used with them.
+ *          See apreq_tempfile_pool_get().
+ *     </TD>
+ *   </TR>
+ *   <TR class="odd">
+ *     <TD>APREQ2_MemSpool</TD>
+ *     <TD>server</TD>
+ *     <TD>0 0</TD>
+ *     <TD> Takes two sizes: an upload that outgrows APREQ2_BrigadeLimit
+ *          is spooled to an anonymous memfd instead of a temp file while
+ *          it is no larger than the first, and while all such uploads
+ *          in the child stay within the second.  Larger uploads move on
+ *          to a temp file.  Linux only; see apreq_spool_memory_set().
+ *     </TD>
+ *   </TR>
+ *   <TR>
+ *     <TD>APREQ2_SpoolDirect</TD>
+ *     <TD>server</TD>
+ *     <TD>0</TD>
+ *     <TD> Once an upload's spool file reaches this size, the rest of
+ *          it is written with O_DIRECT, or dropped from the page cache
+ *          as it is written where O_DIRECT isn't available, so large
+ *          uploads don't evict other files' cached pages.  0 turns
+ *          this off.  See apreq_spool_direct_set().
+ *     </TD>
+ *   </TR>
  * </TABLE>
  *
  * <H2>Implementation Details</H2>
@@ -171,7 +246,7 @@ APR_DECLARE_OPTIONAL_FN(APREQ_DECLARE(apreq_handle_t *),
  * using this apache2 module
  * @see APREQ_MODULE
  */
-#define APREQ_APACHE2_MMN 20101207
+#define APREQ_APACHE2_MMN 20261017
 
 /** @} */
 
@@ -4,6 +4,10 @@ struct dir_config {
     const char         *temp_dir;
     apr_uint64_t        read_limit;
     apr_size_t          brigade_limit;
+    int                 lazy_decode;
+    apr_array_header_t *parse_only;
+    int                 async_spool;
+    int                 decode_cte;
 };
 
 /* The "warehouse", stored in r->request_config */
@@ -11,6 +15,7 @@ struct apache2_handle {
     apreq_handle_t      handle;
     request_rec        *r;
     apr_table_t        *jar, *args;
+    struct apreq_table_index_t *jar_index, *args_index, *body_index;
     apr_status_t        jar_status, args_status;
     ap_filter_t        *f;
 };
@@ -30,6 +35,11 @@ struct filter_ctx {
     apr_uint64_t        read_limit;     /* Max bytes the filter may show to parser */
     apr_size_t          brigade_limit;
     const char         *temp_dir;
+    int                 lazy_decode;    /* leave urlencoded values encoded */
+    const apr_array_header_t *parse_only; /* field names to parse, or all */
+    int                 async_spool;    /* queue spool writes on a writer */
+    int                 decode_cte;     /* decode base64 and q-p parts */
+    int                 sink_busy;      /* the parser's sink is full */
 };
 
 apr_status_t apreq_filter_prefetch(ap_filter_t *f, apr_off_t readbytes);
@@ -37,6 +37,10 @@ static void *apreq_create_dir_config(apr_pool_t *p, char *d)
     dc->temp_dir      = NULL;
     dc->read_limit    = -1;
     dc->brigade_limit = -1;
+    dc->lazy_decode   = -1;
+    dc->parse_only    = NULL;
+    dc->async_spool   = -1;
+    dc->decode_cte    = -1;
     return dc;
 }
 
@@ -53,6 +57,18 @@ static void *apreq_merge_dir_config(apr_pool_t *p, void *a_, void *b_)
     c->read_limit    = (b->read_limit < a->read_limit)  /* yes, min */
                       ? b->read_limit : a->read_limit;
 
+    c->lazy_decode   = (b->lazy_decode == -1)           /* overrides ok */
+                      ? a->lazy_decode : b->lazy_decode;
+
+    c->parse_only    = (b->parse_only != NULL)          /* overrides ok */
+                      ? b->parse_only : a->parse_only;
+
+    c->async_spool   = (b->async_spool == -1)           /* overrides ok */
+                      ? a->async_spool : b->async_spool;
+
+    c->decode_cte    = (b->decode_cte == -1)            /* overrides ok */
+                      ? a->decode_cte : b->decode_cte;
+
     return c;
 }
 
@@ -95,6 +111,114 @@ static const char *apreq_set_brigade_limit(cmd_parms *cmd, void *data,
     return NULL;
 }
 
+static const char *apreq_set_lazy_decode(cmd_parms *cmd, void *data, int flag)
+{
+    struct dir_config *conf = data;
+    const char *err = ap_check_cmd_context(cmd, NOT_IN_LIMIT);
+
+    if (err != NULL)
+        return err;
+
+    conf->lazy_decode = flag;
+    return NULL;
+}
+
+static const char *apreq_set_parse_only(cmd_parms *cmd, void *data,
+                                        const char *arg)
+{
+    struct dir_config *conf = data;
+    const char *err = ap_check_cmd_context(cmd, NOT_IN_LIMIT);
+
+    if (err != NULL)
+        return err;
+
+    if (conf->parse_only == NULL)
+        conf->parse_only = apr_array_make(cmd->pool, 4, sizeof(char *));
+
+    *(const char **)apr_array_push(conf->parse_only) = arg;
+    return NULL;
+}
+
+static const char *apreq_set_async_spool(cmd_parms *cmd, void *data, int flag)
+{
+    struct dir_config *conf = data;
+    const char *err = ap_check_cmd_context(cmd, NOT_IN_LIMIT);
+
+    if (err != NULL)
+        return err;
+
+    conf->async_spool = flag;
+    return NULL;
+}
+
+static const char *apreq_set_decode_cte(cmd_parms *cmd, void *data, int flag)
+{
+    struct dir_config *conf = data;
+    const char *err = ap_check_cmd_context(cmd, NOT_IN_LIMIT);
+
+    if (err != NULL)
+        return err;
+
+    conf->decode_cte = flag;
+    return NULL;
+}
+
+/* Server-wide: each child keeps its own pool of this many files. */
+static int tempfile_pool_max = 0;
+
+static const char *apreq_set_tempfile_pool(cmd_parms *cmd, void *data,
+                                           const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err != NULL)
+        return err;
+
+    tempfile_pool_max = (int)apreq_atoi64f(arg);
+    if (tempfile_pool_max < 0)
+        return "APREQ2_TempFilePool must be a non-negative number";
+    return NULL;
+}
+
+/* Server-wide as well; the budget is per child. */
+static apr_size_t mem_spool_limit = 0;
+static apr_uint64_t mem_spool_budget = 0;
+
+static const char *apreq_set_mem_spool(cmd_parms *cmd, void *data,
+                                       const char *limit, const char *budget)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    apr_int64_t l, b;
+
+    if (err != NULL)
+        return err;
+
+    l = apreq_atoi64f(limit);
+    b = apreq_atoi64f(budget);
+    if (l < 0 || b < 0)
+        return "APREQ2_MemSpool sizes must be non-negative";
+
+    mem_spool_limit = (apr_size_t)l;
+    mem_spool_budget = (apr_uint64_t)b;
+    return NULL;
+}
+
+static apr_off_t spool_direct = 0;
+
+static const char *apreq_set_spool_direct(cmd_parms *cmd, void *data,
+                                          const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err != NULL)
+        return err;
+
+    spool_direct = (apr_off_t)apreq_atoi64f(arg);
+    if (spool_direct < 0)
+        return "APREQ2_SpoolDirect must be a non-negative size";
+    return NULL;
+}
+
 
 static const command_rec apreq_cmds[] =
 {
@@ -104,6 +228,23 @@ static const command_rec apreq_cmds[] =
                   "Maximum amount of data that will be fed into a parser."),
     AP_INIT_TAKE1("APREQ2_BrigadeLimit", apreq_set_brigade_limit, NULL, OR_ALL,
                   "Maximum in-memory bytes a brigade may use."),
+    AP_INIT_FLAG("APREQ2_LazyDecode", apreq_set_lazy_decode, NULL, OR_ALL,
+                 "Url-decode query string and form values on first use."),
+    AP_INIT_ITERATE("APREQ2_ParseOnly", apreq_set_parse_only, NULL, OR_ALL,
+                    "Names of the only body fields to parse."),
+    AP_INIT_FLAG("APREQ2_AsyncSpool", apreq_set_async_spool, NULL, OR_ALL,
+                 "Queue upload spool writes instead of blocking on them."),
+    AP_INIT_FLAG("APREQ2_DecodeTransferEncoding", apreq_set_decode_cte,
+                 NULL, OR_ALL,
+                 "Decode base64 and quoted-printable multipart parts."),
+    AP_INIT_TAKE1("APREQ2_TempFilePool", apreq_set_tempfile_pool, NULL,
+                  RSRC_CONF, "Number of unlinked temp files to keep for reuse."),
+    AP_INIT_TAKE2("APREQ2_MemSpool", apreq_set_mem_spool, NULL, RSRC_CONF,
+                  "Largest upload spooled to memory, and all such uploads' "
+                  "total per child."),
+    AP_INIT_TAKE1("APREQ2_SpoolDirect", apreq_set_spool_direct, NULL,
+                  RSRC_CONF, "Spool file size past which uploads bypass "
+                  "the page cache."),
     { NULL }
 };
 
@@ -114,6 +255,7 @@ void apreq_filter_init_context(ap_filter_t *f)
     struct filter_ctx *ctx = f->ctx;
     apr_bucket_alloc_t *ba = r->connection->bucket_alloc;
     const char *cl_header;
+    apr_off_t size_hint = 0;
 
     if (r->method_number == M_GET) {
         /* Don't parse GET (this protects against subrequest body parsing). */
@@ -141,6 +283,7 @@ void apreq_filter_init_context(ap_filter_t *f)
             ctx->body_status = APREQ_ERROR_OVERLIMIT;
             return;
         }
+        size_hint = content_length;
     }
 
     if (ctx->parser == NULL) {
@@ -149,12 +292,17 @@ void apreq_filter_init_context(ap_filter_t *f)
         if (ct_header != NULL) {
             apreq_parser_function_t pf = apreq_parser(ct_header);
 
+            if (pf == apreq_parse_urlencoded && ctx->lazy_decode)
+                pf = apreq_parse_urlencoded_lazy;
+
             if (pf != NULL) {
                 ctx->parser = apreq_parser_make(r->pool, ba, ct_header, pf,
                                                 ctx->brigade_limit,
                                                 ctx->temp_dir,
                                                 ctx->hook_queue,
                                                 NULL);
+                ctx->parser->parse_only = ctx->parse_only;
+                ctx->parser->decode_transfer_encoding = ctx->decode_cte;
             }
             else {
                 ctx->body_status = APREQ_ERROR_NOPARSER;
@@ -173,8 +321,30 @@ void apreq_filter_init_context(ap_filter_t *f)
             ctx->parser->temp_dir = ctx->temp_dir;
         if (ctx->hook_queue != NULL)
             apreq_parser_add_hook(ctx->parser, ctx->hook_queue);
+        if (ctx->parse_only != NULL)
+            ctx->parser->parse_only = ctx->parse_only;
+        if (ctx->decode_cte)
+            ctx->parser->decode_transfer_encoding = 1;
+    }
+
+    ctx->parser->size_hint = size_hint;
+
+    if (ctx->parser->inflate == NULL) {
+        const char *ce_header = apr_table_get(r->headers_in,
+                                              "Content-Encoding");
+        apr_status_t s = apreq_parser_inflate(ctx->parser, ce_header,
+                                              ctx->read_limit);
+        if (s != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, s, r,
+                          "Unsupported Content-Encoding (%s)", ce_header);
+            ctx->body_status = s;
+            return;
+        }
     }
 
+    if (ctx->async_spool && ctx->parser->spool_writer == NULL)
+        ctx->parser->spool_writer = apreq_spool_writer_make(r->pool, 0);
+
     ctx->hook_queue = NULL;
     ctx->bb    = apr_brigade_create(r->pool, ba);
     ctx->bbtmp = apr_brigade_create(r->pool, ba);
@@ -252,6 +422,41 @@ static apr_status_t apreq_filter_init(ap_filter_t *f)
 
 
 
+/*
+ * Runs the parser over ctx->bb.  APR_EAGAIN from the parser means its
+ * upload sink is full: the body is still incomplete, but no more of it
+ * should be read until the sink has caught up.  Until then the parser
+ * is only offered what it already holds, and ctx->bb is set aside in
+ * pool to be parsed once the sink has taken that.
+ */
+static apr_status_t apreq_filter_parse(struct filter_ctx *ctx,
+                                       apr_pool_t *pool)
+{
+    apr_status_t s;
+
+    if (ctx->sink_busy) {
+        /* ctx->bbtmp is empty outside of a prefetch */
+        s = apreq_parser_run(ctx->parser, ctx->body, ctx->bbtmp);
+        apr_brigade_cleanup(ctx->bbtmp);
+        if (s == APR_EAGAIN) {
+            apreq_brigade_setaside(ctx->bb, pool);
+            return s;
+        }
+        ctx->sink_busy = 0;
+        if (s != APR_INCOMPLETE || APR_BRIGADE_EMPTY(ctx->bb)) {
+            apr_brigade_cleanup(ctx->bb);
+            ctx->body_status = s;
+            return s;
+        }
+    }
+
+    s = apreq_parser_run(ctx->parser, ctx->body, ctx->bb);
+    apr_brigade_cleanup(ctx->bb);
+    ctx->sink_busy = (s == APR_EAGAIN);
+    ctx->body_status = ctx->sink_busy ? APR_INCOMPLETE : s;
+    return s;
+}
+
 apr_status_t apreq_filter_prefetch(ap_filter_t *f, apr_off_t readbytes)
 {
     struct filter_ctx *ctx = f->ctx;
@@ -265,6 +470,14 @@ apr_status_t apreq_filter_prefetch(ap_filter_t *f, apr_off_t readbytes)
     if (ctx->body_status != APR_INCOMPLETE || readbytes == 0)
         return ctx->body_status;
 
+    /* Offer the sink what it left behind before reading any more */
+    if (ctx->sink_busy) {
+        if (apreq_filter_parse(ctx, r->pool) == APR_EAGAIN)
+            return APR_EAGAIN;
+        if (ctx->body_status != APR_INCOMPLETE)
+            return ctx->body_status;
+    }
+
     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r,
                   "prefetching %" APR_OFF_T_FMT " bytes", readbytes);
 
@@ -308,6 +521,7 @@ apr_status_t apreq_filter_prefetch(ap_filter_t *f, apr_off_t readbytes)
 
     apr_brigade_length(ctx->bb, 1, &len);
     ctx->bytes_read += len;
+    apreq_parser_hint_read(ctx->parser, len);
 
     if (ctx->bytes_read > ctx->read_limit) {
         ctx->body_status = APREQ_ERROR_OVERLIMIT;
@@ -318,10 +532,7 @@ apr_status_t apreq_filter_prefetch(ap_filter_t *f, apr_off_t readbytes)
         return ctx->body_status;
     }
 
-    ctx->body_status = apreq_parser_run(ctx->parser, ctx->body, ctx->bb);
-    apr_brigade_cleanup(ctx->bb);
-
-    return ctx->body_status;
+    return apreq_filter_parse(ctx, r->pool);
 }
 
 
@@ -380,6 +591,27 @@ apr_status_t apreq_filter(ap_filter_t *f,
     }
 
 
+    /* While the sink is full, the data the parser has yet to see is
+     * held in ctx->bb, and no more is read once that reaches the
+     * brigade limit.
+     */
+    if (ctx->sink_busy && apreq_filter_parse(ctx, r->pool) == APR_EAGAIN) {
+        apr_brigade_length(ctx->bb, 1, &len);
+        if ((apr_uint64_t)len >= ctx->brigade_limit) {
+            if (block == APR_NONBLOCK_READ)
+                return APR_EAGAIN;
+
+            /* A blocking read can't be put off: give up the parse */
+            ctx->body_status = APREQ_ERROR_OVERLIMIT;
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, ctx->body_status, r,
+                          "upload sink stalled with %" APR_OFF_T_FMT
+                          " bytes held; abandoning the parse", len);
+            apr_brigade_cleanup(ctx->bb);
+            ctx->sink_busy = 0;
+            return ap_get_brigade(f->next, bb, mode, block, readbytes);
+        }
+    }
+
     rv = ap_get_brigade(f->next, bb, mode, block, readbytes);
     if (rv != APR_SUCCESS)
         return rv;
@@ -387,6 +619,7 @@ apr_status_t apreq_filter(ap_filter_t *f,
     apreq_brigade_copy(ctx->bb, bb);
     apr_brigade_length(bb, 1, &len);
     ctx->bytes_read += len;
+    apreq_parser_hint_read(ctx->parser, len);
 
     if (ctx->bytes_read > ctx->read_limit) {
         ctx->body_status = APREQ_ERROR_OVERLIMIT;
@@ -397,13 +630,26 @@ apr_status_t apreq_filter(ap_filter_t *f,
                       ctx->bytes_read, ctx->read_limit);
     }
     else {
-        ctx->body_status = apreq_parser_run(ctx->parser, ctx->body, ctx->bb);
-        apr_brigade_cleanup(ctx->bb);
+        /* Data headed downstream can't wait for a full sink; it is
+         * held until the sink catches up.
+         */
+        apreq_filter_parse(ctx, r->pool);
     }
     return APR_SUCCESS;
 }
 
 
+static int apreq_pre_config(apr_pool_t *p, apr_pool_t *plog,
+                            apr_pool_t *ptemp)
+{
+    /* a restart without these directives turns them back off */
+    tempfile_pool_max = 0;
+    mem_spool_limit = 0;
+    mem_spool_budget = 0;
+    spool_direct = 0;
+    return OK;
+}
+
 static int apreq_pre_init(apr_pool_t *p, apr_pool_t *plog,
                           apr_pool_t *ptemp, server_rec *base_server)
 {
@@ -438,6 +684,28 @@ static int apreq_post_init(apr_pool_t *p, apr_pool_t *plog,
     return OK;
 }
 
+static void apreq_child_init(apr_pool_t *pchild, server_rec *s)
+{
+    apr_status_t status;
+
+    if (tempfile_pool_max > 0) {
+        status = apreq_tempfile_pool_init(pchild, tempfile_pool_max);
+        if (status != APR_SUCCESS)
+            ap_log_error(APLOG_MARK, APLOG_WARNING, status, s,
+                         "APREQ2_TempFilePool disabled");
+    }
+
+    status = apreq_spool_memory_set(mem_spool_limit, mem_spool_budget);
+    if (status != APR_SUCCESS)
+        ap_log_error(APLOG_MARK, APLOG_WARNING, status, s,
+                     "APREQ2_MemSpool disabled");
+
+    status = apreq_spool_direct_set(spool_direct);
+    if (status != APR_SUCCESS)
+        ap_log_error(APLOG_MARK, APLOG_WARNING, status, s,
+                     "APREQ2_SpoolDirect disabled");
+}
+
 static void register_hooks (apr_pool_t *p)
 {
     /* APR_HOOK_FIRST because we want other modules to be able to
@@ -450,6 +718,9 @@ static void register_hooks (apr_pool_t *p)
      */
     ap_hook_post_config(apreq_post_init, NULL, NULL, APR_HOOK_LAST);
 
+    ap_hook_pre_config(apreq_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init(apreq_child_init, NULL, NULL, APR_HOOK_MIDDLE);
+
     ap_register_input_filter(APREQ_FILTER_NAME, apreq_filter, apreq_filter_init,
                              AP_FTYPE_PROTOCOL-1);
 }
@@ -500,6 +771,10 @@ void apreq_filter_make_context(ap_filter_t *f)
                 ctx->temp_dir      = d->temp_dir;
                 ctx->read_limit    = d->read_limit;
                 ctx->brigade_limit = d->brigade_limit;
+                ctx->lazy_decode   = d->lazy_decode == 1;
+                ctx->parse_only    = d->parse_only;
+                ctx->async_spool   = d->async_spool == 1;
+                ctx->decode_cte    = d->decode_cte == 1;
 
                 if (ctx->parser != NULL) {
                     ctx->parser->temp_dir = d->temp_dir;
@@ -534,6 +809,10 @@ void apreq_filter_make_context(ap_filter_t *f)
             ? APREQ_DEFAULT_READ_LIMIT : d->read_limit;
         ctx->brigade_limit = (d->brigade_limit == (apr_size_t)-1)
             ? APREQ_DEFAULT_BRIGADE_LIMIT : d->brigade_limit;
+        ctx->lazy_decode   = d->lazy_decode == 1;
+        ctx->parse_only    = d->parse_only;
+        ctx->async_spool   = d->async_spool == 1;
+        ctx->decode_cte    = d->decode_cte == 1;
     }
 
     f->ctx = ctx;
@@ -27,6 +27,7 @@
 #include "apreq_module_apache2.h"
 #include "apreq_private_apache2.h"
 #include "apreq_error.h"
+#include "apreq_util.h"
 
 
 APR_INLINE
@@ -75,9 +76,13 @@ static apr_status_t apache2_args(apreq_handle_t *handle, const apr_table_t **t)
 
     if (req->args_status == APR_EINIT) {
         if (r->args != NULL) {
+            struct dir_config *d = ap_get_module_config(r->per_dir_config,
+                                                        &apreq_module);
             req->args = apr_table_make(handle->pool, APREQ_DEFAULT_NELTS);
-            req->args_status =
-                apreq_parse_query_string(handle->pool, req->args, r->args);
+            req->args_status = (d != NULL && d->lazy_decode == 1)
+                ? apreq_parse_query_string_lazy(handle->pool, req->args,
+                                                r->args)
+                : apreq_parse_query_string(handle->pool, req->args, r->args);
         }
         else
             req->args_status = APREQ_ERROR_NODATA;
@@ -104,7 +109,7 @@ static apreq_cookie_t *apache2_jar_get(apreq_handle_t *handle, const char *name)
     if (t == NULL)
         return NULL;
 
-    val = apr_table_get(t, name);
+    val = apreq_table_index_get(req->jar_index, t, name);
     if (val == NULL)
         return NULL;
 
@@ -125,11 +130,11 @@ static apreq_param_t *apache2_args_get(apreq_handle_t *handle, const char *name)
     if (t == NULL)
         return NULL;
 
-    val = apr_table_get(t, name);
+    val = apreq_table_index_get(req->args_index, t, name);
     if (val == NULL)
         return NULL;
 
-    return apreq_value_to_param(val);
+    return apreq_value_to_decoded_param(val);
 }
 
 
@@ -161,6 +166,7 @@ static apr_status_t apache2_body(apreq_handle_t *handle, const apr_table_t **t)
 
 static apreq_param_t *apache2_body_get(apreq_handle_t *handle, const char *name)
 {
+    struct apache2_handle *req = (struct apache2_handle *)handle;
     ap_filter_t *f = get_apreq_filter(handle);
     struct filter_ctx *ctx;
     const char *val;
@@ -176,9 +182,9 @@ static apreq_param_t *apache2_body_get(apreq_handle_t *handle, const char *name)
 
     case APR_SUCCESS:
 
-        val = apr_table_get(ctx->body, name);
+        val = apreq_table_index_get(req->body_index, ctx->body, name);
         if (val != NULL)
-            return apreq_value_to_param(val);
+            return apreq_value_to_decoded_param(val);
         return NULL;
 
 
@@ -192,9 +198,9 @@ static apreq_param_t *apache2_body_get(apreq_handle_t *handle, const char *name)
 
     case APR_INCOMPLETE:
 
-        val = apr_table_get(ctx->body, name);
+        val = apreq_table_index_get(req->body_index, ctx->body, name);
         if (val != NULL)
-            return apreq_value_to_param(val);
+            return apreq_value_to_decoded_param(val);
 
         /* Not seen yet, so we need to scan for
            param while prefetching the body */
@@ -214,12 +220,16 @@ static apreq_param_t *apache2_body_get(apreq_handle_t *handle, const char *name)
         hook_ctx->prev = ctx->parser->hook;
 
         do {
-            apreq_filter_prefetch(f, APREQ_DEFAULT_READ_BLOCK_SIZE);
-            if (hook_ctx->param != NULL)
-                return hook_ctx->param;
-        } while (ctx->body_status == APR_INCOMPLETE);
+            /* APR_EAGAIN: the upload sink is full, so give up for now */
+            if (apreq_filter_prefetch(f, APREQ_DEFAULT_READ_BLOCK_SIZE)
+                == APR_EAGAIN)
+                break;
+        } while (hook_ctx->param == NULL
+                 && ctx->body_status == APR_INCOMPLETE);
 
         ctx->parser->hook = h->next;
+        if (hook_ctx->param != NULL)
+            return apreq_value_to_decoded_param(hook_ctx->param->v.data);
         return NULL;
 
 
@@ -228,9 +238,9 @@ static apreq_param_t *apache2_body_get(apreq_handle_t *handle, const char *name)
         if (ctx->body == NULL)
             return NULL;
 
-        val = apr_table_get(ctx->body, name);
+        val = apreq_table_index_get(req->body_index, ctx->body, name);
         if (val != NULL)
-            return apreq_value_to_param(val);
+            return apreq_value_to_decoded_param(val);
         return NULL;
 
     }
@@ -239,6 +249,64 @@ static apreq_param_t *apache2_body_get(apreq_handle_t *handle, const char *name)
     return NULL;
 }
 
+static apr_status_t apache2_body_getv(apreq_handle_t *handle,
+                                      const char *const *names, int n,
+                                      apreq_param_t **params)
+{
+    struct apache2_handle *req = (struct apache2_handle *)handle;
+    ap_filter_t *f = get_apreq_filter(handle);
+    struct filter_ctx *ctx;
+    apreq_hook_t *h;
+    apreq_hook_find_params_ctx_t *hook_ctx;
+    const char *val;
+    int i, missing = 0;
+
+    if (f->ctx == NULL)
+        apreq_filter_make_context(f);
+    ctx = f->ctx;
+
+    if (ctx->body_status == APR_EINIT) {
+        apreq_filter_init_context(f);
+        if (ctx->body_status == APR_INCOMPLETE)
+            apreq_filter_prefetch(f, APREQ_DEFAULT_READ_BLOCK_SIZE);
+    }
+
+    for (i = 0; i < n; ++i) {
+        val = (ctx->body == NULL) ? NULL
+            : apreq_table_index_get(req->body_index, ctx->body, names[i]);
+        params[i] = (val != NULL) ? apreq_value_to_param(val) : NULL;
+        missing += (val == NULL);
+    }
+
+    if (missing > 0 && ctx->body_status == APR_INCOMPLETE) {
+        /* Scan for every name still missing with a single
+           hook while prefetching the rest of the body */
+        hook_ctx = apr_palloc(handle->pool, sizeof *hook_ctx);
+        hook_ctx->names = names;
+        hook_ctx->params = params;
+        hook_ctx->nelts = n;
+        hook_ctx->missing = missing;
+
+        h = apreq_hook_make(handle->pool, apreq_hook_find_params,
+                            ctx->parser->hook, hook_ctx);
+        ctx->parser->hook = h;
+
+        do {
+            if (apreq_filter_prefetch(f, APREQ_DEFAULT_READ_BLOCK_SIZE)
+                == APR_EAGAIN)
+                break;
+        } while (hook_ctx->missing > 0 && ctx->body_status == APR_INCOMPLETE);
+
+        ctx->parser->hook = h->next;
+    }
+
+    for (i = 0; i < n; ++i)
+        if (params[i] != NULL)
+            params[i] = apreq_value_to_decoded_param(params[i]->v.data);
+
+    return ctx->body_status;
+}
+
 static
 apr_status_t apache2_parser_get(apreq_handle_t *handle,
                                   const apreq_parser_t **parser)
@@ -410,6 +478,28 @@ apr_status_t apache2_temp_dir_get(apreq_handle_t *handle,
     return APR_SUCCESS;
 }
 
+static
+apr_status_t apache2_parse_only_set(apreq_handle_t *handle,
+                                    const apr_array_header_t *names)
+{
+    ap_filter_t *f = get_apreq_filter(handle);
+    struct filter_ctx *ctx;
+
+    if (f->ctx == NULL)
+        apreq_filter_make_context(f);
+
+    ctx = f->ctx;
+
+    if (ctx->bytes_read == 0) {
+        ctx->parse_only = names;
+        if (ctx->parser != NULL)
+            ctx->parser->parse_only = names;
+        return APR_SUCCESS;
+    }
+
+    return APREQ_ERROR_NOTEMPTY;
+}
+
 static APREQ_MODULE(apache2, APREQ_APACHE2_MMN);
 
 APREQ_DECLARE(apreq_handle_t *) apreq_handle_apache2(request_rec *r)
@@ -432,6 +522,9 @@ APREQ_DECLARE(apreq_handle_t *) apreq_handle_apache2(request_rec *r)
 
     req->args_status = req->jar_status = APR_EINIT;
     req->args = req->jar = NULL;
+    req->jar_index = apreq_table_index_make(r->pool);
+    req->args_index = apreq_table_index_make(r->pool);
+    req->body_index = apreq_table_index_make(r->pool);
 
     req->f = NULL;
 
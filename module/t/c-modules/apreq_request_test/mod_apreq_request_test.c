@@ -22,6 +22,9 @@
    APREQ2_ReadLimit 500K
    SetHandler apreq_request_test
 </Location>
+<Location /apreq_request_test/decoded>
+   APREQ2_DecodeTransferEncoding On
+</Location>
 
 #endif
 #endif
@@ -0,0 +1,119 @@
+/*
+**  Licensed to the Apache Software Foundation (ASF) under one or more
+** contributor license agreements.  See the NOTICE file distributed with
+** this work for additional information regarding copyright ownership.
+** The ASF licenses this file to You under the Apache License, Version 2.0
+** (the "License"); you may not use this file except in compliance with
+** the License.  You may obtain a copy of the License at
+**
+**      http://www.apache.org/licenses/LICENSE-2.0
+**
+**  Unless required by applicable law or agreed to in writing, software
+**  distributed under the License is distributed on an "AS IS" BASIS,
+**  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+**  See the License for the specific language governing permissions and
+**  limitations under the License.
+*/
+
+#ifdef CONFIG_FOR_HTTPD_TEST
+#if CONFIG_FOR_HTTPD_TEST
+
+<Location /apreq_sink_test>
+   SetHandler apreq_sink_test
+</Location>
+
+#endif
+#endif
+
+#define APACHE_HTTPD_TEST_HANDLER apreq_sink_test_handler
+
+#include "apache_httpd_test.h"
+
+#include "apreq_module.h"
+#include "apreq_parser.h"
+#include "apreq_error.h"
+#include "apreq_module_apache2.h"
+
+#include "httpd.h"
+#include "util_filter.h"
+
+struct sink_ctx {
+    int        stall;   /* never take anything */
+    apr_size_t total;   /* upload bytes taken */
+};
+
+static apr_status_t test_sink(APREQ_SINK_ARGS)
+{
+    struct sink_ctx *ctx = sink->ctx;
+    apr_off_t len;
+
+    if (ctx->stall)
+        return APR_EAGAIN;
+
+    apr_brigade_length(bb, 1, &len);
+    ctx->total += len;
+    apr_brigade_cleanup(bb);
+    return APR_SUCCESS;
+}
+
+/* Reads the body the way a downstream consumer does, with the apreq
+ * filter passing it through; "?stall" leaves the upload sink full
+ * throughout, so the filter has to give up the parse.
+ */
+static int apreq_sink_test_handler(request_rec *r)
+{
+    apreq_handle_t *req;
+    apreq_parser_t *parser;
+    const apr_table_t *body;
+    apr_bucket_brigade *bb;
+    struct sink_ctx *ctx;
+    const char *cl;
+    apr_off_t body_len = 0;
+    apr_status_t s;
+    int eos = 0;
+
+    if (strcmp(r->handler, "apreq_sink_test") != 0)
+        return DECLINED;
+
+    req = apreq_handle_apache2(r);
+
+    ctx = apr_pcalloc(r->pool, sizeof *ctx);
+    ctx->stall = r->args != NULL && strcmp(r->args, "stall") == 0;
+
+    parser = apreq_parser_make(r->pool, r->connection->bucket_alloc,
+                               apr_table_get(r->headers_in, "Content-Type"),
+                               apreq_parse_multipart,
+                               APREQ_DEFAULT_BRIGADE_LIMIT, NULL, NULL, NULL);
+    parser->sink = apreq_sink_make(r->pool, test_sink, ctx);
+    apreq_parser_set(req, parser);
+    apreq_brigade_limit_set(req, 8192);
+
+    bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+
+    while (!eos) {
+        apr_off_t len;
+
+        s = ap_get_brigade(r->input_filters, bb, AP_MODE_READBYTES,
+                           APR_BLOCK_READ, HUGE_STRING_LEN);
+        if (s != APR_SUCCESS || APR_BRIGADE_EMPTY(bb))
+            break;
+
+        eos = APR_BUCKET_IS_EOS(APR_BRIGADE_LAST(bb));
+        apr_brigade_length(bb, 1, &len);
+        body_len += len;
+        apr_brigade_cleanup(bb);
+    }
+
+    s = apreq_body(req, &body);
+    cl = apr_table_get(r->headers_in, "Content-Length");
+
+    ap_set_content_type(r, "text/plain");
+    ap_rprintf(r, "%" APR_SIZE_T_FMT " %s %s", ctx->total,
+               s == APR_SUCCESS ? "success"
+               : s == APREQ_ERROR_OVERLIMIT ? "overlimit" : "error",
+               (cl != NULL && apr_atoi64(cl) == body_len) ? "complete"
+               : "short");
+    return OK;
+}
+
+APACHE_HTTPD_TEST_MODULE(apreq_sink_test);
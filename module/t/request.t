@@ -6,7 +6,7 @@ use Apache::TestUtil;
 use Apache::TestRequest qw(GET_BODY UPLOAD_BODY POST_BODY GET_RC);
 require File::Copy;
 
-my $num_tests = 18;
+my $num_tests = 20;
 $num_tests *= 2 if Apache::Test::have_ssl();
 plan tests => $num_tests, need_lwp;
 my $scheme = "http";
@@ -26,6 +26,29 @@ foreach my $location ('/apreq_request_test', '/apreq_access_test') {
 
 ok t_cmp(GET_RC("/apreq_access_test"), 403, "access denied");
 
+my $mfd = join "\r\n",
+    "--AaB03x",
+    'Content-Disposition: form-data; name="qp"',
+    "Content-Transfer-Encoding: quoted-printable",
+    "",
+    "2+2=3D4, =",
+    "soft break",
+    "--AaB03x",
+    'Content-Disposition: form-data; name="b64"',
+    "Content-Transfer-Encoding: base64",
+    "",
+    "aGVsbG8=",
+    "--AaB03x--",
+    "";
+my @mfd = ("Content-Type" => "multipart/form-data; boundary=AaB03x",
+           content => $mfd);
+
+ok t_cmp(POST_BODY("/apreq_request_test", @mfd),
+         qr/^\tb64 => aGVsbG8=$/m, "transfer encodings kept by default");
+ok t_cmp(POST_BODY("/apreq_request_test/decoded", @mfd),
+         "ARGS:\nBODY:\n\tqp => 2+2=4, soft break\n\tb64 => hello\n",
+         "APREQ2_DecodeTransferEncoding");
+
 my $filler = "0123456789" x 25_000; # length($filler) must be < 500K / 2
 my $body = POST_BODY("/apreq_access_test?foo=1;",
                      content => "bar=2&quux=$filler;test=6&more=$filler");
@@ -0,0 +1,25 @@
+use strict;
+use warnings FATAL => 'all';
+
+use Apache::Test;
+use Apache::TestUtil;
+use Apache::TestConfig;
+use Apache::TestRequest qw(UPLOAD_BODY);
+
+plan tests => 2, need_lwp;
+
+my $location = "/apreq_sink_test";
+
+my $server_root = Apache::Test::config()->{vars}->{serverroot};
+my $file = "$server_root/c-modules/apreq_upload_test/128k";
+
+# the sink takes the whole upload
+ok t_cmp(UPLOAD_BODY($location, filename => $file),
+         "131072 success complete",
+         "upload handed to the sink");
+
+# the sink stays full: the filter gives up the parse once it holds
+# the brigade limit, but the body still reaches the handler
+ok t_cmp(UPLOAD_BODY("$location?stall", filename => $file),
+         "0 overlimit complete",
+         "stalled sink");
@@ -61,6 +61,9 @@ LINK32_OBJS= \
 	"$(INTDIR)\parser.obj" \
 	"$(INTDIR)\parser_header.obj" \
 	"$(INTDIR)\parser_multipart.obj" \
+	"$(INTDIR)\parser_json.obj" \
+	"$(INTDIR)\parser_ndjson.obj" \
+	"$(INTDIR)\parser_inflate.obj" \
 	"$(INTDIR)\parser_urlencoded.obj" \
 	"$(INTDIR)\util.obj" \
 	"$(INTDIR)\version.obj" \
@@ -176,6 +179,21 @@ SOURCE=$(LIBDIR)\parser_multipart.c
 "$(INTDIR)\parser_multipart.obj" : $(SOURCE) "$(INTDIR)"
 	$(CPP) /Fo"$(INTDIR)\parser_multipart.obj" $(CPP_PROJ) $(SOURCE)
 
+SOURCE=$(LIBDIR)\parser_json.c
+
+"$(INTDIR)\parser_json.obj" : $(SOURCE) "$(INTDIR)"
+	$(CPP) /Fo"$(INTDIR)\parser_json.obj" $(CPP_PROJ) $(SOURCE)
+
+SOURCE=$(LIBDIR)\parser_ndjson.c
+
+"$(INTDIR)\parser_ndjson.obj" : $(SOURCE) "$(INTDIR)"
+	$(CPP) /Fo"$(INTDIR)\parser_ndjson.obj" $(CPP_PROJ) $(SOURCE)
+
+SOURCE=$(LIBDIR)\parser_inflate.c
+
+"$(INTDIR)\parser_inflate.obj" : $(SOURCE) "$(INTDIR)"
+	$(CPP) /Fo"$(INTDIR)\parser_inflate.obj" $(CPP_PROJ) $(SOURCE)
+
 SOURCE=$(LIBDIR)\parser_urlencoded.c
 
 "$(INTDIR)\parser_urlencoded.obj" : $(SOURCE) "$(INTDIR)"